@@ -7,10 +7,18 @@ function build_aerosim_sfuns
     aerosim_sfun_mex_path = strcat(this_file_path, '/sfun_mex');
 
     aerosim_kafka_utils_src = strcat(aerosim_sfun_src_path, '/', 'aerosim_kafka_utils.c');
+    aerosim_trace_src = strcat(aerosim_sfun_src_path, '/', 'aerosim_trace.c');
+    aerosim_transport_src = strcat(aerosim_sfun_src_path, '/', 'aerosim_transport.c');
+    aerosim_shm_transport_src = strcat(aerosim_sfun_src_path, '/', 'aerosim_shm_transport.c');
+    aerosim_replay_src = strcat(aerosim_sfun_src_path, '/', 'aerosim_replay.c');
+    aerosim_fleet_src = strcat(aerosim_sfun_src_path, '/', 'aerosim_fleet.c');
+    aerosim_barrier_src = strcat(aerosim_sfun_src_path, '/', 'aerosim_barrier.c');
     aerosim_clock_sfun_src = strcat(aerosim_sfun_src_path, '/', 'sl_aerosim_clock_sync.c');
     aerosim_producer_sfun_src = strcat(aerosim_sfun_src_path, '/', 'sl_aerosim_kafka_producer.c');
     aerosim_consumer_sfun_src = strcat(aerosim_sfun_src_path, '/', 'sl_aerosim_kafka_consumer.c');
     aerosim_decode_json_sfun_src = strcat(aerosim_sfun_src_path, '/', 'sf_aerosim_json_parser.cpp');
+    aerosim_fleet_consumer_sfun_src = strcat(aerosim_sfun_src_path, '/', 'sl_aerosim_fleet_consumer.c');
+    aerosim_fleet_producer_sfun_src = strcat(aerosim_sfun_src_path, '/', 'sl_aerosim_fleet_producer.c');
 
     % Dependency folders
     jDir = kafka.getRoot('..' ,'CPP', 'jansson');
@@ -40,7 +48,7 @@ function build_aerosim_sfuns
             ...['-L"', fullfile(jDir, 'src','.libs'), '"'], ...
             '-ljansson',...
             };
-        platformArgs = {'-lz'};
+        platformArgs = {'-lz', '-lrt'};
     elseif ispc
 %         is64 = strcmp('PCWIN64', computer);
 %         if is64
@@ -59,10 +67,12 @@ function build_aerosim_sfuns
     end
 
     sfuns = { ...
-        {aerosim_clock_sfun_src, aerosim_kafka_utils_src, 'mw_kafka_utils.c', 'mx_kafka_utils.c', jansson{:}}, ...
-        {aerosim_producer_sfun_src, 'mw_kafka_utils.c', 'mx_kafka_utils.c'}, ...
-        {aerosim_consumer_sfun_src, aerosim_kafka_utils_src, 'mw_kafka_utils.c', 'mx_kafka_utils.c'}, ...
-        {aerosim_decode_json_sfun_src, jansson{:}} ...
+        {aerosim_clock_sfun_src, aerosim_barrier_src, aerosim_kafka_utils_src, aerosim_transport_src, aerosim_shm_transport_src, aerosim_replay_src, aerosim_trace_src, 'mw_kafka_utils.c', 'mx_kafka_utils.c', jansson{:}}, ...
+        {aerosim_producer_sfun_src, aerosim_kafka_utils_src, aerosim_transport_src, aerosim_shm_transport_src, aerosim_replay_src, aerosim_trace_src, 'mw_kafka_utils.c', 'mx_kafka_utils.c', jansson{:}}, ...
+        {aerosim_consumer_sfun_src, aerosim_kafka_utils_src, aerosim_transport_src, aerosim_shm_transport_src, aerosim_replay_src, aerosim_trace_src, 'mw_kafka_utils.c', 'mx_kafka_utils.c', jansson{:}}, ...
+        {aerosim_decode_json_sfun_src, aerosim_trace_src, jansson{:}}, ...
+        {aerosim_fleet_consumer_sfun_src, aerosim_fleet_src, aerosim_kafka_utils_src, aerosim_transport_src, aerosim_shm_transport_src, aerosim_replay_src, aerosim_trace_src, 'mw_kafka_utils.c', 'mx_kafka_utils.c', jansson{:}}, ...
+        {aerosim_fleet_producer_sfun_src, aerosim_fleet_src, aerosim_kafka_utils_src, aerosim_transport_src, aerosim_shm_transport_src, aerosim_replay_src, aerosim_trace_src, 'mw_kafka_utils.c', 'mx_kafka_utils.c', jansson{:}} ...
         }; %#ok<CCAT>
 
     for k=1:length(sfuns)
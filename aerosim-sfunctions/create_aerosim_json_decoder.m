@@ -5,8 +5,24 @@
 %   bus_object_name     : name of the bus object type
 %   sfpLength           : maximum length of JSON string (entered as string)
 %   sample_time_sec     : subsystem sample time (entered as string, cannot be -1 or 0)
+%   enable_trace        : (optional) also output the end-to-end trace id and origin, default false
 
-function create_aerosim_json_decoder(model_name, bus_object_name, sfpLength, sample_time_sec)
+function create_aerosim_json_decoder(model_name, bus_object_name, sfpLength, sample_time_sec, enable_trace)
+
+if nargin < 5
+    enable_trace = false;
+end
+
+%% Trace fields
+% Decoded after the bus signals; messages that aren't traced yet start the trace at their platform timestamp
+trace_fields = {};
+trace_field_types = {};
+trace_outputs = {};
+if enable_trace
+    trace_fields = {'metadata.trace_id' 'metadata.trace_origin_platform.sec' 'metadata.trace_origin_platform.nanosec'};
+    trace_field_types = {'double' 'double' 'double'};
+    trace_outputs = {'trace_id' 'trace_origin_sec' 'trace_origin_nanosec'};
+end
 
 %% Configurations
 subsystem_name = ['AeroSim JSON Decoder - Bus: ' bus_object_name];
@@ -104,6 +120,10 @@ for i=1:length(signals)
     sfpFields_str = append(sfpFields_str, sprintf('''%s'',', signals{i}));
     sfpFieldTypes_str = append(sfpFieldTypes_str, sprintf('''%s'',', bus_object_dict{signals{i}}{2}));
 end
+for i=1:length(trace_fields)
+    sfpFields_str = append(sfpFields_str, sprintf('''%s'',', trace_fields{i}));
+    sfpFieldTypes_str = append(sfpFieldTypes_str, sprintf('''%s'',', trace_field_types{i}));
+end
 sfpFields_str = sfpFields_str(1:end-1);
 sfpFields_str = append(sfpFields_str, sprintf('}'));
 sfpFieldTypes_str = sfpFieldTypes_str(1:end-1);
@@ -179,5 +199,15 @@ set_param(bus_output_blockname, 'OutDataTypeStr', ['Bus: ' bus_object_name]);
 bus_output_handle = get_param(bus_output_blockname, 'PortHandles');
 add_line(subsystem_path, signals_to_bus_handle.Outport(2), bus_output_handle.Inport(1));
 
+% trace outputs
+for i=1:length(trace_fields)
+    trace_output_blockname = [subsystem_path trace_outputs{i}];
+    add_block('simulink/Sinks/Out1', trace_output_blockname);
+    output_port_pos = get_param(json_parser_handle.Outport(length(signals)+i), 'position');
+    set_param(trace_output_blockname, 'Position', [output_port_pos(1)+200, output_port_pos(2)-7, output_port_pos(1)+230, output_port_pos(2)+7]);
+    trace_output_handle = get_param(trace_output_blockname, 'PortHandles');
+    add_line(subsystem_path, json_parser_handle.Outport(length(signals)+i), trace_output_handle.Inport(1));
+end
+
 
 end  % End of function
\ No newline at end of file
@@ -5,8 +5,25 @@
 %   bus_object_name     : name of the bus object type
 %   sfpLength           : maximum length of JSON string (entered as string)
 %   sample_time_sec     : subsystem sample time (entered as string, cannot be -1 or 0)
+%   enable_trace        : (optional) also encode the end-to-end trace id and origin and output
+%                         the loop latency in seconds, default false
 
-function create_aerosim_json_encoder(model_name, bus_object_name, sfpLength, sample_time_sec)
+function create_aerosim_json_encoder(model_name, bus_object_name, sfpLength, sample_time_sec, enable_trace)
+
+if nargin < 5
+    enable_trace = false;
+end
+
+%% Trace fields
+% Encoded after the bus signals, typically wired from the matching AeroSim JSON Decoder trace outputs
+trace_fields = {};
+trace_field_types = {};
+trace_inputs = {};
+if enable_trace
+    trace_fields = {'metadata.trace_id' 'metadata.trace_origin_platform.sec' 'metadata.trace_origin_platform.nanosec'};
+    trace_field_types = {'double' 'double' 'double'};
+    trace_inputs = {'trace_id' 'trace_origin_sec' 'trace_origin_nanosec'};
+end
 
 %% Configurations
 subsystem_name = ['AeroSim JSON Encoder - Bus: ' bus_object_name];
@@ -104,6 +121,10 @@ for i=1:length(signals)
     sfpFields_str = append(sfpFields_str, sprintf('''%s'',', signals{i}));
     sfpFieldTypes_str = append(sfpFieldTypes_str, sprintf('''%s'',', bus_object_dict{signals{i}}{2}));
 end
+for i=1:length(trace_fields)
+    sfpFields_str = append(sfpFields_str, sprintf('''%s'',', trace_fields{i}));
+    sfpFieldTypes_str = append(sfpFieldTypes_str, sprintf('''%s'',', trace_field_types{i}));
+end
 sfpFields_str = sfpFields_str(1:end-1);
 sfpFields_str = append(sfpFields_str, sprintf('}'));
 sfpFieldTypes_str = sfpFieldTypes_str(1:end-1);
@@ -180,5 +201,25 @@ set_param(bus_input_blockname, 'OutDataTypeStr', ['Bus: ' bus_object_name]);
 bus_input_handle = get_param(bus_input_blockname, 'PortHandles');
 add_line(subsystem_path, bus_input_handle.Outport(1), bus_to_signals_handle.Inport(2));
 
+% trace inputs
+for i=1:length(trace_fields)
+    trace_input_blockname = [subsystem_path trace_inputs{i}];
+    add_block('simulink/Sources/In1', trace_input_blockname);
+    input_port_pos = get_param(json_parser_handle.Inport(length(signals)+i), 'position');
+    set_param(trace_input_blockname, 'Position', [input_port_pos(1)-200, input_port_pos(2)-7, input_port_pos(1)-170, input_port_pos(2)+7]);
+    trace_input_handle = get_param(trace_input_blockname, 'PortHandles');
+    add_line(subsystem_path, trace_input_handle.Outport(1), json_parser_handle.Inport(length(signals)+i));
+end
+
+% loop_latency_output
+if enable_trace
+    loop_latency_output_blockname = [subsystem_path 'loop_latency_output'];
+    add_block('simulink/Sinks/Out1', loop_latency_output_blockname);
+    output_port_pos = get_param(json_parser_handle.Outport(3), 'position');
+    set_param(loop_latency_output_blockname, 'Position', [output_port_pos(1)+200, output_port_pos(2)-7, output_port_pos(1)+230, output_port_pos(2)+7]);
+    loop_latency_output_handle = get_param(loop_latency_output_blockname, 'PortHandles');
+    add_line(subsystem_path, json_parser_handle.Outport(3), loop_latency_output_handle.Inport(1));
+end
+
 
 end  % End of function
\ No newline at end of file
@@ -0,0 +1,102 @@
+#!/bin/bash
+
+# Build the headless harness executables, one per S-function, and the
+# lock-step benchmark into aerosim-sfunctions/harness/bin/. Run build.sh
+# first to build librdkafka and jansson.
+
+if [ -z "$AEROSIM_SIMULINK_ROOT" ]; then
+    echo "AEROSIM_SIMULINK_ROOT is not set. Please set it to the root directory of the Aerosim Simulink project."
+    exit 1
+fi
+
+MATLAB_KAFKA_APP_PATH=$AEROSIM_SIMULINK_ROOT/matlab-apache-kafka/Software/MATLAB/app/sfun
+LIBRDKAFKA_SRC_PATH=$AEROSIM_SIMULINK_ROOT/matlab-apache-kafka/Software/CPP/librdkafka/src
+HARNESS_PATH=$AEROSIM_SIMULINK_ROOT/aerosim-sfunctions/harness
+AEROSIM_SRC_PATH=$AEROSIM_SIMULINK_ROOT/aerosim-sfunctions/src
+OUT_PATH=$HARNESS_PATH/bin
+OBJ_PATH=$OUT_PATH/obj
+
+if [ ! -f "$MATLAB_KAFKA_APP_PATH/librdkafka.so" ] || [ ! -f "$MATLAB_KAFKA_APP_PATH/lib/libjansson.a" ]; then
+    echo "librdkafka or jansson is not built. Please run build.sh first."
+    exit 1
+fi
+
+# The harness headers come first so they replace the Simulink ones; rdkafka_mock.h is only in the librdkafka sources
+INCLUDES="-I$HARNESS_PATH -I$AEROSIM_SRC_PATH -I$MATLAB_KAFKA_APP_PATH/inc -I$MATLAB_KAFKA_APP_PATH/src -I$LIBRDKAFKA_SRC_PATH"
+CFLAGS="-O2 -g -Wall $INCLUDES"
+LIBS="$MATLAB_KAFKA_APP_PATH/lib/libjansson.a $MATLAB_KAFKA_APP_PATH/librdkafka.so -Wl,-rpath,$MATLAB_KAFKA_APP_PATH -lz -lrt -lpthread -lm"
+
+COMMON_SRCS="$HARNESS_PATH/harness.c $AEROSIM_SRC_PATH/aerosim_trace.c"
+KAFKA_SRCS="$AEROSIM_SRC_PATH/aerosim_kafka_utils.c $AEROSIM_SRC_PATH/aerosim_transport.c $AEROSIM_SRC_PATH/aerosim_shm_transport.c $AEROSIM_SRC_PATH/aerosim_replay.c $MATLAB_KAFKA_APP_PATH/src/mw_kafka_utils.c $MATLAB_KAFKA_APP_PATH/src/mx_kafka_utils.c"
+
+# compile <source> <object> [flags...]
+compile() {
+    local src=$1
+    local obj=$2
+    shift 2
+
+    case "$src" in
+        *.cpp) g++ $CFLAGS "$@" -c "$src" -o "$obj" ;;
+        *) gcc -std=gnu99 $CFLAGS "$@" -c "$src" -o "$obj" ;;
+    esac
+}
+
+# compile_sfunction <S-function source> <object>
+# Only the harness registration stays global, so that S-functions with helpers
+# of the same name (e.g. initKafkaConsumer) link into one executable.
+compile_sfunction() {
+    local name=$(basename "${1%.*}")
+
+    compile "$1" "$2" || return 1
+    objcopy --keep-global-symbol=harness_sfunction_$name "$2"
+}
+
+# build_harness <S-function source> <other sources...>
+build_harness() {
+    local sfun_src=$1
+    local name=$(basename "${sfun_src%.*}")
+    local objs="$OBJ_PATH/$name/$name.o $OBJ_PATH/$name/harness_main.o"
+    shift
+
+    echo "Building harness_$name ..."
+    mkdir -p "$OBJ_PATH/$name"
+    compile_sfunction "$sfun_src" "$OBJ_PATH/$name/$name.o" || return 1
+    compile "$HARNESS_PATH/harness_main.c" "$OBJ_PATH/$name/harness_main.o" -DHARNESS_SFUNCTION=$name || return 1
+    for src in "$@"; do
+        local obj="$OBJ_PATH/$name/$(basename "${src%.*}").o"
+        compile "$src" "$obj" || return 1
+        objs="$objs $obj"
+    done
+    g++ $objs $LIBS -o "$OUT_PATH/harness_$name"
+}
+
+# build_lockstep_bench: the clock sync, consumer, JSON parser and producer blocks in one executable
+build_lockstep_bench() {
+    local objs=""
+
+    echo "Building lockstep_bench ..."
+    mkdir -p "$OBJ_PATH/lockstep_bench"
+    for sfun in sl_aerosim_clock_sync.c sl_aerosim_kafka_consumer.c sl_aerosim_kafka_producer.c sf_aerosim_json_parser.cpp; do
+        local obj="$OBJ_PATH/lockstep_bench/${sfun%.*}.o"
+        compile_sfunction "$AEROSIM_SRC_PATH/$sfun" "$obj" || return 1
+        objs="$objs $obj"
+    done
+    for src in "$HARNESS_PATH/lockstep_bench.c" $AEROSIM_SRC_PATH/aerosim_barrier.c $COMMON_SRCS $KAFKA_SRCS; do
+        local obj="$OBJ_PATH/lockstep_bench/$(basename "${src%.*}").o"
+        compile "$src" "$obj" || return 1
+        objs="$objs $obj"
+    done
+    g++ $objs $LIBS -o "$OUT_PATH/lockstep_bench"
+}
+
+build_harness $AEROSIM_SRC_PATH/sl_aerosim_clock_sync.c $AEROSIM_SRC_PATH/aerosim_barrier.c $COMMON_SRCS $KAFKA_SRCS || exit 1
+build_harness $AEROSIM_SRC_PATH/sl_aerosim_kafka_producer.c $COMMON_SRCS $KAFKA_SRCS || exit 1
+build_harness $AEROSIM_SRC_PATH/sl_aerosim_kafka_consumer.c $COMMON_SRCS $KAFKA_SRCS || exit 1
+build_harness $AEROSIM_SRC_PATH/sf_aerosim_json_parser.cpp $COMMON_SRCS || exit 1
+build_harness $AEROSIM_SRC_PATH/sl_aerosim_fleet_consumer.c $AEROSIM_SRC_PATH/aerosim_fleet.c $COMMON_SRCS $KAFKA_SRCS || exit 1
+build_harness $AEROSIM_SRC_PATH/sl_aerosim_fleet_producer.c $AEROSIM_SRC_PATH/aerosim_fleet.c $COMMON_SRCS $KAFKA_SRCS || exit 1
+build_lockstep_bench || exit 1
+
+echo
+echo "Run e.g. $OUT_PATH/harness_sf_aerosim_json_parser $HARNESS_PATH/scenarios/json_decode.txt"
+echo "      or $OUT_PATH/lockstep_bench -r 0,500,1000,2000"
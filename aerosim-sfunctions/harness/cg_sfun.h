@@ -0,0 +1,33 @@
+#ifndef AEROSIM_HARNESS_CG_SFUN_H
+#define AEROSIM_HARNESS_CG_SFUN_H
+
+/*
+    Included at the end of the S-function source in place of the code
+    generation registration: hands the S-function's methods to the harness.
+*/
+#include "harness.h"
+
+#ifndef MDL_START
+#define mdlStart NULL
+#endif
+
+#ifndef MDL_SIM_STATE
+#define mdlGetSimState NULL
+#define mdlSetSimState NULL
+#endif
+
+#ifdef __cplusplus
+extern "C"
+#endif
+const harness_sfunction_t HARNESS_SFUNCTION_SYMBOL(S_FUNCTION_NAME) = {
+    HARNESS_STRINGIFY(S_FUNCTION_NAME),
+    mdlInitializeSizes,
+    mdlInitializeSampleTimes,
+    mdlStart,
+    mdlOutputs,
+    mdlTerminate,
+    mdlGetSimState,
+    mdlSetSimState
+};
+
+#endif /* AEROSIM_HARNESS_CG_SFUN_H */
@@ -0,0 +1,7 @@
+#ifndef AEROSIM_HARNESS_FIXEDPOINT_H
+#define AEROSIM_HARNESS_FIXEDPOINT_H
+
+/* The fixed-point registration functions are declared in the harness simstruc.h */
+#include "simstruc.h"
+
+#endif /* AEROSIM_HARNESS_FIXEDPOINT_H */
@@ -0,0 +1,1260 @@
+/*
+    Headless S-function harness: a stub SimStruct and the mx and mex
+    functions the AeroSim S-functions use, so they run without MATLAB.
+    harness_main.c runs one S-function from a scenario file,
+    lockstep_bench.c runs the lock-step loop of several S-functions.
+
+    Allocations are counted on the calling thread only, by interposing the
+    glibc malloc family; client library threads (e.g. librdkafka) aren't
+    included.
+*/
+#include "harness.h"
+
+#include <stdarg.h>
+#include <time.h>
+
+#define HARNESS_MAX_PARAMS 64
+#define HARNESS_MAX_DTYPES 16
+#define HARNESS_DTYPE_BASE 100
+
+struct mxArray_tag {
+    mxClassID classID;
+    size_t count;    /* number of elements */
+    double *pr;      /* mxDOUBLE_CLASS values */
+    char *str;       /* mxCHAR_CLASS characters, NUL terminated */
+    mxArray **cells; /* mxCELL_CLASS elements, mxSTRUCT_CLASS field values */
+    void *data;      /* values of the other numeric classes */
+    char **fields;   /* mxSTRUCT_CLASS field names, a struct is 1x1 */
+    int fieldCount;
+};
+
+typedef struct {
+    int_T width;
+    DTypeId dtype;
+    void *signal;
+} harness_port_t;
+
+typedef struct {
+    int isSigned;
+    int bytes;
+} harness_dtype_t;
+
+struct SimStruct_tag {
+    const harness_sfunction_t *sfun;
+    char path[256];
+    mxArray *params[HARNESS_MAX_PARAMS];
+    int_T paramCount;
+    int_T numParams;
+    int_T numInputs;
+    int_T numOutputs;
+    harness_port_t *inputs;
+    harness_port_t *outputs;
+    int_T numPWork;
+    int_T numIWork;
+    int_T numRWork;
+    void **pwork;
+    int_T *iwork;
+    real_T *rwork;
+    harness_dtype_t dtypes[HARNESS_MAX_DTYPES];
+    int dtypeCount;
+    time_T sampleTime;
+    time_T offsetTime;
+    time_T t;
+    const char *errorStatus;
+    int stopRequested;
+    long callSystemCount;
+    harness_call_system_t callSystem;
+    void *callSystemContext;
+};
+
+void harnessFatal(const char *fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    fprintf(stderr, "%% ");
+    vfprintf(stderr, fmt, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+    exit(1);
+}
+
+/*
+    Allocation counters
+*/
+static __thread unsigned long alloc_count;
+static __thread unsigned long alloc_bytes;
+
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+void *malloc(size_t size)
+{
+    alloc_count++;
+    alloc_bytes += size;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    alloc_count++;
+    alloc_bytes += count * size;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    alloc_count++;
+    alloc_bytes += size;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+    __libc_free(ptr);
+}
+#endif
+
+/*
+    mx arrays
+*/
+static mxArray *newArray(mxClassID classID, size_t count)
+{
+    mxArray *a = (mxArray *)calloc(1, sizeof(mxArray));
+
+    if (a == NULL) {
+        harnessFatal("Out of memory");
+    }
+    a->classID = classID;
+    a->count = count;
+    return a;
+}
+
+mxClassID mxGetClassID(const mxArray *a)
+{
+    return a != NULL ? a->classID : mxUNKNOWN_CLASS;
+}
+
+size_t mxGetNumberOfElements(const mxArray *a)
+{
+    return a != NULL ? a->count : 0;
+}
+
+size_t mxGetM(const mxArray *a)
+{
+    return a != NULL && a->count > 0 ? 1 : 0;
+}
+
+size_t mxGetN(const mxArray *a)
+{
+    return mxGetNumberOfElements(a);
+}
+
+double mxGetScalar(const mxArray *a)
+{
+    if (a == NULL || a->count == 0) {
+        return 0.0;
+    }
+    switch (a->classID) {
+    case mxDOUBLE_CLASS:
+        return a->pr[0];
+    case mxCHAR_CLASS:
+        return (double)(unsigned char)a->str[0];
+    default:
+        return 0.0;
+    }
+}
+
+double *mxGetPr(const mxArray *a)
+{
+    return a != NULL ? a->pr : NULL;
+}
+
+void *mxGetData(const mxArray *a)
+{
+    if (a == NULL) {
+        return NULL;
+    }
+    switch (a->classID) {
+    case mxCHAR_CLASS:
+        return a->str;
+    case mxDOUBLE_CLASS:
+        return a->pr;
+    default:
+        return a->data;
+    }
+}
+
+int mxGetString(const mxArray *a, char *buf, mwSize buflen)
+{
+    size_t len;
+
+    if (a == NULL || a->classID != mxCHAR_CLASS || buflen == 0) {
+        return 1;
+    }
+    len = a->count < buflen - 1 ? a->count : buflen - 1;
+    memcpy(buf, a->str, len);
+    buf[len] = '\0';
+    return len < a->count;
+}
+
+char *mxArrayToString(const mxArray *a)
+{
+    char *str;
+
+    if (a == NULL || a->classID != mxCHAR_CLASS) {
+        return NULL;
+    }
+    str = (char *)mxMalloc(a->count + 1);
+    memcpy(str, a->str, a->count + 1);
+    return str;
+}
+
+mxArray *mxGetCell(const mxArray *a, mwIndex index)
+{
+    if (a == NULL || a->classID != mxCELL_CLASS || index >= a->count) {
+        return NULL;
+    }
+    return a->cells[index];
+}
+
+bool mxIsChar(const mxArray *a)
+{
+    return mxGetClassID(a) == mxCHAR_CLASS;
+}
+
+bool mxIsCell(const mxArray *a)
+{
+    return mxGetClassID(a) == mxCELL_CLASS;
+}
+
+bool mxIsDouble(const mxArray *a)
+{
+    return mxGetClassID(a) == mxDOUBLE_CLASS;
+}
+
+bool mxIsNumeric(const mxArray *a)
+{
+    return mxGetClassID(a) >= mxDOUBLE_CLASS;
+}
+
+bool mxIsEmpty(const mxArray *a)
+{
+    return mxGetNumberOfElements(a) == 0;
+}
+
+bool mxIsStruct(const mxArray *a)
+{
+    return mxGetClassID(a) == mxSTRUCT_CLASS;
+}
+
+mxArray *mxCreateDoubleScalar(double value)
+{
+    return harnessCreateDoubles(&value, 1);
+}
+
+mxArray *mxCreateString(const char *str)
+{
+    return harnessCreateString(str);
+}
+
+static size_t classSize(mxClassID classID)
+{
+    switch (classID) {
+    case mxINT8_CLASS:
+    case mxUINT8_CLASS:
+    case mxLOGICAL_CLASS:
+        return 1;
+    case mxINT16_CLASS:
+    case mxUINT16_CLASS:
+        return 2;
+    case mxINT32_CLASS:
+    case mxUINT32_CLASS:
+    case mxSINGLE_CLASS:
+        return 4;
+    default:
+        return 8;
+    }
+}
+
+mxArray *mxCreateNumericMatrix(mwSize m, mwSize n, mxClassID classID, mxComplexity complexity)
+{
+    mxArray *a;
+
+    if (classID == mxDOUBLE_CLASS) {
+        a = newArray(mxDOUBLE_CLASS, m * n);
+        a->pr = (double *)mxCalloc(m * n > 0 ? m * n : 1, sizeof(double));
+        return a;
+    }
+    a = newArray(classID, m * n);
+    a->data = mxCalloc(m * n > 0 ? m * n : 1, classSize(classID));
+    return a;
+}
+
+mxArray *mxCreateStructMatrix(mwSize m, mwSize n, int nfields, const char **fieldnames)
+{
+    mxArray *a;
+    int i;
+
+    if (m * n != 1) {
+        harnessFatal("Only 1x1 structs are supported");
+    }
+    a = newArray(mxSTRUCT_CLASS, 1);
+    a->fields = (char **)mxCalloc(nfields > 0 ? nfields : 1, sizeof(char *));
+    a->cells = (mxArray **)mxCalloc(nfields > 0 ? nfields : 1, sizeof(mxArray *));
+    a->fieldCount = nfields;
+    for (i = 0; i < nfields; i++) {
+        a->fields[i] = strdup(fieldnames[i]);
+    }
+    return a;
+}
+
+static int findField(const mxArray *a, mwIndex index, const char *fieldname)
+{
+    int i;
+
+    if (a == NULL || a->classID != mxSTRUCT_CLASS || index != 0) {
+        return -1;
+    }
+    for (i = 0; i < a->fieldCount; i++) {
+        if (strcmp(a->fields[i], fieldname) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+mxArray *mxGetField(const mxArray *a, mwIndex index, const char *fieldname)
+{
+    int i = findField(a, index, fieldname);
+
+    return i >= 0 ? a->cells[i] : NULL;
+}
+
+void mxSetField(mxArray *a, mwIndex index, const char *fieldname, mxArray *value)
+{
+    int i = findField(a, index, fieldname);
+
+    if (i < 0) {
+        harnessFatal("Struct has no field '%s'", fieldname);
+    }
+    a->cells[i] = value;
+}
+
+void mxDestroyArray(mxArray *a)
+{
+    size_t i;
+
+    if (a == NULL) {
+        return;
+    }
+    if (a->classID == mxCELL_CLASS || a->classID == mxSTRUCT_CLASS) {
+        size_t count = (a->classID == mxCELL_CLASS) ? a->count : (size_t)a->fieldCount;
+        for (i = 0; i < count; i++) {
+            mxDestroyArray(a->cells[i]);
+        }
+    }
+    for (i = 0; i < (size_t)a->fieldCount; i++) {
+        free(a->fields[i]);
+    }
+    free(a->fields);
+    free(a->cells);
+    free(a->pr);
+    free(a->str);
+    free(a->data);
+    free(a);
+}
+
+void *mxMalloc(mwSize n)
+{
+    void *p = malloc(n);
+
+    if (p == NULL) {
+        harnessFatal("Out of memory");
+    }
+    return p;
+}
+
+void *mxCalloc(mwSize n, mwSize size)
+{
+    void *p = calloc(n, size);
+
+    if (p == NULL) {
+        harnessFatal("Out of memory");
+    }
+    return p;
+}
+
+void mxFree(void *p)
+{
+    free(p);
+}
+
+/*
+    mex
+*/
+int mexPrintf(const char *fmt, ...)
+{
+    va_list args;
+    int ret;
+
+    /* Block messages go to stderr to keep the report on stdout */
+    va_start(args, fmt);
+    ret = vfprintf(stderr, fmt, args);
+    va_end(args);
+    return ret;
+}
+
+void mexWarnMsgTxt(const char *msg)
+{
+    fprintf(stderr, "Warning: %s\n", msg);
+}
+
+void mexErrMsgTxt(const char *msg)
+{
+    harnessFatal("%s", msg);
+}
+
+/*
+    Parameters
+*/
+void ssSetNumSFcnParams(SimStruct *S, int_T n)
+{
+    S->numParams = n;
+}
+
+int_T ssGetNumSFcnParams(SimStruct *S)
+{
+    return S->numParams;
+}
+
+int_T ssGetSFcnParamsCount(SimStruct *S)
+{
+    return S->paramCount;
+}
+
+const mxArray *ssGetSFcnParam(SimStruct *S, int_T index)
+{
+    if (index < 0 || index >= S->paramCount) {
+        return NULL;
+    }
+    return S->params[index];
+}
+
+void ssSetSFcnParamNotTunable(SimStruct *S, int_T index)
+{
+}
+
+/*
+    Sizes
+*/
+static harness_port_t *getPort(harness_port_t *ports, int_T count, int_T port, const char *kind)
+{
+    if (port < 0 || port >= count) {
+        harnessFatal("%s port %d out of range (%d ports)", kind, port, count);
+    }
+    return &ports[port];
+}
+
+static int_T setNumPorts(harness_port_t **ports, int_T *count, int_T n)
+{
+    int_T i;
+
+    *ports = (harness_port_t *)realloc(*ports, (n > 0 ? n : 1) * sizeof(harness_port_t));
+    if (*ports == NULL) {
+        harnessFatal("Out of memory");
+    }
+    for (i = 0; i < n; i++) {
+        (*ports)[i].width = 1;
+        (*ports)[i].dtype = SS_DOUBLE;
+        (*ports)[i].signal = NULL;
+    }
+    *count = n;
+    return 1;
+}
+
+void ssSetNumContStates(SimStruct *S, int_T n)
+{
+}
+
+void ssSetNumDiscStates(SimStruct *S, int_T n)
+{
+}
+
+int_T ssSetNumInputPorts(SimStruct *S, int_T n)
+{
+    return setNumPorts(&S->inputs, &S->numInputs, n);
+}
+
+int_T ssSetNumOutputPorts(SimStruct *S, int_T n)
+{
+    return setNumPorts(&S->outputs, &S->numOutputs, n);
+}
+
+int_T ssGetNumInputPorts(SimStruct *S)
+{
+    return S->numInputs;
+}
+
+int_T ssGetNumOutputPorts(SimStruct *S)
+{
+    return S->numOutputs;
+}
+
+void ssSetInputPortWidth(SimStruct *S, int_T port, int_T width)
+{
+    getPort(S->inputs, S->numInputs, port, "Input")->width = width;
+}
+
+void ssSetInputPortDataType(SimStruct *S, int_T port, DTypeId id)
+{
+    getPort(S->inputs, S->numInputs, port, "Input")->dtype = id;
+}
+
+void ssSetInputPortRequiredContiguous(SimStruct *S, int_T port, int_T value)
+{
+}
+
+void ssSetInputPortDirectFeedThrough(SimStruct *S, int_T port, int_T value)
+{
+}
+
+void ssSetInputPortMatrixDimensions(SimStruct *S, int_T port, int_T m, int_T n)
+{
+    getPort(S->inputs, S->numInputs, port, "Input")->width = m * n;
+}
+
+int_T ssGetInputPortWidth(SimStruct *S, int_T port)
+{
+    return getPort(S->inputs, S->numInputs, port, "Input")->width;
+}
+
+void ssSetOutputPortWidth(SimStruct *S, int_T port, int_T width)
+{
+    getPort(S->outputs, S->numOutputs, port, "Output")->width = width;
+}
+
+void ssSetOutputPortDataType(SimStruct *S, int_T port, DTypeId id)
+{
+    getPort(S->outputs, S->numOutputs, port, "Output")->dtype = id;
+}
+
+void ssSetOutputPortMatrixDimensions(SimStruct *S, int_T port, int_T m, int_T n)
+{
+    getPort(S->outputs, S->numOutputs, port, "Output")->width = m * n;
+}
+
+int_T ssGetOutputPortWidth(SimStruct *S, int_T port)
+{
+    return getPort(S->outputs, S->numOutputs, port, "Output")->width;
+}
+
+void ssSetNumSampleTimes(SimStruct *S, int_T n)
+{
+}
+
+void ssSetNumRWork(SimStruct *S, int_T n)
+{
+    S->numRWork = n;
+}
+
+void ssSetNumIWork(SimStruct *S, int_T n)
+{
+    S->numIWork = n;
+}
+
+void ssSetNumPWork(SimStruct *S, int_T n)
+{
+    S->numPWork = n;
+}
+
+int_T ssGetNumPWork(SimStruct *S)
+{
+    return S->numPWork;
+}
+
+void ssSetNumDWork(SimStruct *S, int_T n)
+{
+}
+
+void ssSetNumModes(SimStruct *S, int_T n)
+{
+}
+
+void ssSetNumNonsampledZCs(SimStruct *S, int_T n)
+{
+}
+
+void ssSetSimStateCompliance(SimStruct *S, int_T compliance)
+{
+}
+
+void ssSetOptions(SimStruct *S, uint_T options)
+{
+}
+
+/*
+    Data types
+*/
+static DTypeId registerDataType(SimStruct *S, int_T isSigned, int_T wordLength)
+{
+    int i;
+
+    for (i = 0; i < S->dtypeCount; i++) {
+        if (S->dtypes[i].isSigned == isSigned && S->dtypes[i].bytes * 8 == wordLength) {
+            return HARNESS_DTYPE_BASE + i;
+        }
+    }
+    if (S->dtypeCount == HARNESS_MAX_DTYPES || wordLength % 8 != 0 || wordLength > 64) {
+        return INVALID_DTYPE_ID;
+    }
+    S->dtypes[S->dtypeCount].isSigned = isSigned;
+    S->dtypes[S->dtypeCount].bytes = wordLength / 8;
+    return HARNESS_DTYPE_BASE + S->dtypeCount++;
+}
+
+DTypeId ssRegisterDataTypeInteger(SimStruct *S, int_T isSigned, int_T wordLength, int_T obeyDataTypeOverride)
+{
+    return registerDataType(S, isSigned, wordLength);
+}
+
+DTypeId ssRegisterDataTypeFxpBinaryPoint(SimStruct *S, int_T isSigned, int_T wordLength, int_T fractionLength,
+                                         int_T obeyDataTypeOverride)
+{
+    /* Only integers, the blocks register fraction length 0 */
+    return fractionLength == 0 ? registerDataType(S, isSigned, wordLength) : INVALID_DTYPE_ID;
+}
+
+static size_t dataTypeSize(SimStruct *S, DTypeId id)
+{
+    switch (id) {
+    case SS_DOUBLE:
+        return sizeof(real_T);
+    case SS_SINGLE:
+        return sizeof(real32_T);
+    case SS_INT8:
+    case SS_UINT8:
+    case SS_BOOLEAN:
+        return 1;
+    case SS_INT16:
+    case SS_UINT16:
+        return 2;
+    case SS_INT32:
+    case SS_UINT32:
+        return 4;
+    default:
+        if (id >= HARNESS_DTYPE_BASE && id < HARNESS_DTYPE_BASE + S->dtypeCount) {
+            return (size_t)S->dtypes[id - HARNESS_DTYPE_BASE].bytes;
+        }
+        return 0; /* function-call port */
+    }
+}
+
+/*
+    Sample times
+*/
+void ssSetSampleTime(SimStruct *S, int_T index, time_T period)
+{
+    S->sampleTime = period;
+}
+
+void ssSetOffsetTime(SimStruct *S, int_T index, time_T offset)
+{
+    S->offsetTime = offset;
+}
+
+time_T ssGetSampleTime(SimStruct *S, int_T index)
+{
+    return S->sampleTime;
+}
+
+void ssSetCallSystemOutput(SimStruct *S, int_T element)
+{
+}
+
+void ssSetModelReferenceSampleTimeDefaultInheritance(SimStruct *S)
+{
+}
+
+/*
+    Simulation
+*/
+int_T ssGetSimMode(SimStruct *S)
+{
+    return SS_SIMMODE_NORMAL;
+}
+
+int_T ssIsMajorTimeStep(SimStruct *S)
+{
+    return 1;
+}
+
+int_T ssRTWGenIsCodeGen(SimStruct *S)
+{
+    return 0;
+}
+
+time_T ssGetT(SimStruct *S)
+{
+    return S->t;
+}
+
+const char *ssGetPath(SimStruct *S)
+{
+    return S->path;
+}
+
+const char *ssGetModelName(SimStruct *S)
+{
+    return "harness";
+}
+
+void ssSetErrorStatus(SimStruct *S, const char *msg)
+{
+    S->errorStatus = msg;
+}
+
+void ssWarning(SimStruct *S, const char *msg)
+{
+    fprintf(stderr, "Warning: %s: %s\n", S->path, msg);
+}
+
+void ssSetStopRequested(SimStruct *S, int_T value)
+{
+    S->stopRequested = value;
+}
+
+int_T ssCallSystemWithTid(SimStruct *S, int_T element, int_T tid)
+{
+    S->callSystemCount++;
+    if (S->callSystem != NULL) {
+        return S->callSystem(S->callSystemContext, S, element);
+    }
+    return 1;
+}
+
+int_T ssWriteRTWParamSettings(SimStruct *S, int_T nParams, ...)
+{
+    return 1;
+}
+
+/*
+    Work vectors and signals
+*/
+void ssSetPWorkValue(SimStruct *S, int_T index, void *value)
+{
+    if (index < 0 || index >= S->numPWork) {
+        harnessFatal("PWork index %d out of range (%d)", index, S->numPWork);
+    }
+    S->pwork[index] = value;
+}
+
+void *ssGetPWorkValue(SimStruct *S, int_T index)
+{
+    if (index < 0 || index >= S->numPWork) {
+        harnessFatal("PWork index %d out of range (%d)", index, S->numPWork);
+    }
+    return S->pwork[index];
+}
+
+void **ssGetPWork(SimStruct *S)
+{
+    return S->pwork;
+}
+
+void ssSetIWorkValue(SimStruct *S, int_T index, int_T value)
+{
+    if (index < 0 || index >= S->numIWork) {
+        harnessFatal("IWork index %d out of range (%d)", index, S->numIWork);
+    }
+    S->iwork[index] = value;
+}
+
+int_T ssGetIWorkValue(SimStruct *S, int_T index)
+{
+    if (index < 0 || index >= S->numIWork) {
+        harnessFatal("IWork index %d out of range (%d)", index, S->numIWork);
+    }
+    return S->iwork[index];
+}
+
+void ssSetRWorkValue(SimStruct *S, int_T index, real_T value)
+{
+    if (index < 0 || index >= S->numRWork) {
+        harnessFatal("RWork index %d out of range (%d)", index, S->numRWork);
+    }
+    S->rwork[index] = value;
+}
+
+real_T ssGetRWorkValue(SimStruct *S, int_T index)
+{
+    if (index < 0 || index >= S->numRWork) {
+        harnessFatal("RWork index %d out of range (%d)", index, S->numRWork);
+    }
+    return S->rwork[index];
+}
+
+const void *ssGetInputPortSignal(SimStruct *S, int_T port)
+{
+    return getPort(S->inputs, S->numInputs, port, "Input")->signal;
+}
+
+void *ssGetOutputPortSignal(SimStruct *S, int_T port)
+{
+    return getPort(S->outputs, S->numOutputs, port, "Output")->signal;
+}
+
+static void allocatePorts(SimStruct *S, harness_port_t *ports, int_T count)
+{
+    int_T i;
+
+    for (i = 0; i < count; i++) {
+        size_t size = dataTypeSize(S, ports[i].dtype);
+        ports[i].signal = calloc(ports[i].width > 0 ? ports[i].width : 1, size > 0 ? size : sizeof(real_T));
+        if (ports[i].signal == NULL) {
+            harnessFatal("Out of memory");
+        }
+    }
+}
+
+static void allocateWork(SimStruct *S)
+{
+    allocatePorts(S, S->inputs, S->numInputs);
+    allocatePorts(S, S->outputs, S->numOutputs);
+    S->pwork = (void **)calloc(S->numPWork + 1, sizeof(void *));
+    S->iwork = (int_T *)calloc(S->numIWork + 1, sizeof(int_T));
+    S->rwork = (real_T *)calloc(S->numRWork + 1, sizeof(real_T));
+    if (S->pwork == NULL || S->iwork == NULL || S->rwork == NULL) {
+        harnessFatal("Out of memory");
+    }
+}
+
+/*
+    Port values
+*/
+static void storeNumber(SimStruct *S, DTypeId dtype, void *dst, double value)
+{
+    switch (dtype) {
+    case SS_DOUBLE:
+        *(real_T *)dst = value;
+        break;
+    case SS_SINGLE:
+        *(real32_T *)dst = (real32_T)value;
+        break;
+    case SS_INT8:
+        *(int8_T *)dst = (int8_T)value;
+        break;
+    case SS_UINT8:
+        *(uint8_T *)dst = (uint8_T)value;
+        break;
+    case SS_BOOLEAN:
+        *(boolean_T *)dst = value != 0.0;
+        break;
+    case SS_INT16:
+        *(int16_T *)dst = (int16_T)value;
+        break;
+    case SS_UINT16:
+        *(uint16_T *)dst = (uint16_T)value;
+        break;
+    case SS_INT32:
+        *(int32_T *)dst = (int32_T)value;
+        break;
+    case SS_UINT32:
+        *(uint32_T *)dst = (uint32_T)value;
+        break;
+    default:
+        if (dataTypeSize(S, dtype) == 8) {
+            if (S->dtypes[dtype - HARNESS_DTYPE_BASE].isSigned) {
+                *(int64_T *)dst = (int64_T)value;
+            } else {
+                *(uint64_T *)dst = (uint64_T)value;
+            }
+        }
+        break;
+    }
+}
+
+void harnessSetInput(SimStruct *S, int_T port, const mxArray *value)
+{
+    harness_port_t *p = getPort(S->inputs, S->numInputs, port, "Input");
+    size_t size = dataTypeSize(S, p->dtype);
+    size_t bytes = (size_t)p->width * size;
+    size_t i;
+
+    memset(p->signal, 0, bytes);
+    if (value->classID == mxCHAR_CLASS) {
+        memcpy(p->signal, value->str, value->count < bytes ? value->count : bytes);
+    } else if (value->classID == mxDOUBLE_CLASS) {
+        for (i = 0; i < value->count && i < (size_t)p->width; i++) {
+            storeNumber(S, p->dtype, (char *)p->signal + i * size, value->pr[i]);
+        }
+    } else {
+        harnessFatal("Input port %d: cell arrays aren't port values", port);
+    }
+}
+
+static double loadNumber(SimStruct *S, DTypeId dtype, const void *src)
+{
+    switch (dtype) {
+    case SS_DOUBLE:
+        return *(const real_T *)src;
+    case SS_SINGLE:
+        return *(const real32_T *)src;
+    case SS_INT8:
+        return *(const int8_T *)src;
+    case SS_UINT8:
+    case SS_BOOLEAN:
+        return *(const uint8_T *)src;
+    case SS_INT16:
+        return *(const int16_T *)src;
+    case SS_UINT16:
+        return *(const uint16_T *)src;
+    case SS_INT32:
+        return *(const int32_T *)src;
+    case SS_UINT32:
+        return *(const uint32_T *)src;
+    default:
+        if (dataTypeSize(S, dtype) == 8) {
+            return S->dtypes[dtype - HARNESS_DTYPE_BASE].isSigned ? (double)*(const int64_T *)src
+                                                                  : (double)*(const uint64_T *)src;
+        }
+        return 0.0;
+    }
+}
+
+void harnessPrintOutput(SimStruct *S, int_T port)
+{
+    harness_port_t *p = getPort(S->outputs, S->numOutputs, port, "Output");
+    size_t size = dataTypeSize(S, p->dtype);
+    int_T i;
+
+    printf("output %d:", port);
+    if (p->dtype == SS_INT8 || p->dtype == SS_UINT8) {
+        /* Byte vectors are messages */
+        printf(" '%.*s'\n", (int)strnlen((const char *)p->signal, p->width), (const char *)p->signal);
+        return;
+    }
+    for (i = 0; i < p->width; i++) {
+        printf(" %.17g", loadNumber(S, p->dtype, (const char *)p->signal + i * size));
+    }
+    printf("\n");
+}
+
+/*
+    Values
+*/
+static const char *skipSpace(const char *p)
+{
+    while (*p == ' ' || *p == '\t' || *p == ',') {
+        p++;
+    }
+    return p;
+}
+
+mxArray *harnessCreateString(const char *str)
+{
+    mxArray *a = newArray(mxCHAR_CLASS, strlen(str));
+
+    a->str = strdup(str);
+    return a;
+}
+
+mxArray *harnessCreateDoubles(const double *values, size_t count)
+{
+    mxArray *a = newArray(mxDOUBLE_CLASS, count);
+
+    a->pr = (double *)calloc(count > 0 ? count : 1, sizeof(double));
+    if (count > 0) {
+        memcpy(a->pr, values, count * sizeof(double));
+    }
+    return a;
+}
+
+mxArray *harnessCreateCell(size_t count)
+{
+    mxArray *a = newArray(mxCELL_CLASS, count);
+
+    a->cells = (mxArray **)calloc(count > 0 ? count : 1, sizeof(mxArray *));
+    return a;
+}
+
+void harnessSetCell(mxArray *cell, size_t index, mxArray *value)
+{
+    if (cell->classID != mxCELL_CLASS || index >= cell->count) {
+        harnessFatal("Cell index %zu out of range", index);
+    }
+    cell->cells[index] = value;
+}
+
+mxArray *harnessParseValue(const char **text, const char *context)
+{
+    const char *p = skipSpace(*text);
+    mxArray *a;
+    char *end;
+
+    if (*p == '\'') {
+        size_t len = 0;
+
+        a = newArray(mxCHAR_CLASS, 0);
+        a->str = (char *)calloc(strlen(p) + 1, 1);
+        for (p++; *p != '\0'; p++) {
+            if (*p == '\'') {
+                if (p[1] != '\'') {
+                    break;
+                }
+                p++;
+            }
+            a->str[len++] = *p;
+        }
+        if (*p != '\'') {
+            harnessFatal("%s: unterminated string", context);
+        }
+        a->count = len;
+        *text = p + 1;
+        return a;
+    }
+    if (*p == '[' || *p == '{') {
+        char close = *p == '[' ? ']' : '}';
+        size_t capacity = 8;
+
+        a = newArray(*p == '[' ? mxDOUBLE_CLASS : mxCELL_CLASS, 0);
+        if (close == ']') {
+            a->pr = (double *)calloc(capacity, sizeof(double));
+        } else {
+            a->cells = (mxArray **)calloc(capacity, sizeof(mxArray *));
+        }
+        for (p = skipSpace(p + 1); *p != close; p = skipSpace(p)) {
+            if (*p == '\0') {
+                harnessFatal("%s: missing '%c'", context, close);
+            }
+            if (a->count == capacity) {
+                capacity *= 2;
+                if (close == ']') {
+                    a->pr = (double *)realloc(a->pr, capacity * sizeof(double));
+                } else {
+                    a->cells = (mxArray **)realloc(a->cells, capacity * sizeof(mxArray *));
+                }
+            }
+            if (close == ']') {
+                a->pr[a->count] = strtod(p, &end);
+                if (end == p) {
+                    harnessFatal("%s: invalid number", context);
+                }
+                p = end;
+            } else {
+                a->cells[a->count] = harnessParseValue(&p, context);
+            }
+            a->count++;
+        }
+        *text = p + 1;
+        return a;
+    }
+
+    a = newArray(mxDOUBLE_CLASS, 1);
+    a->pr = (double *)calloc(1, sizeof(double));
+    a->pr[0] = strtod(p, &end);
+    if (end == p) {
+        harnessFatal("%s: invalid value '%s'", context, p);
+    }
+    *text = end;
+    return a;
+}
+
+/*
+    Blocks
+*/
+SimStruct *harnessCreateBlock(const harness_sfunction_t *sfun, const char *name)
+{
+    SimStruct *S = (SimStruct *)calloc(1, sizeof(SimStruct));
+
+    if (S == NULL) {
+        harnessFatal("Out of memory");
+    }
+    S->sfun = sfun;
+    snprintf(S->path, sizeof(S->path), "harness/%s", name != NULL ? name : sfun->name);
+    return S;
+}
+
+void harnessSetParam(SimStruct *S, int_T index, mxArray *value)
+{
+    if (index < 0 || index >= HARNESS_MAX_PARAMS) {
+        harnessFatal("%s: parameter index %d out of range", S->path, index);
+    }
+    S->params[index] = value;
+    if (index >= S->paramCount) {
+        S->paramCount = index + 1;
+    }
+}
+
+static void checkError(SimStruct *S, const char *method)
+{
+    if (S->errorStatus != NULL) {
+        harnessFatal("%s: error in %s: %s", S->path, method, S->errorStatus);
+    }
+}
+
+void harnessInitializeBlock(SimStruct *S)
+{
+    int_T i;
+
+    for (i = 0; i < S->paramCount; i++) {
+        if (S->params[i] == NULL) {
+            harnessFatal("%s: parameter %d is missing", S->path, i);
+        }
+    }
+    S->sfun->initializeSizes(S);
+    checkError(S, "mdlInitializeSizes");
+    if (S->numParams != S->paramCount) {
+        harnessFatal("%s: %s expects %d parameters, got %d", S->path, S->sfun->name, S->numParams, S->paramCount);
+    }
+    S->sfun->initializeSampleTimes(S);
+    checkError(S, "mdlInitializeSampleTimes");
+    allocateWork(S);
+}
+
+void harnessStartBlock(SimStruct *S)
+{
+    if (S->sfun->start != NULL) {
+        S->sfun->start(S);
+        checkError(S, "mdlStart");
+    }
+}
+
+void harnessBlockOutputs(SimStruct *S, time_T t)
+{
+    S->t = t;
+    S->sfun->outputs(S, 0);
+    if (S->errorStatus != NULL) {
+        /* Terminate like Simulink does after a failed step */
+        S->sfun->terminate(S);
+        checkError(S, "mdlOutputs");
+    }
+}
+
+void harnessTerminateBlock(SimStruct *S)
+{
+    S->sfun->terminate(S);
+    checkError(S, "mdlTerminate");
+}
+
+const harness_sfunction_t *harnessGetSFunction(SimStruct *S)
+{
+    return S->sfun;
+}
+
+void harnessRestartBlock(SimStruct *S)
+{
+    mxArray *state = NULL;
+    int_T i;
+
+    if (S->sfun->getSimState != NULL) {
+        state = S->sfun->getSimState(S);
+        checkError(S, "mdlGetSimState");
+    }
+    harnessTerminateBlock(S);
+
+    /* The sizes don't change, only the work vectors and outputs start over */
+    for (i = 0; i < S->numOutputs; i++) {
+        size_t size = dataTypeSize(S, S->outputs[i].dtype);
+        memset(S->outputs[i].signal, 0, (S->outputs[i].width > 0 ? S->outputs[i].width : 1)
+                                            * (size > 0 ? size : sizeof(real_T)));
+    }
+    memset(S->pwork, 0, (S->numPWork + 1) * sizeof(void *));
+    memset(S->iwork, 0, (S->numIWork + 1) * sizeof(int_T));
+    memset(S->rwork, 0, (S->numRWork + 1) * sizeof(real_T));
+    S->stopRequested = 0;
+
+    harnessStartBlock(S);
+    if (state != NULL) {
+        S->sfun->setSimState(S, state);
+        checkError(S, "mdlSetSimState");
+        mxDestroyArray(state);
+    }
+}
+
+void harnessConnect(SimStruct *dst, int_T inPort, SimStruct *src, int_T outPort)
+{
+    harness_port_t *in = getPort(dst->inputs, dst->numInputs, inPort, "Input");
+    harness_port_t *out = getPort(src->outputs, src->numOutputs, outPort, "Output");
+
+    if (in->width != out->width || dataTypeSize(dst, in->dtype) != dataTypeSize(src, out->dtype)) {
+        harnessFatal("Can't connect %s output %d (width %d) to %s input %d (width %d)", src->path, outPort,
+                     out->width, dst->path, inPort, in->width);
+    }
+    free(in->signal);
+    in->signal = out->signal;
+}
+
+void harnessSetCallSystem(SimStruct *S, harness_call_system_t callback, void *context)
+{
+    S->callSystem = callback;
+    S->callSystemContext = context;
+}
+
+long harnessGetCallSystemCount(SimStruct *S)
+{
+    return S->callSystemCount;
+}
+
+int harnessGetStopRequested(SimStruct *S)
+{
+    return S->stopRequested;
+}
+
+time_T harnessGetOffsetTime(SimStruct *S)
+{
+    return S->offsetTime;
+}
+
+/*
+    Measurements
+*/
+int64_t harnessNowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void harnessBeginSample(harness_sample_t *sample)
+{
+    alloc_count = 0;
+    alloc_bytes = 0;
+    sample->ns = harnessNowNs();
+}
+
+void harnessEndSample(harness_sample_t *sample)
+{
+    sample->ns = harnessNowNs() - sample->ns;
+    sample->allocs = alloc_count;
+    sample->bytes = alloc_bytes;
+}
+
+static int compareNs(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+void harnessReportDurations(const char *label, int64_t *ns, long count)
+{
+    double sum = 0.0;
+    long i;
+
+    if (count <= 0) {
+        printf("  %-20s no samples\n", label);
+        return;
+    }
+    for (i = 0; i < count; i++) {
+        sum += ns[i];
+    }
+    qsort(ns, count, sizeof(int64_t), compareNs);
+    printf("  %-20s min %.3f us  p50 %.3f us  p90 %.3f us  p99 %.3f us  max %.3f us  mean %.3f us\n", label,
+           ns[0] * 1e-3, ns[count / 2] * 1e-3, ns[(count * 9) / 10] * 1e-3, ns[(count * 99) / 100] * 1e-3,
+           ns[count - 1] * 1e-3, sum / count * 1e-3);
+}
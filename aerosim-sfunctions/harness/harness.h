@@ -0,0 +1,107 @@
+#ifndef AEROSIM_HARNESS_H
+#define AEROSIM_HARNESS_H
+
+#include "simstruc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+    Methods of an S-function, registered by cg_sfun.h at the end of the
+    S-function source as harness_sfunction_<S_FUNCTION_NAME>. start is NULL
+    unless the S-function defines MDL_START, getSimState and setSimState
+    unless it defines MDL_SIM_STATE.
+*/
+typedef struct {
+    const char *name;
+    void (*initializeSizes)(SimStruct *S);
+    void (*initializeSampleTimes)(SimStruct *S);
+    void (*start)(SimStruct *S);
+    void (*outputs)(SimStruct *S, int_T tid);
+    void (*terminate)(SimStruct *S);
+    mxArray *(*getSimState)(SimStruct *S);
+    void (*setSimState)(SimStruct *S, const mxArray *state);
+} harness_sfunction_t;
+
+#define HARNESS_CONCAT_(a, b) a##b
+#define HARNESS_CONCAT(a, b) HARNESS_CONCAT_(a, b)
+#define HARNESS_STRINGIFY_(x) #x
+#define HARNESS_STRINGIFY(x) HARNESS_STRINGIFY_(x)
+#define HARNESS_SFUNCTION_SYMBOL(name) HARNESS_CONCAT(harness_sfunction_, name)
+
+/* Print the message and exit the process */
+void harnessFatal(const char *fmt, ...);
+
+/*
+    Values. harnessParseValue() reads a number, a vector [1 2 3], a string
+    'text' ('' for a quote) or a cell array {'a' 'b' 1} and advances the
+    text past it; context prefixes the error messages, e.g. "file:line".
+*/
+mxArray *harnessParseValue(const char **text, const char *context);
+mxArray *harnessCreateString(const char *str);
+mxArray *harnessCreateDoubles(const double *values, size_t count);
+mxArray *harnessCreateCell(size_t count);
+void harnessSetCell(mxArray *cell, size_t index, mxArray *value);
+
+/*
+    Blocks. A block is an S-function instance with its own SimStruct, run
+    in normal simulation mode. Outputs and terminate exit the process with
+    the block's error status, if any.
+*/
+SimStruct *harnessCreateBlock(const harness_sfunction_t *sfun, const char *name);
+void harnessSetParam(SimStruct *S, int_T index, mxArray *value);
+void harnessInitializeBlock(SimStruct *S); /* sizes, sample times and work vectors */
+void harnessStartBlock(SimStruct *S);
+void harnessBlockOutputs(SimStruct *S, time_T t);
+void harnessTerminateBlock(SimStruct *S);
+const harness_sfunction_t *harnessGetSFunction(SimStruct *S);
+
+/*
+    Restart the block like a simulation restored from a saved operating
+    point: save its SimState, terminate it, start it again with cleared work
+    vectors and outputs and restore the SimState. Blocks without a custom
+    SimState start over.
+*/
+void harnessRestartBlock(SimStruct *S);
+
+/* Feed the input port from an output port of another block, like a Simulink line */
+void harnessConnect(SimStruct *dst, int_T inPort, SimStruct *src, int_T outPort);
+
+/* Copy a string or numbers into the input port, zeroing the rest of it */
+void harnessSetInput(SimStruct *S, int_T port, const mxArray *value);
+void harnessPrintOutput(SimStruct *S, int_T port);
+
+/*
+    Function-call outputs run the callback, which returns 0 on error like
+    ssCallSystemWithTid(). Without a callback the calls are only counted.
+*/
+typedef int (*harness_call_system_t)(void *context, SimStruct *S, int_T element);
+void harnessSetCallSystem(SimStruct *S, harness_call_system_t callback, void *context);
+long harnessGetCallSystemCount(SimStruct *S);
+
+int harnessGetStopRequested(SimStruct *S);
+time_T harnessGetOffsetTime(SimStruct *S);
+
+/*
+    Measurements. A sample holds the duration of a call and the heap
+    allocations the calling thread made during it.
+*/
+typedef struct {
+    int64_t ns;
+    unsigned long allocs;
+    unsigned long bytes;
+} harness_sample_t;
+
+int64_t harnessNowNs(void);
+void harnessBeginSample(harness_sample_t *sample);
+void harnessEndSample(harness_sample_t *sample);
+
+/* Print min/p50/p90/p99/max/mean of the durations, sorting them in place */
+void harnessReportDurations(const char *label, int64_t *ns, long count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AEROSIM_HARNESS_H */
@@ -0,0 +1,294 @@
+/*
+    Runs one S-function through mdlInitializeSizes, mdlInitializeSampleTimes,
+    mdlStart, N calls of mdlOutputs and mdlTerminate, driven by a scenario
+    file, and reports the time and the heap allocations of each call.
+    HARNESS_SFUNCTION names the S-function, e.g. -DHARNESS_SFUNCTION=sf_aerosim_json_parser.
+
+    Scenario file, one statement per line, '#' starts a comment:
+        param <index> <value>            S-function parameter, 0-based like the EP_ enums
+        input <port> <value>             input port value from the first step on
+        at <step> input <port> <value>   input port value from the given step on
+        steps <count>                    number of mdlOutputs calls (default 1000)
+        warmup <count>                   leading calls left out of the statistics (default 0)
+        step_size <seconds>              simulation time step (default 0.01)
+        print <port>                     print the output port after the last step
+        restart <step>                   restart the block from its SimState before the given step
+    A value is a number, a vector [1 2 3], a string 'text' ('' for a quote)
+    or a cell array {'a' 'b' 1}. A string input fills the port bytes and
+    zeroes the rest, numbers are converted to the port data type.
+
+    Usage: harness_<sfunction> <scenario> [-n steps] [-o timings.csv]
+*/
+#include "harness.h"
+
+#define HARNESS_DEFAULT_STEPS 1000
+#define HARNESS_DEFAULT_STEP_SIZE 0.01
+
+extern const harness_sfunction_t HARNESS_SFUNCTION_SYMBOL(HARNESS_SFUNCTION);
+
+/*
+    Scenario
+*/
+typedef struct {
+    long step;
+    int_T port;
+    mxArray *value;
+} harness_input_t;
+
+typedef struct {
+    harness_input_t *inputs;
+    int inputCount;
+    int_T *prints;
+    int printCount;
+    long *restarts;
+    int restartCount;
+    long steps;
+    long warmup;
+    double stepSize;
+} harness_scenario_t;
+
+static const char *skipSpace(const char *p)
+{
+    while (*p == ' ' || *p == '\t') {
+        p++;
+    }
+    return p;
+}
+
+static long parseInteger(const char **pp, const char *context)
+{
+    const char *p = skipSpace(*pp);
+    char *end;
+    long value = strtol(p, &end, 10);
+
+    if (end == p) {
+        harnessFatal("%s: invalid integer", context);
+    }
+    *pp = end;
+    return value;
+}
+
+static int matchWord(const char **pp, const char *word)
+{
+    const char *p = skipSpace(*pp);
+    size_t len = strlen(word);
+
+    if (strncmp(p, word, len) != 0 || (p[len] != ' ' && p[len] != '\t' && p[len] != '\0')) {
+        return 0;
+    }
+    *pp = p + len;
+    return 1;
+}
+
+static void parseInput(harness_scenario_t *scenario, long step, const char **pp, const char *context)
+{
+    harness_input_t *input;
+
+    scenario->inputs = (harness_input_t *)realloc(scenario->inputs, (scenario->inputCount + 1) * sizeof(harness_input_t));
+    input = &scenario->inputs[scenario->inputCount++];
+    input->step = step;
+    input->port = (int_T)parseInteger(pp, context);
+    input->value = harnessParseValue(pp, context);
+}
+
+static void loadScenario(SimStruct *S, harness_scenario_t *scenario, const char *file)
+{
+    FILE *fp = fopen(file, "r");
+    char buf[65536], context[1024];
+    int line = 0;
+
+    if (fp == NULL) {
+        harnessFatal("Couldn't open scenario '%s'", file);
+    }
+    scenario->steps = HARNESS_DEFAULT_STEPS;
+    scenario->stepSize = HARNESS_DEFAULT_STEP_SIZE;
+
+    while (fgets(buf, sizeof(buf), fp) != NULL) {
+        const char *p = buf;
+        char *nl = strchr(buf, '\n');
+
+        line++;
+        snprintf(context, sizeof(context), "%s:%d", file, line);
+        if (nl != NULL) {
+            *nl = '\0';
+        }
+        p = skipSpace(p);
+        if (*p == '\0' || *p == '#') {
+            continue;
+        }
+        if (matchWord(&p, "param")) {
+            long index = parseInteger(&p, context);
+
+            harnessSetParam(S, (int_T)index, harnessParseValue(&p, context));
+        } else if (matchWord(&p, "input")) {
+            parseInput(scenario, 0, &p, context);
+        } else if (matchWord(&p, "at")) {
+            long step = parseInteger(&p, context);
+
+            if (!matchWord(&p, "input")) {
+                harnessFatal("%s: expected 'input'", context);
+            }
+            parseInput(scenario, step, &p, context);
+        } else if (matchWord(&p, "steps")) {
+            scenario->steps = parseInteger(&p, context);
+        } else if (matchWord(&p, "warmup")) {
+            scenario->warmup = parseInteger(&p, context);
+        } else if (matchWord(&p, "step_size")) {
+            char *end;
+
+            scenario->stepSize = strtod(skipSpace(p), &end);
+            if (end == skipSpace(p) || scenario->stepSize <= 0.0) {
+                harnessFatal("%s: invalid step size", context);
+            }
+            p = end;
+        } else if (matchWord(&p, "restart")) {
+            scenario->restarts = (long *)realloc(scenario->restarts, (scenario->restartCount + 1) * sizeof(long));
+            scenario->restarts[scenario->restartCount++] = parseInteger(&p, context);
+        } else if (matchWord(&p, "print")) {
+            scenario->prints = (int_T *)realloc(scenario->prints, (scenario->printCount + 1) * sizeof(int_T));
+            scenario->prints[scenario->printCount++] = (int_T)parseInteger(&p, context);
+        } else {
+            harnessFatal("%s: unknown statement '%s'", context, p);
+        }
+        p = skipSpace(p);
+        if (*p != '\0' && *p != '#') {
+            harnessFatal("%s: unexpected '%s'", context, p);
+        }
+    }
+    fclose(fp);
+}
+
+/*
+    Report
+*/
+static void reportCall(const char *method, const harness_sample_t *sample)
+{
+    printf("  %-20s %10.3f us %8lu allocs %10lu bytes\n", method, sample->ns * 1e-3, sample->allocs, sample->bytes);
+}
+
+static void reportOutputs(const harness_sample_t *samples, long count)
+{
+    int64_t *ns;
+    double allocs = 0.0, bytes = 0.0;
+    unsigned long maxAllocs = 0;
+    long i;
+
+    if (count <= 0) {
+        printf("  %-20s no calls measured\n", "mdlOutputs");
+        return;
+    }
+    ns = (int64_t *)calloc(count, sizeof(int64_t));
+    for (i = 0; i < count; i++) {
+        ns[i] = samples[i].ns;
+        allocs += samples[i].allocs;
+        bytes += samples[i].bytes;
+        if (samples[i].allocs > maxAllocs) {
+            maxAllocs = samples[i].allocs;
+        }
+    }
+    harnessReportDurations("mdlOutputs", ns, count);
+    printf("  %-20s allocs/call %.2f (max %lu), bytes/call %.1f\n", "", allocs / count, maxAllocs, bytes / count);
+    free(ns);
+}
+
+static void writeTimings(const char *file, const harness_sample_t *samples, long count)
+{
+    FILE *fp = fopen(file, "w");
+    long i;
+
+    if (fp == NULL) {
+        harnessFatal("Couldn't open '%s'", file);
+    }
+    fprintf(fp, "step,ns,allocs,bytes\n");
+    for (i = 0; i < count; i++) {
+        fprintf(fp, "%ld,%lld,%lu,%lu\n", i, (long long)samples[i].ns, samples[i].allocs, samples[i].bytes);
+    }
+    fclose(fp);
+}
+
+int main(int argc, char **argv)
+{
+    const harness_sfunction_t *sfun = &HARNESS_SFUNCTION_SYMBOL(HARNESS_SFUNCTION);
+    SimStruct *S = harnessCreateBlock(sfun, NULL);
+    harness_scenario_t scenario;
+    harness_sample_t sizes, start, terminate, *samples;
+    const char *scenarioFile = NULL, *timingsFile = NULL;
+    long steps = -1, step;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            steps = atol(argv[++i]);
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            timingsFile = argv[++i];
+        } else if (scenarioFile == NULL) {
+            scenarioFile = argv[i];
+        } else {
+            scenarioFile = NULL;
+            break;
+        }
+    }
+    if (scenarioFile == NULL) {
+        fprintf(stderr, "Usage: %s <scenario> [-n steps] [-o timings.csv]\n", argv[0]);
+        return 2;
+    }
+
+    memset(&scenario, 0, sizeof(scenario));
+    loadScenario(S, &scenario, scenarioFile);
+    if (steps >= 0) {
+        scenario.steps = steps;
+    }
+    if (scenario.warmup > scenario.steps) {
+        scenario.warmup = scenario.steps;
+    }
+
+    harnessBeginSample(&sizes);
+    harnessInitializeBlock(S);
+    harnessEndSample(&sizes);
+
+    samples = (harness_sample_t *)calloc(scenario.steps > 0 ? scenario.steps : 1, sizeof(harness_sample_t));
+    harnessBeginSample(&start);
+    harnessStartBlock(S);
+    harnessEndSample(&start);
+
+    for (step = 0; step < scenario.steps && !harnessGetStopRequested(S); step++) {
+        for (i = 0; i < scenario.restartCount; i++) {
+            if (scenario.restarts[i] == step) {
+                harnessRestartBlock(S);
+            }
+        }
+        for (i = 0; i < scenario.inputCount; i++) {
+            if (scenario.inputs[i].step == step) {
+                harnessSetInput(S, scenario.inputs[i].port, scenario.inputs[i].value);
+            }
+        }
+        harnessBeginSample(&samples[step]);
+        harnessBlockOutputs(S, harnessGetOffsetTime(S) + step * scenario.stepSize);
+        harnessEndSample(&samples[step]);
+    }
+
+    harnessBeginSample(&terminate);
+    harnessTerminateBlock(S);
+    harnessEndSample(&terminate);
+
+    for (i = 0; i < scenario.printCount; i++) {
+        harnessPrintOutput(S, scenario.prints[i]);
+    }
+    printf("%s: %ld steps (%ld warmup), step size %g s\n", sfun->name, step, scenario.warmup, scenario.stepSize);
+    reportCall("mdlInitializeSizes", &sizes);
+    if (sfun->start != NULL) {
+        reportCall("mdlStart", &start);
+    }
+    reportOutputs(samples + scenario.warmup, step - scenario.warmup);
+    reportCall("mdlTerminate", &terminate);
+    if (harnessGetCallSystemCount(S) > 0) {
+        printf("  %-20s %ld\n", "function calls", harnessGetCallSystemCount(S));
+    }
+    if (harnessGetStopRequested(S)) {
+        printf("  %-20s at step %ld\n", "stop requested", step - 1);
+    }
+    if (timingsFile != NULL) {
+        writeTimings(timingsFile, samples, step);
+    }
+    return 0;
+}
@@ -0,0 +1,650 @@
+/*
+    Lock-step throughput benchmark. Runs the clock sync block with a
+    function-call subsystem of consumer -> JSON decoder -> JSON encoder ->
+    producer blocks, like the co-simulation models, against librdkafka's
+    in-process mock cluster. A stand-in AeroSim orchestrator thread
+    publishes the start command, then a vehicle state message and a clock
+    tick per step, and times each tick until the clock sync block's
+    step-complete acknowledgement.
+
+    Each rate runs on a fresh mock cluster. Rate 0 runs closed-loop: the
+    next tick is published as soon as the previous one is acknowledged,
+    which measures the lock-step limit. A positive rate publishes the ticks
+    open-loop; the rate is sustained if every tick is acknowledged and the
+    acknowledgements keep up with it.
+
+    Usage: lockstep_bench [options]
+        -r <rates>       comma-separated tick rates in Hz, 0 for closed-loop (default 0)
+        -n <ticks>       measured ticks per rate (default 2000)
+        -w <ticks>       leading ticks left out of the statistics (default 100)
+        -m <count>       mock cluster brokers (default 1)
+        -B <brokers>     use these brokers instead of a mock cluster, e.g. shm://<namespace>;
+                         only one rate, and the topics must be empty
+        -c <key=value>   client config of all blocks and orchestrator clients, repeatable
+        -t <seconds>     clock tick and acknowledgement timeout (default 5)
+*/
+#define _GNU_SOURCE /* RUSAGE_THREAD */
+
+#include "harness.h"
+#include "aerosim_transport.h"
+#include "rdkafka_mock.h"
+
+#include <pthread.h>
+#include <sys/resource.h>
+
+extern const harness_sfunction_t HARNESS_SFUNCTION_SYMBOL(sl_aerosim_clock_sync);
+extern const harness_sfunction_t HARNESS_SFUNCTION_SYMBOL(sl_aerosim_kafka_consumer);
+extern const harness_sfunction_t HARNESS_SFUNCTION_SYMBOL(sl_aerosim_kafka_producer);
+extern const harness_sfunction_t HARNESS_SFUNCTION_SYMBOL(sf_aerosim_json_parser);
+
+/* Topics of the clock sync block */
+#define CLOCK_TOPIC "aerosim.clock"
+#define ORCHESTRATOR_TOPIC "aerosim.orchestrator.commands"
+
+/* Topics of the benchmark model */
+#define STATE_TOPIC "aerosim.bench.state"
+#define OUTPUT_TOPIC "aerosim.bench.output"
+#define ACK_TOPIC "aerosim.bench.ack"
+
+#define BENCH_MSG_LEN 1024
+#define BENCH_KEY_LEN 64
+#define BENCH_STEP_SIZE 0.01
+#define BENCH_MAX_RATES 32
+#define BENCH_MAX_CONF 64
+
+/* Vehicle state fields decoded from the state message and encoded into the output message */
+static const char *state_fields[] = {
+    "vehicle_state.position.x", "vehicle_state.position.y", "vehicle_state.position.z",
+    "vehicle_state.velocity.x", "vehicle_state.velocity.y", "vehicle_state.velocity.z"
+};
+#define STATE_FIELD_COUNT ((int)(sizeof(state_fields) / sizeof(state_fields[0])))
+
+/* Resend interval of the handshake tick until the first acknowledgement */
+#define HANDSHAKE_RESEND_NS 20000000
+
+typedef struct {
+    const char *brokers; /* NULL for a mock cluster */
+    int mockBrokers;
+    long ticks;
+    long warmup;
+    double timeout;
+    const char *conf[BENCH_MAX_CONF]; /* key, value pairs */
+    int confCount;
+} bench_options_t;
+
+typedef struct {
+    const bench_options_t *options;
+    const char *brokers;
+    double rate;
+    aerosim_writer_t *commands;
+    aerosim_writer_t *clock;
+    aerosim_writer_t *state;
+    aerosim_reader_t *acks;
+    int64_t *sent_ns;    /* per tick, the handshake tick is 0 */
+    int64_t *latency_ns; /* per tick, -1 until acknowledged */
+    long acked;
+    int64_t first_sent_ns;
+    int64_t last_ack_ns;
+    struct rusage usage; /* orchestrator thread */
+    int failed;
+} bench_run_t;
+
+/* The function-call subsystem of the clock sync block */
+typedef struct {
+    SimStruct *consumer;
+    SimStruct *decoder;
+    SimStruct *encoder;
+    SimStruct *producer;
+    int64_t *ns;
+    long count;
+    long capacity;
+} bench_subsystem_t;
+
+/*
+    Stand-in orchestrator
+*/
+static void publish(aerosim_writer_t *writer, const char *payload)
+{
+    if (aerosimWriteMessage(writer, "orchestrator", 12, payload, (int)strlen(payload), -1)) {
+        fprintf(stderr, "%% Failed publishing '%.40s...'\n", payload);
+    }
+}
+
+static void publishCommand(bench_run_t *run, const char *command)
+{
+    char msg[512];
+
+    snprintf(msg, sizeof(msg),
+             "{\"metadata\":{\"topic\":\"" ORCHESTRATOR_TOPIC "\",\"type_name\":\"aerosim::types::JsonData\","
+             "\"timestamp_sim\":{\"sec\":0,\"nanosec\":0}},\"data\":{\"data\":\"{\\\"command\\\":\\\"%s\\\"}\"}}",
+             command);
+    publish(run->commands, msg);
+}
+
+/* Publish the vehicle state, then the clock tick of the step; a resent tick reuses the state */
+static void publishTick(bench_run_t *run, long tick)
+{
+    int64_t sim_ns = (int64_t)(tick * BENCH_STEP_SIZE * 1e9 + 0.5);
+    int64_t wall_ms = aerosimWallClockMs();
+    char msg[1024];
+
+    snprintf(msg, sizeof(msg),
+             "{\"metadata\":{\"topic\":\"" STATE_TOPIC "\",\"type_name\":\"aerosim::types::VehicleState\","
+             "\"timestamp_sim\":{\"sec\":%lld,\"nanosec\":%lld},\"timestamp_platform\":{\"sec\":%lld,\"nanosec\":%lld}},"
+             "\"data\":{\"position\":{\"x\":%.3f,\"y\":-2.25,\"z\":100.0},\"velocity\":{\"x\":10.0,\"y\":0.0,\"z\":-0.5}}}",
+             (long long)(sim_ns / 1000000000), (long long)(sim_ns % 1000000000),
+             (long long)(wall_ms / 1000), (long long)(wall_ms % 1000) * 1000000, tick * 0.1);
+    if (run->sent_ns[tick] == 0) {
+        publish(run->state, msg);
+    }
+
+    snprintf(msg, sizeof(msg),
+             "{\"metadata\":{\"topic\":\"" CLOCK_TOPIC "\",\"type_name\":\"aerosim::types::TimeStamp\","
+             "\"timestamp_sim\":{\"sec\":%lld,\"nanosec\":%lld},\"timestamp_platform\":{\"sec\":%lld,\"nanosec\":%lld}},"
+             "\"data\":{\"sec\":%lld,\"nanosec\":%lld},\"step\":%ld}",
+             (long long)(sim_ns / 1000000000), (long long)(sim_ns % 1000000000),
+             (long long)(wall_ms / 1000), (long long)(wall_ms % 1000) * 1000000,
+             (long long)(sim_ns / 1000000000), (long long)(sim_ns % 1000000000), tick);
+    run->sent_ns[tick] = aerosimMonotonicNs();
+    publish(run->clock, msg);
+}
+
+/*
+    Match the step-complete acknowledgements to the ticks. The first block
+    step runs on the handshake tick 0, so the step index is the tick + 1.
+*/
+static void drainAcks(bench_run_t *run)
+{
+    aerosim_message_t message;
+
+    while (aerosimReadMessage(run->acks, &message)) {
+        int64_t now_ns = aerosimMonotonicNs();
+        const char *step = NULL;
+        long tick;
+
+        if (message.len < BENCH_MSG_LEN) {
+            char payload[BENCH_MSG_LEN];
+            memcpy(payload, message.payload, message.len);
+            payload[message.len] = '\0';
+            step = strstr(payload, "\"step\":");
+            tick = (step != NULL) ? strtol(step + 7, NULL, 10) - 1 : -1;
+        } else {
+            tick = -1;
+        }
+        aerosimReleaseMessage(run->acks, &message);
+
+        if (tick >= 0 && tick <= run->options->ticks && run->latency_ns[tick] < 0) {
+            run->latency_ns[tick] = now_ns - run->sent_ns[tick];
+            run->acked++;
+            run->last_ack_ns = now_ns;
+        }
+    }
+}
+
+/* Wait for acknowledgements until the monotonic deadline or until the tick is acknowledged */
+static int waitAcks(bench_run_t *run, int64_t deadline_ns, long tick)
+{
+    while (tick < 0 || run->latency_ns[tick] < 0) {
+        drainAcks(run);
+        if (tick >= 0 && run->latency_ns[tick] >= 0) {
+            break;
+        }
+        if (aerosimMonotonicNs() >= deadline_ns) {
+            return 0;
+        }
+        aerosimWaitReaders(&run->acks, 1, deadline_ns, NULL);
+    }
+    return 1;
+}
+
+static void *runOrchestrator(void *arg)
+{
+    bench_run_t *run = (bench_run_t *)arg;
+    const int64_t timeout_ns = (int64_t)(run->options->timeout * 1e9);
+    const long ticks = run->options->ticks;
+    int64_t deadline_ns;
+    long tick;
+
+    publishCommand(run, "start");
+
+    /* Handshake: repeat tick 0 until the block acknowledges it (the block drops the duplicates) */
+    deadline_ns = aerosimMonotonicNs() + timeout_ns;
+    do {
+        publishTick(run, 0);
+    } while (!waitAcks(run, aerosimMonotonicNs() + HANDSHAKE_RESEND_NS, 0) && aerosimMonotonicNs() < deadline_ns);
+    if (run->latency_ns[0] < 0) {
+        fprintf(stderr, "%% The clock sync block didn't acknowledge the handshake tick\n");
+        run->failed = 1;
+    }
+
+    run->first_sent_ns = aerosimMonotonicNs();
+    for (tick = 1; tick <= ticks && !run->failed; tick++) {
+        if (run->rate > 0) {
+            /* Publish on schedule, collecting acknowledgements meanwhile */
+            waitAcks(run, run->first_sent_ns + (int64_t)((tick - 1) / run->rate * 1e9), -1);
+            publishTick(run, tick);
+        } else {
+            publishTick(run, tick);
+            if (!waitAcks(run, aerosimMonotonicNs() + timeout_ns, tick)) {
+                fprintf(stderr, "%% Tick %ld wasn't acknowledged\n", tick);
+                run->failed = 1;
+            }
+        }
+    }
+    waitAcks(run, aerosimMonotonicNs() + timeout_ns, ticks);
+
+    publishCommand(run, "stop");
+    getrusage(RUSAGE_THREAD, &run->usage);
+    return NULL;
+}
+
+/*
+    Benchmark model
+*/
+static int runSubsystem(void *context, SimStruct *S, int_T element)
+{
+    bench_subsystem_t *subsystem = (bench_subsystem_t *)context;
+    time_T t = ssGetT(S);
+    harness_sample_t sample;
+
+    harnessBeginSample(&sample);
+    harnessBlockOutputs(subsystem->consumer, t);
+    harnessBlockOutputs(subsystem->decoder, t);
+    harnessBlockOutputs(subsystem->encoder, t);
+    harnessBlockOutputs(subsystem->producer, t);
+    harnessEndSample(&sample);
+
+    if (subsystem->count < subsystem->capacity) {
+        subsystem->ns[subsystem->count++] = sample.ns;
+    }
+    return 1;
+}
+
+/* The block client config: the options, then the benchmark's -c options */
+static mxArray *createConf(const bench_options_t *options, const char **pairs, int pairCount)
+{
+    mxArray *conf = harnessCreateCell(pairCount * 2 + options->confCount);
+    int i;
+
+    for (i = 0; i < pairCount * 2; i++) {
+        harnessSetCell(conf, i, harnessCreateString(pairs[i]));
+    }
+    for (i = 0; i < options->confCount; i++) {
+        harnessSetCell(conf, pairCount * 2 + i, harnessCreateString(options->conf[i]));
+    }
+    return conf;
+}
+
+static mxArray *createFieldList(int types)
+{
+    mxArray *list = harnessCreateCell(STATE_FIELD_COUNT);
+    int i;
+
+    for (i = 0; i < STATE_FIELD_COUNT; i++) {
+        harnessSetCell(list, i, harnessCreateString(types ? "double" : state_fields[i]));
+    }
+    return list;
+}
+
+static mxArray *number(double value)
+{
+    return harnessCreateDoubles(&value, 1);
+}
+
+static SimStruct *createJsonBlock(const char *name, int direction)
+{
+    SimStruct *S = harnessCreateBlock(&HARNESS_SFUNCTION_SYMBOL(sf_aerosim_json_parser), name);
+
+    harnessSetParam(S, 0, number(direction)); /* 1 decode, 2 encode */
+    harnessSetParam(S, 1, number(BENCH_MSG_LEN));
+    harnessSetParam(S, 2, number(0));
+    harnessSetParam(S, 3, number(0));
+    harnessSetParam(S, 4, createFieldList(0));
+    harnessSetParam(S, 5, createFieldList(1));
+    harnessSetParam(S, 6, harnessCreateString(""));
+    return S;
+}
+
+static void createModel(const bench_options_t *options, const char *brokers, SimStruct **pclock,
+                        bench_subsystem_t *subsystem)
+{
+    static const char *clock_conf[] = {
+        "aerosim.ack.topic", ACK_TOPIC,
+        "aerosim.clock.decode", "1"
+    };
+    const double sample_time[2] = { BENCH_STEP_SIZE, 0.0 };
+    const double inherited[2] = { INHERITED_SAMPLE_TIME, 0.0 };
+    SimStruct *clock = harnessCreateBlock(&HARNESS_SFUNCTION_SYMBOL(sl_aerosim_clock_sync), "clock_sync");
+    SimStruct *consumer = harnessCreateBlock(&HARNESS_SFUNCTION_SYMBOL(sl_aerosim_kafka_consumer), "consumer");
+    SimStruct *producer = harnessCreateBlock(&HARNESS_SFUNCTION_SYMBOL(sl_aerosim_kafka_producer), "producer");
+    SimStruct *decoder = createJsonBlock("decoder", 1);
+    SimStruct *encoder = createJsonBlock("encoder", 2);
+    int i;
+
+    harnessSetParam(clock, 0, harnessCreateString(brokers));
+    harnessSetParam(clock, 1, number(options->timeout));
+    harnessSetParam(clock, 2, number(options->timeout));
+    harnessSetParam(clock, 3, number(BENCH_MSG_LEN));
+    harnessSetParam(clock, 4, number(BENCH_KEY_LEN));
+    harnessSetParam(clock, 5, number(0));
+    harnessSetParam(clock, 6, createConf(options, clock_conf, 2));
+    harnessSetParam(clock, 7, harnessCreateCell(0));
+    harnessSetParam(clock, 8, harnessCreateString(""));
+    harnessSetParam(clock, 9, harnessCreateDoubles(sample_time, 2));
+
+    harnessSetParam(consumer, 0, harnessCreateString(brokers));
+    harnessSetParam(consumer, 1, harnessCreateString(STATE_TOPIC));
+    harnessSetParam(consumer, 2, harnessCreateString("aerosim.bench"));
+    harnessSetParam(consumer, 3, number(BENCH_MSG_LEN));
+    harnessSetParam(consumer, 4, number(BENCH_KEY_LEN));
+    harnessSetParam(consumer, 5, number(0));
+    harnessSetParam(consumer, 6, createConf(options, NULL, 0));
+    harnessSetParam(consumer, 7, harnessCreateCell(0));
+    harnessSetParam(consumer, 8, harnessCreateString(""));
+    harnessSetParam(consumer, 9, harnessCreateDoubles(inherited, 2));
+
+    harnessSetParam(producer, 0, harnessCreateString(brokers));
+    harnessSetParam(producer, 1, harnessCreateString(OUTPUT_TOPIC));
+    harnessSetParam(producer, 2, number(0));
+    harnessSetParam(producer, 3, number(0));
+    harnessSetParam(producer, 4, harnessCreateString("bench"));
+    harnessSetParam(producer, 5, number(BENCH_MSG_LEN));
+    harnessSetParam(producer, 6, number(0));
+    harnessSetParam(producer, 7, createConf(options, NULL, 0));
+    harnessSetParam(producer, 8, harnessCreateCell(0));
+    harnessSetParam(producer, 9, harnessCreateString(""));
+    harnessSetParam(producer, 10, harnessCreateDoubles(inherited, 2));
+
+    harnessInitializeBlock(clock);
+    harnessInitializeBlock(consumer);
+    harnessInitializeBlock(decoder);
+    harnessInitializeBlock(encoder);
+    harnessInitializeBlock(producer);
+
+    /* consumer message -> decoder -> encoder fields -> encoder message -> producer */
+    harnessConnect(decoder, 0, consumer, 1);
+    for (i = 0; i < STATE_FIELD_COUNT; i++) {
+        harnessConnect(encoder, i, decoder, i);
+    }
+    harnessConnect(producer, 0, encoder, 0);
+
+    subsystem->consumer = consumer;
+    subsystem->decoder = decoder;
+    subsystem->encoder = encoder;
+    subsystem->producer = producer;
+    harnessSetCallSystem(clock, runSubsystem, subsystem);
+    *pclock = clock;
+}
+
+/*
+    Runs
+*/
+static void openOrchestrator(bench_run_t *run)
+{
+    const char *conf[BENCH_MAX_CONF + 2];
+    const char *topic = ACK_TOPIC;
+    int confCount = 0, i, res;
+
+    conf[confCount++] = "linger.ms";
+    conf[confCount++] = "0";
+    for (i = 0; i < run->options->confCount; i++) {
+        conf[confCount++] = run->options->conf[i];
+    }
+
+    res = aerosimOpenWriter(&run->commands, run->brokers, ORCHESTRATOR_TOPIC, confCount, 0, conf);
+    res = res || aerosimOpenWriter(&run->clock, run->brokers, CLOCK_TOPIC, confCount, 0, conf);
+    res = res || aerosimOpenWriter(&run->state, run->brokers, STATE_TOPIC, confCount, 0, conf);
+    res = res || aerosimOpenReader(&run->acks, run->brokers, "aerosim.bench.orchestrator", &topic, 1,
+                                   confCount, 0, conf, RD_KAFKA_OFFSET_BEGINNING);
+    if (res) {
+        harnessFatal("Couldn't open the orchestrator clients on '%s'", run->brokers);
+    }
+}
+
+static void closeOrchestrator(bench_run_t *run)
+{
+    aerosimCloseReader(run->acks);
+    aerosimCloseWriter(run->state);
+    aerosimCloseWriter(run->clock);
+    aerosimCloseWriter(run->commands);
+}
+
+static double cpuSeconds(const struct rusage *usage)
+{
+    return usage->ru_utime.tv_sec + usage->ru_utime.tv_usec * 1e-6 + usage->ru_stime.tv_sec
+           + usage->ru_stime.tv_usec * 1e-6;
+}
+
+/* Run one rate, returns 1 if the rate was sustained */
+static int runRate(const bench_options_t *options, const char *brokers, double rate, double *achieved)
+{
+    bench_run_t run;
+    bench_subsystem_t subsystem;
+    SimStruct *clock = NULL;
+    struct rusage self_start, self_end, thread_start, thread_end;
+    pthread_t orchestrator;
+    int64_t start_ns, wall_ns, *latencies;
+    long step, tick, count = 0;
+    double span_s;
+    int sustained;
+
+    memset(&run, 0, sizeof(run));
+    memset(&subsystem, 0, sizeof(subsystem));
+    run.options = options;
+    run.brokers = brokers;
+    run.rate = rate;
+    run.sent_ns = (int64_t *)calloc(options->ticks + 1, sizeof(int64_t));
+    run.latency_ns = (int64_t *)malloc((options->ticks + 1) * sizeof(int64_t));
+    for (tick = 0; tick <= options->ticks; tick++) {
+        run.latency_ns[tick] = -1;
+    }
+    subsystem.capacity = options->ticks + 16;
+    subsystem.ns = (int64_t *)calloc(subsystem.capacity, sizeof(int64_t));
+
+    openOrchestrator(&run);
+    createModel(options, brokers, &clock, &subsystem);
+    harnessStartBlock(clock);
+    harnessStartBlock(subsystem.consumer);
+    harnessStartBlock(subsystem.decoder);
+    harnessStartBlock(subsystem.encoder);
+    harnessStartBlock(subsystem.producer);
+
+    getrusage(RUSAGE_SELF, &self_start);
+    getrusage(RUSAGE_THREAD, &thread_start);
+    start_ns = aerosimMonotonicNs();
+    if (pthread_create(&orchestrator, NULL, runOrchestrator, &run) != 0) {
+        harnessFatal("Couldn't start the orchestrator thread");
+    }
+
+    /* The model loop: the clock sync block waits for each tick and runs the subsystem */
+    for (step = 0; !harnessGetStopRequested(clock); step++) {
+        harnessBlockOutputs(clock, harnessGetOffsetTime(clock) + step * BENCH_STEP_SIZE);
+    }
+
+    pthread_join(orchestrator, NULL);
+    wall_ns = aerosimMonotonicNs() - start_ns;
+    getrusage(RUSAGE_THREAD, &thread_end);
+    getrusage(RUSAGE_SELF, &self_end);
+
+    harnessTerminateBlock(subsystem.producer);
+    harnessTerminateBlock(subsystem.encoder);
+    harnessTerminateBlock(subsystem.decoder);
+    harnessTerminateBlock(subsystem.consumer);
+    harnessTerminateBlock(clock);
+    closeOrchestrator(&run);
+
+    /* Measured ticks after the warmup, the handshake tick excluded */
+    latencies = (int64_t *)calloc(options->ticks + 1, sizeof(int64_t));
+    for (tick = 1 + options->warmup; tick <= options->ticks; tick++) {
+        if (run.latency_ns[tick] >= 0) {
+            latencies[count++] = run.latency_ns[tick];
+        }
+    }
+    span_s = (run.last_ack_ns - run.first_sent_ns) * 1e-9;
+    *achieved = (run.acked > 1 && span_s > 0) ? (run.acked - 1) / span_s : 0.0;
+    sustained = !run.failed && run.acked == options->ticks + 1 && (rate <= 0 || *achieved >= 0.95 * rate);
+
+    if (rate > 0) {
+        printf("rate %g Hz: ", rate);
+    } else {
+        printf("closed-loop: ");
+    }
+    printf("%ld/%ld ticks acknowledged in %.3f s, %.1f ticks/s, %s\n", run.acked > 0 ? run.acked - 1 : 0,
+           options->ticks, span_s, *achieved, sustained ? "sustained" : "not sustained");
+    harnessReportDurations("tick latency", latencies, count);
+    if (subsystem.count > 1 + options->warmup) {
+        harnessReportDurations("subsystem", subsystem.ns + 1 + options->warmup, subsystem.count - 1 - options->warmup);
+    }
+    printf("  %-20s block thread %.1f %%, orchestrator thread %.1f %%, process %.1f %% "
+           "(incl. client and mock broker threads)\n", "cpu",
+           (cpuSeconds(&thread_end) - cpuSeconds(&thread_start)) / (wall_ns * 1e-9) * 100.0,
+           cpuSeconds(&run.usage) / (wall_ns * 1e-9) * 100.0,
+           (cpuSeconds(&self_end) - cpuSeconds(&self_start)) / (wall_ns * 1e-9) * 100.0);
+
+    free(latencies);
+    free(subsystem.ns);
+    free(run.latency_ns);
+    free(run.sent_ns);
+    return sustained;
+}
+
+/* Start a mock cluster with the benchmark topics, hosted by the client *prk */
+static rd_kafka_mock_cluster_t *startMockCluster(int brokerCount, rd_kafka_t **prk)
+{
+    static const char *topics[] = { CLOCK_TOPIC, ORCHESTRATOR_TOPIC, STATE_TOPIC, OUTPUT_TOPIC, ACK_TOPIC };
+    char errstr[512];
+    rd_kafka_t *rk = rd_kafka_new(RD_KAFKA_PRODUCER, rd_kafka_conf_new(), errstr, sizeof(errstr));
+    rd_kafka_mock_cluster_t *mcluster;
+    size_t i;
+
+    if (rk == NULL) {
+        harnessFatal("Couldn't create the mock cluster client: %s", errstr);
+    }
+    mcluster = rd_kafka_mock_cluster_new(rk, brokerCount);
+    if (mcluster == NULL) {
+        harnessFatal("Couldn't create the mock cluster");
+    }
+    for (i = 0; i < sizeof(topics) / sizeof(topics[0]); i++) {
+        rd_kafka_mock_topic_create(mcluster, topics[i], 1, 1);
+    }
+    *prk = rk;
+    return mcluster;
+}
+
+static void stopMockCluster(rd_kafka_mock_cluster_t *mcluster, rd_kafka_t *rk)
+{
+    rd_kafka_mock_cluster_destroy(mcluster);
+    rd_kafka_destroy(rk);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-r rates] [-n ticks] [-w ticks] [-m brokers] [-B brokers] "
+                    "[-c key=value]... [-t seconds]\n", name);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    bench_options_t options;
+    double rates[BENCH_MAX_RATES] = { 0.0 };
+    double achieved, best = -1.0, closed_loop = -1.0;
+    int rateCount = 1, i;
+
+    memset(&options, 0, sizeof(options));
+    options.mockBrokers = 1;
+    options.ticks = 2000;
+    options.warmup = 100;
+    options.timeout = 5.0;
+
+    for (i = 1; i < argc; i++) {
+        const char *arg = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if (arg == NULL || argv[i][0] != '-' || argv[i][1] == '\0' || argv[i][2] != '\0') {
+            usage(argv[0]);
+        }
+        switch (argv[i][1]) {
+        case 'r': {
+            char *end;
+            const char *p = arg;
+
+            for (rateCount = 0; rateCount < BENCH_MAX_RATES && *p != '\0'; rateCount++) {
+                rates[rateCount] = strtod(p, &end);
+                if (end == p || rates[rateCount] < 0) {
+                    usage(argv[0]);
+                }
+                p = (*end == ',') ? end + 1 : end;
+            }
+            break;
+        }
+        case 'n':
+            options.ticks = atol(arg);
+            break;
+        case 'w':
+            options.warmup = atol(arg);
+            break;
+        case 'm':
+            options.mockBrokers = atoi(arg);
+            break;
+        case 'B':
+            options.brokers = arg;
+            break;
+        case 't':
+            options.timeout = atof(arg);
+            break;
+        case 'c': {
+            char *pair = strdup(arg), *eq = strchr(pair, '=');
+
+            if (eq == NULL || options.confCount + 2 > BENCH_MAX_CONF) {
+                usage(argv[0]);
+            }
+            *eq = '\0';
+            options.conf[options.confCount++] = pair;
+            options.conf[options.confCount++] = eq + 1;
+            break;
+        }
+        default:
+            usage(argv[0]);
+        }
+        i++;
+    }
+    if (options.ticks < 1 || options.warmup < 0 || options.warmup >= options.ticks || options.mockBrokers < 1) {
+        usage(argv[0]);
+    }
+    if (options.brokers != NULL && rateCount > 1) {
+        harnessFatal("-B runs one rate only, the runs would share the topics");
+    }
+
+    printf("lock-step benchmark: %ld ticks (%ld warmup) per rate, step size %g s, %s\n", options.ticks,
+           options.warmup, BENCH_STEP_SIZE, options.brokers != NULL ? options.brokers : "mock cluster");
+    fflush(stdout);
+    for (i = 0; i < rateCount; i++) {
+        const char *brokers = options.brokers;
+        rd_kafka_mock_cluster_t *mcluster = NULL;
+        rd_kafka_t *rk = NULL;
+        int sustained;
+
+        if (brokers == NULL) {
+            mcluster = startMockCluster(options.mockBrokers, &rk);
+            brokers = rd_kafka_mock_cluster_bootstraps(mcluster);
+        }
+        sustained = runRate(&options, brokers, rates[i], &achieved);
+        if (mcluster != NULL) {
+            stopMockCluster(mcluster, rk);
+        }
+
+        if (rates[i] <= 0) {
+            closed_loop = achieved;
+        } else if (sustained && rates[i] > best) {
+            best = rates[i];
+        }
+    }
+
+    if (best >= 0) {
+        printf("max sustainable tick rate: %g Hz\n", best);
+    }
+    if (closed_loop >= 0) {
+        printf("closed-loop lock-step rate: %.1f ticks/s\n", closed_loop);
+    }
+    return 0;
+}
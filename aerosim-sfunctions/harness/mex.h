@@ -0,0 +1,7 @@
+#ifndef AEROSIM_HARNESS_MEX_H
+#define AEROSIM_HARNESS_MEX_H
+
+/* The mx and mex functions are declared in the harness simstruc.h */
+#include "simstruc.h"
+
+#endif /* AEROSIM_HARNESS_MEX_H */
@@ -0,0 +1,214 @@
+#ifndef AEROSIM_HARNESS_SIMSTRUC_H
+#define AEROSIM_HARNESS_SIMSTRUC_H
+
+/*
+    Stand-in for the Simulink simstruc.h used by the headless harness. It
+    declares the part of the SimStruct, mx and mex API that the AeroSim
+    S-functions use, as functions implemented in harness.c instead of the
+    Simulink macros.
+*/
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef int8_t int8_T;
+typedef uint8_t uint8_T;
+typedef int16_t int16_T;
+typedef uint16_t uint16_T;
+typedef int32_t int32_T;
+typedef uint32_t uint32_T;
+typedef int64_t int64_T;
+typedef uint64_t uint64_T;
+typedef int int_T;
+typedef unsigned int uint_T;
+typedef double real_T;
+typedef float real32_T;
+typedef unsigned char boolean_T;
+typedef double time_T;
+typedef char char_T;
+typedef int DTypeId;
+typedef size_t mwSize;
+typedef size_t mwIndex;
+
+typedef struct mxArray_tag mxArray;
+typedef struct SimStruct_tag SimStruct;
+
+typedef enum {
+    mxUNKNOWN_CLASS = 0,
+    mxCELL_CLASS,
+    mxSTRUCT_CLASS,
+    mxLOGICAL_CLASS,
+    mxCHAR_CLASS,
+    mxVOID_CLASS,
+    mxDOUBLE_CLASS,
+    mxSINGLE_CLASS,
+    mxINT8_CLASS,
+    mxUINT8_CLASS,
+    mxINT16_CLASS,
+    mxUINT16_CLASS,
+    mxINT32_CLASS,
+    mxUINT32_CLASS,
+    mxINT64_CLASS,
+    mxUINT64_CLASS
+} mxClassID;
+
+typedef enum {
+    mxREAL = 0,
+    mxCOMPLEX
+} mxComplexity;
+
+typedef enum {
+    SS_DOUBLE = 0,
+    SS_SINGLE,
+    SS_INT8,
+    SS_UINT8,
+    SS_INT16,
+    SS_UINT16,
+    SS_INT32,
+    SS_UINT32,
+    SS_BOOLEAN
+} BuiltInDTypeId;
+
+#define SS_FCN_CALL (-2)
+#define INVALID_DTYPE_ID (-10)
+#define INHERITED_SAMPLE_TIME (-1.0)
+
+#define SS_OPTION_EXCEPTION_FREE_CODE 0x1
+#define SS_OPTION_CALL_TERMINATE_ON_EXIT 0x2
+
+typedef enum {
+    SS_SIMMODE_NORMAL = 0,
+    SS_SIMMODE_SIZES_CALL_ONLY,
+    SS_SIMMODE_RTWGEN,
+    SS_SIMMODE_EXTERNAL
+} SS_SimMode;
+
+typedef enum {
+    USE_DEFAULT_SIM_STATE = 0,
+    DISALLOW_SIM_STATE,
+    USE_CUSTOM_SIM_STATE
+} ssSimStateCompliance;
+
+enum {
+    SSWRITE_VALUE_QSTR = 0,
+    SSWRITE_VALUE_DTYPE_NUM,
+    SSWRITE_VALUE_VECT_STR,
+    SSWRITE_VALUE_NUM
+};
+
+/* Parameters */
+void ssSetNumSFcnParams(SimStruct *S, int_T n);
+int_T ssGetNumSFcnParams(SimStruct *S);
+int_T ssGetSFcnParamsCount(SimStruct *S);
+const mxArray *ssGetSFcnParam(SimStruct *S, int_T index);
+void ssSetSFcnParamNotTunable(SimStruct *S, int_T index);
+
+/* Sizes */
+void ssSetNumContStates(SimStruct *S, int_T n);
+void ssSetNumDiscStates(SimStruct *S, int_T n);
+int_T ssSetNumInputPorts(SimStruct *S, int_T n);
+int_T ssSetNumOutputPorts(SimStruct *S, int_T n);
+int_T ssGetNumInputPorts(SimStruct *S);
+int_T ssGetNumOutputPorts(SimStruct *S);
+void ssSetInputPortWidth(SimStruct *S, int_T port, int_T width);
+void ssSetInputPortDataType(SimStruct *S, int_T port, DTypeId id);
+void ssSetInputPortRequiredContiguous(SimStruct *S, int_T port, int_T value);
+void ssSetInputPortDirectFeedThrough(SimStruct *S, int_T port, int_T value);
+void ssSetInputPortMatrixDimensions(SimStruct *S, int_T port, int_T m, int_T n);
+int_T ssGetInputPortWidth(SimStruct *S, int_T port);
+void ssSetOutputPortWidth(SimStruct *S, int_T port, int_T width);
+void ssSetOutputPortDataType(SimStruct *S, int_T port, DTypeId id);
+void ssSetOutputPortMatrixDimensions(SimStruct *S, int_T port, int_T m, int_T n);
+int_T ssGetOutputPortWidth(SimStruct *S, int_T port);
+void ssSetNumSampleTimes(SimStruct *S, int_T n);
+void ssSetNumRWork(SimStruct *S, int_T n);
+void ssSetNumIWork(SimStruct *S, int_T n);
+void ssSetNumPWork(SimStruct *S, int_T n);
+int_T ssGetNumPWork(SimStruct *S);
+void ssSetNumDWork(SimStruct *S, int_T n);
+void ssSetNumModes(SimStruct *S, int_T n);
+void ssSetNumNonsampledZCs(SimStruct *S, int_T n);
+void ssSetSimStateCompliance(SimStruct *S, int_T compliance);
+void ssSetOptions(SimStruct *S, uint_T options);
+
+/* Data types */
+DTypeId ssRegisterDataTypeInteger(SimStruct *S, int_T isSigned, int_T wordLength, int_T obeyDataTypeOverride);
+DTypeId ssRegisterDataTypeFxpBinaryPoint(SimStruct *S, int_T isSigned, int_T wordLength, int_T fractionLength,
+                                         int_T obeyDataTypeOverride);
+
+/* Sample times */
+void ssSetSampleTime(SimStruct *S, int_T index, time_T period);
+void ssSetOffsetTime(SimStruct *S, int_T index, time_T offset);
+time_T ssGetSampleTime(SimStruct *S, int_T index);
+void ssSetCallSystemOutput(SimStruct *S, int_T element);
+void ssSetModelReferenceSampleTimeDefaultInheritance(SimStruct *S);
+
+/* Simulation */
+int_T ssGetSimMode(SimStruct *S);
+int_T ssIsMajorTimeStep(SimStruct *S);
+int_T ssRTWGenIsCodeGen(SimStruct *S);
+time_T ssGetT(SimStruct *S);
+const char *ssGetPath(SimStruct *S);
+const char *ssGetModelName(SimStruct *S);
+void ssSetErrorStatus(SimStruct *S, const char *msg);
+void ssWarning(SimStruct *S, const char *msg);
+void ssSetStopRequested(SimStruct *S, int_T value);
+int_T ssCallSystemWithTid(SimStruct *S, int_T element, int_T tid);
+int_T ssWriteRTWParamSettings(SimStruct *S, int_T nParams, ...);
+
+/* Work vectors and signals */
+void ssSetPWorkValue(SimStruct *S, int_T index, void *value);
+void *ssGetPWorkValue(SimStruct *S, int_T index);
+void **ssGetPWork(SimStruct *S);
+void ssSetIWorkValue(SimStruct *S, int_T index, int_T value);
+int_T ssGetIWorkValue(SimStruct *S, int_T index);
+void ssSetRWorkValue(SimStruct *S, int_T index, real_T value);
+real_T ssGetRWorkValue(SimStruct *S, int_T index);
+const void *ssGetInputPortSignal(SimStruct *S, int_T port);
+void *ssGetOutputPortSignal(SimStruct *S, int_T port);
+
+/* mx arrays */
+mxClassID mxGetClassID(const mxArray *a);
+size_t mxGetNumberOfElements(const mxArray *a);
+size_t mxGetM(const mxArray *a);
+size_t mxGetN(const mxArray *a);
+double mxGetScalar(const mxArray *a);
+double *mxGetPr(const mxArray *a);
+void *mxGetData(const mxArray *a);
+int mxGetString(const mxArray *a, char *buf, mwSize buflen);
+char *mxArrayToString(const mxArray *a);
+mxArray *mxGetCell(const mxArray *a, mwIndex index);
+bool mxIsChar(const mxArray *a);
+bool mxIsCell(const mxArray *a);
+bool mxIsDouble(const mxArray *a);
+bool mxIsNumeric(const mxArray *a);
+bool mxIsEmpty(const mxArray *a);
+bool mxIsStruct(const mxArray *a);
+mxArray *mxCreateDoubleScalar(double value);
+mxArray *mxCreateString(const char *str);
+mxArray *mxCreateNumericMatrix(mwSize m, mwSize n, mxClassID classID, mxComplexity complexity);
+mxArray *mxCreateStructMatrix(mwSize m, mwSize n, int nfields, const char **fieldnames);
+mxArray *mxGetField(const mxArray *a, mwIndex index, const char *fieldname);
+void mxSetField(mxArray *a, mwIndex index, const char *fieldname, mxArray *value);
+void mxDestroyArray(mxArray *a);
+void *mxMalloc(mwSize n);
+void *mxCalloc(mwSize n, mwSize size);
+void mxFree(void *p);
+
+/* mex */
+int mexPrintf(const char *fmt, ...);
+void mexWarnMsgTxt(const char *msg);
+void mexErrMsgTxt(const char *msg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AEROSIM_HARNESS_SIMSTRUC_H */
@@ -0,0 +1,348 @@
+#include "aerosim_barrier.h"
+#include "aerosim_replay.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BARRIER_MSG_LEN 128
+
+typedef struct {
+    aerosim_barrier_member_t info;
+    int64_t ready_ns; /* monotonic time the member reported its last step */
+    int64_t session;  /* latest session of the member seen */
+} barrier_member_t;
+
+/* Barriers opened by this module, to tell its sessions apart within a millisecond */
+static unsigned barrier_opens = 0;
+
+struct aerosim_barrier_s {
+    aerosim_reader_t *reader;
+    aerosim_writer_t *ready_writer;
+    aerosim_writer_t *members_writer;
+    char *members_topic;
+    int min_participants; /* until the first release */
+    int released;
+    int64_t session;
+    int count;
+    int capacity;
+    barrier_member_t *members; /* members[0] is this participant */
+    int64_t announced_ns;
+};
+
+/*
+    Members
+*/
+static barrier_member_t *findMember(aerosim_barrier_t *barrier, const void *participant, size_t len)
+{
+    int i;
+
+    for (i = 0; i < barrier->count; i++) {
+        const char *name = barrier->members[i].info.participant;
+        if (strlen(name) == len && memcmp(name, participant, len) == 0) {
+            return &barrier->members[i];
+        }
+    }
+    return NULL;
+}
+
+static barrier_member_t *addMember(aerosim_barrier_t *barrier, const void *participant, size_t len)
+{
+    barrier_member_t *member;
+    char *name;
+
+    if (barrier->count == barrier->capacity) {
+        int capacity = (barrier->capacity > 0) ? 2 * barrier->capacity : 8;
+        barrier_member_t *members = (barrier_member_t *)realloc(barrier->members, capacity * sizeof(barrier_member_t));
+        if (members == NULL) {
+            return NULL;
+        }
+        barrier->members = members;
+        barrier->capacity = capacity;
+    }
+    if ((name = (char *)malloc(len + 1)) == NULL) {
+        return NULL;
+    }
+    memcpy(name, participant, len);
+    name[len] = '\0';
+
+    member = &barrier->members[barrier->count++];
+    memset(member, 0, sizeof(*member));
+    member->info.participant = name;
+    member->info.active = 1;
+    return member;
+}
+
+static int countActiveMembers(const aerosim_barrier_t *barrier)
+{
+    int i, active = 0;
+
+    for (i = 0; i < barrier->count; i++) {
+        active += barrier->members[i].info.active;
+    }
+    return active;
+}
+
+static void updateReadyStep(barrier_member_t *member, uint64_t step, int64_t now_ns)
+{
+    if (step > member->info.ready_step) {
+        member->info.ready_step = step;
+        member->ready_ns = now_ns;
+    }
+}
+
+/*
+    Messages
+*/
+static int announce(aerosim_barrier_t *barrier, const char *event)
+{
+    const char *participant = barrier->members[0].info.participant;
+    char payload[BARRIER_MSG_LEN];
+    int len = snprintf(payload, sizeof(payload), "{\"event\":\"%s\",\"step\":%llu,\"session\":%lld}", event,
+                       (unsigned long long)barrier->members[0].info.ready_step, (long long)barrier->session);
+
+    barrier->announced_ns = aerosimMonotonicNs();
+    return aerosimWriteMessage(barrier->members_writer, participant, (int)strlen(participant), payload, len, -1);
+}
+
+static void handleMessage(aerosim_barrier_t *barrier, const aerosim_message_t *message, int64_t now_ns)
+{
+    const char *payload = (const char *)message->payload;
+    const char *end = payload + message->len;
+    const char *event;
+    barrier_member_t *member;
+    int64_t step = 0;
+    int64_t session = 0;
+    int leave = 0;
+    int joined = 0;
+
+    if (message->key_len == 0) {
+        return;
+    }
+    member = findMember(barrier, message->key, message->key_len);
+    if (member == &barrier->members[0]) {
+        /* Our own message */
+        return;
+    }
+    aerosimParseJsonInteger(aerosimFindJsonValue(payload, end, "step"), end, &step);
+    aerosimParseJsonInteger(aerosimFindJsonValue(payload, end, "session"), end, &session);
+
+    if (message->topic != NULL && strcmp(message->topic, barrier->members_topic) == 0) {
+        event = aerosimFindJsonValue(payload, end, "event");
+        leave = (event != NULL && end - event >= 7 && memcmp(event, "\"leave\"", 7) == 0);
+    }
+
+    /* Messages of an earlier session, and those a session sent before it left, arrive late */
+    if (member != NULL && (session < member->session || (session == member->session && !member->info.active))) {
+        return;
+    }
+    if (leave) {
+        if (member != NULL) {
+            member->session = session;
+            if (member->info.active) {
+                fprintf(stderr, "%% Barrier participant '%s' left\n", member->info.participant);
+                member->info.active = 0;
+            }
+        }
+        return;
+    }
+
+    /* A join or a ready step, either of which makes the sender a member */
+    if (member == NULL) {
+        member = addMember(barrier, message->key, message->key_len);
+        if (member == NULL) {
+            fprintf(stderr, "%% Couldn't allocate a barrier member\n");
+            return;
+        }
+        member->session = session;
+        joined = 1;
+    } else if (session > member->session) {
+        /* A new session of the participant, e.g. a restarted process, reports its steps anew */
+        member->session = session;
+        member->info.ready_step = 0;
+        member->info.active = 1;
+        joined = 1;
+    }
+    if (step > 0) {
+        updateReadyStep(member, (uint64_t)step, now_ns);
+    }
+    if (joined) {
+        fprintf(stderr, "%% Barrier participant '%s' joined (%d members)\n", member->info.participant,
+                countActiveMembers(barrier));
+        /* Let the new member know about this one */
+        announce(barrier, "join");
+    }
+}
+
+/*
+    Barrier
+*/
+static int isReleased(const aerosim_barrier_t *barrier, uint64_t step)
+{
+    int i;
+
+    for (i = 0; i < barrier->count; i++) {
+        if (barrier->members[i].info.active && barrier->members[i].info.ready_step < step) {
+            return 0;
+        }
+    }
+    return barrier->released || countActiveMembers(barrier) >= barrier->min_participants;
+}
+
+/* Charge the wait past start_ns to the last member to report the step */
+static void recordStraggler(aerosim_barrier_t *barrier, int64_t start_ns)
+{
+    barrier_member_t *straggler = NULL;
+    int i;
+
+    for (i = 1; i < barrier->count; i++) {
+        barrier_member_t *member = &barrier->members[i];
+        if (member->info.active && member->ready_ns > start_ns
+            && (straggler == NULL || member->ready_ns > straggler->ready_ns)) {
+            straggler = member;
+        }
+    }
+    if (straggler != NULL) {
+        int64_t wait_ns = straggler->ready_ns - start_ns;
+        straggler->info.straggler_count++;
+        straggler->info.straggler_ns_sum += wait_ns;
+        if (wait_ns > straggler->info.straggler_ns_max) {
+            straggler->info.straggler_ns_max = wait_ns;
+        }
+    }
+}
+
+aerosim_barrier_t *aerosimOpenBarrier(const char *brokers, const char *topic,
+    const char *participant, int minParticipants,
+    int confCount, int topicConfCount, const char **confArray)
+{
+    aerosim_barrier_t *barrier = (aerosim_barrier_t *)calloc(1, sizeof(aerosim_barrier_t));
+    const char **barrierConf = (const char **)malloc(sizeof(char *) * (confCount + topicConfCount + 2));
+    const char *topics[2];
+    char *group = NULL;
+    int barrierConfCount = 2;
+    int i, res = 1;
+
+    if (barrier == NULL || barrierConf == NULL) {
+        goto exit_open_barrier;
+    }
+    barrier->min_participants = minParticipants;
+    barrier->session = aerosimWallClockMs() * 1000 + (int64_t)(barrier_opens++ % 1000);
+    barrier->members_topic = (char *)malloc(strlen(topic) + strlen(AEROSIM_BARRIER_MEMBERS_SUFFIX) + 1);
+    group = (char *)malloc(strlen("aerosim.barrier.") + strlen(participant) + 1);
+    if (barrier->members_topic == NULL || group == NULL || addMember(barrier, participant, strlen(participant)) == NULL) {
+        goto exit_open_barrier;
+    }
+    sprintf(barrier->members_topic, "%s%s", topic, AEROSIM_BARRIER_MEMBERS_SUFFIX);
+    sprintf(group, "aerosim.barrier.%s", participant);
+
+    /* Barrier messages are sent without batching delay and never recorded */
+    barrierConf[0] = "linger.ms";
+    barrierConf[1] = "0";
+    for (i = 0; i < confCount; i += 2) {
+        if (strcmp(confArray[i], AEROSIM_RECORD_FILE_OPTION) != 0) {
+            barrierConf[barrierConfCount++] = confArray[i];
+            barrierConf[barrierConfCount++] = confArray[i + 1];
+        }
+    }
+    memcpy(barrierConf + barrierConfCount, confArray + confCount, sizeof(char *) * topicConfCount);
+
+    /* Each participant reads every message from the latest one on */
+    topics[0] = topic;
+    topics[1] = barrier->members_topic;
+    if (aerosimOpenReader(&barrier->reader, brokers, group, topics, 2,
+                          barrierConfCount, topicConfCount, barrierConf, RD_KAFKA_OFFSET_END)
+        || aerosimOpenWriter(&barrier->ready_writer, brokers, topic, barrierConfCount, topicConfCount, barrierConf)
+        || aerosimOpenWriter(&barrier->members_writer, brokers, barrier->members_topic,
+                             barrierConfCount, topicConfCount, barrierConf)) {
+        fprintf(stderr, "%% Couldn't open the barrier on topic %s\n", topic);
+        goto exit_open_barrier;
+    }
+    res = announce(barrier, "join");
+
+exit_open_barrier:
+    free(barrierConf);
+    free(group);
+    if (res) {
+        aerosimCloseBarrier(barrier);
+        return NULL;
+    }
+    return barrier;
+}
+
+int aerosimWaitBarrier(aerosim_barrier_t *barrier, uint64_t step, int64_t deadline_ns)
+{
+    const char *participant = barrier->members[0].info.participant;
+    int64_t start_ns, now_ns, wait_ns;
+    aerosim_message_t message;
+    char payload[BARRIER_MSG_LEN];
+    int len;
+
+    barrier->members[0].info.ready_step = step;
+    len = snprintf(payload, sizeof(payload), "{\"step\":%llu,\"session\":%lld}", (unsigned long long)step,
+                   (long long)barrier->session);
+    if (aerosimWriteMessage(barrier->ready_writer, participant, (int)strlen(participant), payload, len, -1)) {
+        return -1;
+    }
+
+    start_ns = aerosimMonotonicNs();
+    for (;;) {
+        now_ns = aerosimMonotonicNs();
+        while (aerosimReadMessage(barrier->reader, &message)) {
+            handleMessage(barrier, &message, now_ns);
+            aerosimReleaseMessage(barrier->reader, &message);
+        }
+        if (isReleased(barrier, step)) {
+            recordStraggler(barrier, start_ns);
+            barrier->released = 1;
+            return 0;
+        }
+        if (now_ns >= deadline_ns) {
+            return 1;
+        }
+
+        /* Repeat the announcement for members that missed it */
+        if (now_ns - barrier->announced_ns >= AEROSIM_BARRIER_ANNOUNCE_NS) {
+            announce(barrier, "join");
+        }
+        wait_ns = barrier->announced_ns + AEROSIM_BARRIER_ANNOUNCE_NS;
+        aerosimWaitReaders(&barrier->reader, 1, (wait_ns < deadline_ns) ? wait_ns : deadline_ns, NULL);
+    }
+}
+
+int aerosimGetBarrierMissingParticipants(const aerosim_barrier_t *barrier)
+{
+    int missing = barrier->min_participants - countActiveMembers(barrier);
+    return (!barrier->released && missing > 0) ? missing : 0;
+}
+
+int aerosimGetBarrierMemberCount(const aerosim_barrier_t *barrier)
+{
+    return barrier->count;
+}
+
+const aerosim_barrier_member_t *aerosimGetBarrierMember(const aerosim_barrier_t *barrier, int index)
+{
+    return (index >= 0 && index < barrier->count) ? &barrier->members[index].info : NULL;
+}
+
+void aerosimCloseBarrier(aerosim_barrier_t *barrier)
+{
+    int i;
+
+    if (barrier == NULL) {
+        return;
+    }
+    if (barrier->members_writer != NULL && barrier->count > 0) {
+        announce(barrier, "leave");
+    }
+    aerosimCloseReader(barrier->reader);
+    aerosimCloseWriter(barrier->ready_writer);
+    aerosimCloseWriter(barrier->members_writer);
+    for (i = 0; i < barrier->count; i++) {
+        free((char *)barrier->members[i].info.participant);
+    }
+    free(barrier->members);
+    free(barrier->members_topic);
+    free(barrier);
+}
@@ -0,0 +1,66 @@
+#ifndef AEROSIM_BARRIER_H
+#define AEROSIM_BARRIER_H
+
+#include "aerosim_transport.h"
+
+/*
+    Step barrier across Simulink processes that step together, e.g. the
+    vehicle, ground control and weather models of one scenario. Each
+    participant publishes "ready for step k" to the barrier topic, keyed by
+    its participant id, and may run step k once every member has reported
+    step k. Members are discovered on the membership topic <topic>.members:
+    participants announce themselves when they open the barrier, again for
+    each newly seen member and periodically while waiting, and leave when
+    they close it. The announcements carry the last reported step, so
+    members that missed messages (e.g. a Kafka consumer that wasn't assigned
+    yet) catch up.
+
+    Messages, keyed by participant id:
+        <topic>          {"step":k,"session":s}
+        <topic>.members  {"event":"join","step":k,"session":s} or {"event":"leave","step":k,"session":s}
+
+    The session tells the barriers a participant opened apart (the wall
+    clock time of the open), so messages a participant sent before it left
+    can't make it a member again; a newer session joins anew.
+
+    All participants must join before the first step; the first barrier
+    waits for at least minParticipants members, this one included. Later
+    barriers only wait for the members that haven't left.
+*/
+#define AEROSIM_BARRIER_MEMBERS_SUFFIX ".members"
+#define AEROSIM_BARRIER_ANNOUNCE_NS (200 * 1000000LL)
+
+typedef struct aerosim_barrier_s aerosim_barrier_t;
+
+/* Per-member statistics, the straggler is the last member to report a step */
+typedef struct {
+    const char *participant;
+    int active;                /* joined and not left */
+    uint64_t ready_step;       /* last reported step */
+    uint64_t straggler_count;  /* barriers this member was the last to report */
+    int64_t straggler_ns_sum;  /* time the others waited for it as the straggler */
+    int64_t straggler_ns_max;
+} aerosim_barrier_member_t;
+
+aerosim_barrier_t *aerosimOpenBarrier(const char *brokers, const char *topic,
+    const char *participant, int minParticipants,
+    int confCount, int topicConfCount, const char **confArray);
+
+/*
+    Report the step and wait until every member has reported it, or until
+    the monotonic deadline has passed. Returns 0 once released, 1 on
+    timeout, -1 if the step couldn't be reported.
+*/
+int aerosimWaitBarrier(aerosim_barrier_t *barrier, uint64_t step, int64_t deadline_ns);
+
+/* Participants the first barrier still waits to join, 0 once a step was released */
+int aerosimGetBarrierMissingParticipants(const aerosim_barrier_t *barrier);
+
+/* Members seen so far, this participant first, including those that left */
+int aerosimGetBarrierMemberCount(const aerosim_barrier_t *barrier);
+const aerosim_barrier_member_t *aerosimGetBarrierMember(const aerosim_barrier_t *barrier, int index);
+
+/* Leaves the barrier */
+void aerosimCloseBarrier(aerosim_barrier_t *barrier);
+
+#endif /* AEROSIM_BARRIER_H */
@@ -0,0 +1,413 @@
+#include "aerosim_fleet.h"
+
+#include <math.h>
+
+#include "jansson.h"
+
+#define JSON_DATA_TYPE_NAME "aerosim::types::JsonData"
+
+typedef struct {
+    char *name;
+    char *path;          /* the field name, its '.' separators replaced by NULs */
+    const char **tokens; /* JSON path below the bus token */
+    int depth;
+    int metadata;        /* looked up in the message metadata */
+    int port;
+    int column;
+} fleet_field_t;
+
+typedef struct {
+    const char *key;
+    size_t len;
+    int vehicle;
+} fleet_key_t;
+
+struct aerosim_fleet_s {
+    int vehicleCount;
+    char **keys;          /* by vehicle */
+    fleet_key_t *sorted;  /* by key, for the lookup */
+    int fieldCount;
+    fleet_field_t *fields;
+    int portCount;
+    int *portColumns;
+    /*
+        Encoding plan: the data fields in JSON path order, each with the
+        text that closes the previous field's objects, separates and opens
+        its own objects up to its name, e.g. "},\"velocity\":{\"x\":".
+    */
+    int encodeCount;
+    int *encodeOrder;
+    char **encodePrefix;
+    char *encodeSuffix;
+};
+
+/*
+    Fleet
+*/
+static int compareKeys(const void *a, const void *b)
+{
+    const fleet_key_t *ka = (const fleet_key_t *)a;
+    const fleet_key_t *kb = (const fleet_key_t *)b;
+    size_t len = ka->len < kb->len ? ka->len : kb->len;
+    int res = memcmp(ka->key, kb->key, len);
+
+    if (res != 0) {
+        return res;
+    }
+    return (ka->len > kb->len) - (ka->len < kb->len);
+}
+
+static const aerosim_fleet_t *sortFleet; /* qsort() has no context argument */
+
+static int compareFieldPaths(const void *a, const void *b)
+{
+    const fleet_field_t *fa = &sortFleet->fields[*(const int *)a];
+    const fleet_field_t *fb = &sortFleet->fields[*(const int *)b];
+    int i, res;
+
+    for (i = 0; i < fa->depth && i < fb->depth; i++) {
+        res = strcmp(fa->tokens[i], fb->tokens[i]);
+        if (res != 0) {
+            return res;
+        }
+    }
+    return fa->depth - fb->depth;
+}
+
+static int parseField(fleet_field_t *field, const char *name)
+{
+    char *p;
+    int i;
+
+    field->name = strdup(name);
+    field->path = strdup(name);
+    field->depth = 0;
+    if (field->name == NULL || field->path == NULL) {
+        return -1;
+    }
+    for (p = field->path; *p != '\0'; p++) {
+        if (*p == '.') {
+            field->depth++;
+        }
+    }
+    field->tokens = (const char **)calloc(field->depth > 0 ? field->depth : 1, sizeof(char *));
+    if (field->tokens == NULL) {
+        return -1;
+    }
+
+    /* Skip the bus token */
+    p = strchr(field->path, '.');
+    for (i = 0; i < field->depth; i++) {
+        *p++ = '\0';
+        field->tokens[i] = p;
+        p += strcspn(p, ".");
+        if (*field->tokens[i] == '\0') {
+            return -1;
+        }
+    }
+    field->metadata = strcmp(field->path, "metadata") == 0;
+    return field->depth > 0 ? 0 : -1;
+}
+
+/* Append to the NUL-terminated text of the buffer, returns -1 if it doesn't fit */
+static int appendText(char *text, size_t size, size_t *len, const char *append)
+{
+    size_t n = strlen(append);
+
+    if (*len + n >= size) {
+        return -1;
+    }
+    memcpy(text + *len, append, n + 1);
+    *len += n;
+    return 0;
+}
+
+static int planEncoding(aerosim_fleet_t *fleet)
+{
+    const fleet_field_t *prev = NULL;
+    char text[1024];
+    size_t len;
+    int i, k, res;
+
+    fleet->encodeOrder = (int *)calloc(fleet->fieldCount, sizeof(int));
+    fleet->encodePrefix = (char **)calloc(fleet->fieldCount, sizeof(char *));
+    if (fleet->encodeOrder == NULL || fleet->encodePrefix == NULL) {
+        return -1;
+    }
+    for (i = 0; i < fleet->fieldCount; i++) {
+        if (!fleet->fields[i].metadata) {
+            fleet->encodeOrder[fleet->encodeCount++] = i;
+        }
+    }
+    sortFleet = fleet;
+    qsort(fleet->encodeOrder, fleet->encodeCount, sizeof(int), compareFieldPaths);
+    sortFleet = NULL;
+
+    for (i = 0; i < fleet->encodeCount; i++) {
+        const fleet_field_t *field = &fleet->fields[fleet->encodeOrder[i]];
+        int common = 0;
+
+        len = 0;
+        text[0] = '\0';
+        res = 0;
+        if (prev != NULL) {
+            /* Objects shared with the previous field stay open */
+            while (common < prev->depth - 1 && common < field->depth - 1
+                   && strcmp(prev->tokens[common], field->tokens[common]) == 0) {
+                common++;
+            }
+            if (strcmp(prev->tokens[common], field->tokens[common]) == 0) {
+                fprintf(stderr, "%% Fleet fields '%s' and '%s' overlap\n", prev->name, field->name);
+                return -1;
+            }
+            for (k = common; k < prev->depth - 1; k++) {
+                res |= appendText(text, sizeof(text), &len, "}");
+            }
+            res |= appendText(text, sizeof(text), &len, ",");
+        }
+        for (k = common; k < field->depth; k++) {
+            res |= appendText(text, sizeof(text), &len, "\"");
+            res |= appendText(text, sizeof(text), &len, field->tokens[k]);
+            res |= appendText(text, sizeof(text), &len, (k < field->depth - 1) ? "\":{" : "\":");
+        }
+        if (res || (fleet->encodePrefix[i] = strdup(text)) == NULL) {
+            return -1;
+        }
+        prev = field;
+    }
+
+    len = 0;
+    text[0] = '\0';
+    for (k = 0; prev != NULL && k < prev->depth - 1; k++) {
+        if (appendText(text, sizeof(text), &len, "}")) {
+            return -1;
+        }
+    }
+    fleet->encodeSuffix = strdup(text);
+    return fleet->encodeSuffix != NULL ? 0 : -1;
+}
+
+aerosim_fleet_t *aerosimCreateFleet(int vehicleCount, const char **keys,
+    int fieldCount, const char **fields, const int *ports)
+{
+    aerosim_fleet_t *fleet = (aerosim_fleet_t *)calloc(1, sizeof(aerosim_fleet_t));
+    int i;
+
+    if (fleet == NULL) {
+        return NULL;
+    }
+    if (vehicleCount < 1 || fieldCount < 1) {
+        fprintf(stderr, "%% A fleet needs at least one vehicle key and one field\n");
+        goto fail;
+    }
+    fleet->vehicleCount = vehicleCount;
+    fleet->fieldCount = fieldCount;
+    fleet->keys = (char **)calloc(vehicleCount, sizeof(char *));
+    fleet->sorted = (fleet_key_t *)calloc(vehicleCount, sizeof(fleet_key_t));
+    fleet->fields = (fleet_field_t *)calloc(fieldCount, sizeof(fleet_field_t));
+    if (fleet->keys == NULL || fleet->sorted == NULL || fleet->fields == NULL) {
+        goto fail;
+    }
+
+    for (i = 0; i < vehicleCount; i++) {
+        fleet->keys[i] = strdup(keys[i]);
+        if (fleet->keys[i] == NULL) {
+            goto fail;
+        }
+        fleet->sorted[i].key = fleet->keys[i];
+        fleet->sorted[i].len = strlen(fleet->keys[i]);
+        fleet->sorted[i].vehicle = i;
+    }
+    qsort(fleet->sorted, vehicleCount, sizeof(fleet_key_t), compareKeys);
+    for (i = 1; i < vehicleCount; i++) {
+        if (compareKeys(&fleet->sorted[i - 1], &fleet->sorted[i]) == 0) {
+            fprintf(stderr, "%% Duplicate fleet vehicle key '%s'\n", fleet->sorted[i].key);
+            goto fail;
+        }
+    }
+
+    for (i = 0; i < fieldCount; i++) {
+        if (ports[i] < 0 || ports[i] >= fieldCount) {
+            fprintf(stderr, "%% Invalid port %d of fleet field '%s'\n", ports[i], fields[i]);
+            goto fail;
+        }
+        if (ports[i] + 1 > fleet->portCount) {
+            fleet->portCount = ports[i] + 1;
+        }
+    }
+    fleet->portColumns = (int *)calloc(fleet->portCount, sizeof(int));
+    if (fleet->portColumns == NULL) {
+        goto fail;
+    }
+    for (i = 0; i < fieldCount; i++) {
+        if (parseField(&fleet->fields[i], fields[i])) {
+            fprintf(stderr, "%% Invalid fleet field '%s', expected <bus>.<path>\n", fields[i]);
+            goto fail;
+        }
+        fleet->fields[i].port = ports[i];
+        fleet->fields[i].column = fleet->portColumns[ports[i]]++;
+    }
+    for (i = 0; i < fleet->portCount; i++) {
+        if (fleet->portColumns[i] == 0) {
+            fprintf(stderr, "%% Fleet port %d has no fields\n", i);
+            goto fail;
+        }
+    }
+
+    if (planEncoding(fleet)) {
+        goto fail;
+    }
+    return fleet;
+
+fail:
+    aerosimDestroyFleet(fleet);
+    return NULL;
+}
+
+void aerosimDestroyFleet(aerosim_fleet_t *fleet)
+{
+    int i;
+
+    if (fleet == NULL) {
+        return;
+    }
+    for (i = 0; fleet->keys != NULL && i < fleet->vehicleCount; i++) {
+        free(fleet->keys[i]);
+    }
+    for (i = 0; fleet->fields != NULL && i < fleet->fieldCount; i++) {
+        free(fleet->fields[i].name);
+        free(fleet->fields[i].path);
+        free((void *)fleet->fields[i].tokens);
+    }
+    for (i = 0; fleet->encodePrefix != NULL && i < fleet->encodeCount; i++) {
+        free(fleet->encodePrefix[i]);
+    }
+    free(fleet->encodePrefix);
+    free(fleet->encodeOrder);
+    free(fleet->encodeSuffix);
+    free(fleet->portColumns);
+    free(fleet->fields);
+    free(fleet->sorted);
+    free(fleet->keys);
+    free(fleet);
+}
+
+int aerosimGetFleetVehicleCount(const aerosim_fleet_t *fleet)
+{
+    return fleet->vehicleCount;
+}
+
+int aerosimGetFleetPortCount(const aerosim_fleet_t *fleet)
+{
+    return fleet->portCount;
+}
+
+int aerosimGetFleetPortColumns(const aerosim_fleet_t *fleet, int port)
+{
+    return fleet->portColumns[port];
+}
+
+const char *aerosimGetFleetKey(const aerosim_fleet_t *fleet, int vehicle)
+{
+    return fleet->keys[vehicle];
+}
+
+int aerosimFindFleetVehicle(const aerosim_fleet_t *fleet, const void *key, size_t keyLen)
+{
+    fleet_key_t wanted;
+    const fleet_key_t *found;
+
+    wanted.key = (const char *)key;
+    wanted.len = keyLen;
+    found = (const fleet_key_t *)bsearch(&wanted, fleet->sorted, fleet->vehicleCount, sizeof(fleet_key_t), compareKeys);
+    return (found != NULL) ? found->vehicle : -1;
+}
+
+/*
+    Decoding
+*/
+int aerosimDecodeFleetMessage(const aerosim_fleet_t *fleet, int vehicle,
+    const char *payload, size_t len, real_T **ports)
+{
+    json_error_t error;
+    json_t *root = json_loadb(payload, len, 0, &error);
+    json_t *metadata, *data, *nested = NULL;
+    const char *typeName;
+    int i, k;
+
+    if (!json_is_object(root)) {
+        json_decref(root);
+        return -1;
+    }
+    metadata = json_object_get(root, "metadata");
+    data = json_object_get(root, "data");
+    typeName = json_string_value(json_object_get(metadata, "type_name"));
+    if (typeName != NULL && strcmp(typeName, JSON_DATA_TYPE_NAME) == 0) {
+        const char *str = json_string_value(json_object_get(data, "data"));
+        nested = (str != NULL) ? json_loads(str, 0, &error) : NULL;
+        data = nested;
+    }
+
+    for (i = 0; i < fleet->fieldCount; i++) {
+        const fleet_field_t *field = &fleet->fields[i];
+        json_t *value = field->metadata ? metadata : data;
+
+        for (k = 0; k < field->depth && value != NULL; k++) {
+            value = json_object_get(value, field->tokens[k]);
+        }
+        if (json_is_number(value)) {
+            ports[field->port][vehicle + fleet->vehicleCount * field->column] = json_number_value(value);
+        } else if (json_is_boolean(value)) {
+            ports[field->port][vehicle + fleet->vehicleCount * field->column] = json_is_true(value) ? 1.0 : 0.0;
+        }
+    }
+
+    json_decref(nested);
+    json_decref(root);
+    return 0;
+}
+
+/*
+    Encoding
+*/
+int aerosimEncodeFleetMessage(const aerosim_fleet_t *fleet, int vehicle,
+    const real_T *const *ports, const char *topic, const char *typeName,
+    time_T simTime, int64_t platformNs, char *buf, size_t bufLen)
+{
+    long long simSec = (long long)floor(simTime);
+    long long simNanosec = (long long)llround((simTime - (double)simSec) * 1e9);
+    size_t len;
+    int n, i;
+
+    if (simNanosec >= 1000000000LL) {
+        simSec++;
+        simNanosec -= 1000000000LL;
+    }
+    n = snprintf(buf, bufLen,
+                 "{\"metadata\":{\"topic\":\"%s\",\"type_name\":\"%s\",\"timestamp_sim\":{\"sec\":%lld,\"nanosec\":%lld},"
+                 "\"timestamp_platform\":{\"sec\":%lld,\"nanosec\":%lld}},\"data\":{",
+                 topic, typeName, simSec, simNanosec,
+                 (long long)(platformNs / 1000000000), (long long)(platformNs % 1000000000));
+    if (n < 0 || (size_t)n >= bufLen) {
+        return -1;
+    }
+    len = (size_t)n;
+
+    for (i = 0; i < fleet->encodeCount; i++) {
+        const fleet_field_t *field = &fleet->fields[fleet->encodeOrder[i]];
+        real_T value = ports[field->port][vehicle + fleet->vehicleCount * field->column];
+
+        n = isfinite(value) ? snprintf(buf + len, bufLen - len, "%s%.17g", fleet->encodePrefix[i], value)
+                            : snprintf(buf + len, bufLen - len, "%snull", fleet->encodePrefix[i]);
+        if (n < 0 || (size_t)n >= bufLen - len) {
+            return -1;
+        }
+        len += (size_t)n;
+    }
+
+    n = snprintf(buf + len, bufLen - len, "%s}}", fleet->encodeSuffix);
+    if (n < 0 || (size_t)n >= bufLen - len) {
+        return -1;
+    }
+    return (int)(len + (size_t)n);
+}
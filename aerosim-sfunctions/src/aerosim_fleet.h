@@ -0,0 +1,52 @@
+#ifndef AEROSIM_FLEET_H
+#define AEROSIM_FLEET_H
+
+#include "simstruc.h"
+
+/*
+    Vehicle fleet layout of the vectorized fleet consumer and producer
+    blocks. A fleet is N vehicles, told apart by their Kafka message key,
+    and a list of numeric message fields. Each field is one column of a
+    port, and each port is an N-by-columns double matrix (structure of
+    arrays, column-major): vehicle v's column c is element v + N * c.
+
+    Field names follow the JSON parser blocks: the first token names the
+    bus and is skipped, so "vehicle_state.position.x" is data.position.x
+    of the message; "metadata.*" fields come from the message metadata.
+    JsonData messages (data.data holding a JSON string) are decoded from
+    that string.
+*/
+typedef struct aerosim_fleet_s aerosim_fleet_t;
+
+/* ports are the 0-based fleet port of each field, numbered from 0 without gaps */
+aerosim_fleet_t *aerosimCreateFleet(int vehicleCount, const char **keys,
+    int fieldCount, const char **fields, const int *ports);
+void aerosimDestroyFleet(aerosim_fleet_t *fleet);
+
+int aerosimGetFleetVehicleCount(const aerosim_fleet_t *fleet);
+int aerosimGetFleetPortCount(const aerosim_fleet_t *fleet);
+int aerosimGetFleetPortColumns(const aerosim_fleet_t *fleet, int port);
+const char *aerosimGetFleetKey(const aerosim_fleet_t *fleet, int vehicle);
+
+/* Index of the vehicle with the message key, -1 if it isn't in the fleet */
+int aerosimFindFleetVehicle(const aerosim_fleet_t *fleet, const void *key, size_t keyLen);
+
+/*
+    Decode the fields of one vehicle's message into its row of the port
+    matrices. Fields missing from the message keep their value. Returns 0,
+    or -1 if the message isn't a JSON object.
+*/
+int aerosimDecodeFleetMessage(const aerosim_fleet_t *fleet, int vehicle,
+    const char *payload, size_t len, real_T **ports);
+
+/*
+    Encode one vehicle's row of the port matrices as an AeroSim message with
+    the given topic, type name and timestamps, fields with a "metadata"
+    bus excluded. Non-finite values are encoded as null. Returns the message
+    length, or -1 if it doesn't fit in bufLen bytes (including the NUL).
+*/
+int aerosimEncodeFleetMessage(const aerosim_fleet_t *fleet, int vehicle,
+    const real_T *const *ports, const char *topic, const char *typeName,
+    time_T simTime, int64_t platformNs, char *buf, size_t bufLen);
+
+#endif /* AEROSIM_FLEET_H */
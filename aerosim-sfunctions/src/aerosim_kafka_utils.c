@@ -1,69 +1,536 @@
 #include "aerosim_kafka_utils.h"
+#include "aerosim_trace.h"
+
+#include "jansson.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#endif
 
 static char errstr[512]; /* librdkafka API error reporting buffer */
 
+/* Maximum time to wait for the start offsets of the consumer slots to be resolved */
+#define AEROSIM_CONSUMER_SETTLE_TIMEOUT_MS 5000
+
+/* Wall clock monotonic time in nanoseconds, unaffected by system time changes */
+int64_t aerosimMonotonicNs(void)
+{
+#ifdef _WIN32
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    if (frequency.QuadPart == 0) {
+        QueryPerformanceFrequency(&frequency);
+    }
+    QueryPerformanceCounter(&counter);
+    return (int64_t)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#endif
+}
+
+/* Wall clock time in milliseconds since the epoch, the time base of Kafka message timestamps */
+int64_t aerosimWallClockMs(void)
+{
+#ifdef _WIN32
+    FILETIME ft;
+    ULARGE_INTEGER t;
+    GetSystemTimeAsFileTime(&ft);
+    t.LowPart = ft.dwLowDateTime;
+    t.HighPart = ft.dwHighDateTime;
+    /* 100 ns intervals since 1601-01-01 */
+    return (int64_t)(t.QuadPart / 10000ULL) - 11644473600000LL;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+#endif
+}
+
+/* Sleep until the monotonic deadline (see aerosimMonotonicNs()) has passed */
+void aerosimSleepUntilNs(int64_t deadline_ns)
+{
+    int64_t now_ns;
+    while ((now_ns = aerosimMonotonicNs()) < deadline_ns) {
+#ifdef _WIN32
+        Sleep((DWORD)((deadline_ns - now_ns + 999999) / 1000000));
+#else
+        struct timespec ts;
+        ts.tv_sec = (time_t)((deadline_ns - now_ns) / 1000000000LL);
+        ts.tv_nsec = (long)((deadline_ns - now_ns) % 1000000000LL);
+        nanosleep(&ts, NULL);
+#endif
+    }
+}
+
+/*
+    HDR-style histogram
+*/
+static int histogramBucket(int64_t value)
+{
+    int magnitude = 0;
+    if (value < (2 << AEROSIM_HISTOGRAM_SUB_BITS)) {
+        return value < 0 ? 0 : (int)value;
+    }
+    while ((value >> magnitude) >= (2 << AEROSIM_HISTOGRAM_SUB_BITS)) {
+        magnitude++;
+    }
+    return (magnitude << AEROSIM_HISTOGRAM_SUB_BITS) + (int)(value >> magnitude);
+}
+
+/* Highest value that falls into the bucket */
+static int64_t histogramBucketHighest(int bucket)
+{
+    int magnitude;
+    if (bucket < (2 << AEROSIM_HISTOGRAM_SUB_BITS)) {
+        return bucket;
+    }
+    magnitude = (bucket >> AEROSIM_HISTOGRAM_SUB_BITS) - 1;
+    return ((int64_t)(bucket - (magnitude << AEROSIM_HISTOGRAM_SUB_BITS) + 1) << magnitude) - 1;
+}
+
+void aerosimHistogramReset(aerosim_histogram_t *histogram)
+{
+    memset(histogram, 0, sizeof(*histogram));
+}
+
+void aerosimHistogramRecord(aerosim_histogram_t *histogram, int64_t value)
+{
+    if (value < 0) {
+        value = 0;
+    }
+    histogram->counts[histogramBucket(value)]++;
+    if (histogram->count == 0 || value < histogram->min) {
+        histogram->min = value;
+    }
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+    histogram->count++;
+    histogram->sum += (double)value;
+}
+
+/* Value at the percentile (0-100), reported as the highest value of its bucket */
+int64_t aerosimHistogramPercentile(const aerosim_histogram_t *histogram, double percentile)
+{
+    uint64_t target, seen = 0;
+    int b;
+
+    if (histogram->count == 0) {
+        return 0;
+    }
+    target = (uint64_t)(percentile / 100.0 * (double)histogram->count + 0.5);
+    if (target < 1) {
+        target = 1;
+    }
+    for (b = 0; b < AEROSIM_HISTOGRAM_BUCKETS; b++) {
+        seen += histogram->counts[b];
+        if (seen >= target) {
+            int64_t highest = histogramBucketHighest(b);
+            return highest < histogram->max ? highest : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+/*
+    AeroSim block options
+
+    Block options that have no dedicated mask parameter are given as
+    "aerosim." prefixed key/value pairs in the block's client config. They
+    are read by the blocks and never passed on to librdkafka.
+*/
+static int isAerosimOption(const char *key)
+{
+    return strncmp(key, AEROSIM_OPTION_PREFIX, strlen(AEROSIM_OPTION_PREFIX)) == 0;
+}
+
+const char *aerosimGetOption(int confCount, const char **confArray, const char *key)
+{
+    int i;
+    for (i = 0; i + 1 < confCount; i += 2) {
+        if (strcmp(confArray[i], key) == 0) {
+            return confArray[i + 1];
+        }
+    }
+    return NULL;
+}
+
+/*
+    Look up an option in a "conf" block parameter (cell array of alternating
+    keys and values). Usable before mdlStart, e.g. to size optional ports.
+    Returns 1 and copies the value if the option is set, 0 otherwise.
+*/
+int aerosimGetOptionMX(const mxArray *conf, const char *key, char *value, int valueLen)
+{
+    char name[256];
+    int i, n;
+
+    if (conf == NULL || mxGetClassID(conf) != mxCELL_CLASS) {
+        return 0;
+    }
+
+    n = (int)mxGetNumberOfElements(conf);
+    for (i = 0; i + 1 < n; i += 2) {
+        if (mxGetString(mxGetCell(conf, i), name, sizeof(name)) == 0 && strcmp(name, key) == 0) {
+            return mxGetString(mxGetCell(conf, i + 1), value, valueLen) == 0;
+        }
+    }
+    return 0;
+}
+
+double aerosimGetOptionNumberMX(const mxArray *conf, const char *key, double defaultValue)
+{
+    char value[64];
+    char *end;
+    double number;
+
+    if (!aerosimGetOptionMX(conf, key, value, sizeof(value))) {
+        return defaultValue;
+    }
+
+    number = strtod(value, &end);
+    if (end == value) {
+        if (strcmp(value, "true") == 0) {
+            return 1.0;
+        }
+        if (strcmp(value, "false") == 0) {
+            return 0.0;
+        }
+        fprintf(stderr, "%% Invalid value '%s' for option '%s'\n", value, key);
+        return defaultValue;
+    }
+    return number;
+}
+
+/*
+    Build a shared client registry key from one or two identifying strings
+    and the librdkafka configuration, leaving out AeroSim block options so
+    blocks that only differ in those still share a client.
+*/
+static char *makeRegistryKey(const char *id1, const char *id2, int confCount, const char **confArray)
+{
+    size_t len = strlen(id1) + strlen(id2) + 2;
+    int i;
+    for (i = 0; i < confCount; i++) {
+        len += strlen(confArray[i]) + 1;
+    }
+
+    char *key = (char *)malloc(len);
+    if (key == NULL) {
+        return NULL;
+    }
+
+    strcpy(key, id1);
+    strcat(key, "\n");
+    strcat(key, id2);
+    for (i = 0; i + 1 < confCount; i += 2) {
+        if (isAerosimOption(confArray[i])) {
+            continue;
+        }
+        strcat(key, "\n");
+        strcat(key, confArray[i]);
+        strcat(key, "=");
+        strcat(key, confArray[i + 1]);
+    }
+    return key;
+}
+
+/*
+    Shared consumer runtime
+
+    Consumer blocks (and the consumers inside the clock sync block) with the
+    same brokers, group and configuration share one rd_kafka_t instance with
+    manually assigned partitions. Each block owns an aerosim_consumer_t slot
+    with its own queue that its topic partition queues are forwarded to, so
+    messages are demultiplexed per block by librdkafka without extra copies.
+    A slot may read several topics through its one queue; the reader
+    dispatches on the message's topic name. A client never assigns the same
+    topic twice; a second block reading an already assigned topic gets its
+    own client so both see every message.
+*/
+typedef struct aerosim_consumer_client_s
+{
+    char *registry_key; /* brokers + group + configuration */
+    rd_kafka_t *rk;
+    int ref_count;
+    aerosim_consumer_t *consumers; /* slots assigned on this client */
+    struct aerosim_consumer_client_s *next;
+} aerosim_consumer_client_t;
+
+typedef struct
+{
+    char *name;
+    rd_kafka_queue_t *partition_queue; /* partition fetch queue */
+    int64_t next_offset;               /* offset after the last consumed message, or the start offset */
+} aerosim_consumer_topic_t;
+
+struct aerosim_consumer_s
+{
+    aerosim_consumer_client_t *client;
+    aerosim_consumer_topic_t *topics;
+    int topic_count;
+    int32_t partition;
+    rd_kafka_queue_t *queue;           /* per-block queue the partition queues forward to */
+    int64_t fallback_offset;           /* start offset if the latest offset can't be resolved */
+    int64_t settle_deadline_ns;        /* monotonic deadline for resolving the start offset */
+    int settled;                       /* start offset was resolved (or fell back) */
+    int event_fds[2];                  /* queue I/O event pipe (read, write), -1 if not enabled */
+    int64_t consumer_lag;              /* from the client statistics, -1 if unknown */
+    aerosim_consumer_t *next;
+};
+
+static aerosim_consumer_client_t *consumer_registry = NULL;
+
+/*
+    librdkafka statistics
+
+    Every client gets a statistics sink as its opaque. The statistics
+    callback keeps the key figures of the latest statistics and appends the
+    raw JSON to the optional aerosim.stats.file.
+*/
+typedef struct
+{
+    aerosim_kafka_stats_t stats;
+    aerosim_consumer_client_t *client; /* consumer client whose slots get their lag, NULL for producers */
+    char *file;                        /* raw statistics file, NULL if not written */
+    long max_bytes;                    /* rotate the file once it would exceed this size */
+} aerosim_stats_sink_t;
+
+static aerosim_stats_sink_t *newStatsSink(int confCount, const char **confArray)
+{
+    const char *file = aerosimGetOption(confCount, confArray, "aerosim.stats.file");
+    const char *max_bytes = aerosimGetOption(confCount, confArray, "aerosim.stats.file.max.bytes");
+    aerosim_stats_sink_t *sink = (aerosim_stats_sink_t *)calloc(1, sizeof(aerosim_stats_sink_t));
+
+    if (sink == NULL) {
+        return NULL;
+    }
+    sink->stats.consumer_lag = -1;
+    sink->max_bytes = (max_bytes != NULL) ? atol(max_bytes) : AEROSIM_STATS_FILE_MAX_BYTES;
+    if (file != NULL && file[0] != '\0' && (sink->file = strdup(file)) == NULL) {
+        free(sink);
+        return NULL;
+    }
+    return sink;
+}
+
+static void freeStatsSink(aerosim_stats_sink_t *sink)
+{
+    if (sink != NULL) {
+        free(sink->file);
+        free(sink);
+    }
+}
+
+/* Append the raw statistics as one line, moving a full file to <file>.1 */
+static void appendStatsFile(const aerosim_stats_sink_t *sink, const char *json, size_t json_len)
+{
+    FILE *f = fopen(sink->file, "ab");
+    long size;
+
+    if (f == NULL) {
+        return;
+    }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    if (size > 0 && sink->max_bytes > 0 && size + (long)json_len + 1 > sink->max_bytes) {
+        char *rotated = (char *)malloc(strlen(sink->file) + 3);
+        fclose(f);
+        if (rotated != NULL) {
+            sprintf(rotated, "%s.1", sink->file);
+            remove(rotated);
+            rename(sink->file, rotated);
+            free(rotated);
+        }
+        f = fopen(sink->file, "ab");
+        if (f == NULL) {
+            return;
+        }
+    }
+    fwrite(json, 1, json_len, f);
+    fputc('\n', f);
+    fclose(f);
+}
+
+static int64_t getStatsInteger(json_t *obj, const char *key)
+{
+    json_t *value = json_object_get(obj, key);
+    return json_is_integer(value) ? (int64_t)json_integer_value(value) : 0;
+}
+
+/* Consumer lag of a topic partition, -1 if unknown */
+static int64_t getStatsConsumerLag(json_t *topics, const char *topic, const char *partition)
+{
+    json_t *value = json_object_get(json_object_get(json_object_get(json_object_get(topics, topic), "partitions"),
+                                                    partition), "consumer_lag");
+    return json_is_integer(value) ? (int64_t)json_integer_value(value) : -1;
+}
+
+static int statsCallback(rd_kafka_t *rk, char *json, size_t json_len, void *opaque)
+{
+    aerosim_stats_sink_t *sink = (aerosim_stats_sink_t *)opaque;
+    aerosim_kafka_stats_t *stats = &sink->stats;
+    json_error_t error;
+    json_t *root, *topics, *value;
+    const char *name;
+
+    root = json_loadb(json, json_len, 0, &error);
+    if (root == NULL) {
+        fprintf(stderr, "%% Couldn't parse librdkafka statistics: %s\n", error.text);
+        return 0;
+    }
+
+    stats->updates++;
+    stats->msgq_depth = getStatsInteger(root, "msg_cnt");
+    stats->txbytes = getStatsInteger(root, "tx_bytes");
+    stats->rxbytes = getStatsInteger(root, "rx_bytes");
+
+    stats->rtt_p99_us = 0;
+    json_object_foreach(json_object_get(root, "brokers"), name, value) {
+        int64_t p99 = getStatsInteger(json_object_get(value, "rtt"), "p99");
+        if (p99 > stats->rtt_p99_us) {
+            stats->rtt_p99_us = p99;
+        }
+    }
+
+    /* Consumer lag over the assigned partitions of the client and of each consumer slot */
+    topics = json_object_get(root, "topics");
+    if (sink->client != NULL) {
+        aerosim_consumer_t *consumer;
+        char partition[16];
+        int i;
+
+        stats->consumer_lag = -1;
+        for (consumer = sink->client->consumers; consumer != NULL; consumer = consumer->next) {
+            sprintf(partition, "%d", (int)consumer->partition);
+            consumer->consumer_lag = -1;
+            for (i = 0; i < consumer->topic_count; i++) {
+                int64_t lag = getStatsConsumerLag(topics, consumer->topics[i].name, partition);
+                if (lag >= 0) {
+                    consumer->consumer_lag = (consumer->consumer_lag < 0 ? 0 : consumer->consumer_lag) + lag;
+                }
+            }
+            if (consumer->consumer_lag >= 0) {
+                stats->consumer_lag = (stats->consumer_lag < 0 ? 0 : stats->consumer_lag) + consumer->consumer_lag;
+            }
+        }
+    }
+    json_decref(root);
+
+    if (sink->file != NULL) {
+        appendStatsFile(sink, json, json_len);
+    }
+
+    /* librdkafka frees the JSON buffer */
+    return 0;
+}
+
+/* Statistics of a client created by this module, NULL for other clients */
+const aerosim_kafka_stats_t *aerosimGetKafkaStats(rd_kafka_t *rk)
+{
+    aerosim_stats_sink_t *sink = (rk != NULL) ? (aerosim_stats_sink_t *)rd_kafka_opaque(rk) : NULL;
+    return (sink != NULL) ? &sink->stats : NULL;
+}
+
+/* Statistics of the slot's client, with the consumer lag of the slot's own partitions */
+int aerosimGetKafkaConsumerStats(aerosim_consumer_t *consumer, aerosim_kafka_stats_t *stats)
+{
+    const aerosim_kafka_stats_t *client_stats;
+
+    if (consumer == NULL || (client_stats = aerosimGetKafkaStats(consumer->client->rk)) == NULL) {
+        return 0;
+    }
+    *stats = *client_stats;
+    stats->consumer_lag = consumer->consumer_lag;
+    return 1;
+}
+
+void aerosimWriteKafkaStatsOutput(const aerosim_kafka_stats_t *stats, real_T *output)
+{
+    output[0] = stats->rtt_p99_us * 1e-6;
+    output[1] = (real_T)stats->msgq_depth;
+    output[2] = (real_T)stats->txbytes;
+    output[3] = (real_T)stats->consumer_lag;
+}
+
 /*
     This function is based on the mwInitializeKafkaConsumer() function
-    in mw_kafka_utils.c with modified partition offset assignment to
-    always start from the latest offset to bypass any stale data.
+    in mw_kafka_utils.c, without subscribing or assigning any topic. Topic
+    partitions are assigned incrementally as blocks open their slots.
 */
-int aerosimInitializeKafkaConsumer(rd_kafka_t **prk,
-    const char *brokers, const char *group, const char *topic,
-    int confCount, int topicConfCount, const char **confArray,
-    int64_t start_offset)
+static rd_kafka_t *createKafkaConsumer(const char *brokers, const char *group,
+    int confCount, int topicConfCount, const char **confArray)
 {
     rd_kafka_t *rk = NULL;        /* Consumer instance handle */
     rd_kafka_conf_t *conf = NULL; /* Temporary configuration object */
     rd_kafka_topic_conf_t *topic_conf = NULL;
-    rd_kafka_topic_partition_list_t *topics;
-    int partition = 0;
+    aerosim_stats_sink_t *sink = NULL;
     int i;
- 
+
     conf = rd_kafka_conf_new();
     if (conf == NULL) {
         fprintf(stderr, "Couldn't instantiate Kafka config object.\n");
-        return 1;
+        return NULL;
     }
 
     /* Topic configuration */
     topic_conf = rd_kafka_topic_conf_new();
     if (topic_conf == NULL) {
         fprintf(stderr, "Couldn't instantiate topic configuration\n");
-        return 2;
+        rd_kafka_conf_destroy(conf);
+        return NULL;
     }
 
     if (rd_kafka_conf_set(conf, "group.id", group, errstr, sizeof(errstr)) != RD_KAFKA_CONF_OK) {
         fprintf(stderr, "%s\n", errstr);
-        return 3;
+        goto create_consumer_error;
     }
 
     rd_kafka_conf_set(conf, "enable.partition.eof", "true", NULL, 0);
 
+    /* Statistics are only emitted when statistics.interval.ms is configured */
+    sink = newStatsSink(confCount, confArray);
+    if (sink == NULL) {
+        fprintf(stderr, "Couldn't allocate statistics sink\n");
+        goto create_consumer_error;
+    }
+    rd_kafka_conf_set_opaque(conf, sink);
+    rd_kafka_conf_set_stats_cb(conf, statsCallback);
+
     /* Set additional user defined configuration values */
     for (i = 0; i < confCount; i += 2) {
-        char *key = (char *)confArray[i];
-        char *value = (char *)(confArray[i + 1]);
-        if (rd_kafka_conf_set(conf, key, value, errstr, sizeof(errstr)) != RD_KAFKA_CONF_OK) {
-            fprintf(stderr, "aerosimInitializeKafkaConsumer: %s\n", errstr);
-            return 1;
+        if (isAerosimOption(confArray[i])) {
+            continue;
+        }
+        if (rd_kafka_conf_set(conf, confArray[i], confArray[i + 1], errstr, sizeof(errstr)) != RD_KAFKA_CONF_OK) {
+            fprintf(stderr, "aerosimOpenKafkaConsumer: %s\n", errstr);
+            goto create_consumer_error;
         }
     }
 
-    if (topicConfCount > 0) {
-        /* Set additional user defined configuration values */
-        for (i = 0; i < topicConfCount; i += 2) {
-            char *key = (char *)confArray[confCount + i];
-            char *value = (char *)(confArray[confCount + i + 1]);
-            if (rd_kafka_topic_conf_set(topic_conf, key, value, errstr, sizeof(errstr)) != RD_KAFKA_CONF_OK) {
-                fprintf(stderr, "aerosimInitializeKafkaConsumer: %s\n", errstr);
-                return 2;
-            }
+    for (i = 0; i < topicConfCount; i += 2) {
+        if (isAerosimOption(confArray[confCount + i])) {
+            continue;
+        }
+        if (rd_kafka_topic_conf_set(topic_conf, confArray[confCount + i], confArray[confCount + i + 1],
+                                    errstr, sizeof(errstr)) != RD_KAFKA_CONF_OK) {
+            fprintf(stderr, "aerosimOpenKafkaConsumer: %s\n", errstr);
+            goto create_consumer_error;
         }
     }
 
-    /* Set default topic config for pattern-matched topics. */
-    /* This seems to make the app core dump */
+    /* Set default topic config for the assigned topics (takes ownership of topic_conf) */
     rd_kafka_conf_set_default_topic_conf(conf, topic_conf);
+    topic_conf = NULL;
 
     /*
     * Create consumer instance.
@@ -75,46 +542,1156 @@ int aerosimInitializeKafkaConsumer(rd_kafka_t **prk,
     rk = rd_kafka_new(RD_KAFKA_CONSUMER, conf, errstr, sizeof(errstr));
     if (!rk) {
         fprintf(stderr, "%s\n", errstr);
-        return 4;
+        rd_kafka_conf_destroy(conf);
+        freeStatsSink(sink);
+        return NULL;
     }
     conf = NULL;
 
     /* Add brokers */
     if (rd_kafka_brokers_add(rk, brokers) == 0) {
         fprintf(stderr, "%% No valid brokers specified\n");
-        return 5;
+        rd_kafka_destroy(rk);
+        freeStatsSink(sink);
+        return NULL;
+    }
+
+    /*
+        The main queue is intentionally not redirected to the consumer queue
+        with rd_kafka_poll_set_consumer(): messages are read from the per-block
+        queues, and client events are served by rd_kafka_poll() instead.
+    */
+    return rk;
+
+create_consumer_error:
+    if (topic_conf != NULL) {
+        rd_kafka_topic_conf_destroy(topic_conf);
+    }
+    rd_kafka_conf_destroy(conf);
+    freeStatsSink(sink);
+    return NULL;
+}
+
+/* Check whether any of the topics is already assigned on the client */
+static int isConsumerTopicAssigned(const aerosim_consumer_client_t *client, const char **topics, int topicCount)
+{
+    const aerosim_consumer_t *consumer;
+    int i, j;
+
+    for (consumer = client->consumers; consumer != NULL; consumer = consumer->next) {
+        for (i = 0; i < consumer->topic_count; i++) {
+            for (j = 0; j < topicCount; j++) {
+                if (strcmp(consumer->topics[i].name, topics[j]) == 0) {
+                    return 1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+static aerosim_consumer_client_t *acquireConsumerClient(const char *brokers, const char *group,
+    const char **topics, int topicCount, int confCount, int topicConfCount, const char **confArray)
+{
+    aerosim_consumer_client_t *client;
+
+    char *registry_key = makeRegistryKey(brokers, group, confCount + topicConfCount, confArray);
+    if (registry_key == NULL) {
+        fprintf(stderr, "Couldn't allocate consumer registry key\n");
+        return NULL;
+    }
+
+    for (client = consumer_registry; client != NULL; client = client->next) {
+        if (strcmp(client->registry_key, registry_key) != 0) {
+            continue;
+        }
+
+        /* Reuse this client only if none of the topics is assigned on it yet */
+        if (!isConsumerTopicAssigned(client, topics, topicCount)) {
+            free(registry_key);
+            return client;
+        }
+    }
+
+    rd_kafka_t *rk = createKafkaConsumer(brokers, group, confCount, topicConfCount, confArray);
+    if (rk == NULL) {
+        free(registry_key);
+        return NULL;
+    }
+
+    client = (aerosim_consumer_client_t *)malloc(sizeof(aerosim_consumer_client_t));
+    if (client == NULL) {
+        freeStatsSink((aerosim_stats_sink_t *)rd_kafka_opaque(rk));
+        rd_kafka_destroy(rk);
+        free(registry_key);
+        return NULL;
+    }
+    client->registry_key = registry_key;
+    client->rk = rk;
+    ((aerosim_stats_sink_t *)rd_kafka_opaque(rk))->client = client;
+    client->ref_count = 0;
+    client->consumers = NULL;
+    client->next = consumer_registry;
+    consumer_registry = client;
+    return client;
+}
+
+static void releaseConsumerClient(aerosim_consumer_client_t *client)
+{
+    aerosim_consumer_client_t **pclient;
+
+    if (--client->ref_count > 0) {
+        return;
+    }
+
+    for (pclient = &consumer_registry; *pclient != NULL; pclient = &(*pclient)->next) {
+        if (*pclient == client) {
+            *pclient = client->next;
+            break;
+        }
+    }
+
+    aerosim_stats_sink_t *sink = (aerosim_stats_sink_t *)rd_kafka_opaque(client->rk);
+    rd_kafka_consumer_close(client->rk);
+    rd_kafka_destroy(client->rk);
+    freeStatsSink(sink);
+    free(client->registry_key);
+    free(client);
+}
+
+static rd_kafka_topic_partition_list_t *makeConsumerPartitionList(const aerosim_consumer_t *consumer,
+    const int *selected, int64_t offset)
+{
+    rd_kafka_topic_partition_list_t *topics = rd_kafka_topic_partition_list_new(consumer->topic_count);
+    int i;
+
+    for (i = 0; i < consumer->topic_count; i++) {
+        if (selected == NULL || selected[i]) {
+            rd_kafka_topic_partition_list_add(topics, consumer->topics[i].name, consumer->partition)->offset = offset;
+        }
+    }
+    return topics;
+}
+
+/*
+    Add the slot's topic partitions to the client's assignment to start
+    consuming them. selected (NULL for all) picks a subset of the topics.
+*/
+static int assignConsumerPartitions(aerosim_consumer_t *consumer, const int *selected, int64_t offset)
+{
+    rd_kafka_topic_partition_list_t *topics = makeConsumerPartitionList(consumer, selected, offset);
+    rd_kafka_error_t *error;
+
+    error = rd_kafka_incremental_assign(consumer->client->rk, topics);
+    rd_kafka_topic_partition_list_destroy(topics);
+    if (error) {
+        fprintf(stderr, "%% Failed to start consuming topic '%s': %s\n", consumer->topics[0].name, rd_kafka_error_string(error));
+        rd_kafka_error_destroy(error);
+        return 1;
+    }
+    return 0;
+}
+
+static void unassignConsumerPartitions(aerosim_consumer_t *consumer, const int *selected)
+{
+    rd_kafka_topic_partition_list_t *topics = makeConsumerPartitionList(consumer, selected, RD_KAFKA_OFFSET_INVALID);
+    rd_kafka_error_t *error;
+
+    error = rd_kafka_incremental_unassign(consumer->client->rk, topics);
+    if (error) {
+        fprintf(stderr, "%% Failed to stop consuming topic '%s': %s\n", consumer->topics[0].name, rd_kafka_error_string(error));
+        rd_kafka_error_destroy(error);
+    }
+    rd_kafka_topic_partition_list_destroy(topics);
+}
+
+/*
+    Wait until the slot's latest offsets are known, i.e. the client has
+    fetched the partitions and cached their high watermarks. Slots are opened
+    together in mdlStart, so their deadlines expire together and the total
+    start delay is bounded by one timeout rather than one per block. Topics
+    whose offset can't be resolved in time (e.g. the topic doesn't exist yet)
+    are re-assigned from the block's fallback start offset.
+*/
+static void settleKafkaConsumer(aerosim_consumer_t *consumer)
+{
+    int64_t high_offsets[AEROSIM_MAX_CONSUMER_TOPICS];
+    int unresolved[AEROSIM_MAX_CONSUMER_TOPICS];
+    int unresolved_count;
+    int i;
+
+    for (;;) {
+        unresolved_count = 0;
+        for (i = 0; i < consumer->topic_count; i++) {
+            int64_t low_offset = RD_KAFKA_OFFSET_INVALID;
+            high_offsets[i] = RD_KAFKA_OFFSET_INVALID;
+            rd_kafka_get_watermark_offsets(consumer->client->rk, consumer->topics[i].name, consumer->partition,
+                                           &low_offset, &high_offsets[i]);
+            unresolved[i] = high_offsets[i] < 0;
+            unresolved_count += unresolved[i];
+        }
+        if (unresolved_count == 0 || aerosimMonotonicNs() >= consumer->settle_deadline_ns) {
+            break;
+        }
+        rd_kafka_poll(consumer->client->rk, 1);
     }
+    consumer->settled = 1;
 
-    rd_kafka_poll_set_consumer(rk);
+    for (i = 0; i < consumer->topic_count; i++) {
+        if (unresolved[i]) {
+            fprintf(stderr, "%% Topic '%s' latest offset not resolved after %d ms, initial offset set to: %ld\n",
+                    consumer->topics[i].name, AEROSIM_CONSUMER_SETTLE_TIMEOUT_MS, (long)consumer->fallback_offset);
+        } else {
+            fprintf(stderr, "%% Topic '%s' initial offset set to: %ld\n", consumer->topics[i].name, (long)high_offsets[i]);
+            consumer->topics[i].next_offset = high_offsets[i];
+        }
+    }
+
+    if (unresolved_count > 0 && consumer->fallback_offset != RD_KAFKA_OFFSET_END) {
+        unassignConsumerPartitions(consumer, unresolved);
+        assignConsumerPartitions(consumer, unresolved, consumer->fallback_offset);
+    }
+}
+
+/*
+    Open a consumer slot for partition 0 of one or more topics on a shared
+    consumer client; all topics are read through the slot's single queue.
+    The partition offset assignment always starts from the latest offset to
+    bypass any stale data, falling back to start_offset if the latest offset
+    can't be resolved.
+*/
+int aerosimOpenKafkaConsumerTopics(aerosim_consumer_t **pconsumer,
+    const char *brokers, const char *group, const char **topics, int topicCount,
+    int confCount, int topicConfCount, const char **confArray,
+    int64_t start_offset)
+{
+    aerosim_consumer_client_t *client = NULL;
+    aerosim_consumer_t *consumer = NULL;
+    int partition = 0;
+    int i;
 
-    topics = rd_kafka_topic_partition_list_new(1);
+    if (topicCount < 1 || topicCount > AEROSIM_MAX_CONSUMER_TOPICS) {
+        fprintf(stderr, "%% A consumer slot reads 1 to %d topics\n", AEROSIM_MAX_CONSUMER_TOPICS);
+        return 1;
+    }
 
-    /* Set initial configured offset to start_offset */
-    rd_kafka_topic_partition_t* topic_part = rd_kafka_topic_partition_list_add(topics, topic, partition);
-    topic_part->offset = start_offset;
+    client = acquireConsumerClient(brokers, group, topics, topicCount, confCount, topicConfCount, confArray);
+    if (client == NULL) {
+        return 4;
+    }
+    client->ref_count++;
 
-    /* Try to fetch high watermarks for the partition to get the latest offset of any stale data */
-    int64_t low_offset;
-    int64_t high_offset;
-    rd_kafka_resp_err_t err = rd_kafka_query_watermark_offsets(rk, topic, topic_part->partition, &low_offset, &high_offset, 5000);
-    if (err) {
-        fprintf(stderr, "%% Result of querying topic '%s' watermark offsets: %s\n", topic, rd_kafka_err2str(err));
-    } else if (high_offset >=0) {
-        topic_part->offset = high_offset;
+    consumer = (aerosim_consumer_t *)calloc(1, sizeof(aerosim_consumer_t));
+    if (consumer == NULL
+        || (consumer->topics = (aerosim_consumer_topic_t *)calloc(topicCount, sizeof(aerosim_consumer_topic_t))) == NULL) {
+        fprintf(stderr, "Couldn't allocate consumer slot\n");
+        free(consumer);
+        releaseConsumerClient(client);
+        return 1;
     }
-    fprintf(stderr, "%% Topic '%s' initial offset set to: %ld\n", topic, topic_part->offset);
+    consumer->client = client;
+    consumer->partition = partition;
+    consumer->event_fds[0] = consumer->event_fds[1] = -1;
+    consumer->consumer_lag = -1;
 
-    /* Assign topic partitions to start consuming them */
-    {
-        rd_kafka_resp_err_t err;
-        if ((err = rd_kafka_assign(rk, topics))) {
-            static char msg[256];
+    /*
+        Forward the partitions' fetch queues to the block's own queue before
+        the partitions are assigned, so no message can reach the client's
+        shared consumer queue.
+    */
+    consumer->queue = rd_kafka_queue_new(client->rk);
+    if (consumer->queue == NULL) {
+        fprintf(stderr, "%% Couldn't create queue for topic '%s'\n", topics[0]);
+        aerosimCloseKafkaConsumer(consumer);
+        return 6;
+    }
+    for (i = 0; i < topicCount; i++) {
+        aerosim_consumer_topic_t *topic = &consumer->topics[consumer->topic_count];
+        topic->next_offset = RD_KAFKA_OFFSET_INVALID;
+        if ((topic->name = strdup(topics[i])) == NULL) {
+            fprintf(stderr, "Couldn't allocate consumer slot\n");
+            aerosimCloseKafkaConsumer(consumer);
+            return 1;
+        }
+        consumer->topic_count++;
 
-            fprintf(stderr, "%% Failed to start consuming topics: %s\n", rd_kafka_err2str(err));
+        topic->partition_queue = rd_kafka_queue_get_partition(client->rk, topics[i], partition);
+        if (topic->partition_queue == NULL) {
+            fprintf(stderr, "%% Couldn't get queue for topic '%s' partition %d\n", topics[i], partition);
+            aerosimCloseKafkaConsumer(consumer);
             return 6;
         }
+        rd_kafka_queue_forward(topic->partition_queue, consumer->queue);
+    }
+
+    /*
+        Start from the latest offset to bypass any stale data. The logical
+        RD_KAFKA_OFFSET_END offset is resolved asynchronously by the client,
+        so opening a slot never blocks and the offset lookups of all blocks
+        run in parallel. The start offset is settled lazily on first poll.
+    */
+    consumer->fallback_offset = start_offset;
+    consumer->settle_deadline_ns = aerosimMonotonicNs() + (int64_t)AEROSIM_CONSUMER_SETTLE_TIMEOUT_MS * 1000000LL;
+    if (assignConsumerPartitions(consumer, NULL, RD_KAFKA_OFFSET_END)) {
+        aerosimCloseKafkaConsumer(consumer);
+        return 6;
+    }
+
+    consumer->next = client->consumers;
+    client->consumers = consumer;
+
+    *pconsumer = consumer;
+    return 0;
+}
+
+int aerosimOpenKafkaConsumer(aerosim_consumer_t **pconsumer,
+    const char *brokers, const char *group, const char *topic,
+    int confCount, int topicConfCount, const char **confArray,
+    int64_t start_offset)
+{
+    return aerosimOpenKafkaConsumerTopics(pconsumer, brokers, group, &topic, 1,
+                                          confCount, topicConfCount, confArray, start_offset);
+}
+
+/* The slot topic a message belongs to */
+static aerosim_consumer_topic_t *findConsumerTopic(aerosim_consumer_t *consumer, const rd_kafka_message_t *rkmessage)
+{
+    int i;
+
+    if (consumer->topic_count > 1) {
+        const char *name = rd_kafka_topic_name(rkmessage->rkt);
+        for (i = 1; i < consumer->topic_count; i++) {
+            if (strcmp(consumer->topics[i].name, name) == 0) {
+                return &consumer->topics[i];
+            }
+        }
+    }
+    return &consumer->topics[0];
+}
+
+/*
+    Poll the block's queue for the next message. Partition EOF and other
+    consumer events are skipped. Returns NULL if no message is available
+    within timeout_ms. The returned message must be released with
+    rd_kafka_message_destroy().
+*/
+static rd_kafka_message_t *pollKafkaConsumer(aerosim_consumer_t *consumer, int timeout_ms)
+{
+    rd_kafka_message_t *rkmessage;
+
+    if (consumer == NULL) {
+        return NULL;
+    }
+
+    if (!consumer->settled) {
+        settleKafkaConsumer(consumer);
+    }
+
+    /* Serve client events (errors, logs, statistics) of the shared client */
+    rd_kafka_poll(consumer->client->rk, 0);
+
+    while ((rkmessage = rd_kafka_consume_queue(consumer->queue, timeout_ms)) != NULL) {
+        if (!rkmessage->err) {
+            findConsumerTopic(consumer, rkmessage)->next_offset = rkmessage->offset + 1;
+            return rkmessage;
+        }
+        if (rkmessage->err != RD_KAFKA_RESP_ERR__PARTITION_EOF) {
+            fprintf(stderr, "%% Consume error for topic '%s': %s\n",
+                    rkmessage->rkt != NULL ? rd_kafka_topic_name(rkmessage->rkt) : consumer->topics[0].name,
+                    rd_kafka_err2str(rkmessage->err));
+        }
+        rd_kafka_message_destroy(rkmessage);
+        timeout_ms = 0;
+    }
+    return NULL;
+}
+
+rd_kafka_message_t *aerosimPollKafkaConsumer(aerosim_consumer_t *consumer, int timeout_ms)
+{
+    rd_kafka_message_t *rkmessage;
+
+    AEROSIM_TRACE_BEGIN("kafka.poll", "kafka");
+    rkmessage = pollKafkaConsumer(consumer, timeout_ms);
+    AEROSIM_TRACE_END("kafka.poll", "kafka");
+    return rkmessage;
+}
+
+/*
+    Number of messages of the slot's partitions that are not consumed yet:
+    the cached high watermark (updated by every fetch response, no broker
+    request) minus the offset after the last consumed message.
+*/
+int64_t aerosimGetKafkaConsumerLag(aerosim_consumer_t *consumer)
+{
+    int64_t lag = 0;
+    int i;
+
+    if (consumer == NULL) {
+        return 0;
+    }
+    for (i = 0; i < consumer->topic_count; i++) {
+        int64_t low_offset, high_offset = RD_KAFKA_OFFSET_INVALID;
+        rd_kafka_get_watermark_offsets(consumer->client->rk, consumer->topics[i].name, consumer->partition,
+                                       &low_offset, &high_offset);
+        if (high_offset >= 0 && consumer->topics[i].next_offset >= 0 && high_offset > consumer->topics[i].next_offset) {
+            lag += high_offset - consumer->topics[i].next_offset;
+        }
+    }
+    return lag;
+}
+
+/*
+    Skip the slot's backlog: seek each partition to its latest message. The
+    seek doesn't block; messages fetched from before the seek are dropped by
+    librdkafka instead of being returned by aerosimPollKafkaConsumer().
+*/
+int aerosimSkipKafkaConsumerToLatest(aerosim_consumer_t *consumer)
+{
+    rd_kafka_topic_partition_list_t *partitions;
+    rd_kafka_error_t *error;
+    int i;
+
+    if (consumer == NULL) {
+        return 1;
+    }
+    partitions = rd_kafka_topic_partition_list_new(consumer->topic_count);
+    for (i = 0; i < consumer->topic_count; i++) {
+        int64_t low_offset, high_offset = RD_KAFKA_OFFSET_INVALID;
+        rd_kafka_get_watermark_offsets(consumer->client->rk, consumer->topics[i].name, consumer->partition,
+                                       &low_offset, &high_offset);
+        if (high_offset > 0 && high_offset - 1 > consumer->topics[i].next_offset) {
+            rd_kafka_topic_partition_list_add(partitions, consumer->topics[i].name, consumer->partition)->offset =
+                high_offset - 1;
+            consumer->topics[i].next_offset = high_offset - 1;
+        }
+    }
+
+    error = (partitions->cnt > 0) ? rd_kafka_seek_partitions(consumer->client->rk, partitions, 0) : NULL;
+    rd_kafka_topic_partition_list_destroy(partitions);
+    if (error) {
+        fprintf(stderr, "%% Failed to skip to the latest message of topic '%s': %s\n", consumer->topics[0].name,
+                rd_kafka_error_string(error));
+        rd_kafka_error_destroy(error);
+        return 1;
+    }
+    return 0;
+}
+
+int aerosimGetKafkaConsumerOffsets(aerosim_consumer_t *consumer, int64_t *offsets, int maxCount)
+{
+    int i;
+
+    if (consumer == NULL) {
+        return 0;
+    }
+    for (i = 0; i < consumer->topic_count && i < maxCount; i++) {
+        offsets[i] = consumer->topics[i].next_offset;
+    }
+    return i;
+}
+
+/*
+    Re-assign the partitions at the given offsets rather than seeking them:
+    a slot that hasn't settled yet may still be resolving its logical start
+    offset, which a seek wouldn't cancel. The slot counts as settled
+    afterwards, so the start offset isn't applied on the first poll.
+*/
+int aerosimSeekKafkaConsumer(aerosim_consumer_t *consumer, const int64_t *offsets, int count)
+{
+    int selected[AEROSIM_MAX_CONSUMER_TOPICS];
+    int i, res = 0;
+
+    if (consumer == NULL || count != consumer->topic_count) {
+        fprintf(stderr, "%% Saved offsets don't match the topics of the consumer\n");
+        return 1;
+    }
+    if (!consumer->settled) {
+        settleKafkaConsumer(consumer);
+    }
+    for (i = 0; i < count; i++) {
+        if (offsets[i] < 0) {
+            continue;
+        }
+        memset(selected, 0, sizeof(selected));
+        selected[i] = 1;
+        unassignConsumerPartitions(consumer, selected);
+        if (assignConsumerPartitions(consumer, selected, offsets[i])) {
+            res = 1;
+            continue;
+        }
+        consumer->topics[i].next_offset = offsets[i];
+        fprintf(stderr, "%% Topic '%s' offset restored to: %ld\n", consumer->topics[i].name, (long)offsets[i]);
+    }
+    return res;
+}
+
+/*
+    Copy a message into the block's message/key buffers, truncating to the
+    buffer sizes and terminating with a NUL character when there's room.
+*/
+void aerosimCopyKafkaMessage(const rd_kafka_message_t *rkmessage,
+    int8_T *msg, uint32_T *msgLen, int maxMsgLen,
+    int8_T *key, uint32_T *keyLen, int maxKeyLen, int64_T *timestamp)
+{
+    size_t len = rkmessage->len < (size_t)maxMsgLen ? rkmessage->len : (size_t)maxMsgLen;
+    if (len > 0) {
+        memcpy(msg, rkmessage->payload, len);
+    }
+    if (len < (size_t)maxMsgLen) {
+        msg[len] = 0;
+    }
+    *msgLen = (uint32_T)len;
+
+    len = rkmessage->key_len < (size_t)maxKeyLen ? rkmessage->key_len : (size_t)maxKeyLen;
+    if (len > 0) {
+        memcpy(key, rkmessage->key, len);
+    }
+    if (len < (size_t)maxKeyLen) {
+        key[len] = 0;
+    }
+    *keyLen = (uint32_T)len;
+
+    if (timestamp != NULL) {
+        *timestamp = (int64_T)rd_kafka_message_timestamp(rkmessage, NULL);
+    }
+}
+
+/*
+    Non-blocking replacement for mwConsumeKafkaMessage() reading from the
+    block's consumer slot. Returns 0 if no message, 1 if msg was received.
+*/
+int aerosimConsumeKafkaMessage(aerosim_consumer_t *consumer,
+    int8_T *msg, uint32_T *msgLen, int maxMsgLen,
+    int8_T *key, uint32_T *keyLen, int maxKeyLen, int64_T *timestamp)
+{
+    rd_kafka_message_t *rkmessage = aerosimPollKafkaConsumer(consumer, 0);
+    if (rkmessage == NULL) {
+        return 0;
+    }
+
+    aerosimCopyKafkaMessage(rkmessage, msg, msgLen, maxMsgLen, key, keyLen, maxKeyLen, timestamp);
+    rd_kafka_message_destroy(rkmessage);
+    return 1;
+}
+
+#ifndef _WIN32
+/*
+    Let librdkafka write to a pipe whenever the slot's queue goes from empty
+    to non-empty, so waiting threads can sleep in poll() instead of spinning.
+*/
+static int enableConsumerEvents(aerosim_consumer_t *consumer)
+{
+    int i;
+
+    if (consumer->event_fds[0] >= 0) {
+        return 0;
+    }
+    if (pipe(consumer->event_fds) != 0) {
+        fprintf(stderr, "%% Couldn't create event pipe for topic '%s': %s\n", consumer->topics[0].name, strerror(errno));
+        consumer->event_fds[0] = consumer->event_fds[1] = -1;
+        return 1;
+    }
+    for (i = 0; i < 2; i++) {
+        fcntl(consumer->event_fds[i], F_SETFL, fcntl(consumer->event_fds[i], F_GETFL) | O_NONBLOCK);
+        fcntl(consumer->event_fds[i], F_SETFD, FD_CLOEXEC);
+    }
+    rd_kafka_queue_io_event_enable(consumer->queue, consumer->event_fds[1], "1", 1);
+    return 0;
+}
+
+static void drainConsumerEvents(aerosim_consumer_t *consumer)
+{
+    char buf[64];
+    while (read(consumer->event_fds[0], buf, sizeof(buf)) > 0) {
+    }
+}
+#endif
+
+/*
+    Wait policy
+*/
+#define AEROSIM_WAIT_ADAPT_INTERVAL 64
+#define AEROSIM_WAIT_SERVE_INTERVAL_NS 1000000LL
+
+int aerosimInitWaitPolicy(aerosim_wait_policy_t *policy, const char *mode,
+    double spin_us, double max_spin_us)
+{
+    memset(policy, 0, sizeof(*policy));
+
+    if (mode == NULL || strcmp(mode, "block") == 0) {
+        policy->mode = AEROSIM_WAIT_BLOCK;
+    } else if (strcmp(mode, "spin") == 0) {
+        policy->mode = AEROSIM_WAIT_SPIN;
+    } else if (strcmp(mode, "adaptive") == 0) {
+        policy->mode = AEROSIM_WAIT_ADAPTIVE;
+    } else {
+        fprintf(stderr, "%% Unknown wait policy '%s' (expected block, spin or adaptive)\n", mode);
+        return 1;
+    }
+
+    if (spin_us < 0 || max_spin_us < 0) {
+        fprintf(stderr, "%% Wait policy spin budgets must not be negative\n");
+        return 1;
+    }
+    policy->max_spin_ns = (int64_t)(max_spin_us * 1000.0);
+    policy->spin_budget_ns = (int64_t)(spin_us * 1000.0);
+    if (policy->spin_budget_ns > policy->max_spin_ns) {
+        policy->spin_budget_ns = policy->max_spin_ns;
+    }
+    return 0;
+}
+
+const char *aerosimWaitModeName(aerosim_wait_mode_t mode)
+{
+    switch (mode) {
+    case AEROSIM_WAIT_SPIN:
+        return "spin";
+    case AEROSIM_WAIT_ADAPTIVE:
+        return "adaptive";
+    default:
+        return "block";
+    }
+}
+
+/* Histogram bucket b holds waits shorter than 2^b us (bucket 0: below 1 us) */
+static int waitHistogramBucket(int64_t wait_ns)
+{
+    int64_t us = wait_ns / 1000;
+    int bucket = 0;
+    while (us > 0 && bucket < AEROSIM_WAIT_HISTOGRAM_BUCKETS - 1) {
+        us >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+static int64_t waitHistogramQuantileNs(const aerosim_wait_policy_t *policy, double quantile)
+{
+    uint64_t target = (uint64_t)(quantile * (double)policy->samples);
+    uint64_t seen = 0;
+    int b;
+    for (b = 0; b < AEROSIM_WAIT_HISTOGRAM_BUCKETS; b++) {
+        seen += policy->histogram[b];
+        if (seen > target) {
+            break;
+        }
+    }
+    return ((int64_t)1 << b) * 1000;
+}
+
+/*
+    Re-learn the spin budget: spin long enough to catch 90% of the recent
+    waits if that fits the maximum budget, else 50%. If most waits are longer
+    than the maximum budget spinning only burns CPU, so block right away.
+    Older samples are halved so the budget follows changes in the step rate.
+*/
+static void adaptWaitPolicy(aerosim_wait_policy_t *policy)
+{
+    int64_t p90 = waitHistogramQuantileNs(policy, 0.9);
+    int64_t p50 = waitHistogramQuantileNs(policy, 0.5);
+    int b;
+
+    if (p90 <= policy->max_spin_ns) {
+        policy->spin_budget_ns = p90;
+    } else if (p50 <= policy->max_spin_ns) {
+        policy->spin_budget_ns = p50;
+    } else {
+        policy->spin_budget_ns = 0;
+    }
+
+    policy->samples = 0;
+    for (b = 0; b < AEROSIM_WAIT_HISTOGRAM_BUCKETS; b++) {
+        policy->histogram[b] /= 2;
+        policy->samples += policy->histogram[b];
+    }
+}
+
+void aerosimRecordWait(aerosim_wait_policy_t *policy, int64_t wait_ns, int64_t latency_ns, int blocked)
+{
+    if (policy == NULL) {
+        return;
+    }
+
+    policy->waits++;
+    if (blocked) {
+        policy->block_wakeups++;
+    } else {
+        policy->spin_wakeups++;
+        policy->wake_latency_sum_ns += latency_ns;
+        if (latency_ns > policy->wake_latency_max_ns) {
+            policy->wake_latency_max_ns = latency_ns;
+        }
+    }
+
+    policy->histogram[waitHistogramBucket(wait_ns)]++;
+    policy->samples++;
+    if (policy->mode == AEROSIM_WAIT_ADAPTIVE && policy->samples >= AEROSIM_WAIT_ADAPT_INTERVAL) {
+        adaptWaitPolicy(policy);
+    }
+}
+
+/* Collect the distinct clients of the consumer slots, to serve each one's events */
+static int collectConsumerClients(aerosim_consumer_t **consumers, int count, rd_kafka_t **clients)
+{
+    int client_count = 0;
+    int i, j;
+
+    for (i = 0; i < count; i++) {
+        rd_kafka_t *rk = consumers[i]->client->rk;
+        for (j = 0; j < client_count; j++) {
+            if (clients[j] == rk) {
+                break;
+            }
+        }
+        if (j == client_count) {
+            clients[client_count++] = rk;
+        }
+    }
+    return client_count;
+}
+
+static void serveConsumerClients(rd_kafka_t **clients, int client_count)
+{
+    int i;
+    for (i = 0; i < client_count; i++) {
+        rd_kafka_poll(clients[i], 0);
+    }
+}
+
+static int readyKafkaConsumer(aerosim_consumer_t **consumers, int count)
+{
+    int i;
+    for (i = 0; i < count; i++) {
+        if (rd_kafka_queue_length(consumers[i]->queue) > 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+    Wait until one of the consumer slots has a queued message or event, or
+    until the monotonic deadline (see aerosimMonotonicNs(), INT64_MAX waits
+    forever) has passed. Blocking doesn't consume CPU: the thread sleeps on
+    the queues' I/O event pipes and wakes up as soon as a message arrives.
+    With a spin or adaptive policy the queues are busy-polled first, which
+    avoids the scheduler wake-up latency at the cost of a busy core. A NULL
+    policy always blocks. The events of every client of the slots are served
+    while waiting. At most AEROSIM_MAX_WAIT_CONSUMERS slots can be waited for.
+
+    The recorded wake-up latency is the busy-poll check interval of spin
+    wake-ups. Blocked wake-ups record none: the delay from a message's
+    arrival to poll() returning isn't observable here.
+
+    Returns the index of a ready slot, or -1 on timeout or error.
+*/
+static int waitKafkaConsumers(aerosim_consumer_t **consumers, int count, int64_t deadline_ns,
+    aerosim_wait_policy_t *policy)
+{
+#ifndef _WIN32
+    struct pollfd fds[AEROSIM_MAX_WAIT_CONSUMERS];
+#endif
+    rd_kafka_t *clients[AEROSIM_MAX_WAIT_CONSUMERS];
+    int client_count;
+    int events_enabled = 1;
+    int blocked = 0;
+    int64_t start_ns, check_ns, served_ns, spin_end_ns;
+    int i, ready;
+
+    if (count > AEROSIM_MAX_WAIT_CONSUMERS) {
+        fprintf(stderr, "%% Can't wait for %d consumers, the maximum is %d\n",
+            count, AEROSIM_MAX_WAIT_CONSUMERS);
+        return -1;
+    }
+    client_count = collectConsumerClients(consumers, count, clients);
+
+    for (i = 0; i < count; i++) {
+        if (!consumers[i]->settled) {
+            settleKafkaConsumer(consumers[i]);
+        }
+#ifdef _WIN32
+        /* No pipe support for queue events */
+        events_enabled = 0;
+#else
+        if (enableConsumerEvents(consumers[i])) {
+            events_enabled = 0;
+        }
+        fds[i].fd = consumers[i]->event_fds[0];
+        fds[i].events = POLLIN;
+#endif
+    }
+
+    start_ns = aerosimMonotonicNs();
+    check_ns = start_ns;
+    served_ns = start_ns;
+    spin_end_ns = start_ns;
+    if (policy != NULL && policy->mode == AEROSIM_WAIT_SPIN) {
+        spin_end_ns = deadline_ns;
+    } else if (policy != NULL && policy->mode == AEROSIM_WAIT_ADAPTIVE) {
+        spin_end_ns = start_ns + policy->spin_budget_ns;
+    }
+
+    for (;;) {
+        int64_t now_ns;
+        int timeout_ms;
+
+        /* The event pipe is only written on empty -> non-empty transitions, check queues first */
+        ready = readyKafkaConsumer(consumers, count);
+        now_ns = aerosimMonotonicNs();
+        if (ready >= 0) {
+#ifndef _WIN32
+            if (!blocked && events_enabled) {
+                /* Consume the pipe wake-up that was skipped by spinning */
+                drainConsumerEvents(consumers[ready]);
+            }
+#endif
+            aerosimRecordWait(policy, now_ns - start_ns, now_ns - check_ns, blocked);
+            return ready;
+        }
+        if (now_ns >= deadline_ns) {
+            if (policy != NULL) {
+                policy->timeouts++;
+            }
+            return -1;
+        }
+
+        if (now_ns < spin_end_ns) {
+            check_ns = now_ns;
+            if (now_ns - served_ns >= AEROSIM_WAIT_SERVE_INTERVAL_NS) {
+                /* Keep serving client events while spinning */
+                serveConsumerClients(clients, client_count);
+                served_ns = now_ns;
+            }
+            AEROSIM_CPU_RELAX();
+            continue;
+        }
+
+        if (deadline_ns - now_ns > (int64_t)1000 * 1000000LL) {
+            /* Wake up at least once a second to serve client events */
+            timeout_ms = 1000;
+        } else {
+            /* Round up so a wake-up never happens before the deadline */
+            timeout_ms = (int)((deadline_ns - now_ns + 999999) / 1000000);
+        }
+        if (!events_enabled && timeout_ms > 1) {
+            /* Fall back to 1 ms polling */
+            timeout_ms = 1;
+        }
+
+#ifdef _WIN32
+        Sleep(timeout_ms);
+        check_ns = aerosimMonotonicNs();
+#else
+        int polled = poll(fds, count, timeout_ms);
+        check_ns = aerosimMonotonicNs();
+        if (polled > 0) {
+            for (i = 0; i < count; i++) {
+                if (fds[i].revents & POLLIN) {
+                    drainConsumerEvents(consumers[i]);
+                }
+            }
+        }
+#endif
+        serveConsumerClients(clients, client_count);
+        blocked = 1;
+        served_ns = check_ns;
+    }
+}
+
+int aerosimWaitKafkaConsumers(aerosim_consumer_t **consumers, int count, int64_t deadline_ns,
+    aerosim_wait_policy_t *policy)
+{
+    int ready;
+
+    AEROSIM_TRACE_BEGIN("kafka.wait", "kafka");
+    ready = waitKafkaConsumers(consumers, count, deadline_ns, policy);
+    AEROSIM_TRACE_END("kafka.wait", "kafka");
+    return ready;
+}
+
+/*
+    Close a consumer slot: unassign its partitions and release the shared
+    client, which is closed and destroyed with its last slot.
+*/
+void aerosimCloseKafkaConsumer(aerosim_consumer_t *consumer)
+{
+    aerosim_consumer_t **pconsumer;
+    aerosim_consumer_client_t *client;
+    int i;
+
+    if (consumer == NULL) {
+        return;
+    }
+    client = consumer->client;
+
+    for (pconsumer = &client->consumers; *pconsumer != NULL; pconsumer = &(*pconsumer)->next) {
+        if (*pconsumer == consumer) {
+            *pconsumer = consumer->next;
+            unassignConsumerPartitions(consumer, NULL);
+            break;
+        }
+    }
+
+    for (i = 0; i < consumer->topic_count; i++) {
+        if (consumer->topics[i].partition_queue != NULL) {
+            rd_kafka_queue_forward(consumer->topics[i].partition_queue, NULL);
+            rd_kafka_queue_destroy(consumer->topics[i].partition_queue);
+        }
+        free(consumer->topics[i].name);
+    }
+    if (consumer->queue != NULL) {
+        if (consumer->event_fds[1] >= 0) {
+            rd_kafka_queue_io_event_enable(consumer->queue, -1, NULL, 0);
+        }
+        rd_kafka_queue_destroy(consumer->queue);
+    }
+#ifndef _WIN32
+    if (consumer->event_fds[0] >= 0) {
+        close(consumer->event_fds[0]);
+        close(consumer->event_fds[1]);
+    }
+#endif
+    free(consumer->topics);
+    free(consumer);
+
+    releaseConsumerClient(client);
+}
+
+/*
+    Shared producer registry
+
+    Every producer block used to create its own rd_kafka_t in mdlStart, each
+    with its own broker connections, I/O threads and batching queues. Blocks
+    with identical brokers and client configuration now share one producer
+    instance, so messages to different topics are batched together and only
+    one set of connections is opened. Each block still owns its own
+    rd_kafka_t topic handle.
+*/
+typedef struct aerosim_producer_entry_s
+{
+    char *registry_key; /* brokers + client configuration */
+    rd_kafka_t *rk;
+    int ref_count;
+    struct aerosim_producer_entry_s *next;
+} aerosim_producer_entry_t;
+
+static aerosim_producer_entry_t *producer_registry = NULL;
+
+static void producerDeliveryReportCallback(rd_kafka_t *rk, const rd_kafka_message_t *rkmessage, void *opaque)
+{
+    if (rkmessage->err) {
+        fprintf(stderr, "%% Message delivery failed: %s\n", rd_kafka_err2str(rkmessage->err));
+    }
+}
+
+static rd_kafka_t *createKafkaProducer(const char *brokers, int confCount, const char **confArray)
+{
+    rd_kafka_t *rk = NULL;
+    rd_kafka_conf_t *conf = NULL;
+    aerosim_stats_sink_t *sink = NULL;
+    int i;
+
+    conf = rd_kafka_conf_new();
+    if (conf == NULL) {
+        fprintf(stderr, "Couldn't instantiate Kafka config object.\n");
+        return NULL;
+    }
+
+    /* Set additional user defined configuration values */
+    for (i = 0; i < confCount; i += 2) {
+        if (isAerosimOption(confArray[i])) {
+            continue;
+        }
+        if (rd_kafka_conf_set(conf, confArray[i], confArray[i + 1], errstr, sizeof(errstr)) != RD_KAFKA_CONF_OK) {
+            fprintf(stderr, "aerosimAcquireKafkaProducer: %s\n", errstr);
+            rd_kafka_conf_destroy(conf);
+            return NULL;
+        }
+    }
+
+    rd_kafka_conf_set_dr_msg_cb(conf, producerDeliveryReportCallback);
+
+    /* Statistics are only emitted when statistics.interval.ms is configured */
+    sink = newStatsSink(confCount, confArray);
+    if (sink == NULL) {
+        fprintf(stderr, "Couldn't allocate statistics sink\n");
+        rd_kafka_conf_destroy(conf);
+        return NULL;
+    }
+    rd_kafka_conf_set_opaque(conf, sink);
+    rd_kafka_conf_set_stats_cb(conf, statsCallback);
+
+    /* rd_kafka_new() takes ownership of the conf object */
+    rk = rd_kafka_new(RD_KAFKA_PRODUCER, conf, errstr, sizeof(errstr));
+    if (!rk) {
+        fprintf(stderr, "%s\n", errstr);
+        rd_kafka_conf_destroy(conf);
+        freeStatsSink(sink);
+        return NULL;
+    }
+
+    if (rd_kafka_brokers_add(rk, brokers) == 0) {
+        fprintf(stderr, "%% No valid brokers specified\n");
+        rd_kafka_destroy(rk);
+        freeStatsSink(sink);
+        return NULL;
+    }
+
+    return rk;
+}
+
+/*
+    Drop-in replacement for mwInitializeKafkaProducer() that reuses an
+    existing producer instance when one with the same brokers and client
+    configuration is already open.
+
+    NOTE: librdkafka keeps a single topic object per topic name and client,
+          so the topic configuration of the first block opening a given
+          topic is the one in effect for all blocks producing to it.
+*/
+int aerosimAcquireKafkaProducer(rd_kafka_t **prk, rd_kafka_topic_t **prkt,
+    const char *brokers, const char *topic,
+    int confCount, int topicConfCount, const char **confArray)
+{
+    aerosim_producer_entry_t *entry = NULL;
+    rd_kafka_topic_conf_t *topic_conf = NULL;
+    rd_kafka_topic_t *rkt = NULL;
+    int i;
+
+    char *registry_key = makeRegistryKey(brokers, "", confCount, confArray);
+    if (registry_key == NULL) {
+        fprintf(stderr, "Couldn't allocate producer registry key\n");
+        return 1;
+    }
+
+    for (entry = producer_registry; entry != NULL; entry = entry->next) {
+        if (strcmp(entry->registry_key, registry_key) == 0) {
+            break;
+        }
+    }
+
+    if (entry == NULL) {
+        rd_kafka_t *rk = createKafkaProducer(brokers, confCount, confArray);
+        if (rk == NULL) {
+            free(registry_key);
+            return 4;
+        }
+
+        entry = (aerosim_producer_entry_t *)malloc(sizeof(aerosim_producer_entry_t));
+        if (entry == NULL) {
+            freeStatsSink((aerosim_stats_sink_t *)rd_kafka_opaque(rk));
+            rd_kafka_destroy(rk);
+            free(registry_key);
+            return 1;
+        }
+        entry->registry_key = registry_key;
+        entry->rk = rk;
+        entry->ref_count = 0;
+        entry->next = producer_registry;
+        producer_registry = entry;
+    } else {
+        free(registry_key);
+    }
+    entry->ref_count++;
+
+    /* Topic configuration */
+    topic_conf = rd_kafka_topic_conf_new();
+    if (topic_conf == NULL) {
+        fprintf(stderr, "Couldn't instantiate topic configuration\n");
+        aerosimReleaseKafkaProducer(entry->rk, NULL);
+        return 2;
+    }
+    for (i = 0; i < topicConfCount; i += 2) {
+        if (isAerosimOption(confArray[confCount + i])) {
+            continue;
+        }
+        if (rd_kafka_topic_conf_set(topic_conf, confArray[confCount + i], confArray[confCount + i + 1],
+                                    errstr, sizeof(errstr)) != RD_KAFKA_CONF_OK) {
+            fprintf(stderr, "aerosimAcquireKafkaProducer: %s\n", errstr);
+            rd_kafka_topic_conf_destroy(topic_conf);
+            aerosimReleaseKafkaProducer(entry->rk, NULL);
+            return 2;
+        }
+    }
+
+    /* rd_kafka_topic_new() takes ownership of the topic_conf object */
+    rkt = rd_kafka_topic_new(entry->rk, topic, topic_conf);
+    if (!rkt) {
+        fprintf(stderr, "%% Failed to create topic object: %s\n", rd_kafka_err2str(rd_kafka_last_error()));
+        aerosimReleaseKafkaProducer(entry->rk, NULL);
+        return 3;
+    }
+
+    *prk = entry->rk;
+    *prkt = rkt;
+    return 0;
+}
+
+/*
+    Release a topic handle obtained from aerosimAcquireKafkaProducer(). The
+    shared producer instance is flushed and destroyed with its last user.
+*/
+void aerosimReleaseKafkaProducer(rd_kafka_t *rk, rd_kafka_topic_t *rkt)
+{
+    aerosim_producer_entry_t **pentry;
+
+    if (rkt != NULL) {
+        rd_kafka_topic_destroy(rkt);
+    }
+    if (rk == NULL) {
+        return;
+    }
+
+    for (pentry = &producer_registry; *pentry != NULL; pentry = &(*pentry)->next) {
+        aerosim_producer_entry_t *entry = *pentry;
+        if (entry->rk != rk) {
+            continue;
+        }
+
+        if (--entry->ref_count > 0) {
+            return;
+        }
+
+        /* Last user of this producer, wait for outstanding messages to be delivered */
+        rd_kafka_flush(rk, 5000);
+        if (rd_kafka_outq_len(rk) > 0) {
+            fprintf(stderr, "%% %d message(s) were not delivered\n", rd_kafka_outq_len(rk));
+        }
+        aerosim_stats_sink_t *sink = (aerosim_stats_sink_t *)rd_kafka_opaque(rk);
+        rd_kafka_destroy(rk);
+        freeStatsSink(sink);
+
+        *pentry = entry->next;
+        free(entry->registry_key);
+        free(entry);
+        return;
+    }
+}
+
+int aerosimProduceKafkaMessageWithHeaders(rd_kafka_t *rk, rd_kafka_topic_t *rkt,
+    const char *key, int keyLen, const char *payload, int len, int64_t timestamp,
+    rd_kafka_headers_t *headers)
+{
+    const char *msgKey = (keyLen > 0) ? key : NULL;
+    rd_kafka_resp_err_t err;
+
+    /* librdkafka stamps a zero timestamp with the current time, so that's what non-positive ones map to */
+    err = rd_kafka_producev(rk,
+                            RD_KAFKA_V_RKT(rkt),
+                            RD_KAFKA_V_PARTITION(RD_KAFKA_PARTITION_UA),
+                            RD_KAFKA_V_MSGFLAGS(RD_KAFKA_MSG_F_COPY),
+                            RD_KAFKA_V_KEY(msgKey, (size_t)keyLen),
+                            RD_KAFKA_V_VALUE((void *)payload, (size_t)len),
+                            RD_KAFKA_V_TIMESTAMP(timestamp > 0 ? timestamp : 0),
+                            RD_KAFKA_V_HEADERS(headers),
+                            RD_KAFKA_V_END);
+    if (err != RD_KAFKA_RESP_ERR_NO_ERROR) {
+        fprintf(stderr, "%% Failed to produce to topic %s: %s\n", rd_kafka_topic_name(rkt), rd_kafka_err2str(err));
+        rd_kafka_headers_destroy(headers);
+        return 1;
     }
 
-    *prk = rk;
+    /* Serve the delivery reports */
+    rd_kafka_poll(rk, 0);
     return 0;
-}
\ No newline at end of file
+}
@@ -1,7 +1,197 @@
+#ifndef AEROSIM_KAFKA_UTILS_H
+#define AEROSIM_KAFKA_UTILS_H
+
 #include "mw_kafka_utils.h"
 #include "mx_kafka_utils.h"
 
-int aerosimInitializeKafkaConsumer(rd_kafka_t **prk,
+int64_t aerosimMonotonicNs(void);
+int64_t aerosimWallClockMs(void);
+void aerosimSleepUntilNs(int64_t deadline_ns);
+
+/*
+    HDR-style latency histogram: exact below 64, above that 32 linear
+    sub-buckets per power of two (about 3% relative precision), covering
+    all non-negative int64 values. Fixed size, recording never allocates.
+*/
+#define AEROSIM_HISTOGRAM_SUB_BITS 5
+#define AEROSIM_HISTOGRAM_BUCKETS 1920
+
+typedef struct {
+    uint64_t counts[AEROSIM_HISTOGRAM_BUCKETS];
+    uint64_t count;
+    int64_t min;
+    int64_t max;
+    double sum;
+} aerosim_histogram_t;
+
+void aerosimHistogramReset(aerosim_histogram_t *histogram);
+void aerosimHistogramRecord(aerosim_histogram_t *histogram, int64_t value);
+int64_t aerosimHistogramPercentile(const aerosim_histogram_t *histogram, double percentile);
+
+/*
+    Block options without a dedicated mask parameter are passed as
+    "aerosim." prefixed keys in the client config; they are never handed to
+    librdkafka and don't affect client sharing.
+*/
+#define AEROSIM_OPTION_PREFIX "aerosim."
+
+const char *aerosimGetOption(int confCount, const char **confArray, const char *key);
+int aerosimGetOptionMX(const mxArray *conf, const char *key, char *value, int valueLen);
+double aerosimGetOptionNumberMX(const mxArray *conf, const char *key, double defaultValue);
+
+/*
+    Shared consumer runtime. Consumer blocks with the same brokers, group and
+    configuration share one rd_kafka_t instance; each block reads its topics
+    from its own aerosim_consumer_t slot queue. Opening a slot doesn't block;
+    its start offset is resolved asynchronously and settled on first poll.
+    Like the producer registry, the client registry is static within the
+    MEX module that links this file: each S-function is its own MEX module,
+    so blocks of one S-function share a client, but e.g. the clock sync
+    block and the consumer blocks each get their own.
+*/
+typedef struct aerosim_consumer_s aerosim_consumer_t;
+
+#define AEROSIM_MAX_CONSUMER_TOPICS 8
+
+int aerosimOpenKafkaConsumerTopics(aerosim_consumer_t **pconsumer,
+    const char *brokers, const char *group, const char **topics, int topicCount,
+    int confCount, int topicConfCount, const char **confArray,
+    int64_t start_offset);
+
+int aerosimOpenKafkaConsumer(aerosim_consumer_t **pconsumer,
     const char *brokers, const char *group, const char *topic,
     int confCount, int topicConfCount, const char **confArray,
-    int64_t start_offset);
\ No newline at end of file
+    int64_t start_offset);
+
+rd_kafka_message_t *aerosimPollKafkaConsumer(aerosim_consumer_t *consumer, int timeout_ms);
+
+void aerosimCopyKafkaMessage(const rd_kafka_message_t *rkmessage,
+    int8_T *msg, uint32_T *msgLen, int maxMsgLen,
+    int8_T *key, uint32_T *keyLen, int maxKeyLen, int64_T *timestamp);
+
+int aerosimConsumeKafkaMessage(aerosim_consumer_t *consumer,
+    int8_T *msg, uint32_T *msgLen, int maxMsgLen,
+    int8_T *key, uint32_T *keyLen, int maxKeyLen, int64_T *timestamp);
+
+int64_t aerosimGetKafkaConsumerLag(aerosim_consumer_t *consumer);
+int aerosimSkipKafkaConsumerToLatest(aerosim_consumer_t *consumer);
+
+/*
+    Offsets of the next message to consume from each of the slot's topics,
+    in the order they were opened, RD_KAFKA_OFFSET_INVALID for a topic that
+    hasn't resolved its start offset yet. Seeking resumes each topic from its
+    saved offset instead of the start offset; topics with a negative offset
+    keep their position.
+*/
+int aerosimGetKafkaConsumerOffsets(aerosim_consumer_t *consumer, int64_t *offsets, int maxCount);
+int aerosimSeekKafkaConsumer(aerosim_consumer_t *consumer, const int64_t *offsets, int count);
+
+/*
+    librdkafka statistics. Every client registers a statistics callback,
+    which librdkafka only calls when the client config sets
+    statistics.interval.ms, from the thread serving the client's events. The
+    key figures of the latest statistics are kept per client. The raw
+    statistics JSON is appended to the file named by the aerosim.stats.file
+    option (one line per update), which is moved to <file>.1 once it reaches
+    aerosim.stats.file.max.bytes.
+*/
+#define AEROSIM_STATS_FILE_MAX_BYTES (16L * 1024 * 1024)
+
+typedef struct {
+    uint64_t updates;     /* statistics received */
+    int64_t rtt_p99_us;   /* highest broker round-trip time p99 */
+    int64_t msgq_depth;   /* messages waiting in the client's queues */
+    int64_t txbytes;      /* bytes sent to the brokers */
+    int64_t rxbytes;      /* bytes received from the brokers */
+    int64_t consumer_lag; /* messages behind the high watermark, -1 if unknown or not a consumer */
+} aerosim_kafka_stats_t;
+
+const aerosim_kafka_stats_t *aerosimGetKafkaStats(rd_kafka_t *rk);
+int aerosimGetKafkaConsumerStats(aerosim_consumer_t *consumer, aerosim_kafka_stats_t *stats);
+
+/* Statistics output port: rtt p99 [s], msgq depth, txbytes, consumer lag */
+#define AEROSIM_STATS_OUTPUT_WIDTH 4
+#define AEROSIM_STATS_OUTPUT_OPTION "aerosim.stats.output"
+
+void aerosimWriteKafkaStatsOutput(const aerosim_kafka_stats_t *stats, real_T *output);
+
+#define AEROSIM_MAX_WAIT_CONSUMERS 16
+
+/*
+    Wait policy for aerosimWaitKafkaConsumers(): block on the queue event
+    pipes, busy-poll the queues, or busy-poll for an adaptive budget before
+    blocking. The adaptive budget is learned from a log2 histogram of the
+    observed wait durations. The policy also collects wake-up statistics;
+    the wake-up latency only covers spin wake-ups.
+*/
+typedef enum {
+    AEROSIM_WAIT_BLOCK = 0,
+    AEROSIM_WAIT_SPIN,
+    AEROSIM_WAIT_ADAPTIVE
+} aerosim_wait_mode_t;
+
+#define AEROSIM_WAIT_HISTOGRAM_BUCKETS 32
+
+typedef struct {
+    aerosim_wait_mode_t mode;
+    int64_t spin_budget_ns;
+    int64_t max_spin_ns;
+    uint64_t histogram[AEROSIM_WAIT_HISTOGRAM_BUCKETS];
+    uint64_t samples;
+    uint64_t waits;
+    uint64_t spin_wakeups;
+    uint64_t block_wakeups;
+    uint64_t timeouts;
+    int64_t wake_latency_sum_ns;
+    int64_t wake_latency_max_ns;
+} aerosim_wait_policy_t;
+
+int aerosimInitWaitPolicy(aerosim_wait_policy_t *policy, const char *mode,
+    double spin_us, double max_spin_us);
+
+const char *aerosimWaitModeName(aerosim_wait_mode_t mode);
+
+int aerosimWaitKafkaConsumers(aerosim_consumer_t **consumers, int count, int64_t deadline_ns,
+    aerosim_wait_policy_t *policy);
+
+/*
+    Account a completed wait, e.g. for waits implemented by other transports.
+    The latency is only accounted for spin wake-ups (blocked == 0).
+*/
+void aerosimRecordWait(aerosim_wait_policy_t *policy, int64_t wait_ns, int64_t latency_ns, int blocked);
+
+/* Busy-poll loop hint */
+#if defined(_MSC_VER)
+#define AEROSIM_CPU_RELAX() YieldProcessor()
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define AEROSIM_CPU_RELAX() __builtin_ia32_pause()
+#elif defined(__GNUC__) && defined(__aarch64__)
+#define AEROSIM_CPU_RELAX() __asm__ __volatile__("yield")
+#else
+#define AEROSIM_CPU_RELAX() ((void)0)
+#endif
+
+void aerosimCloseKafkaConsumer(aerosim_consumer_t *consumer);
+
+/*
+    Shared producer registry. Producer blocks with the same broker list and
+    client configuration share one rd_kafka_t instance (reference counted)
+    and only own their rd_kafka_topic_t handle. The registry is process-wide
+    within the MEX module that links this file.
+*/
+int aerosimAcquireKafkaProducer(rd_kafka_t **prk, rd_kafka_topic_t **prkt,
+    const char *brokers, const char *topic,
+    int confCount, int topicConfCount, const char **confArray);
+
+void aerosimReleaseKafkaProducer(rd_kafka_t *rk, rd_kafka_topic_t *rkt);
+
+/*
+    Produce a message with headers, which are owned by the message once
+    produced and destroyed on failure. A timestamp of zero or less (e.g.
+    -1) stamps the message with the current time. Returns 0 on success.
+*/
+int aerosimProduceKafkaMessageWithHeaders(rd_kafka_t *rk, rd_kafka_topic_t *rkt,
+    const char *key, int keyLen, const char *payload, int len, int64_t timestamp,
+    rd_kafka_headers_t *headers);
+
+#endif /* AEROSIM_KAFKA_UTILS_H */
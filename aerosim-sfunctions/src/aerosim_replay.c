@@ -0,0 +1,541 @@
+#include "aerosim_replay.h"
+
+#ifdef _WIN32
+
+aerosim_recorder_t *aerosimOpenRecorder(const char *file)
+{
+    fprintf(stderr, "%% Recording is not supported on Windows\n");
+    return NULL;
+}
+
+void aerosimRecordMessage(aerosim_recorder_t *recorder, uint64_t step, const aerosim_message_t *message)
+{
+}
+
+void aerosimCloseRecorder(aerosim_recorder_t *recorder)
+{
+}
+
+int aerosimOpenReplayReader(aerosim_reader_t *reader, const char *file,
+    const char **topics, int topicCount)
+{
+    fprintf(stderr, "%% The replay:// transport is not supported on Windows\n");
+    return 1;
+}
+
+int aerosimOpenReplayWriter(aerosim_writer_t *writer)
+{
+    fprintf(stderr, "%% The replay:// transport is not supported on Windows\n");
+    return 1;
+}
+
+#else
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Initial size of a segment file mapping, doubled whenever it is full */
+#define AEROSIM_RECORD_INITIAL_BYTES (16L * 1024 * 1024)
+
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t header_bytes;
+} record_file_header_t;
+
+typedef struct {
+    uint32_t record_bytes;
+    uint32_t topic_len;
+    uint32_t key_len;
+    uint32_t len;
+    uint64_t step;
+    int64_t timestamp;
+} record_header_t;
+
+typedef struct {
+    uint64_t step;
+    uint64_t offset;
+} record_index_entry_t;
+
+/*
+    Recorder
+*/
+struct aerosim_recorder_s {
+    char *file;
+    int fd;
+    unsigned char *data;
+    size_t mapped;      /* size of the file and its mapping */
+    size_t used;        /* end of the last record */
+    FILE *index;
+    uint64_t indexed_step;
+    uint64_t messages;
+    int failed;
+};
+
+static int mapRecorder(aerosim_recorder_t *recorder, size_t size)
+{
+    if (recorder->data != NULL) {
+        munmap(recorder->data, recorder->mapped);
+        recorder->data = NULL;
+    }
+    if (ftruncate(recorder->fd, (off_t)size) != 0) {
+        fprintf(stderr, "%% Couldn't grow recording %s: %s\n", recorder->file, strerror(errno));
+        return 1;
+    }
+    recorder->data = (unsigned char *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, recorder->fd, 0);
+    if (recorder->data == MAP_FAILED) {
+        recorder->data = NULL;
+        fprintf(stderr, "%% Couldn't map recording %s: %s\n", recorder->file, strerror(errno));
+        return 1;
+    }
+    recorder->mapped = size;
+    return 0;
+}
+
+aerosim_recorder_t *aerosimOpenRecorder(const char *file)
+{
+    aerosim_recorder_t *recorder = (aerosim_recorder_t *)calloc(1, sizeof(aerosim_recorder_t));
+    char *index_file;
+    record_file_header_t *header;
+
+    if (recorder == NULL) {
+        return NULL;
+    }
+    recorder->fd = -1;
+    if ((recorder->file = strdup(file)) == NULL
+        || (index_file = (char *)malloc(strlen(file) + 5)) == NULL) {
+        free(recorder->file);
+        free(recorder);
+        return NULL;
+    }
+    sprintf(index_file, "%s.idx", file);
+
+    recorder->fd = open(file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (recorder->fd < 0) {
+        fprintf(stderr, "%% Couldn't create recording %s: %s\n", file, strerror(errno));
+    } else if ((recorder->index = fopen(index_file, "wb")) == NULL) {
+        fprintf(stderr, "%% Couldn't create recording index %s: %s\n", index_file, strerror(errno));
+    }
+    free(index_file);
+    if (recorder->index == NULL || mapRecorder(recorder, AEROSIM_RECORD_INITIAL_BYTES)) {
+        aerosimCloseRecorder(recorder);
+        return NULL;
+    }
+
+    header = (record_file_header_t *)recorder->data;
+    header->magic = AEROSIM_RECORD_MAGIC;
+    header->version = AEROSIM_RECORD_VERSION;
+    header->header_bytes = AEROSIM_RECORD_HEADER_BYTES;
+    recorder->used = AEROSIM_RECORD_HEADER_BYTES;
+    recorder->indexed_step = UINT64_MAX;
+    return recorder;
+}
+
+void aerosimRecordMessage(aerosim_recorder_t *recorder, uint64_t step, const aerosim_message_t *message)
+{
+    size_t topic_len = (message->topic != NULL) ? strlen(message->topic) : 0;
+    size_t size = (sizeof(record_header_t) + topic_len + 1 + message->key_len + message->len + 7) & ~(size_t)7;
+    record_header_t *record;
+    unsigned char *p;
+
+    if (recorder == NULL || recorder->failed) {
+        return;
+    }
+    if (recorder->used + size > recorder->mapped) {
+        size_t mapped = recorder->mapped;
+        while (recorder->used + size > mapped) {
+            mapped *= 2;
+        }
+        if (mapRecorder(recorder, mapped)) {
+            recorder->failed = 1;
+            return;
+        }
+    }
+
+    if (step != recorder->indexed_step) {
+        record_index_entry_t entry;
+        entry.step = step;
+        entry.offset = recorder->used;
+        if (fwrite(&entry, sizeof(entry), 1, recorder->index) != 1) {
+            fprintf(stderr, "%% Couldn't write the index of recording %s: %s\n", recorder->file, strerror(errno));
+            recorder->failed = 1;
+            return;
+        }
+        recorder->indexed_step = step;
+    }
+
+    record = (record_header_t *)(recorder->data + recorder->used);
+    record->record_bytes = (uint32_t)size;
+    record->topic_len = (uint32_t)topic_len;
+    record->key_len = (uint32_t)message->key_len;
+    record->len = (uint32_t)message->len;
+    record->step = step;
+    record->timestamp = message->timestamp;
+    p = (unsigned char *)(record + 1);
+    if (topic_len > 0) {
+        memcpy(p, message->topic, topic_len);
+    }
+    p[topic_len] = '\0';
+    p += topic_len + 1;
+    if (message->key_len > 0) {
+        memcpy(p, message->key, message->key_len);
+    }
+    if (message->len > 0) {
+        memcpy(p + message->key_len, message->payload, message->len);
+    }
+    recorder->used += size;
+    recorder->messages++;
+}
+
+void aerosimCloseRecorder(aerosim_recorder_t *recorder)
+{
+    if (recorder == NULL) {
+        return;
+    }
+    if (recorder->data != NULL) {
+        munmap(recorder->data, recorder->mapped);
+    }
+    if (recorder->fd >= 0) {
+        /* Cut the unused part of the last mapping */
+        if (recorder->used > 0 && ftruncate(recorder->fd, (off_t)recorder->used) != 0) {
+            fprintf(stderr, "%% Couldn't truncate recording %s: %s\n", recorder->file, strerror(errno));
+        }
+        close(recorder->fd);
+    }
+    if (recorder->index != NULL && fclose(recorder->index) != 0) {
+        /* Buffered index entries are only written here */
+        fprintf(stderr, "%% Couldn't write the index of recording %s: %s\n", recorder->file, strerror(errno));
+        recorder->failed = 1;
+    }
+    if (recorder->failed) {
+        fprintf(stderr, "%% Recording %s is incomplete, don't replay it\n", recorder->file);
+    } else if (recorder->used > 0) {
+        fprintf(stderr, "Recorded %llu messages to %s\n", (unsigned long long)recorder->messages, recorder->file);
+    }
+    free(recorder->file);
+    free(recorder);
+}
+
+/*
+    Replay reader
+*/
+typedef struct {
+    const unsigned char *data;
+    size_t size;
+    const record_index_entry_t *index;
+    size_t index_count;
+    size_t index_size;
+    size_t cursor; /* offset of the next record */
+    uint64_t step;
+    char *topics[AEROSIM_MAX_CONSUMER_TOPICS];
+    int topic_count;
+} replay_reader_t;
+
+static const record_header_t *recordAt(const replay_reader_t *replay, size_t offset)
+{
+    const record_header_t *record;
+
+    if (offset + sizeof(record_header_t) > replay->size) {
+        return NULL;
+    }
+    record = (const record_header_t *)(replay->data + offset);
+    if (record->record_bytes < sizeof(record_header_t) || offset + record->record_bytes > replay->size) {
+        return NULL;
+    }
+    return record;
+}
+
+static int isReplayTopic(const replay_reader_t *replay, const record_header_t *record)
+{
+    const char *topic = (const char *)(record + 1);
+    int i;
+
+    for (i = 0; i < replay->topic_count; i++) {
+        if (strcmp(replay->topics[i], topic) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Offset of the first record of the reader's topics in the current step from offset on, or 0 */
+static size_t nextReplayRecord(const replay_reader_t *replay, size_t offset)
+{
+    const record_header_t *record;
+
+    while ((record = recordAt(replay, offset)) != NULL && record->step <= replay->step) {
+        if (record->step == replay->step && isReplayTopic(replay, record)) {
+            return offset;
+        }
+        offset += record->record_bytes;
+    }
+    return 0;
+}
+
+static int replayRead(void *impl, aerosim_message_t *message)
+{
+    replay_reader_t *replay = (replay_reader_t *)impl;
+    size_t offset = nextReplayRecord(replay, replay->cursor);
+    const record_header_t *record;
+    const unsigned char *p;
+
+    if (offset == 0) {
+        return 0;
+    }
+    record = recordAt(replay, offset);
+    replay->cursor = offset + record->record_bytes;
+
+    p = (const unsigned char *)(record + 1);
+    message->topic = (const char *)p;
+    p += record->topic_len + 1;
+    message->key = p;
+    message->key_len = record->key_len;
+    message->payload = p + record->key_len;
+    message->len = record->len;
+    message->timestamp = record->timestamp;
+    aerosimClearEnvelope(&message->envelope);
+    message->handle = NULL;
+    return 1;
+}
+
+static int replayReadLatest(void *impl, aerosim_message_t *message)
+{
+    int found = 0;
+
+    while (replayRead(impl, message)) {
+        found = 1;
+    }
+    return found;
+}
+
+static void replayRelease(void *impl, aerosim_message_t *message)
+{
+    /* Messages point into the mapped recording */
+}
+
+/* Never blocks: a step without further recorded messages times out right away */
+static int replayWait(void **impls, int count, int64_t deadline_ns, aerosim_wait_policy_t *policy)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        replay_reader_t *replay = (replay_reader_t *)impls[i];
+        if (nextReplayRecord(replay, replay->cursor) != 0) {
+            aerosimRecordWait(policy, 0, 0, 0);
+            return i;
+        }
+    }
+    if (policy != NULL) {
+        policy->timeouts++;
+    }
+    return -1;
+}
+
+static int64_t replayLag(void *impl)
+{
+    replay_reader_t *replay = (replay_reader_t *)impl;
+    size_t offset = replay->cursor;
+    int64_t lag = 0;
+
+    while ((offset = nextReplayRecord(replay, offset)) != 0) {
+        offset += recordAt(replay, offset)->record_bytes;
+        lag++;
+    }
+    return lag;
+}
+
+static int replaySkipToLatest(void *impl)
+{
+    /* The recording only holds the messages that were delivered */
+    return 0;
+}
+
+static int replayStats(void *impl, aerosim_kafka_stats_t *stats)
+{
+    return 0;
+}
+
+static void replayBeginStep(void *impl, uint64_t step)
+{
+    replay_reader_t *replay = (replay_reader_t *)impl;
+    size_t lo = 0, hi = replay->index_count;
+
+    replay->step = step;
+
+    /* Jump to the step's first record, messages of skipped steps are dropped */
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (replay->index[mid].step < step) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo < replay->index_count && replay->index[lo].offset > replay->cursor) {
+        replay->cursor = (size_t)replay->index[lo].offset;
+    }
+}
+
+static int replayOffsets(void *impl, int64_t *offsets, int maxCount)
+{
+    replay_reader_t *replay = (replay_reader_t *)impl;
+
+    /* All topics are read from the one recording */
+    offsets[0] = (int64_t)replay->cursor;
+    return 1;
+}
+
+static int replaySeek(void *impl, uint64_t step, const int64_t *offsets, int count)
+{
+    replay_reader_t *replay = (replay_reader_t *)impl;
+    const record_file_header_t *header = (const record_file_header_t *)replay->data;
+
+    if (count != 1 || offsets[0] < (int64_t)header->header_bytes || offsets[0] > (int64_t)replay->size) {
+        fprintf(stderr, "%% Saved position isn't part of the recording\n");
+        return 1;
+    }
+    replay->cursor = (size_t)offsets[0];
+    replay->step = step;
+    return 0;
+}
+
+static void replayClose(void *impl)
+{
+    replay_reader_t *replay = (replay_reader_t *)impl;
+    int i;
+
+    if (replay == NULL) {
+        return;
+    }
+    if (replay->data != NULL) {
+        munmap((void *)replay->data, replay->size);
+    }
+    if (replay->index != NULL) {
+        munmap((void *)replay->index, replay->index_size);
+    }
+    for (i = 0; i < replay->topic_count; i++) {
+        free(replay->topics[i]);
+    }
+    free(replay);
+}
+
+static const aerosim_reader_ops_t replay_reader_ops = {
+    replayRead,
+    replayReadLatest,
+    replayRelease,
+    replayWait,
+    replayLag,
+    replaySkipToLatest,
+    replayStats,
+    replayClose,
+    replayBeginStep,
+    replayOffsets,
+    replaySeek
+};
+
+/* Map a whole file read-only, returns NULL if it can't be opened or is empty */
+static const void *mapFile(const char *file, size_t *size)
+{
+    struct stat st;
+    void *data;
+    int fd = open(file, O_RDONLY);
+
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+    *size = (size_t)st.st_size;
+    return data;
+}
+
+int aerosimOpenReplayReader(aerosim_reader_t *reader, const char *file,
+    const char **topics, int topicCount)
+{
+    replay_reader_t *replay;
+    const record_file_header_t *header;
+    char *index_file;
+    int i;
+
+    if (topicCount > AEROSIM_MAX_CONSUMER_TOPICS) {
+        fprintf(stderr, "%% A replay reader reads up to %d topics\n", AEROSIM_MAX_CONSUMER_TOPICS);
+        return 1;
+    }
+    if ((replay = (replay_reader_t *)calloc(1, sizeof(replay_reader_t))) == NULL) {
+        return 1;
+    }
+    for (i = 0; i < topicCount; i++) {
+        if ((replay->topics[i] = strdup(topics[i])) == NULL) {
+            replayClose(replay);
+            return 1;
+        }
+        replay->topic_count++;
+    }
+
+    replay->data = (const unsigned char *)mapFile(file, &replay->size);
+    header = (const record_file_header_t *)replay->data;
+    if (header == NULL || replay->size < AEROSIM_RECORD_HEADER_BYTES || header->magic != AEROSIM_RECORD_MAGIC
+        || header->version != AEROSIM_RECORD_VERSION) {
+        fprintf(stderr, "%% Couldn't open recording %s\n", file);
+        replayClose(replay);
+        return 1;
+    }
+    replay->cursor = header->header_bytes;
+
+    /* Without the index, records of skipped steps are scanned over */
+    if ((index_file = (char *)malloc(strlen(file) + 5)) != NULL) {
+        sprintf(index_file, "%s.idx", file);
+        replay->index = (const record_index_entry_t *)mapFile(index_file, &replay->index_size);
+        replay->index_count = (replay->index != NULL) ? replay->index_size / sizeof(record_index_entry_t) : 0;
+        free(index_file);
+    }
+
+    reader->ops = &replay_reader_ops;
+    reader->impl = replay;
+    reader->replay = 1;
+    return 0;
+}
+
+/*
+    Replay writer: the replayed run doesn't publish
+*/
+static int discardWrite(void *impl, const char *key, int keyLen, const char *payload, int len, int64_t timestamp,
+                        const aerosim_envelope_t *envelope)
+{
+    return 0;
+}
+
+static int discardStats(void *impl, aerosim_kafka_stats_t *stats)
+{
+    return 0;
+}
+
+static void discardClose(void *impl)
+{
+}
+
+static const aerosim_writer_ops_t discard_writer_ops = {
+    discardWrite,
+    discardStats,
+    discardClose
+};
+
+int aerosimOpenReplayWriter(aerosim_writer_t *writer)
+{
+    writer->ops = &discard_writer_ops;
+    writer->impl = NULL;
+    return 0;
+}
+
+#endif /* _WIN32 */
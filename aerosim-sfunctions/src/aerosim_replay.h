@@ -0,0 +1,48 @@
+#ifndef AEROSIM_REPLAY_H
+#define AEROSIM_REPLAY_H
+
+#include "aerosim_transport.h"
+
+/*
+    Record and replay of the messages a block consumed. With the
+    aerosim.record.file option (client config) a reader appends every
+    message it delivers to the block to a memory-mapped segment file,
+    tagged with the block's step (see aerosimBeginReaderStep()). Each
+    recording block needs its own file. A "replay://<file>" broker URI
+    replaces the transport with that recording: each step serves exactly
+    the messages recorded at that step, without waiting and without a
+    broker, and the block's writers discard their messages. Replay runs as
+    fast as the model computes.
+
+    Segment file, little-endian:
+        file header (AEROSIM_RECORD_HEADER_BYTES):
+            uint64 magic AEROSIM_RECORD_MAGIC, uint32 version,
+            uint32 offset of the first record
+        records, each aligned to 8 bytes:
+            uint32 record size including header and padding, 0 past the end
+            uint32 topic_len, uint32 key_len, uint32 len
+            uint64 step, int64 timestamp (ms since the epoch)
+            topic bytes and a NUL, key bytes, payload bytes, padding
+
+    Step index file <file>.idx: {uint64 step, uint64 offset} of the first
+    record of each recorded step, in step order.
+
+    Not available on Windows.
+*/
+#define AEROSIM_RECORD_MAGIC 0x314345524f524541ULL /* "AEROREC1" */
+#define AEROSIM_RECORD_VERSION 1
+#define AEROSIM_RECORD_HEADER_BYTES 64
+#define AEROSIM_RECORD_FILE_OPTION "aerosim.record.file"
+
+typedef struct aerosim_recorder_s aerosim_recorder_t;
+
+aerosim_recorder_t *aerosimOpenRecorder(const char *file);
+void aerosimRecordMessage(aerosim_recorder_t *recorder, uint64_t step, const aerosim_message_t *message);
+void aerosimCloseRecorder(aerosim_recorder_t *recorder);
+
+int aerosimOpenReplayReader(aerosim_reader_t *reader, const char *file,
+    const char **topics, int topicCount);
+
+int aerosimOpenReplayWriter(aerosim_writer_t *writer);
+
+#endif /* AEROSIM_REPLAY_H */
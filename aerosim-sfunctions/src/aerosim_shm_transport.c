@@ -0,0 +1,592 @@
+#include "aerosim_shm_transport.h"
+
+#ifdef _WIN32
+
+int aerosimOpenShmReader(aerosim_reader_t *reader, const char *ns,
+    const char **topics, int topicCount, int confCount, const char **confArray,
+    int64_t start_offset)
+{
+    fprintf(stderr, "%% The shm:// transport is not supported on Windows\n");
+    return 1;
+}
+
+int aerosimOpenShmWriter(aerosim_writer_t *writer, const char *ns, const char *topic,
+    int confCount, const char **confArray)
+{
+    fprintf(stderr, "%% The shm:// transport is not supported on Windows\n");
+    return 1;
+}
+
+#else
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define AEROSIM_SHM_HEADER_BYTES 128
+#define AEROSIM_SHM_SLOT_HEADER_BYTES 24
+
+/* Maximum time to wait for the process creating a ring to set it up */
+#define AEROSIM_SHM_OPEN_TIMEOUT_NS 2000000000LL
+
+/* Poll interval of a blocking wait, there is no wake-up notification */
+#define AEROSIM_SHM_SLEEP_NS 20000LL
+
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t slot_count;
+    uint32_t slot_bytes;
+    uint32_t slot_stride;
+    uint8_t reserved1[40];
+    uint64_t write_seq;
+    uint8_t reserved2[56];
+} shm_header_t;
+
+typedef struct {
+    uint64_t state;
+    int64_t timestamp;
+    uint32_t key_len;
+    uint32_t len;
+} shm_slot_t;
+
+typedef struct {
+    char *topic;
+    shm_header_t *header;
+    size_t map_size;
+    uint64_t next_seq; /* reader cursor */
+    uint64_t dropped;  /* messages overwritten before the reader got to them */
+} shm_ring_t;
+
+typedef struct {
+    shm_ring_t rings[AEROSIM_MAX_CONSUMER_TOPICS];
+    int ring_count;
+    unsigned char *buffer; /* copy of the last message read */
+} shm_reader_t;
+
+static shm_slot_t *ringSlot(const shm_ring_t *ring, uint64_t seq)
+{
+    return (shm_slot_t *)((unsigned char *)ring->header + AEROSIM_SHM_HEADER_BYTES
+                          + (seq & (ring->header->slot_count - 1)) * ring->header->slot_stride);
+}
+
+static void ringName(char *name, size_t size, const char *ns, const char *topic)
+{
+    size_t i;
+    snprintf(name, size, "/%s.%s", (ns != NULL && ns[0] != '\0') ? ns : "aerosim", topic);
+    for (i = 1; name[i] != '\0'; i++) {
+        char c = name[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+              || c == '.' || c == '-' || c == '_')) {
+            name[i] = '_';
+        }
+    }
+}
+
+static uint32_t optionSlots(int confCount, const char **confArray)
+{
+    const char *value = aerosimGetOption(confCount, confArray, "aerosim.shm.slots");
+    long requested = (value != NULL) ? atol(value) : AEROSIM_SHM_DEFAULT_SLOTS;
+    uint32_t slots = 1;
+    while (slots < (uint32_t)requested && slots < (1u << 24)) {
+        slots <<= 1;
+    }
+    return slots;
+}
+
+static uint32_t optionSlotBytes(int confCount, const char **confArray)
+{
+    const char *value = aerosimGetOption(confCount, confArray, "aerosim.shm.slot.bytes");
+    long bytes = (value != NULL) ? atol(value) : AEROSIM_SHM_DEFAULT_SLOT_BYTES;
+    return (bytes > 0) ? (uint32_t)bytes : AEROSIM_SHM_DEFAULT_SLOT_BYTES;
+}
+
+/* Map the ring, waiting for its creator to set it up */
+static int mapExistingRing(shm_ring_t *ring, int fd, const char *name)
+{
+    const int64_t deadline_ns = aerosimMonotonicNs() + AEROSIM_SHM_OPEN_TIMEOUT_NS;
+    shm_header_t *header = NULL;
+    struct stat st;
+    size_t size;
+
+    for (;;) {
+        if (header == NULL && fstat(fd, &st) == 0 && st.st_size >= AEROSIM_SHM_HEADER_BYTES) {
+            header = (shm_header_t *)mmap(NULL, AEROSIM_SHM_HEADER_BYTES, PROT_READ, MAP_SHARED, fd, 0);
+            if (header == MAP_FAILED) {
+                fprintf(stderr, "%% Couldn't map shared memory ring %s: %s\n", name, strerror(errno));
+                return 1;
+            }
+        }
+        if (header != NULL && __atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) == AEROSIM_SHM_MAGIC) {
+            break;
+        }
+        if (aerosimMonotonicNs() >= deadline_ns) {
+            fprintf(stderr, "%% Shared memory ring %s was never initialized, remove it from /dev/shm\n", name);
+            if (header != NULL) {
+                munmap(header, AEROSIM_SHM_HEADER_BYTES);
+            }
+            return 1;
+        }
+        aerosimSleepUntilNs(aerosimMonotonicNs() + AEROSIM_SHM_SLEEP_NS);
+    }
+
+    if (header->version != AEROSIM_SHM_VERSION) {
+        fprintf(stderr, "%% Shared memory ring %s has version %u, expected %d\n", name,
+                header->version, AEROSIM_SHM_VERSION);
+        munmap(header, AEROSIM_SHM_HEADER_BYTES);
+        return 1;
+    }
+    size = AEROSIM_SHM_HEADER_BYTES + (size_t)header->slot_count * header->slot_stride;
+    munmap(header, AEROSIM_SHM_HEADER_BYTES);
+
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < size) {
+        fprintf(stderr, "%% Shared memory ring %s is truncated\n", name);
+        return 1;
+    }
+    ring->header = (shm_header_t *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ring->header == MAP_FAILED) {
+        ring->header = NULL;
+        fprintf(stderr, "%% Couldn't map shared memory ring %s: %s\n", name, strerror(errno));
+        return 1;
+    }
+    ring->map_size = size;
+    return 0;
+}
+
+static int createRing(shm_ring_t *ring, int fd, const char *name, uint32_t slot_count, uint32_t slot_bytes)
+{
+    uint32_t stride = (AEROSIM_SHM_SLOT_HEADER_BYTES + slot_bytes + 63) & ~63u;
+    size_t size = AEROSIM_SHM_HEADER_BYTES + (size_t)slot_count * stride;
+
+    if (ftruncate(fd, (off_t)size) != 0) {
+        fprintf(stderr, "%% Couldn't size shared memory ring %s: %s\n", name, strerror(errno));
+        return 1;
+    }
+    ring->header = (shm_header_t *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ring->header == MAP_FAILED) {
+        ring->header = NULL;
+        fprintf(stderr, "%% Couldn't map shared memory ring %s: %s\n", name, strerror(errno));
+        return 1;
+    }
+    ring->map_size = size;
+
+    /* The new object is zero-filled: write_seq 0 and no slot committed */
+    ring->header->version = AEROSIM_SHM_VERSION;
+    ring->header->slot_count = slot_count;
+    ring->header->slot_bytes = slot_bytes;
+    ring->header->slot_stride = stride;
+    __atomic_store_n(&ring->header->magic, AEROSIM_SHM_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static int openRing(shm_ring_t *ring, const char *ns, const char *topic, int confCount, const char **confArray)
+{
+    char name[256];
+    int fd, res;
+
+    memset(ring, 0, sizeof(*ring));
+    ringName(name, sizeof(name), ns, topic);
+    if ((ring->topic = strdup(topic)) == NULL) {
+        return 1;
+    }
+
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0666);
+    if (fd >= 0) {
+        res = createRing(ring, fd, name, optionSlots(confCount, confArray), optionSlotBytes(confCount, confArray));
+        if (res) {
+            shm_unlink(name);
+        }
+    } else if (errno == EEXIST && (fd = shm_open(name, O_RDWR, 0)) >= 0) {
+        res = mapExistingRing(ring, fd, name);
+    } else {
+        fprintf(stderr, "%% Couldn't open shared memory ring %s: %s\n", name, strerror(errno));
+        res = 1;
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (res) {
+        free(ring->topic);
+        ring->topic = NULL;
+    }
+    return res;
+}
+
+static void closeRing(shm_ring_t *ring)
+{
+    if (ring->header != NULL) {
+        munmap(ring->header, ring->map_size);
+        ring->header = NULL;
+    }
+    free(ring->topic);
+    ring->topic = NULL;
+}
+
+/*
+    Reader
+*/
+static int readRing(shm_ring_t *ring, unsigned char *buffer, aerosim_message_t *message)
+{
+    const uint64_t slot_count = ring->header->slot_count;
+
+    for (;;) {
+        uint64_t write_seq = __atomic_load_n(&ring->header->write_seq, __ATOMIC_ACQUIRE);
+        uint64_t seq = ring->next_seq;
+        shm_slot_t *slot;
+        uint64_t state;
+
+        if (seq >= write_seq) {
+            return 0;
+        }
+        if (write_seq - seq > slot_count) {
+            ring->dropped += write_seq - slot_count - seq;
+            seq = ring->next_seq = write_seq - slot_count;
+        }
+
+        slot = ringSlot(ring, seq);
+        state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+        if (state < 2 * seq + 2) {
+            /* Claimed but not committed yet */
+            return 0;
+        }
+        if (state == 2 * seq + 2) {
+            int64_t timestamp = slot->timestamp;
+            size_t key_len = slot->key_len;
+            size_t len = slot->len;
+            int valid = (key_len + len <= ring->header->slot_bytes);
+            if (valid) {
+                memcpy(buffer, (unsigned char *)slot + AEROSIM_SHM_SLOT_HEADER_BYTES, key_len + len);
+            }
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (valid && __atomic_load_n(&slot->state, __ATOMIC_RELAXED) == state) {
+                ring->next_seq = seq + 1;
+                message->topic = ring->topic;
+                message->key = buffer;
+                message->key_len = key_len;
+                message->payload = buffer + key_len;
+                message->len = len;
+                message->timestamp = timestamp;
+                aerosimClearEnvelope(&message->envelope);
+                message->handle = NULL;
+                return 1;
+            }
+        }
+
+        /* Overwritten by a writer a ring ahead */
+        ring->dropped++;
+        ring->next_seq = seq + 1;
+    }
+}
+
+static int shmRead(void *impl, aerosim_message_t *message)
+{
+    shm_reader_t *reader = (shm_reader_t *)impl;
+    int i;
+
+    for (i = 0; i < reader->ring_count; i++) {
+        if (readRing(&reader->rings[i], reader->buffer, message)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int shmSkipToLatest(void *impl)
+{
+    shm_reader_t *reader = (shm_reader_t *)impl;
+    int i;
+
+    for (i = 0; i < reader->ring_count; i++) {
+        shm_ring_t *ring = &reader->rings[i];
+        uint64_t write_seq = __atomic_load_n(&ring->header->write_seq, __ATOMIC_ACQUIRE);
+        if (write_seq > ring->next_seq + 1) {
+            ring->next_seq = write_seq - 1;
+        }
+    }
+    return 0;
+}
+
+static int shmReadLatest(void *impl, aerosim_message_t *message)
+{
+    int found = 0;
+
+    /* Only the last message is needed, don't copy the others */
+    shmSkipToLatest(impl);
+    while (shmRead(impl, message)) {
+        found = 1;
+    }
+    return found;
+}
+
+static void shmRelease(void *impl, aerosim_message_t *message)
+{
+    /* Messages live in the reader's buffer until the next read */
+}
+
+static int64_t shmLag(void *impl)
+{
+    shm_reader_t *reader = (shm_reader_t *)impl;
+    int64_t lag = 0;
+    int i;
+
+    for (i = 0; i < reader->ring_count; i++) {
+        shm_ring_t *ring = &reader->rings[i];
+        uint64_t write_seq = __atomic_load_n(&ring->header->write_seq, __ATOMIC_ACQUIRE);
+        if (write_seq > ring->next_seq) {
+            lag += (int64_t)(write_seq - ring->next_seq);
+        }
+    }
+    return lag;
+}
+
+static int shmReady(void **impls, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (shmLag(impls[i]) > 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+    Same policies as the Kafka consumers, but blocking polls the rings
+    every AEROSIM_SHM_SLEEP_NS since writers don't signal readers.
+*/
+static int shmWait(void **impls, int count, int64_t deadline_ns, aerosim_wait_policy_t *policy)
+{
+    int64_t start_ns = aerosimMonotonicNs();
+    int64_t check_ns = start_ns;
+    int64_t spin_end_ns = start_ns;
+    int blocked = 0;
+
+    if (policy != NULL && policy->mode == AEROSIM_WAIT_SPIN) {
+        spin_end_ns = deadline_ns;
+    } else if (policy != NULL && policy->mode == AEROSIM_WAIT_ADAPTIVE) {
+        spin_end_ns = start_ns + policy->spin_budget_ns;
+    }
+
+    for (;;) {
+        int ready = shmReady(impls, count);
+        int64_t now_ns = aerosimMonotonicNs();
+        if (ready >= 0) {
+            aerosimRecordWait(policy, now_ns - start_ns, now_ns - check_ns, blocked);
+            return ready;
+        }
+        if (now_ns >= deadline_ns) {
+            if (policy != NULL) {
+                policy->timeouts++;
+            }
+            return -1;
+        }
+        check_ns = now_ns;
+        if (now_ns < spin_end_ns) {
+            AEROSIM_CPU_RELAX();
+            continue;
+        }
+        blocked = 1;
+        aerosimSleepUntilNs((deadline_ns - now_ns < AEROSIM_SHM_SLEEP_NS) ? deadline_ns : now_ns + AEROSIM_SHM_SLEEP_NS);
+    }
+}
+
+static int shmReaderStats(void *impl, aerosim_kafka_stats_t *stats)
+{
+    return 0;
+}
+
+static int shmOffsets(void *impl, int64_t *offsets, int maxCount)
+{
+    shm_reader_t *reader = (shm_reader_t *)impl;
+    int i;
+
+    for (i = 0; i < reader->ring_count && i < maxCount; i++) {
+        offsets[i] = (int64_t)reader->rings[i].next_seq;
+    }
+    return i;
+}
+
+/* Messages overwritten since the position was saved count as dropped */
+static int shmSeek(void *impl, uint64_t step, const int64_t *offsets, int count)
+{
+    shm_reader_t *reader = (shm_reader_t *)impl;
+    int i;
+
+    if (count != reader->ring_count) {
+        fprintf(stderr, "%% Saved offsets don't match the topics of the shared memory reader\n");
+        return 1;
+    }
+    for (i = 0; i < count; i++) {
+        shm_ring_t *ring = &reader->rings[i];
+        uint64_t write_seq = __atomic_load_n(&ring->header->write_seq, __ATOMIC_ACQUIRE);
+        if (offsets[i] < 0 || (uint64_t)offsets[i] > write_seq) {
+            /* The ring was recreated since */
+            fprintf(stderr, "%% Shared memory ring %s has no message %lld, reading from the latest one\n",
+                    ring->topic, (long long)offsets[i]);
+            ring->next_seq = write_seq;
+        } else {
+            ring->next_seq = (uint64_t)offsets[i];
+        }
+    }
+    return 0;
+}
+
+static void shmCloseReader(void *impl)
+{
+    shm_reader_t *reader = (shm_reader_t *)impl;
+    uint64_t dropped = 0;
+    int i;
+
+    if (reader == NULL) {
+        return;
+    }
+    for (i = 0; i < reader->ring_count; i++) {
+        dropped += reader->rings[i].dropped;
+        closeRing(&reader->rings[i]);
+    }
+    if (dropped > 0) {
+        fprintf(stderr, "%% Shared memory reader skipped %llu overwritten messages\n", (unsigned long long)dropped);
+    }
+    free(reader->buffer);
+    free(reader);
+}
+
+static const aerosim_reader_ops_t shm_reader_ops = {
+    shmRead,
+    shmReadLatest,
+    shmRelease,
+    shmWait,
+    shmLag,
+    shmSkipToLatest,
+    shmReaderStats,
+    shmCloseReader,
+    NULL,
+    shmOffsets,
+    shmSeek
+};
+
+int aerosimOpenShmReader(aerosim_reader_t *reader, const char *ns,
+    const char **topics, int topicCount, int confCount, const char **confArray,
+    int64_t start_offset)
+{
+    shm_reader_t *shm;
+    uint32_t buffer_size = 0;
+    int i;
+
+    if (topicCount < 1 || topicCount > AEROSIM_MAX_CONSUMER_TOPICS) {
+        fprintf(stderr, "%% A shared memory reader reads 1 to %d topics\n", AEROSIM_MAX_CONSUMER_TOPICS);
+        return 1;
+    }
+    if ((shm = (shm_reader_t *)calloc(1, sizeof(shm_reader_t))) == NULL) {
+        return 1;
+    }
+    for (i = 0; i < topicCount; i++) {
+        shm_ring_t *ring = &shm->rings[i];
+        uint64_t write_seq;
+
+        if (openRing(ring, ns, topics[i], confCount, confArray)) {
+            shmCloseReader(shm);
+            return 1;
+        }
+        shm->ring_count++;
+
+        write_seq = __atomic_load_n(&ring->header->write_seq, __ATOMIC_ACQUIRE);
+        if (start_offset == RD_KAFKA_OFFSET_BEGINNING && write_seq > ring->header->slot_count) {
+            ring->next_seq = write_seq - ring->header->slot_count;
+        } else if (start_offset != RD_KAFKA_OFFSET_BEGINNING) {
+            ring->next_seq = write_seq;
+        }
+        if (ring->header->slot_bytes > buffer_size) {
+            buffer_size = ring->header->slot_bytes;
+        }
+    }
+    if ((shm->buffer = (unsigned char *)malloc(buffer_size)) == NULL) {
+        shmCloseReader(shm);
+        return 1;
+    }
+
+    reader->ops = &shm_reader_ops;
+    reader->impl = shm;
+    return 0;
+}
+
+/*
+    Writer
+*/
+/* Slots have no room for headers, readers scan the envelope from the payload */
+static int shmWrite(void *impl, const char *key, int keyLen, const char *payload, int len, int64_t timestamp,
+                    const aerosim_envelope_t *envelope)
+{
+    shm_ring_t *ring = (shm_ring_t *)impl;
+    shm_slot_t *slot;
+    uint64_t seq;
+
+    if ((size_t)keyLen + (size_t)len > ring->header->slot_bytes) {
+        fprintf(stderr, "%% Message of %d bytes exceeds the shared memory slot size of %u bytes (aerosim.shm.slot.bytes)\n",
+                keyLen + len, ring->header->slot_bytes);
+        return 1;
+    }
+
+    seq = __atomic_fetch_add(&ring->header->write_seq, 1, __ATOMIC_ACQ_REL);
+    slot = ringSlot(ring, seq);
+    __atomic_store_n(&slot->state, 2 * seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    slot->timestamp = (timestamp >= 0) ? timestamp : aerosimWallClockMs();
+    slot->key_len = (uint32_t)keyLen;
+    slot->len = (uint32_t)len;
+    if (keyLen > 0) {
+        memcpy((unsigned char *)slot + AEROSIM_SHM_SLOT_HEADER_BYTES, key, keyLen);
+    }
+    if (len > 0) {
+        memcpy((unsigned char *)slot + AEROSIM_SHM_SLOT_HEADER_BYTES + keyLen, payload, len);
+    }
+
+    __atomic_store_n(&slot->state, 2 * seq + 2, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static int shmWriterStats(void *impl, aerosim_kafka_stats_t *stats)
+{
+    return 0;
+}
+
+static void shmCloseWriter(void *impl)
+{
+    shm_ring_t *ring = (shm_ring_t *)impl;
+
+    if (ring != NULL) {
+        closeRing(ring);
+        free(ring);
+    }
+}
+
+static const aerosim_writer_ops_t shm_writer_ops = {
+    shmWrite,
+    shmWriterStats,
+    shmCloseWriter
+};
+
+int aerosimOpenShmWriter(aerosim_writer_t *writer, const char *ns, const char *topic,
+    int confCount, const char **confArray)
+{
+    shm_ring_t *ring = (shm_ring_t *)malloc(sizeof(shm_ring_t));
+
+    if (ring == NULL) {
+        return 1;
+    }
+    if (openRing(ring, ns, topic, confCount, confArray)) {
+        free(ring);
+        return 1;
+    }
+
+    writer->ops = &shm_writer_ops;
+    writer->impl = ring;
+    return 0;
+}
+
+#endif /* _WIN32 */
@@ -0,0 +1,62 @@
+#ifndef AEROSIM_SHM_TRANSPORT_H
+#define AEROSIM_SHM_TRANSPORT_H
+
+#include "aerosim_transport.h"
+
+/*
+    Shared-memory transport for co-located runs, selected with a
+    "shm://<namespace>" broker URI. Each topic is a broadcast ring in the
+    POSIX shared memory object "/<namespace>.<topic>" (characters other
+    than letters, digits, '.', '-' and '_' are replaced by '_'), created by
+    whichever reader or writer opens it first. Every reader sees every
+    message; a reader that falls more than a ring behind skips the
+    overwritten messages. Rings outlive the processes, like a topic, and
+    keep the geometry they were created with.
+
+    Options (client config):
+        aerosim.shm.slots       ring capacity in messages, rounded up to a
+                                power of two (default 1024)
+        aerosim.shm.slot.bytes  maximum key + payload size (default 16384)
+
+    Layout, for other processes (e.g. the AeroSim side) to implement; all
+    fields are little-endian and naturally aligned:
+
+        offset  0  uint64  magic          AEROSIM_SHM_MAGIC, stored last
+                                          (release) once the ring is set up
+        offset  8  uint32  version        AEROSIM_SHM_VERSION
+        offset 12  uint32  slot_count     power of two
+        offset 16  uint32  slot_bytes     key + payload capacity of a slot
+        offset 20  uint32  slot_stride    slot size, a multiple of 64
+        offset 64  uint64  write_seq      sequence number of the next message
+        offset 128 slots[slot_count], slot of message seq at seq % slot_count:
+            offset  0  uint64  state      2 * seq + 1 while being written,
+                                          2 * seq + 2 once committed
+            offset  8  int64   timestamp  ms since the epoch
+            offset 16  uint32  key_len
+            offset 20  uint32  len
+            offset 24  key bytes, followed by the payload bytes
+
+    A writer claims seq with an atomic fetch-add on write_seq, stores the
+    odd state, issues a release fence, writes the slot and stores the even
+    state with release semantics. A reader with cursor seq loads the state
+    (acquire); if it's 2 * seq + 2 it copies the slot, issues an acquire
+    fence and reloads the state, the copy is valid if it didn't change. A
+    smaller state means the message isn't committed yet, a larger one that
+    it has been overwritten. Readers start at write_seq, or at the oldest
+    message still in the ring for a beginning start offset.
+
+    Not available on Windows.
+*/
+#define AEROSIM_SHM_MAGIC 0x314d48534f524541ULL /* "AEROSHM1" */
+#define AEROSIM_SHM_VERSION 1
+#define AEROSIM_SHM_DEFAULT_SLOTS 1024
+#define AEROSIM_SHM_DEFAULT_SLOT_BYTES 16384
+
+int aerosimOpenShmReader(aerosim_reader_t *reader, const char *ns,
+    const char **topics, int topicCount, int confCount, const char **confArray,
+    int64_t start_offset);
+
+int aerosimOpenShmWriter(aerosim_writer_t *writer, const char *ns, const char *topic,
+    int confCount, const char **confArray);
+
+#endif /* AEROSIM_SHM_TRANSPORT_H */
@@ -0,0 +1,258 @@
+#include "aerosim_trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#define AEROSIM_THREAD_LOCAL __declspec(thread)
+#else
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#else
+#include <pthread.h>
+#endif
+#define AEROSIM_THREAD_LOCAL __thread
+#endif
+
+volatile int aerosim_trace_enabled = 0;
+
+typedef struct {
+    const char *name;
+    const char *category;
+    int64_t ts_ns;
+    char phase;
+} trace_event_t;
+
+/* Written only by its thread, read once recording has stopped */
+typedef struct trace_ring_s {
+    trace_event_t events[AEROSIM_TRACE_RING_EVENTS];
+    uint64_t count; /* events recorded, the ring holds the last AEROSIM_TRACE_RING_EVENTS */
+    uint64_t thread_id;
+    struct trace_ring_s *next;
+} trace_ring_t;
+
+typedef struct trace_name_s {
+    struct trace_name_s *next;
+    char name[1];
+} trace_name_t;
+
+/* Start/stop and names are only used from the Simulink thread (mdlStart / mdlTerminate) */
+static int trace_refcount = 0;
+static char *trace_file = NULL;
+static trace_name_t *trace_names = NULL;
+
+/* Rings are pushed lock-free by the recording threads */
+static trace_ring_t *volatile trace_rings = NULL;
+static volatile unsigned trace_generation = 0;
+
+static AEROSIM_THREAD_LOCAL trace_ring_t *thread_ring = NULL;
+static AEROSIM_THREAD_LOCAL unsigned thread_generation = 0;
+
+/* Same clock as aerosimMonotonicNs(), so traces line up across modules */
+static int64_t traceNowNs(void)
+{
+#ifdef _WIN32
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    if (frequency.QuadPart == 0) {
+        QueryPerformanceFrequency(&frequency);
+    }
+    QueryPerformanceCounter(&counter);
+    return (int64_t)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#endif
+}
+
+/* OS thread id, shared by all modules recording on the thread */
+static uint64_t traceThreadId(void)
+{
+#ifdef _WIN32
+    return (uint64_t)GetCurrentThreadId();
+#elif defined(__linux__)
+    return (uint64_t)syscall(SYS_gettid);
+#else
+    return (uint64_t)(uintptr_t)pthread_self();
+#endif
+}
+
+static int traceProcessId(void)
+{
+#ifdef _WIN32
+    return (int)GetCurrentProcessId();
+#else
+    return (int)getpid();
+#endif
+}
+
+static trace_ring_t *newThreadRing(void)
+{
+    trace_ring_t *ring = (trace_ring_t *)malloc(sizeof(trace_ring_t));
+    if (ring == NULL) {
+        return NULL;
+    }
+    ring->count = 0;
+    ring->thread_id = traceThreadId();
+    do {
+        ring->next = trace_rings;
+#ifdef _WIN32
+    } while (InterlockedCompareExchangePointer((PVOID volatile *)&trace_rings, ring, ring->next) != ring->next);
+#else
+    } while (!__sync_bool_compare_and_swap(&trace_rings, ring->next, ring));
+#endif
+    return ring;
+}
+
+void aerosimTraceEvent(const char *name, const char *category, char phase)
+{
+    trace_ring_t *ring = thread_ring;
+    trace_event_t *event;
+
+    if (name == NULL) {
+        return;
+    }
+    if (ring == NULL || thread_generation != trace_generation) {
+        // First event of this thread since recording started
+        ring = newThreadRing();
+        if (ring == NULL) {
+            return;
+        }
+        thread_ring = ring;
+        thread_generation = trace_generation;
+    }
+    event = &ring->events[ring->count % AEROSIM_TRACE_RING_EVENTS];
+    event->name = name;
+    event->category = category;
+    event->phase = phase;
+    event->ts_ns = traceNowNs();
+    ring->count++;
+}
+
+const char *aerosimTraceName(const char *name)
+{
+    trace_name_t *entry;
+    size_t len;
+
+    if (!aerosim_trace_enabled || name == NULL) {
+        return NULL;
+    }
+    len = strlen(name);
+    entry = (trace_name_t *)malloc(sizeof(trace_name_t) + len);
+    if (entry == NULL) {
+        return NULL;
+    }
+    memcpy(entry->name, name, len + 1);
+    entry->next = trace_names;
+    trace_names = entry;
+    return entry->name;
+}
+
+void aerosimTraceStart(void)
+{
+    const char *file;
+
+    if (trace_refcount++ > 0) {
+        return;
+    }
+    file = getenv(AEROSIM_TRACE_FILE_ENV);
+    if (file == NULL || file[0] == '\0') {
+        return;
+    }
+    trace_file = strdup(file);
+    if (trace_file != NULL) {
+        aerosim_trace_enabled = 1;
+    }
+}
+
+static void writeJSONString(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for (; s != NULL && *s != '\0'; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            fputc('\\', f);
+            fputc(c, f);
+        } else if (c < 0x20) {
+            // Block paths may contain line breaks
+            fprintf(f, "\\u%04x", c);
+        } else {
+            fputc(c, f);
+        }
+    }
+    fputc('"', f);
+}
+
+static void writeTrace(FILE *f)
+{
+    int pid = traceProcessId();
+    uint64_t written = 0, dropped = 0;
+    trace_ring_t *ring;
+
+    fseek(f, 0, SEEK_END);
+    if (ftell(f) == 0) {
+        fprintf(f, "[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"Simulink\"}},\n", pid);
+    }
+    for (ring = trace_rings; ring != NULL; ring = ring->next) {
+        uint64_t first = ring->count > AEROSIM_TRACE_RING_EVENTS ? ring->count - AEROSIM_TRACE_RING_EVENTS : 0;
+        uint64_t i;
+        for (i = first; i < ring->count; i++) {
+            const trace_event_t *event = &ring->events[i % AEROSIM_TRACE_RING_EVENTS];
+            fputs("{\"name\":", f);
+            writeJSONString(f, event->name);
+            fputs(",\"cat\":", f);
+            writeJSONString(f, event->category);
+            fprintf(f, ",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%llu},\n",
+                    event->phase, event->ts_ns / 1e3, pid, (unsigned long long)ring->thread_id);
+        }
+        written += ring->count - first;
+        dropped += first;
+    }
+    fprintf(stderr, "Appended %llu trace events to %s", (unsigned long long)written, trace_file);
+    if (dropped > 0) {
+        fprintf(stderr, " (%llu oldest events overwritten, %d per thread)", (unsigned long long)dropped,
+                AEROSIM_TRACE_RING_EVENTS);
+    }
+    fprintf(stderr, "\n");
+}
+
+void aerosimTraceStop(void)
+{
+    trace_ring_t *ring;
+    FILE *f;
+
+    if (trace_refcount == 0 || --trace_refcount > 0) {
+        return;
+    }
+    if (!aerosim_trace_enabled) {
+        return;
+    }
+    aerosim_trace_enabled = 0;
+
+    f = fopen(trace_file, "ab");
+    if (f == NULL) {
+        fprintf(stderr, "Couldn't open trace file %s\n", trace_file);
+    } else {
+        writeTrace(f);
+        fclose(f);
+    }
+
+    // Release the rings and names, threads allocate a new ring when recording restarts
+    trace_generation++;
+    while ((ring = trace_rings) != NULL) {
+        trace_rings = ring->next;
+        free(ring);
+    }
+    while (trace_names != NULL) {
+        trace_name_t *entry = trace_names;
+        trace_names = entry->next;
+        free(entry);
+    }
+    free(trace_file);
+    trace_file = NULL;
+}
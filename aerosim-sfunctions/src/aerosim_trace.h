@@ -0,0 +1,64 @@
+#ifndef AEROSIM_TRACE_H
+#define AEROSIM_TRACE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+    Chrome Trace / Perfetto event recorder shared by the AeroSim blocks.
+    Recording is off unless the AEROSIM_TRACE_FILE environment variable names
+    a trace file, and a disabled trace point costs one branch. Events are
+    recorded without locking into a fixed-size ring per thread (the oldest
+    events are overwritten) and are appended to the trace file when the last
+    block that started the recorder stops it. Each S-function MEX module has
+    its own recorder; they all append to the same file on the same monotonic
+    clock and thread ids, so all blocks share one timeline. The file is a
+    JSON array that is never closed, which both viewers accept; remove it
+    between simulation runs.
+*/
+#define AEROSIM_TRACE_FILE_ENV "AEROSIM_TRACE_FILE"
+#define AEROSIM_TRACE_RING_EVENTS 65536
+
+extern volatile int aerosim_trace_enabled;
+
+void aerosimTraceStart(void);
+void aerosimTraceStop(void);
+
+/* Copy of the name that stays valid until the trace is written, e.g. for block paths */
+const char *aerosimTraceName(const char *name);
+
+/* Record a begin ('B') or end ('E') event, name and category must outlive the trace */
+void aerosimTraceEvent(const char *name, const char *category, char phase);
+
+#define AEROSIM_TRACE_BEGIN(name, category) \
+    do { if (aerosim_trace_enabled) aerosimTraceEvent((name), (category), 'B'); } while (0)
+
+#define AEROSIM_TRACE_END(name, category) \
+    do { if (aerosim_trace_enabled) aerosimTraceEvent((name), (category), 'E'); } while (0)
+
+#ifdef __cplusplus
+}
+
+/* Traces the enclosing scope */
+class AerosimTraceScope
+{
+public:
+    AerosimTraceScope(const char *name, const char *category) : name_(name), category_(category)
+    {
+        AEROSIM_TRACE_BEGIN(name_, category_);
+    }
+    ~AerosimTraceScope()
+    {
+        AEROSIM_TRACE_END(name_, category_);
+    }
+
+private:
+    const char *name_;
+    const char *category_;
+};
+#endif
+
+#endif /* AEROSIM_TRACE_H */
@@ -0,0 +1,746 @@
+#include "aerosim_transport.h"
+#include "aerosim_shm_transport.h"
+#include "aerosim_replay.h"
+#include "aerosim_trace.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int hasScheme(const char *brokers, const char *scheme)
+{
+    return brokers != NULL && strncmp(brokers, scheme, strlen(scheme)) == 0;
+}
+
+/*
+    Message envelope
+*/
+void aerosimClearEnvelope(aerosim_envelope_t *envelope)
+{
+    envelope->type_name = NULL;
+    envelope->type_name_len = 0;
+    envelope->topic = NULL;
+    envelope->topic_len = 0;
+    envelope->sim_ns = -1;
+    envelope->platform_ns = -1;
+}
+
+const char *aerosimFindJsonValue(const char *buf, const char *end, const char *key)
+{
+    size_t keyLen = strlen(key);
+    const char *p = buf;
+
+    /* The closing quote of an escaped key is preceded by a backslash, so those aren't matched */
+    while (p < end && (p = (const char *)memchr(p, '"', end - p)) != NULL) {
+        const char *v = p + keyLen + 2;
+        if (v <= end && memcmp(p + 1, key, keyLen) == 0 && v[-1] == '"') {
+            while (v < end && isspace((unsigned char)*v)) {
+                v++;
+            }
+            if (v < end && *v == ':') {
+                v++;
+                while (v < end && isspace((unsigned char)*v)) {
+                    v++;
+                }
+                return v;
+            }
+        }
+        p++;
+    }
+    return NULL;
+}
+
+int aerosimParseJsonInteger(const char *p, const char *end, int64_t *value)
+{
+    int negative = 0;
+    int64_t v = 0;
+
+    if (p == NULL) {
+        return 0;
+    }
+    if (p < end && *p == '-') {
+        negative = 1;
+        p++;
+    }
+    if (p >= end || !isdigit((unsigned char)*p)) {
+        return 0;
+    }
+    while (p < end && isdigit((unsigned char)*p)) {
+        v = v * 10 + (*p - '0');
+        p++;
+    }
+    *value = negative ? -v : v;
+    return 1;
+}
+
+/* End of the JSON object starting at p (past its closing brace), NULL if it's truncated */
+static const char *findJsonObjectEnd(const char *p, const char *end)
+{
+    int depth = 0;
+
+    for (; p < end; p++) {
+        if (*p == '"') {
+            for (p++; p < end && *p != '"'; p++) {
+                if (*p == '\\') {
+                    p++;
+                }
+            }
+        } else if (*p == '{') {
+            depth++;
+        } else if (*p == '}' && --depth == 0) {
+            return p + 1;
+        }
+    }
+    return NULL;
+}
+
+static void scanJsonString(const char *p, const char *end, const char **value, size_t *len)
+{
+    const char *q;
+
+    if (p == NULL || *p != '"') {
+        return;
+    }
+    for (q = p + 1; q < end && *q != '"'; q++) {
+        if (*q == '\\') {
+            q++;
+        }
+    }
+    if (q < end) {
+        *value = p + 1;
+        *len = (size_t)(q - p - 1);
+    }
+}
+
+/* AeroSim timestamp {"sec": ..., "nanosec": ...} in nanoseconds */
+static void scanJsonTimestamp(const char *p, const char *end, int64_t *ns)
+{
+    const char *ts_end;
+    int64_t sec, nanosec;
+
+    if (p == NULL || *p != '{' || (ts_end = (const char *)memchr(p, '}', end - p)) == NULL) {
+        return;
+    }
+    if (aerosimParseJsonInteger(aerosimFindJsonValue(p, ts_end, "sec"), ts_end, &sec)
+        && aerosimParseJsonInteger(aerosimFindJsonValue(p, ts_end, "nanosec"), ts_end, &nanosec)) {
+        *ns = sec * 1000000000LL + nanosec;
+    }
+}
+
+int aerosimScanEnvelope(const char *payload, size_t len, aerosim_envelope_t *envelope)
+{
+    const char *end = payload + len;
+    const char *metadata = aerosimFindJsonValue(payload, end, "metadata");
+    const char *metadata_end;
+
+    aerosimClearEnvelope(envelope);
+    if (metadata == NULL || *metadata != '{' || (metadata_end = findJsonObjectEnd(metadata, end)) == NULL) {
+        return 0;
+    }
+    scanJsonString(aerosimFindJsonValue(metadata, metadata_end, "type_name"), metadata_end,
+                   &envelope->type_name, &envelope->type_name_len);
+    scanJsonString(aerosimFindJsonValue(metadata, metadata_end, "topic"), metadata_end,
+                   &envelope->topic, &envelope->topic_len);
+    scanJsonTimestamp(aerosimFindJsonValue(metadata, metadata_end, "timestamp_sim"), metadata_end,
+                      &envelope->sim_ns);
+    scanJsonTimestamp(aerosimFindJsonValue(metadata, metadata_end, "timestamp_platform"), metadata_end,
+                      &envelope->platform_ns);
+    return 1;
+}
+
+/*
+    Kafka reader: a consumer slot, messages are the polled rd_kafka_message_t
+*/
+static void getKafkaHeaderNs(const rd_kafka_headers_t *headers, const char *name, int64_t *ns)
+{
+    const void *value;
+    size_t size;
+
+    if (rd_kafka_header_get_last(headers, name, &value, &size) == RD_KAFKA_RESP_ERR_NO_ERROR && value != NULL) {
+        aerosimParseJsonInteger((const char *)value, (const char *)value + size, ns);
+    }
+}
+
+static void fillKafkaEnvelope(rd_kafka_message_t *rkmessage, aerosim_envelope_t *envelope)
+{
+    rd_kafka_headers_t *headers;
+    const void *value;
+    size_t size;
+
+    aerosimClearEnvelope(envelope);
+    if (rd_kafka_message_headers(rkmessage, &headers) != RD_KAFKA_RESP_ERR_NO_ERROR) {
+        return;
+    }
+    if (rd_kafka_header_get_last(headers, AEROSIM_HEADER_TYPE_NAME, &value, &size) == RD_KAFKA_RESP_ERR_NO_ERROR
+        && value != NULL) {
+        envelope->type_name = (const char *)value;
+        envelope->type_name_len = size;
+    }
+    if (rd_kafka_header_get_last(headers, AEROSIM_HEADER_TOPIC, &value, &size) == RD_KAFKA_RESP_ERR_NO_ERROR
+        && value != NULL) {
+        envelope->topic = (const char *)value;
+        envelope->topic_len = size;
+    }
+    getKafkaHeaderNs(headers, AEROSIM_HEADER_TIMESTAMP_SIM, &envelope->sim_ns);
+    getKafkaHeaderNs(headers, AEROSIM_HEADER_TIMESTAMP_PLATFORM, &envelope->platform_ns);
+}
+
+static void fillKafkaMessage(rd_kafka_message_t *rkmessage, aerosim_message_t *message)
+{
+    message->topic = (rkmessage->rkt != NULL) ? rd_kafka_topic_name(rkmessage->rkt) : NULL;
+    message->payload = rkmessage->payload;
+    message->len = rkmessage->len;
+    message->key = rkmessage->key;
+    message->key_len = rkmessage->key_len;
+    message->timestamp = rd_kafka_message_timestamp(rkmessage, NULL);
+    fillKafkaEnvelope(rkmessage, &message->envelope);
+    message->handle = rkmessage;
+}
+
+static int kafkaRead(void *impl, aerosim_message_t *message)
+{
+    rd_kafka_message_t *rkmessage = aerosimPollKafkaConsumer((aerosim_consumer_t *)impl, 0);
+
+    if (rkmessage == NULL) {
+        return 0;
+    }
+    fillKafkaMessage(rkmessage, message);
+    return 1;
+}
+
+static int kafkaReadLatest(void *impl, aerosim_message_t *message)
+{
+    rd_kafka_message_t *last = NULL, *rkmessage;
+
+    /* Destroy the messages before the last one without copying them */
+    while ((rkmessage = aerosimPollKafkaConsumer((aerosim_consumer_t *)impl, 0)) != NULL) {
+        if (last != NULL) {
+            rd_kafka_message_destroy(last);
+        }
+        last = rkmessage;
+    }
+    if (last == NULL) {
+        return 0;
+    }
+    fillKafkaMessage(last, message);
+    return 1;
+}
+
+static void kafkaRelease(void *impl, aerosim_message_t *message)
+{
+    if (message->handle != NULL) {
+        rd_kafka_message_destroy((rd_kafka_message_t *)message->handle);
+        message->handle = NULL;
+    }
+}
+
+static int kafkaWait(void **impls, int count, int64_t deadline_ns, aerosim_wait_policy_t *policy)
+{
+    aerosim_consumer_t *consumers[AEROSIM_MAX_WAIT_CONSUMERS];
+    int i;
+
+    if (count > AEROSIM_MAX_WAIT_CONSUMERS) {
+        fprintf(stderr, "%% Can't wait for %d Kafka readers, the maximum is %d\n",
+            count, AEROSIM_MAX_WAIT_CONSUMERS);
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        consumers[i] = (aerosim_consumer_t *)impls[i];
+    }
+    return aerosimWaitKafkaConsumers(consumers, count, deadline_ns, policy);
+}
+
+static int64_t kafkaLag(void *impl)
+{
+    return aerosimGetKafkaConsumerLag((aerosim_consumer_t *)impl);
+}
+
+static int kafkaSkipToLatest(void *impl)
+{
+    return aerosimSkipKafkaConsumerToLatest((aerosim_consumer_t *)impl);
+}
+
+static int kafkaReaderStats(void *impl, aerosim_kafka_stats_t *stats)
+{
+    return aerosimGetKafkaConsumerStats((aerosim_consumer_t *)impl, stats);
+}
+
+static int kafkaOffsets(void *impl, int64_t *offsets, int maxCount)
+{
+    return aerosimGetKafkaConsumerOffsets((aerosim_consumer_t *)impl, offsets, maxCount);
+}
+
+static int kafkaSeek(void *impl, uint64_t step, const int64_t *offsets, int count)
+{
+    return aerosimSeekKafkaConsumer((aerosim_consumer_t *)impl, offsets, count);
+}
+
+static void kafkaCloseReader(void *impl)
+{
+    aerosimCloseKafkaConsumer((aerosim_consumer_t *)impl);
+}
+
+static const aerosim_reader_ops_t kafka_reader_ops = {
+    kafkaRead,
+    kafkaReadLatest,
+    kafkaRelease,
+    kafkaWait,
+    kafkaLag,
+    kafkaSkipToLatest,
+    kafkaReaderStats,
+    kafkaCloseReader,
+    NULL,
+    kafkaOffsets,
+    kafkaSeek
+};
+
+/*
+    Kafka writer: a topic handle on a shared producer
+*/
+typedef struct {
+    rd_kafka_t *rk;
+    rd_kafka_topic_t *rkt;
+} kafka_writer_t;
+
+static void addKafkaHeaderNs(rd_kafka_headers_t *headers, const char *name, int64_t ns)
+{
+    char value[24];
+
+    if (ns >= 0) {
+        rd_kafka_header_add(headers, name, -1, value, snprintf(value, sizeof(value), "%lld", (long long)ns));
+    }
+}
+
+static rd_kafka_headers_t *newEnvelopeHeaders(const aerosim_envelope_t *envelope)
+{
+    rd_kafka_headers_t *headers = rd_kafka_headers_new(4);
+
+    if (envelope->type_name != NULL) {
+        rd_kafka_header_add(headers, AEROSIM_HEADER_TYPE_NAME, -1, envelope->type_name, (ssize_t)envelope->type_name_len);
+    }
+    if (envelope->topic != NULL) {
+        rd_kafka_header_add(headers, AEROSIM_HEADER_TOPIC, -1, envelope->topic, (ssize_t)envelope->topic_len);
+    }
+    addKafkaHeaderNs(headers, AEROSIM_HEADER_TIMESTAMP_SIM, envelope->sim_ns);
+    addKafkaHeaderNs(headers, AEROSIM_HEADER_TIMESTAMP_PLATFORM, envelope->platform_ns);
+    return headers;
+}
+
+static int kafkaWrite(void *impl, const char *key, int keyLen, const char *payload, int len, int64_t timestamp,
+                      const aerosim_envelope_t *envelope)
+{
+    kafka_writer_t *writer = (kafka_writer_t *)impl;
+    int ret;
+
+    AEROSIM_TRACE_BEGIN("kafka.produce", "kafka");
+    if (envelope != NULL) {
+        ret = aerosimProduceKafkaMessageWithHeaders(writer->rk, writer->rkt, key, keyLen, payload, len,
+                                                    timestamp, newEnvelopeHeaders(envelope));
+    } else if (timestamp >= 0) {
+        ret = mwProduceKafkaMessageWithTimestamp(writer->rk, writer->rkt, (char *)key, keyLen,
+                                                 (char *)payload, len, (int64_T)timestamp);
+    } else {
+        ret = mwProduceKafkaMessage(writer->rk, writer->rkt, (char *)key, keyLen, (char *)payload, len);
+    }
+    AEROSIM_TRACE_END("kafka.produce", "kafka");
+    return ret;
+}
+
+static int kafkaWriterStats(void *impl, aerosim_kafka_stats_t *stats)
+{
+    const aerosim_kafka_stats_t *client_stats = aerosimGetKafkaStats(((kafka_writer_t *)impl)->rk);
+
+    if (client_stats == NULL) {
+        return 0;
+    }
+    *stats = *client_stats;
+    return 1;
+}
+
+static void kafkaCloseWriter(void *impl)
+{
+    kafka_writer_t *writer = (kafka_writer_t *)impl;
+
+    aerosimReleaseKafkaProducer(writer->rk, writer->rkt);
+    free(writer);
+}
+
+static const aerosim_writer_ops_t kafka_writer_ops = {
+    kafkaWrite,
+    kafkaWriterStats,
+    kafkaCloseWriter
+};
+
+/*
+    Namespace
+*/
+const char *aerosimGetNamespace(int confCount, const char **confArray)
+{
+    const char *ns = aerosimGetOption(confCount, confArray, AEROSIM_NAMESPACE_OPTION);
+
+    if (ns == NULL) {
+        ns = getenv(AEROSIM_NAMESPACE_ENV);
+    }
+    return (ns != NULL && ns[0] != '\0') ? ns : NULL;
+}
+
+/* "<namespace>.<name>", NULL if it can't be allocated */
+static char *newNamespacedName(const char *ns, const char *name)
+{
+    size_t len = strlen(ns) + strlen(name) + 2;
+    char *scoped = (char *)malloc(len);
+
+    if (scoped != NULL) {
+        snprintf(scoped, len, "%s.%s", ns, name);
+    }
+    return scoped;
+}
+
+static void freeNamespacedNames(char **names, int count)
+{
+    int i;
+
+    if (names != NULL) {
+        for (i = 0; i < count; i++) {
+            free(names[i]);
+        }
+        free(names);
+    }
+}
+
+static char **newNamespacedNames(const char *ns, const char **names, int count)
+{
+    char **scoped = (char **)calloc(count > 0 ? count : 1, sizeof(char *));
+    int i;
+
+    if (scoped == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < count; i++) {
+        if ((scoped[i] = newNamespacedName(ns, names[i])) == NULL) {
+            freeNamespacedNames(scoped, count);
+            return NULL;
+        }
+    }
+    return scoped;
+}
+
+/*
+    Transport interface
+*/
+int aerosimOpenReader(aerosim_reader_t **preader,
+    const char *brokers, const char *group, const char **topics, int topicCount,
+    int confCount, int topicConfCount, const char **confArray,
+    int64_t start_offset)
+{
+    aerosim_reader_t *reader = (aerosim_reader_t *)calloc(1, sizeof(aerosim_reader_t));
+    aerosim_consumer_t *consumer = NULL;
+    const char *record_file = aerosimGetOption(confCount, confArray, AEROSIM_RECORD_FILE_OPTION);
+    const char *ns = aerosimGetNamespace(confCount, confArray);
+    char **scoped_topics = NULL;
+    char *scoped_group = NULL;
+    int res;
+
+    if (reader == NULL) {
+        return 1;
+    }
+    if (ns != NULL && !hasScheme(brokers, AEROSIM_REPLAY_SCHEME)) {
+        scoped_topics = newNamespacedNames(ns, topics, topicCount);
+        scoped_group = (group != NULL) ? newNamespacedName(ns, group) : NULL;
+        if (scoped_topics == NULL || (group != NULL && scoped_group == NULL)) {
+            fprintf(stderr, "%% Couldn't allocate the topics of namespace '%s'\n", ns);
+            freeNamespacedNames(scoped_topics, topicCount);
+            free(scoped_group);
+            free(reader);
+            return 1;
+        }
+        topics = (const char **)scoped_topics;
+        group = scoped_group;
+        reader->namespace_len = strlen(ns) + 1;
+    }
+
+    if (hasScheme(brokers, AEROSIM_SHM_SCHEME)) {
+        res = aerosimOpenShmReader(reader, brokers + strlen(AEROSIM_SHM_SCHEME), topics, topicCount,
+                                   confCount, confArray, start_offset);
+    } else if (hasScheme(brokers, AEROSIM_REPLAY_SCHEME)) {
+        res = aerosimOpenReplayReader(reader, brokers + strlen(AEROSIM_REPLAY_SCHEME), topics, topicCount);
+    } else {
+        res = aerosimOpenKafkaConsumerTopics(&consumer, brokers, group, topics, topicCount,
+                                             confCount, topicConfCount, confArray, start_offset);
+        reader->ops = &kafka_reader_ops;
+        reader->impl = consumer;
+    }
+    freeNamespacedNames(scoped_topics, topicCount);
+    free(scoped_group);
+    if (res) {
+        free(reader);
+        return res;
+    }
+    if (record_file != NULL && record_file[0] != '\0'
+        && (reader->recorder = aerosimOpenRecorder(record_file)) == NULL) {
+        aerosimCloseReader(reader);
+        return 1;
+    }
+    *preader = reader;
+    return 0;
+}
+
+void aerosimBeginReaderStep(aerosim_reader_t *reader)
+{
+    reader->step++;
+    if (reader->ops->begin_step != NULL) {
+        reader->ops->begin_step(reader->impl, reader->step);
+    }
+}
+
+int aerosimIsReplayReader(aerosim_reader_t *reader)
+{
+    return reader->replay;
+}
+
+int aerosimIsNamespacedReader(aerosim_reader_t *reader)
+{
+    return reader->namespace_len > 0;
+}
+
+/* The reader only reads namespaced topics, so their prefix is just skipped */
+static void stripNamespace(aerosim_reader_t *reader, aerosim_message_t *message)
+{
+    if (reader->namespace_len > 0 && message->topic != NULL && strlen(message->topic) > reader->namespace_len) {
+        message->topic += reader->namespace_len;
+    }
+}
+
+int aerosimReadMessage(aerosim_reader_t *reader, aerosim_message_t *message)
+{
+    if (!reader->ops->read(reader->impl, message)) {
+        return 0;
+    }
+    stripNamespace(reader, message);
+    if (reader->recorder != NULL) {
+        aerosimRecordMessage(reader->recorder, reader->step, message);
+    }
+    return 1;
+}
+
+int aerosimReadLatestMessage(aerosim_reader_t *reader, aerosim_message_t *message)
+{
+    if (!reader->ops->read_latest(reader->impl, message)) {
+        return 0;
+    }
+    stripNamespace(reader, message);
+    if (reader->recorder != NULL) {
+        aerosimRecordMessage(reader->recorder, reader->step, message);
+    }
+    return 1;
+}
+
+void aerosimReleaseMessage(aerosim_reader_t *reader, aerosim_message_t *message)
+{
+    reader->ops->release(reader->impl, message);
+}
+
+void aerosimCopyMessage(const aerosim_message_t *message,
+    int8_T *msg, uint32_T *msgLen, int maxMsgLen,
+    int8_T *key, uint32_T *keyLen, int maxKeyLen, int64_T *timestamp)
+{
+    size_t len = message->len < (size_t)maxMsgLen ? message->len : (size_t)maxMsgLen;
+    if (len > 0) {
+        memcpy(msg, message->payload, len);
+    }
+    if (len < (size_t)maxMsgLen) {
+        msg[len] = 0;
+    }
+    *msgLen = (uint32_T)len;
+
+    len = message->key_len < (size_t)maxKeyLen ? message->key_len : (size_t)maxKeyLen;
+    if (len > 0) {
+        memcpy(key, message->key, len);
+    }
+    if (len < (size_t)maxKeyLen) {
+        key[len] = 0;
+    }
+    *keyLen = (uint32_T)len;
+
+    if (timestamp != NULL) {
+        *timestamp = (int64_T)message->timestamp;
+    }
+}
+
+int aerosimWaitReaders(aerosim_reader_t **readers, int count, int64_t deadline_ns,
+    aerosim_wait_policy_t *policy)
+{
+    void *impls[AEROSIM_MAX_WAIT_CONSUMERS];
+    int i;
+
+    if (count > AEROSIM_MAX_WAIT_CONSUMERS) {
+        fprintf(stderr, "%% Can't wait for %d readers, the maximum is %d\n",
+            count, AEROSIM_MAX_WAIT_CONSUMERS);
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        impls[i] = readers[i]->impl;
+    }
+    return readers[0]->ops->wait(impls, count, deadline_ns, policy);
+}
+
+int64_t aerosimGetReaderLag(aerosim_reader_t *reader)
+{
+    return reader->ops->lag(reader->impl);
+}
+
+int aerosimSkipReaderToLatest(aerosim_reader_t *reader)
+{
+    return reader->ops->skip_to_latest(reader->impl);
+}
+
+int aerosimGetReaderPosition(aerosim_reader_t *reader, aerosim_reader_position_t *position)
+{
+    if (reader->ops->offsets == NULL) {
+        return 0;
+    }
+    position->step = reader->step;
+    position->count = reader->ops->offsets(reader->impl, position->offsets, AEROSIM_MAX_CONSUMER_TOPICS);
+    return 1;
+}
+
+int aerosimSeekReader(aerosim_reader_t *reader, const aerosim_reader_position_t *position)
+{
+    if (reader->ops->seek == NULL) {
+        fprintf(stderr, "%% The reader can't resume from a saved position\n");
+        return 1;
+    }
+    if (reader->ops->seek(reader->impl, position->step, position->offsets, position->count)) {
+        return 1;
+    }
+    if (reader->recorder != NULL && position->step < reader->step) {
+        /* The step index of a recording must stay in step order */
+        fprintf(stderr, "%% Stopped recording, the reader resumed at step %llu before step %llu\n",
+            (unsigned long long)position->step, (unsigned long long)reader->step);
+        aerosimCloseRecorder(reader->recorder);
+        reader->recorder = NULL;
+    }
+    reader->step = position->step;
+    return 0;
+}
+
+static const char *position_fields[] = { "step", "offsets" };
+
+mxArray *aerosimReaderPositionToMX(const aerosim_reader_position_t *position)
+{
+    mxArray *array = mxCreateStructMatrix(1, 1, 2, position_fields);
+    mxArray *step = mxCreateNumericMatrix(1, 1, mxUINT64_CLASS, mxREAL);
+    mxArray *offsets = mxCreateNumericMatrix(1, position->count, mxINT64_CLASS, mxREAL);
+
+    *(uint64_t *)mxGetData(step) = position->step;
+    if (position->count > 0) {
+        memcpy(mxGetData(offsets), position->offsets, sizeof(int64_t) * position->count);
+    }
+    mxSetField(array, 0, "step", step);
+    mxSetField(array, 0, "offsets", offsets);
+    return array;
+}
+
+int aerosimReaderPositionFromMX(const mxArray *array, aerosim_reader_position_t *position)
+{
+    const mxArray *step, *offsets;
+
+    if (array == NULL || !mxIsStruct(array)
+        || (step = mxGetField(array, 0, "step")) == NULL || mxGetClassID(step) != mxUINT64_CLASS
+        || mxGetNumberOfElements(step) != 1
+        || (offsets = mxGetField(array, 0, "offsets")) == NULL || mxGetClassID(offsets) != mxINT64_CLASS
+        || mxGetNumberOfElements(offsets) > AEROSIM_MAX_CONSUMER_TOPICS) {
+        return 0;
+    }
+    position->step = *(const uint64_t *)mxGetData(step);
+    position->count = (int)mxGetNumberOfElements(offsets);
+    if (position->count > 0) {
+        memcpy(position->offsets, mxGetData(offsets), sizeof(int64_t) * position->count);
+    }
+    return 1;
+}
+
+int aerosimGetReaderStats(aerosim_reader_t *reader, aerosim_kafka_stats_t *stats)
+{
+    return reader->ops->stats(reader->impl, stats);
+}
+
+void aerosimCloseReader(aerosim_reader_t *reader)
+{
+    if (reader == NULL) {
+        return;
+    }
+    reader->ops->close(reader->impl);
+    aerosimCloseRecorder(reader->recorder);
+    free(reader);
+}
+
+int aerosimOpenWriter(aerosim_writer_t **pwriter,
+    const char *brokers, const char *topic,
+    int confCount, int topicConfCount, const char **confArray)
+{
+    aerosim_writer_t *writer = (aerosim_writer_t *)calloc(1, sizeof(aerosim_writer_t));
+    const char *ns = aerosimGetNamespace(confCount, confArray);
+    char *scoped_topic = NULL;
+    kafka_writer_t *kafka;
+    int res;
+
+    if (writer == NULL) {
+        return 1;
+    }
+    if (ns != NULL && !hasScheme(brokers, AEROSIM_REPLAY_SCHEME)) {
+        if ((scoped_topic = newNamespacedName(ns, topic)) == NULL) {
+            free(writer);
+            return 1;
+        }
+        topic = scoped_topic;
+    }
+    if (hasScheme(brokers, AEROSIM_SHM_SCHEME)) {
+        res = aerosimOpenShmWriter(writer, brokers + strlen(AEROSIM_SHM_SCHEME), topic, confCount, confArray);
+    } else if (hasScheme(brokers, AEROSIM_REPLAY_SCHEME)) {
+        res = aerosimOpenReplayWriter(writer);
+    } else if ((kafka = (kafka_writer_t *)calloc(1, sizeof(kafka_writer_t))) == NULL) {
+        res = 1;
+    } else {
+        res = aerosimAcquireKafkaProducer(&kafka->rk, &kafka->rkt, brokers, topic, confCount, topicConfCount, confArray);
+        if (res) {
+            free(kafka);
+        }
+        writer->ops = &kafka_writer_ops;
+        writer->impl = kafka;
+    }
+    free(scoped_topic);
+    if (res) {
+        free(writer);
+        return res;
+    }
+    *pwriter = writer;
+    return 0;
+}
+
+int aerosimWriteMessage(aerosim_writer_t *writer, const char *key, int keyLen,
+    const char *payload, int len, int64_t timestamp)
+{
+    return writer->ops->write(writer->impl, key, keyLen, payload, len, timestamp, NULL);
+}
+
+int aerosimWriteMessageEnvelope(aerosim_writer_t *writer, const char *key, int keyLen,
+    const char *payload, int len, int64_t timestamp, const aerosim_envelope_t *envelope)
+{
+    return writer->ops->write(writer->impl, key, keyLen, payload, len, timestamp, envelope);
+}
+
+int aerosimGetWriterStats(aerosim_writer_t *writer, aerosim_kafka_stats_t *stats)
+{
+    return writer->ops->stats(writer->impl, stats);
+}
+
+void aerosimCloseWriter(aerosim_writer_t *writer)
+{
+    if (writer == NULL) {
+        return;
+    }
+    writer->ops->close(writer->impl);
+    free(writer);
+}
@@ -0,0 +1,225 @@
+#ifndef AEROSIM_TRANSPORT_H
+#define AEROSIM_TRANSPORT_H
+
+#include "aerosim_kafka_utils.h"
+
+/*
+    Message transport of the consumer, producer and clock sync blocks. The
+    brokers parameter selects the backend: "shm://<namespace>" exchanges the
+    messages through shared-memory rings on the local host (see
+    aerosim_shm_transport.h), "replay://<file>" replays a recording (see
+    aerosim_replay.h), any other value is a Kafka broker list.
+    Readers and writers take the same configuration as the Kafka clients;
+    each backend ignores the options it doesn't know.
+*/
+#define AEROSIM_SHM_SCHEME "shm://"
+#define AEROSIM_REPLAY_SCHEME "replay://"
+
+/*
+    Namespace of a co-simulation, so independent runs (e.g. parsim workers)
+    can share the brokers: the aerosim.namespace option, else the
+    AEROSIM_NAMESPACE environment variable. Readers and writers prefix their
+    topics and consumer group with "<namespace>.", and readers strip the
+    prefix from the message topics again. Replay ignores the namespace;
+    recordings hold the topics without it.
+*/
+#define AEROSIM_NAMESPACE_OPTION "aerosim.namespace"
+#define AEROSIM_NAMESPACE_ENV "AEROSIM_NAMESPACE"
+
+/* NULL without a namespace */
+const char *aerosimGetNamespace(int confCount, const char **confArray);
+
+/*
+    Message envelope: the metadata of an AeroSim message, i.e. its type
+    name, topic and timestamps. A writer given the envelope sends it along
+    as Kafka message headers, so readers can route, filter and timestamp
+    the message without parsing the payload. Header values are text, the
+    timestamps in nanoseconds. The shm and replay backends carry no headers;
+    their messages have an empty envelope, and aerosimScanEnvelope() reads
+    it from the payload instead.
+*/
+#define AEROSIM_HEADER_TYPE_NAME "aerosim.type_name"
+#define AEROSIM_HEADER_TOPIC "aerosim.topic"
+#define AEROSIM_HEADER_TIMESTAMP_SIM "aerosim.timestamp_sim"
+#define AEROSIM_HEADER_TIMESTAMP_PLATFORM "aerosim.timestamp_platform"
+
+typedef struct {
+    const char *type_name; /* not NUL-terminated, NULL if absent */
+    size_t type_name_len;
+    const char *topic;     /* not NUL-terminated, NULL if absent */
+    size_t topic_len;
+    int64_t sim_ns;        /* timestamp_sim, -1 if absent */
+    int64_t platform_ns;   /* timestamp_platform, -1 if absent */
+} aerosim_envelope_t;
+
+void aerosimClearEnvelope(aerosim_envelope_t *envelope);
+
+/*
+    Scan the metadata object of an AeroSim message payload for the envelope
+    fields, without parsing the rest of the document. The envelope points
+    into the payload. Returns 1 if the payload has a metadata object.
+*/
+int aerosimScanEnvelope(const char *payload, size_t len, aerosim_envelope_t *envelope);
+
+/*
+    Minimal JSON scanning of a buffer that needn't be NUL-terminated, for
+    fixed message layouts; neither validates the JSON. aerosimFindJsonValue()
+    returns the first character of the value of the first occurrence of the
+    key, or NULL. aerosimParseJsonInteger() returns 1 if p starts an integer.
+*/
+const char *aerosimFindJsonValue(const char *buf, const char *end, const char *key);
+int aerosimParseJsonInteger(const char *p, const char *end, int64_t *value);
+
+typedef struct {
+    const char *topic;
+    const void *payload;
+    size_t len;
+    const void *key;
+    size_t key_len;
+    int64_t timestamp;           /* ms since the epoch, -1 if not available */
+    aerosim_envelope_t envelope; /* from the message headers, empty without */
+    void *handle;                /* backend message, owned by the reader until released */
+} aerosim_message_t;
+
+typedef struct aerosim_reader_s aerosim_reader_t;
+typedef struct aerosim_writer_s aerosim_writer_t;
+
+int aerosimOpenReader(aerosim_reader_t **preader,
+    const char *brokers, const char *group, const char **topics, int topicCount,
+    int confCount, int topicConfCount, const char **confArray,
+    int64_t start_offset);
+
+/*
+    Start the block's next step, called once per major time step before
+    reading. Recorded messages are tagged with the step, replay serves them
+    by step. Messages read before the first call belong to step 0.
+*/
+void aerosimBeginReaderStep(aerosim_reader_t *reader);
+
+/* True if the reader replays a recording, e.g. to skip real-time pacing */
+int aerosimIsReplayReader(aerosim_reader_t *reader);
+
+/* True if the reader's topics are in a namespace (never for replay, which ignores it) */
+int aerosimIsNamespacedReader(aerosim_reader_t *reader);
+
+/* Returns 1 and fills the message if one is available, 0 otherwise; doesn't block */
+int aerosimReadMessage(aerosim_reader_t *reader, aerosim_message_t *message);
+
+/* Like aerosimReadMessage(), but consumes everything available and returns the last message */
+int aerosimReadLatestMessage(aerosim_reader_t *reader, aerosim_message_t *message);
+
+void aerosimReleaseMessage(aerosim_reader_t *reader, aerosim_message_t *message);
+
+void aerosimCopyMessage(const aerosim_message_t *message,
+    int8_T *msg, uint32_T *msgLen, int maxMsgLen,
+    int8_T *key, uint32_T *keyLen, int maxKeyLen, int64_T *timestamp);
+
+/*
+    Wait until one of the readers has a message, or until the monotonic
+    deadline has passed (see aerosimWaitKafkaConsumers()). All readers must
+    use the same backend, and at most AEROSIM_MAX_WAIT_CONSUMERS can be
+    waited for. Returns the index of a ready reader, or -1 on timeout or
+    error.
+*/
+int aerosimWaitReaders(aerosim_reader_t **readers, int count, int64_t deadline_ns,
+    aerosim_wait_policy_t *policy);
+
+/* Messages published but not read yet, -1 if unknown */
+int64_t aerosimGetReaderLag(aerosim_reader_t *reader);
+int aerosimSkipReaderToLatest(aerosim_reader_t *reader);
+
+/*
+    Read position of a reader, saved with the simulation state to resume
+    reading where a previous run left off: the reader's step and a
+    backend-specific offset per topic (Kafka offsets, shm ring sequence
+    numbers, or the replay position in the recording).
+*/
+typedef struct {
+    uint64_t step;
+    int count;
+    int64_t offsets[AEROSIM_MAX_CONSUMER_TOPICS];
+} aerosim_reader_position_t;
+
+/* Returns 1 and fills the position if the backend can restore it */
+int aerosimGetReaderPosition(aerosim_reader_t *reader, aerosim_reader_position_t *position);
+
+/*
+    Continue reading from a position of a reader opened with the same
+    topics, 0 on success. A recording reader stops recording if the
+    position is at an earlier step than the reader's.
+*/
+int aerosimSeekReader(aerosim_reader_t *reader, const aerosim_reader_position_t *position);
+
+/*
+    The position as a struct with the fields step (uint64) and offsets
+    (int64 row vector), as saved in the SimState of the reading blocks.
+    aerosimReaderPositionFromMX() returns 1 if the struct holds a position.
+*/
+mxArray *aerosimReaderPositionToMX(const aerosim_reader_position_t *position);
+int aerosimReaderPositionFromMX(const mxArray *array, aerosim_reader_position_t *position);
+
+/* Returns 1 and fills the statistics if the backend provides them */
+int aerosimGetReaderStats(aerosim_reader_t *reader, aerosim_kafka_stats_t *stats);
+
+void aerosimCloseReader(aerosim_reader_t *reader);
+
+int aerosimOpenWriter(aerosim_writer_t **pwriter,
+    const char *brokers, const char *topic,
+    int confCount, int topicConfCount, const char **confArray);
+
+/* A negative timestamp stamps the message with the current time */
+int aerosimWriteMessage(aerosim_writer_t *writer, const char *key, int keyLen,
+    const char *payload, int len, int64_t timestamp);
+
+/* Like aerosimWriteMessage(), also sending the envelope where the backend supports headers */
+int aerosimWriteMessageEnvelope(aerosim_writer_t *writer, const char *key, int keyLen,
+    const char *payload, int len, int64_t timestamp, const aerosim_envelope_t *envelope);
+
+int aerosimGetWriterStats(aerosim_writer_t *writer, aerosim_kafka_stats_t *stats);
+
+void aerosimCloseWriter(aerosim_writer_t *writer);
+
+/*
+    Backend interface. impl is the backend's reader or writer state; wait
+    gets the impl of every reader. begin_step may be NULL, as may offsets
+    and seek for a backend that can't resume from a saved position. write
+    gets a NULL envelope for messages without one.
+*/
+typedef struct {
+    int (*read)(void *impl, aerosim_message_t *message);
+    int (*read_latest)(void *impl, aerosim_message_t *message);
+    void (*release)(void *impl, aerosim_message_t *message);
+    int (*wait)(void **impls, int count, int64_t deadline_ns, aerosim_wait_policy_t *policy);
+    int64_t (*lag)(void *impl);
+    int (*skip_to_latest)(void *impl);
+    int (*stats)(void *impl, aerosim_kafka_stats_t *stats);
+    void (*close)(void *impl);
+    void (*begin_step)(void *impl, uint64_t step);
+    int (*offsets)(void *impl, int64_t *offsets, int maxCount);
+    int (*seek)(void *impl, uint64_t step, const int64_t *offsets, int count);
+} aerosim_reader_ops_t;
+
+typedef struct {
+    int (*write)(void *impl, const char *key, int keyLen, const char *payload, int len, int64_t timestamp,
+                 const aerosim_envelope_t *envelope);
+    int (*stats)(void *impl, aerosim_kafka_stats_t *stats);
+    void (*close)(void *impl);
+} aerosim_writer_ops_t;
+
+struct aerosim_recorder_s;
+
+struct aerosim_reader_s {
+    const aerosim_reader_ops_t *ops;
+    void *impl;
+    uint64_t step;
+    int replay;
+    size_t namespace_len;                /* topic prefix stripped from the messages */
+    struct aerosim_recorder_s *recorder; /* NULL unless recording */
+};
+
+struct aerosim_writer_s {
+    const aerosim_writer_ops_t *ops;
+    void *impl;
+};
+
+#endif /* AEROSIM_TRANSPORT_H */
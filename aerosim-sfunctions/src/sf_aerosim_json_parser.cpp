@@ -16,6 +16,7 @@
 
 // Needed for JSON decoding
 #include "jansson.h"
+#include "aerosim_trace.h"
 
 enum
 {
@@ -45,6 +46,12 @@ typedef enum
 
 static char errstr[512];
 
+// Opt-in end-to-end trace fields. A decoder reading a message that isn't traced yet starts the trace
+// from the message's platform timestamp; an encoder with both trace origin fields outputs the loop latency.
+#define TRACE_ID_FIELD "metadata.trace_id"
+#define TRACE_ORIGIN_SEC_FIELD "metadata.trace_origin_platform.sec"
+#define TRACE_ORIGIN_NANOSEC_FIELD "metadata.trace_origin_platform.nanosec"
+
 static void populateJSONObject(const char *fieldName, const char *fieldType, json_t *obj, SimStruct *S, int k) {
     json_t *curr_obj = obj;
 
@@ -118,6 +125,57 @@ static void getDataFromJSONField(const char *fieldName, json_t *obj, real_T* rtn
     return;
 }
 
+static json_t *getJSONField(const char *fieldName, json_t *obj)
+{
+    json_t *curr_obj = obj;
+
+    // Same traversal as getDataFromJSONField(), without reporting missing fields
+    char* token_str = strdup(fieldName);
+    char* token = strtok(token_str, ".");
+    token = strtok(NULL, ".");
+    while(token && curr_obj) {
+        curr_obj = json_object_get(curr_obj, token);
+        token = strtok(NULL, ".");
+    }
+
+    free(token_str);
+    return curr_obj;
+}
+
+static bool isTraceField(const char *fieldName)
+{
+    return strcmp(fieldName, TRACE_ID_FIELD) == 0
+        || strcmp(fieldName, TRACE_ORIGIN_SEC_FIELD) == 0
+        || strcmp(fieldName, TRACE_ORIGIN_NANOSEC_FIELD) == 0;
+}
+
+static void getTraceFieldFromPlatformTimestamp(const char *fieldName, json_t *root_metadata, real_T* rtn_number)
+{
+    // The trace starts at this message: its origin is the platform timestamp and
+    // its id the platform timestamp in microseconds (exact in a double)
+    real_T sec = json_number_value(getJSONField("metadata.timestamp_platform.sec", root_metadata));
+    real_T nanosec = json_number_value(getJSONField("metadata.timestamp_platform.nanosec", root_metadata));
+
+    if(strcmp(fieldName, TRACE_ORIGIN_SEC_FIELD) == 0)              *rtn_number = sec;
+    else if(strcmp(fieldName, TRACE_ORIGIN_NANOSEC_FIELD) == 0)     *rtn_number = nanosec;
+    else                                                            *rtn_number = sec * 1e6 + std::floor(nanosec / 1e3);
+}
+
+static real_T getInputPortValue(SimStruct *S, int k, const char *fieldType)
+{
+    if(strcmp(fieldType, "double") == 0)        return ((real_T*)ssGetInputPortSignal(S, k))[0];
+    else if(strcmp(fieldType, "single") == 0)   return ((real32_T*)ssGetInputPortSignal(S, k))[0];
+    else if (strcmp(fieldType, "int8") == 0)    return ((int8_T*)ssGetInputPortSignal(S, k))[0];
+    else if (strcmp(fieldType, "uint8") == 0)   return ((uint8_T*)ssGetInputPortSignal(S, k))[0];
+    else if (strcmp(fieldType, "int16") == 0)   return ((int16_T*)ssGetInputPortSignal(S, k))[0];
+    else if (strcmp(fieldType, "uint16") == 0)  return ((uint16_T*)ssGetInputPortSignal(S, k))[0];
+    else if (strcmp(fieldType, "int32") == 0)   return ((int32_T*)ssGetInputPortSignal(S, k))[0];
+    else if (strcmp(fieldType, "uint32") == 0)  return ((uint32_T*)ssGetInputPortSignal(S, k))[0];
+    else if (strcmp(fieldType, "int64") == 0)   return (real_T)((int64_T*)ssGetInputPortSignal(S, k))[0];
+    else if (strcmp(fieldType, "uint64") == 0)  return (real_T)((uint64_T*)ssGetInputPortSignal(S, k))[0];
+    return 0.0;
+}
+
 static char *getStringFromParamCellString(SimStruct *S, const mxArray *P, int idx)
 {
     static char gsfpErr[1024];
@@ -156,6 +214,30 @@ static char *getStringFromParamCellString(SimStruct *S, const mxArray *P, int id
     return newStr;
 }
 
+static int findFieldIndex(SimStruct *S, const char *name)
+{
+    int k, numFields = mxGetNumberOfElements(P_STRING_LIST);
+    for (k = 0; k < numFields; ++k)
+    {
+        char *fieldName = getStringFromParamCellString(S, P_STRING_LIST, k);
+        bool match = fieldName != NULL && strcmp(fieldName, name) == 0;
+        delete[] fieldName;
+        if (match)
+        {
+            return k;
+        }
+    }
+    return -1;
+}
+
+// The encoder outputs the loop latency when it encodes both trace origin fields
+static bool hasLoopLatencyOutput(SimStruct *S)
+{
+    return P_JSON_ENCODE == SF_DIR_ENCODE
+        && findFieldIndex(S, TRACE_ORIGIN_SEC_FIELD) >= 0
+        && findFieldIndex(S, TRACE_ORIGIN_NANOSEC_FIELD) >= 0;
+}
+
 static int getParamString(SimStruct *S, char **strPtr, const mxArray *prm, int epwIdx, char *errorHelp)
 {
     int N = (int)mxGetNumberOfElements(prm) + 1;
@@ -267,6 +349,7 @@ static void mdlInitializeSizes(SimStruct *S)
     {
         // ENCODING
         int nOut = (P_OUT_LENGTH != 0) ? 2 : 1;
+        bool loopLatency = hasLoopLatencyOutput(S);
         if (!ssSetNumInputPorts(S, numFields))
             return;
 
@@ -304,7 +387,7 @@ static void mdlInitializeSizes(SimStruct *S)
             delete[] fieldType;
         }
 
-        if (!ssSetNumOutputPorts(S, nOut))
+        if (!ssSetNumOutputPorts(S, loopLatency ? nOut + 1 : nOut))
             return;
         ssSetOutputPortWidth(S, 0, P_JSON_LEN);
         ssSetOutputPortDataType(S, 0, SS_INT8);
@@ -313,6 +396,12 @@ static void mdlInitializeSizes(SimStruct *S)
             ssSetOutputPortWidth(S, 1, 1);
             ssSetOutputPortDataType(S, 1, SS_UINT32);
         }
+        if (loopLatency)
+        {
+            // Loop latency in seconds from the trace origin to this encoder
+            ssSetOutputPortWidth(S, nOut, 1);
+            ssSetOutputPortDataType(S, nOut, SS_DOUBLE);
+        }
     }
 
     ssSetNumSampleTimes(S, 1);
@@ -324,7 +413,8 @@ static void mdlInitializeSizes(SimStruct *S)
     }
     else
     {
-        ssSetNumPWork(S, numFields);
+        // One field name per field, followed by the trace name
+        ssSetNumPWork(S, numFields + 1);
     }
     ssSetNumModes(S, 0);
     ssSetNumNonsampledZCs(S, 0);
@@ -365,6 +455,9 @@ static void mdlStart(SimStruct *S)
             ssSetPWorkValue(S, k, getStringFromParamCellString(S, P_STRING_LIST, k));
             // mexPrintf("Found string '%s'\n", ssGetPWorkValue(S, k));
         }
+
+        aerosimTraceStart();
+        ssSetPWorkValue(S, numFields, (void *)aerosimTraceName(ssGetPath(S)));
     }
 }
 #endif /*  MDL_START */
@@ -376,6 +469,13 @@ static void mdlStart(SimStruct *S)
  */
 static void mdlOutputs(SimStruct *S, int_T tid)
 {
+    const char *trace_name = NULL;
+    if (ssGetNumPWork(S) > 0)
+    {
+        trace_name = (const char *)ssGetPWorkValue(S, ssGetNumPWork(S) - 1);
+    }
+    AerosimTraceScope trace_scope(trace_name, "block");
+
     if (P_JSON_ENCODE == SF_DIR_DECODE)
     {
         // DECODING
@@ -432,7 +532,9 @@ static void mdlOutputs(SimStruct *S, int_T tid)
                 const char *fieldType = (const char *)getStringFromParamCellString(S, P_STRING_LIST_TYPE, k);
 
                 // Retrieve JSON data
-                if(strncmp(fieldName, "metadata", 8) == 0) {
+                if(isTraceField(fieldName) && getJSONField(fieldName, root_metadata) == NULL) {
+                    getTraceFieldFromPlatformTimestamp(fieldName, root_metadata, &rtn_number);
+                } else if(strncmp(fieldName, "metadata", 8) == 0) {
                     getDataFromJSONField(fieldName, root_metadata, &rtn_number, rtn_str, &rtn_bool);
                 } else {
                     getDataFromJSONField(fieldName, root_data, &rtn_number, rtn_str, &rtn_bool);
@@ -480,6 +582,8 @@ static void mdlOutputs(SimStruct *S, int_T tid)
         json_t *root_metadata = json_object();
         json_t *root_data = json_object();
         bool is_typename_jsondata = false;
+        real_T trace_origin_sec = 0.0;
+        real_T trace_origin_nanosec = 0.0;
 
         // Populate metadata and data JSON objects
         for (k = 0; k < numFields; ++k) {
@@ -497,6 +601,13 @@ static void mdlOutputs(SimStruct *S, int_T tid)
                 is_typename_jsondata = (strcmp((char*)ssGetInputPortSignal(S, k), "aerosim::types::JsonData") == 0) ? true : false;
             }
 
+            // Keep the trace origin for the loop latency
+            if(strcmp(fieldName, TRACE_ORIGIN_SEC_FIELD) == 0) {
+                trace_origin_sec = getInputPortValue(S, k, fieldType);
+            } else if(strcmp(fieldName, TRACE_ORIGIN_NANOSEC_FIELD) == 0) {
+                trace_origin_nanosec = getInputPortValue(S, k, fieldType);
+            }
+
             delete[] fieldType;
         }
 
@@ -538,6 +649,21 @@ static void mdlOutputs(SimStruct *S, int_T tid)
             }
         }
 
+        // Loop latency from the trace origin's platform time, 0 until a traced message arrived.
+        // Both ends use the system clock, so hosts other than the origin need synchronized clocks.
+        if (ssGetNumOutputPorts(S) > ((P_OUT_LENGTH != 0) ? 2 : 1))
+        {
+            real_T *latency = (real_T *)ssGetOutputPortSignal(S, (P_OUT_LENGTH != 0) ? 2 : 1);
+            if (trace_origin_sec > 0.0) {
+                const auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::system_clock::now().time_since_epoch()).count();
+                *latency = (real_T)(now / 1000000000LL - (int64_T)trace_origin_sec)
+                           + ((real_T)(now % 1000000000LL) - trace_origin_nanosec) * 1e-9;
+            } else {
+                *latency = 0.0;
+            }
+        }
+
         // Free memory
         free(root_str);
         json_decref(root_metadata);
@@ -566,6 +692,8 @@ static void mdlTerminate(SimStruct *S)
             ssSetPWorkValue(S, k, NULL);
         }
     }
+    ssSetPWorkValue(S, numFields, NULL);
+    aerosimTraceStop();
 }
 
 #define MDL_RTW /* Change to #undef to remove function */
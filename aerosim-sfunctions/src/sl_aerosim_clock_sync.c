@@ -25,17 +25,15 @@
 #include "jansson.h"
 
 #include <float.h>
-#include <time.h>
-#ifdef _WIN32
-#include <windows.h>
-#else
-#include <unistd.h>
-#define Sleep(x) usleep((x)*1000)
-#endif
+#include <stdint.h>
+#include <stdio.h>
 
 #include "mw_kafka_utils.h"
 #include "mx_kafka_utils.h"
 #include "aerosim_kafka_utils.h"
+#include "aerosim_transport.h"
+#include "aerosim_barrier.h"
+#include "aerosim_trace.h"
 
 enum
 {
@@ -65,18 +63,187 @@ enum
 
 enum
 {
-    EPW_CLOCK_CONSUMER = 0,
-    EPW_ORCHESTRATOR_CONSUMER = 1,
-    EPW_SIM_START_STATUS = 2,
-    EPW_ORCHESTRATOR_MSG = 3,
-    EPW_ORCHESTRATOR_KEY = 4,
+    EPW_READER = 0,
+    EPW_SIM_START_STATUS = 1,
+    EPW_ORCHESTRATOR_MSG = 2,
+    EPW_ORCHESTRATOR_KEY = 3,
+    EPW_WAIT_POLICY = 4,
+    EPW_STEP_COUNT = 5,
+    EPW_ACK_WRITER = 6,
+    EPW_TICK_COUNT = 7,
+    EPW_PACING = 8,
+    EPW_CLOCK_TICK = 9,
+    EPW_TIMING = 10,
+    EPW_TRACE_NAME = 11,
+    EPW_RUN_ID = 12,
+    EPW_BARRIER = 13,
+    EPW_PENDING_TICKS = 14,
     EPW_NumPWorks
 };
 
+enum
+{
+    EIW_LOOKAHEAD_TICKS = 0,
+    EIW_OCCUPANCY_PORT = 1,
+    EIW_SIM_TIME_PORT = 2,
+    EIW_STEP_PORT = 3,
+    EIW_TIMING_PORT = 4,
+    EIW_STATS_PORT = 5,
+    EIW_NumIWorks
+};
+
+enum
+{
+    ERW_BARRIER_TIMEOUT = 0, /* seconds, negative waits forever */
+    ERW_NumRWorks
+};
+
 static int wait_eof = 0; /* number of partitions awaiting EOF */
 
 static char errstr[512]; /* librdkafka API error reporting buffer */
 
+/* Topics read through the block's single consumer queue, dispatched by topic name */
+#define CLOCK_TOPIC "aerosim.clock"
+#define ORCHESTRATOR_TOPIC "aerosim.orchestrator.commands"
+
+/* Message types of the topics, checked against the type_name message header */
+#define CLOCK_TYPE_NAME "aerosim::types::TimeStamp"
+#define ORCHESTRATOR_TYPE_NAME "aerosim::types::JsonData"
+
+/* Default spin budgets of the clock tick wait policy (client config "aerosim.wait.*") */
+#define DEFAULT_WAIT_SPIN_US 50.0
+#define DEFAULT_WAIT_SPIN_MAX_US 500.0
+
+/* Number of steps the model may run ahead of the last received clock tick (client config) */
+#define P_LOOKAHEAD_TICKS ((int_T)aerosimGetOptionNumberMX(P_CONF, "aerosim.lookahead.ticks", 0))
+
+/* Default number of steps between barrier ticks in free-run mode */
+#define DEFAULT_FREE_RUN_BARRIER_STEPS 100
+
+/*
+    Run id (client config, else the AEROSIM_RUN_ID environment variable).
+    Commands with a `run_id` of another run are ignored; without its own run
+    id the block joins the run of the first start command.
+*/
+#define RUN_ID_OPTION "aerosim.run.id"
+#define RUN_ID_ENV "AEROSIM_RUN_ID"
+#define RUN_ID_LEN 64
+
+/*
+    Step barrier with the other Simulink processes of the scenario (client
+    config, see aerosim_barrier.h): the barrier topic enables it. Each step
+    runs once every participant has reported it. The participant id
+    defaults to the block path; the first step waits for the given number
+    of participants. The barrier timeout defaults to the clock message
+    timeout.
+*/
+#define BARRIER_TOPIC_OPTION "aerosim.barrier.topic"
+#define P_BARRIER_PARTICIPANTS ((int_T)aerosimGetOptionNumberMX(P_CONF, "aerosim.barrier.participants", 1))
+#define P_BARRIER_TIMEOUT (aerosimGetOptionNumberMX(P_CONF, "aerosim.barrier.timeout", P_CLOCK_MSG_TIMEOUT))
+
+/* Parsed orchestrator.command message */
+typedef struct
+{
+    char command[32];
+    char run_id[RUN_ID_LEN]; /* empty if the command doesn't name a run */
+    double ratio;           /* free_run: target sim time / wall time ratio, <= 0 runs unpaced */
+    uint64_t barrier_steps; /* free_run: steps released by each barrier tick */
+} orchestrator_command_t;
+
+/* Pacing state, lock-step unless the orchestrator requested free-run mode */
+typedef struct
+{
+    bool free_run;
+    double ratio;
+    uint64_t barrier_steps;
+    uint64_t base_step;   /* step count when free-run mode started */
+    double base_sim_time; /* simulation time when free-run mode started */
+    int64_t base_wall_ns; /* monotonic time when free-run mode started */
+} clock_pacing_t;
+
+/* Decode the clock message into sim time and step outputs (client config) */
+#define P_DECODE_CLOCK (aerosimGetOptionNumberMX(P_CONF, "aerosim.clock.decode", 0) != 0)
+
+/* Output the last step's phase durations (client config) */
+#define P_OUTPUT_TIMING (aerosimGetOptionNumberMX(P_CONF, "aerosim.timing.output", 0) != 0)
+
+/* Output port layout, the optional ports follow the fixed ports in this order (-1 if disabled) */
+typedef struct
+{
+    int_T timestamp;
+    int_T sim_time;
+    int_T step;
+    int_T occupancy;
+    int_T timing;
+    int_T stats;
+    int_T count;
+} clock_ports_t;
+
+/* Phases of a lock-step tick, timed with the monotonic clock */
+enum
+{
+    PHASE_WAIT = 0, /* blocked waiting for the clock tick (and free-run pacing, barrier participants) */
+    PHASE_POLL,     /* polling and dispatching clock ticks and orchestrator commands */
+    PHASE_COMPUTE,  /* function-call subsystem execution */
+    PHASE_OUTPUT,   /* step acknowledgement */
+    PHASE_STEP,     /* whole step */
+    PHASE_Num
+};
+
+static const char *phase_names[PHASE_Num] = { "wait", "poll", "compute", "output", "step" };
+
+typedef struct
+{
+    aerosim_histogram_t histograms[PHASE_Num];
+} clock_timing_t;
+
+/* Decoded aerosim.clock tick */
+typedef struct
+{
+    int64_t sec;
+    int64_t nanosec;
+    int64_t step;  /* step index from the message, -1 if it has none */
+} clock_tick_t;
+
+/* Last accepted tick, to reject duplicate and out-of-order ticks */
+typedef struct
+{
+    bool valid;
+    clock_tick_t last;
+    uint64_t rejected;
+} clock_tick_state_t;
+
+/*
+    Clock ticks dequeued while waiting for the start command. The clock and
+    orchestrator topics share one queue without an order across topics, so
+    the first ticks of a run can be dequeued before its start command. The
+    ticks that aren't older than the start command are handed to the first
+    step, the older ones are left over from an earlier run and are dropped,
+    also when they are only dequeued after the start command.
+*/
+#define PENDING_TICKS 8
+
+typedef struct
+{
+    size_t len;
+    size_t key_len;
+    int64_t timestamp;
+    int64_t sim_ns;
+} pending_tick_t;
+
+typedef struct
+{
+    int first;
+    int count;
+    pending_tick_t ticks[PENDING_TICKS];
+    int8_T *data; /* PENDING_TICKS payloads of P_MSG_LEN bytes followed by their keys, allocated on first use */
+    int64_t start_timestamp; /* of the start command, -1 if unknown */
+    uint64_t stale;          /* ticks dropped after the start command */
+} pending_ticks_t;
+
+/* Maximum size of a step-complete acknowledgement message */
+#define ACK_MSG_LEN 512
+
 static int getParamString(SimStruct *S, char **strPtr, const mxArray *prm, int epwIdx, char *errorHelp)
 {
     int N = (int)mxGetNumberOfElements(prm);
@@ -102,13 +269,12 @@ static int getParamString(SimStruct *S, char **strPtr, const mxArray *prm, int e
     return 0;
 }
 
-void initKafkaConsumer(SimStruct *S, const char* topic, const char* group, int_T p_work_idx)
+void initKafkaConsumer(SimStruct *S, const char** topics, int topicCount, const char* group, int_T p_work_idx)
 {
-    rd_kafka_t *rk = NULL;        /* Consumer instance handle */
+    aerosim_reader_t *reader = NULL; /* Kafka consumer slot or shared-memory reader */
     rd_kafka_topic_t *rkt = NULL; /* Topic object */
     rd_kafka_conf_t *conf = NULL; /* Temporary configuration object */
     rd_kafka_topic_conf_t *topic_conf = NULL;
-    rd_kafka_topic_partition_list_t *topics;
     int partition = RD_KAFKA_PARTITION_UA;
     int64_t start_offset = RD_KAFKA_OFFSET_BEGINNING;
     /*
@@ -126,7 +292,10 @@ void initKafkaConsumer(SimStruct *S, const char* topic, const char* group, int_T
 
     if (getParamString(S, &brokers, P_BROKER, -1, "brokers"))
         goto exit_init_kafka;
-    mexPrintf("Initializing Kafka Consumer - (brokers: %s, topic: %s, group: %s)\n", brokers, topic, group);
+    for (int i = 0; i < topicCount; i++)
+    {
+        mexPrintf("Initializing Kafka Consumer - (brokers: %s, topic: %s, group: %s)\n", brokers, topics[i], group);
+    }
 
     nConf = mxGetNumberOfElements(P_CONF);
     nTopicConf = mxGetNumberOfElements(P_TOPIC_CONF);
@@ -138,13 +307,14 @@ void initKafkaConsumer(SimStruct *S, const char* topic, const char* group, int_T
         return;
     }
 
-    int res = aerosimInitializeKafkaConsumer(&rk, brokers, group, topic, nConf, nTopicConf, confArray, start_offset);
+    int res = aerosimOpenReader(&reader, brokers, group, topics, topicCount, nConf, nTopicConf, confArray, start_offset);
+    freeConfArray((char **)confArray, nConf + nTopicConf);
     if (res)
     {
         ssSetErrorStatus(S, "Problems initializing Kafka Consumer\n");
         goto exit_init_kafka;
     }
-    ssSetPWorkValue(S, p_work_idx, rk);
+    ssSetPWorkValue(S, p_work_idx, reader);
 
 exit_init_kafka:
     if (brokers != NULL)
@@ -158,16 +328,260 @@ exit_init_kafka:
 }
 
 /**
- * @brief Check if the orchestrator.command matches the desired command
+ * @brief Initialize the producer for step-complete acknowledgements
+ *
+ * The writer shares the block's brokers and configuration. Kafka acks are
+ * sent without batching delay (linger.ms = 0) unless the client config sets it.
+ *
+ * @param topic Acknowledgement topic
+ */
+void initAckProducer(SimStruct *S, const char* topic)
+{
+    aerosim_writer_t *writer = NULL;
+    char *brokers = NULL;
+    int nConf, nTopicConf;
+
+    if (getParamString(S, &brokers, P_BROKER, -1, "brokers"))
+        return;
+    mexPrintf("Initializing Kafka Producer - (brokers: %s, topic: %s)\n", brokers, topic);
+
+    nConf = mxGetNumberOfElements(P_CONF);
+    nTopicConf = mxGetNumberOfElements(P_TOPIC_CONF);
+    const char **confArray = getConfArrayFromMX(nConf, P_CONF, nTopicConf, P_TOPIC_CONF);
+    const char **ackConfArray = (const char **)malloc(sizeof(char *) * (nConf + nTopicConf + 2));
+
+    if (confArray == NULL || ackConfArray == NULL)
+    {
+        ssSetErrorStatus(S, "Couldn't retrieve confArray from parameters");
+        if (confArray != NULL)
+        {
+            freeConfArray((char **)confArray, nConf + nTopicConf);
+        }
+        free(ackConfArray);
+        free(brokers);
+        return;
+    }
+
+    ackConfArray[0] = "linger.ms";
+    ackConfArray[1] = "0";
+    memcpy(ackConfArray + 2, confArray, sizeof(char *) * (nConf + nTopicConf));
+
+    int res = aerosimOpenWriter(&writer, brokers, topic, nConf + 2, nTopicConf, ackConfArray);
+    free(ackConfArray);
+    freeConfArray((char **)confArray, nConf + nTopicConf);
+    free(brokers);
+    if (res)
+    {
+        ssSetErrorStatus(S, "Problems initializing Kafka Producer\n");
+        return;
+    }
+    ssSetPWorkValue(S, EPW_ACK_WRITER, writer);
+}
+
+/**
+ * @brief Join the step barrier of the scenario's Simulink processes
+ *
+ * The barrier shares the block's brokers and configuration. Replay runs
+ * without the barrier, the recorded clock already fixes the steps.
+ *
+ * @param topic Barrier topic
+ */
+void initBarrier(SimStruct *S, const char* topic)
+{
+    aerosim_barrier_t *barrier = NULL;
+    char *brokers = NULL;
+    char participant[256];
+    int nConf, nTopicConf;
+
+    if (aerosimIsReplayReader((aerosim_reader_t *)ssGetPWorkValue(S, EPW_READER)))
+    {
+        mexPrintf("Replaying without the step barrier\n");
+        return;
+    }
+    if (!aerosimGetOptionMX(P_CONF, "aerosim.barrier.id", participant, sizeof(participant)) || participant[0] == '\0')
+    {
+        snprintf(participant, sizeof(participant), "%s", ssGetPath(S));
+    }
+    if (getParamString(S, &brokers, P_BROKER, -1, "brokers"))
+        return;
+    ssSetRWorkValue(S, ERW_BARRIER_TIMEOUT, P_BARRIER_TIMEOUT);
+    mexPrintf("Joining the step barrier - (brokers: %s, topic: %s, participant: %s)\n", brokers, topic, participant);
+
+    nConf = mxGetNumberOfElements(P_CONF);
+    nTopicConf = mxGetNumberOfElements(P_TOPIC_CONF);
+    const char **confArray = getConfArrayFromMX(nConf, P_CONF, nTopicConf, P_TOPIC_CONF);
+    if (confArray == NULL)
+    {
+        ssSetErrorStatus(S, "Couldn't retrieve confArray from parameters");
+        free(brokers);
+        return;
+    }
+
+    barrier = aerosimOpenBarrier(brokers, topic, participant, P_BARRIER_PARTICIPANTS, nConf, nTopicConf, confArray);
+    freeConfArray((char **)confArray, nConf + nTopicConf);
+    free(brokers);
+    if (barrier == NULL)
+    {
+        ssSetErrorStatus(S, "Problems initializing the step barrier\n");
+        return;
+    }
+    ssSetPWorkValue(S, EPW_BARRIER, barrier);
+}
+
+/**
+ * @brief Wait until every barrier participant has reported the step
+ *
+ * @param step Index of the step to run, counting from 1
+ * @return true once the step is released or without a barrier, false on timeout
+ */
+static bool waitStepBarrier(SimStruct *S, uint64_t step)
+{
+    aerosim_barrier_t *barrier = (aerosim_barrier_t *)ssGetPWorkValue(S, EPW_BARRIER);
+    const double timeout_sec = ssGetRWorkValue(S, ERW_BARRIER_TIMEOUT);
+
+    if (barrier == NULL)
+    {
+        return true;
+    }
+
+    const int64_t deadline_ns = (timeout_sec < 0) ? INT64_MAX : aerosimMonotonicNs() + (int64_t)(timeout_sec * 1e9);
+    int res = aerosimWaitBarrier(barrier, step, deadline_ns);
+    if (res == 0)
+    {
+        return true;
+    }
+    if (res < 0)
+    {
+        mexPrintf("Failed reporting step %llu to the barrier... stopping simulation\n", (unsigned long long)step);
+        return false;
+    }
+
+    mexPrintf("Barrier step %llu was not released after %.1lf seconds, waiting for:\n", (unsigned long long)step, timeout_sec);
+    for (int i = 0; i < aerosimGetBarrierMemberCount(barrier); i++)
+    {
+        const aerosim_barrier_member_t *member = aerosimGetBarrierMember(barrier, i);
+        if (member->active && member->ready_step < step)
+        {
+            mexPrintf("  %s (last step %llu)\n", member->participant, (unsigned long long)member->ready_step);
+        }
+    }
+    int missing = aerosimGetBarrierMissingParticipants(barrier);
+    if (missing > 0)
+    {
+        mexPrintf("  %d more participant(s) to join (aerosim.barrier.participants)\n", missing);
+    }
+    mexPrintf("Stopping simulation\n");
+    return false;
+}
+
+/**
+ * @brief Escape a string for a JSON string value, without the quotes
+ *
+ * Quotes, backslashes and control characters are escaped; the output is
+ * truncated to fit, but never within an escape sequence.
+ */
+static void escapeJsonString(const char *str, char *out, size_t size)
+{
+    size_t len = 0;
+
+    for (; *str != '\0'; str++)
+    {
+        unsigned char c = (unsigned char)*str;
+        char escaped[8];
+        int n;
+
+        if (c == '"' || c == '\\')
+            n = snprintf(escaped, sizeof(escaped), "\\%c", c);
+        else if (c < 0x20)
+            n = snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+        else
+            n = snprintf(escaped, sizeof(escaped), "%c", c);
+
+        if (len + n >= size)
+            break;
+        memcpy(out + len, escaped, n);
+        len += n;
+    }
+    out[len] = '\0';
+}
+
+/**
+ * @brief Publish a step-complete acknowledgement
+ *
+ * The ack is a compact JSON object keyed by the block path, so a closed-loop
+ * orchestrator can advance as soon as every participant finished the step.
+ *
+ * @param step Index of the completed step, counting from 1
+ * @param compute_ns Duration of the function-call subsystem execution
+ */
+static void produceStepAck(SimStruct *S, uint64_t step, int64_t compute_ns)
+{
+    aerosim_writer_t *writer = (aerosim_writer_t *)ssGetPWorkValue(S, EPW_ACK_WRITER);
+    const char *run_id = (const char *)ssGetPWorkValue(S, EPW_RUN_ID);
+    char ack[ACK_MSG_LEN];
+    const char *key = ssGetPath(S);
+
+    if (writer == NULL)
+    {
+        return;
+    }
+
+    // Acks name the run once the block has a run id
+    char escaped_run_id[RUN_ID_LEN * 6];
+    escapeJsonString(run_id, escaped_run_id, sizeof(escaped_run_id));
+    int len = snprintf(ack, sizeof(ack), "{\"step\":%llu,\"sim_time\":%.17g,\"compute_ns\":%lld", (unsigned long long)step,
+                       ssGetT(S), (long long)compute_ns);
+    len += snprintf(ack + len, sizeof(ack) - len, run_id[0] != '\0' ? ",\"run_id\":\"%s\"}" : "}", escaped_run_id);
+    int ret = aerosimWriteMessage(writer, key, (int)strlen(key), ack, len, -1);
+    if (ret)
+    {
+        mexPrintf("Failed producing step %llu acknowledgement\n", (unsigned long long)step);
+    }
+}
+
+/**
+ * @brief Check which topic a consumed message was read from
+ *
+ * @param message Consumed message
+ * @param topic Topic name
+ * @return true if the message was read from the topic
+ */
+static bool isMessageTopic(const aerosim_message_t *message, const char *topic) {
+    return message->topic != NULL && strcmp(message->topic, topic) == 0;
+}
+
+/**
+ * @brief Check the type_name message header, so other messages on the
+ * clock and orchestrator topics are dropped without parsing them
+ *
+ * @param message Consumed message
+ * @param type_name Expected type name
+ * @return true if the message has a type_name header with another type
+ */
+static bool isOtherMessageType(const aerosim_message_t *message, const char *type_name) {
+    return message->envelope.type_name != NULL
+           && (message->envelope.type_name_len != strlen(type_name)
+               || memcmp(message->envelope.type_name, type_name, message->envelope.type_name_len) != 0);
+}
+
+/**
+ * @brief Parse an orchestrator.command message
+ *
+ * The command and its parameters are read from the JSON string in the
+ * message's `data.data` field, e.g.
+ * {"command": "free_run", "ratio": 10.0, "barrier_steps": 100, "run_id": "sweep-17"}.
  *
  * @param msg Orchestrator command message
- * @param command Desired command
- * @return true if orchestrator message command matches desired command
- * @return false if orchestrator message command does not match desired command
+ * @param cmd Parsed command, parameters that aren't given keep their defaults
+ * @return true if a command was parsed
+ * @return false if the message doesn't hold a command
  */
-bool isOrchestratorCommand(char* msg, const char* command) {
+bool parseOrchestratorCommand(char* msg, orchestrator_command_t* cmd) {
     bool rtn = false;
 
+    memset(cmd, 0, sizeof(*cmd));
+    cmd->barrier_steps = DEFAULT_FREE_RUN_BARRIER_STEPS;
+
     // Parse and load `data` section of data JSON string
     json_t *root = NULL;  // JSON root of message
     json_t *root_data = NULL;  // JSON root of nested data object
@@ -185,14 +599,26 @@ bool isOrchestratorCommand(char* msg, const char* command) {
     const char *data_str = json_string_value(data_str_ref);
     root_data = json_loads(data_str, 0, &error);
 
-    // Parse `command` and check if desired command is received
+    // Parse `command` and its parameters
     if(json_is_object(root_data)) {
         json_t *command_obj = json_object_get(root_data, "command");
         if(json_is_string(command_obj)) {
             mexPrintf("Received orchestrator.command: %s\n", json_string_value(command_obj));
-            if(strcmp(json_string_value(command_obj), command) == 0) {
-                rtn = true;
-            }
+            snprintf(cmd->command, sizeof(cmd->command), "%s", json_string_value(command_obj));
+            rtn = true;
+        }
+
+        json_t *ratio_obj = json_object_get(root_data, "ratio");
+        if(json_is_number(ratio_obj)) {
+            cmd->ratio = json_number_value(ratio_obj);
+        }
+        json_t *barrier_obj = json_object_get(root_data, "barrier_steps");
+        if(json_is_integer(barrier_obj) && json_integer_value(barrier_obj) > 0) {
+            cmd->barrier_steps = (uint64_t)json_integer_value(barrier_obj);
+        }
+        json_t *run_id_obj = json_object_get(root_data, "run_id");
+        if(json_is_string(run_id_obj)) {
+            snprintf(cmd->run_id, sizeof(cmd->run_id), "%s", json_string_value(run_id_obj));
         }
     }
 
@@ -202,6 +628,312 @@ bool isOrchestratorCommand(char* msg, const char* command) {
     return rtn;
 }
 
+/**
+ * @brief Check that an orchestrator command belongs to the block's run
+ *
+ * A start command assigns its run id to a block without one.
+ *
+ * @param cmd Parsed command
+ * @return true if the command has no run id or the block's run id
+ */
+static bool isRunCommand(SimStruct *S, const orchestrator_command_t* cmd) {
+    char* run_id = (char*)ssGetPWorkValue(S, EPW_RUN_ID);
+
+    if(cmd->run_id[0] == '\0' || strcmp(cmd->run_id, run_id) == 0) {
+        return true;
+    }
+    if(run_id[0] == '\0' && strcmp(cmd->command, "start") == 0) {
+        snprintf(run_id, RUN_ID_LEN, "%s", cmd->run_id);
+        mexPrintf("Joining run '%s'\n", run_id);
+        return true;
+    }
+    mexPrintf("Ignoring orchestrator.command '%s' of run '%s'\n", cmd->command, cmd->run_id);
+    return false;
+}
+
+/**
+ * @brief Apply the pacing commands `free_run` and `lock_step`
+ *
+ * In free-run mode each clock tick is a barrier that releases the next
+ * barrier_steps steps, so the model only waits at every barrier_steps-th
+ * step. A positive ratio additionally paces the model to ratio times
+ * real time. `lock_step` returns to one clock tick per step.
+ *
+ * @param cmd Parsed orchestrator command
+ * @return true if the command was a pacing command
+ */
+static bool applyPacingCommand(SimStruct *S, const orchestrator_command_t* cmd) {
+    clock_pacing_t* pacing = (clock_pacing_t*)ssGetPWorkValue(S, EPW_PACING);
+    uint64_t* step_count = (uint64_t*)ssGetPWorkValue(S, EPW_STEP_COUNT);
+    uint64_t* tick_count = (uint64_t*)ssGetPWorkValue(S, EPW_TICK_COUNT);
+
+    if(strcmp(cmd->command, "free_run") == 0) {
+        mexPrintf("Free-running with a barrier every %llu steps (ratio %.2f)\n",
+                  (unsigned long long)cmd->barrier_steps, cmd->ratio);
+        pacing->free_run = true;
+        pacing->ratio = cmd->ratio;
+        pacing->barrier_steps = cmd->barrier_steps;
+        pacing->base_step = *step_count;
+        pacing->base_sim_time = ssGetT(S);
+        pacing->base_wall_ns = aerosimMonotonicNs();
+        // Clock ticks received from now on count as barriers
+        *tick_count = *step_count;
+        return true;
+    }
+    if(strcmp(cmd->command, "lock_step") == 0) {
+        mexPrintf("Returning to lock-step\n");
+        pacing->free_run = false;
+        *tick_count = *step_count;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Get the step the last received clock tick synchronized the model to
+ *
+ * In lock-step each tick synchronizes one step, in free-run mode each tick
+ * is a barrier for the next barrier_steps steps.
+ */
+static uint64_t getSyncedStep(SimStruct *S) {
+    clock_pacing_t* pacing = (clock_pacing_t*)ssGetPWorkValue(S, EPW_PACING);
+    uint64_t ticks = *(uint64_t*)ssGetPWorkValue(S, EPW_TICK_COUNT);
+
+    if(pacing->free_run) {
+        return pacing->base_step + (ticks - pacing->base_step) * pacing->barrier_steps;
+    }
+    return ticks;
+}
+
+/**
+ * @brief Get how many steps the model may run past the last synchronized step
+ */
+static uint64_t getStepWindow(SimStruct *S) {
+    clock_pacing_t* pacing = (clock_pacing_t*)ssGetPWorkValue(S, EPW_PACING);
+    uint64_t lookahead = (uint64_t)ssGetIWorkValue(S, EIW_LOOKAHEAD_TICKS);
+
+    if(pacing->free_run) {
+        return pacing->barrier_steps - 1 + lookahead;
+    }
+    return lookahead;
+}
+
+static void getOutputPorts(SimStruct *S, clock_ports_t *ports)
+{
+    bool decode = P_DECODE_CLOCK;
+
+    ports->count = 5;
+    ports->timestamp = (P_OUTPUT_TIMESTAMP != 0) ? ports->count++ : -1;
+    ports->sim_time = decode ? ports->count++ : -1;
+    ports->step = decode ? ports->count++ : -1;
+    ports->occupancy = (P_LOOKAHEAD_TICKS > 0) ? ports->count++ : -1;
+    ports->timing = P_OUTPUT_TIMING ? ports->count++ : -1;
+    ports->stats = (aerosimGetOptionNumberMX(P_CONF, AEROSIM_STATS_OUTPUT_OPTION, 0) != 0) ? ports->count++ : -1;
+}
+
+/**
+ * @brief Write the phase duration percentiles to a file
+ *
+ * One line per phase with the sample count and min/mean/p50/p99/p99.9/max
+ * durations in microseconds.
+ */
+static void dumpClockTiming(const clock_timing_t *timing, const char *path)
+{
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL)
+    {
+        mexPrintf("Couldn't open timing file '%s'\n", path);
+        return;
+    }
+
+    fprintf(fp, "phase,count,min_us,mean_us,p50_us,p99_us,p99.9_us,max_us\n");
+    for (int i = 0; i < PHASE_Num; i++)
+    {
+        const aerosim_histogram_t *h = &timing->histograms[i];
+        fprintf(fp, "%s,%llu,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n", phase_names[i], (unsigned long long)h->count,
+                h->min / 1e3, h->count > 0 ? h->sum / (double)h->count / 1e3 : 0.0,
+                aerosimHistogramPercentile(h, 50.0) / 1e3, aerosimHistogramPercentile(h, 99.0) / 1e3,
+                aerosimHistogramPercentile(h, 99.9) / 1e3, h->max / 1e3);
+    }
+    fclose(fp);
+    mexPrintf("Wrote lock-step timing to '%s'\n", path);
+}
+
+/**
+ * @brief Decode the sim time and step index of an aerosim.clock message
+ *
+ * The sim time is taken from the timestamp_sim message header if there is
+ * one, otherwise from `timestamp_sim` {"sec", "nanosec"} of the payload (the
+ * first one, i.e. from the metadata). The optional integer `step` is read
+ * from the payload.
+ *
+ * @return true if the message holds a sim timestamp
+ */
+static bool decodeClockTick(const aerosim_message_t *message, clock_tick_t *tick)
+{
+    const char *payload = (const char *)message->payload;
+    const char *end = payload + message->len;
+
+    if (message->envelope.sim_ns >= 0)
+    {
+        tick->sec = message->envelope.sim_ns / 1000000000LL;
+        tick->nanosec = message->envelope.sim_ns % 1000000000LL;
+    }
+    else
+    {
+        const char *ts = aerosimFindJsonValue(payload, end, "timestamp_sim");
+        const char *ts_end;
+
+        if (ts == NULL || *ts != '{')
+            return false;
+        ts_end = (const char *)memchr(ts, '}', end - ts);
+        if (ts_end == NULL)
+            return false;
+
+        if (!aerosimParseJsonInteger(aerosimFindJsonValue(ts, ts_end, "sec"), ts_end, &tick->sec)
+            || !aerosimParseJsonInteger(aerosimFindJsonValue(ts, ts_end, "nanosec"), ts_end, &tick->nanosec))
+            return false;
+    }
+
+    if (!aerosimParseJsonInteger(aerosimFindJsonValue(payload, end, "step"), end, &tick->step))
+        tick->step = -1;
+    return true;
+}
+
+/**
+ * @brief Accept a clock tick only if it's strictly later than the last one
+ */
+static bool acceptClockTick(clock_tick_state_t *state, const clock_tick_t *tick)
+{
+    if (state->valid)
+    {
+        bool later = tick->sec > state->last.sec
+                     || (tick->sec == state->last.sec && tick->nanosec > state->last.nanosec);
+        if (!later || (tick->step >= 0 && state->last.step >= 0 && tick->step <= state->last.step))
+        {
+            mexPrintf("Ignoring %s aerosim.clock tick %lld.%09lld (last tick %lld.%09lld)\n",
+                      (tick->sec == state->last.sec && tick->nanosec == state->last.nanosec) ? "duplicate" : "out-of-order",
+                      (long long)tick->sec, (long long)tick->nanosec,
+                      (long long)state->last.sec, (long long)state->last.nanosec);
+            state->rejected++;
+            return false;
+        }
+    }
+    state->last = *tick;
+    state->valid = true;
+    return true;
+}
+
+/**
+ * @brief Keep a clock tick received before the start command
+ *
+ * @return the number of older ticks dropped to make room (0 or 1)
+ */
+static int keepPendingTick(SimStruct *S, const aerosim_message_t *message)
+{
+    pending_ticks_t *pending = (pending_ticks_t *)ssGetPWorkValue(S, EPW_PENDING_TICKS);
+    int dropped = 0;
+
+    if (pending->data == NULL)
+    {
+        pending->data = (int8_T *)malloc((size_t)PENDING_TICKS * (P_MSG_LEN + P_KEY_LEN));
+    }
+    if (pending->count == PENDING_TICKS)
+    {
+        pending->first = (pending->first + 1) % PENDING_TICKS;
+        pending->count--;
+        dropped = 1;
+    }
+
+    int slot = (pending->first + pending->count) % PENDING_TICKS;
+    pending_tick_t *tick = &pending->ticks[slot];
+    tick->len = (message->len < (size_t)P_MSG_LEN) ? message->len : (size_t)P_MSG_LEN;
+    tick->key_len = (message->key_len < (size_t)P_KEY_LEN) ? message->key_len : (size_t)P_KEY_LEN;
+    tick->timestamp = message->timestamp;
+    tick->sim_ns = message->envelope.sim_ns;
+    memcpy(pending->data + (size_t)slot * P_MSG_LEN, message->payload, tick->len);
+    memcpy(pending->data + (size_t)PENDING_TICKS * P_MSG_LEN + (size_t)slot * P_KEY_LEN, message->key, tick->key_len);
+    pending->count++;
+    return dropped;
+}
+
+/**
+ * @brief Drop the pending clock ticks older than the start command
+ *
+ * Ticks without a timestamp, or all of them if the start command has none,
+ * can't be told apart from an earlier run's and are dropped too.
+ *
+ * @return the number of dropped ticks
+ */
+static int dropPendingTicksBefore(SimStruct *S, int64_t start_timestamp)
+{
+    pending_ticks_t *pending = (pending_ticks_t *)ssGetPWorkValue(S, EPW_PENDING_TICKS);
+    int dropped = 0;
+
+    pending->start_timestamp = start_timestamp;
+    while (pending->count > 0)
+    {
+        int64_t timestamp = pending->ticks[pending->first].timestamp;
+        if (start_timestamp >= 0 && timestamp >= start_timestamp)
+        {
+            break;
+        }
+        pending->first = (pending->first + 1) % PENDING_TICKS;
+        pending->count--;
+        dropped++;
+    }
+    return dropped;
+}
+
+/**
+ * @brief Check for a clock tick dequeued after the start command but older than it
+ */
+static bool isStaleClockTick(SimStruct *S, const aerosim_message_t *message)
+{
+    pending_ticks_t *pending = (pending_ticks_t *)ssGetPWorkValue(S, EPW_PENDING_TICKS);
+
+    if (pending->start_timestamp >= 0 && message->timestamp >= 0 && message->timestamp < pending->start_timestamp)
+    {
+        pending->stale++;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Take the next pending clock tick, in the order received
+ *
+ * The message points into the pending tick buffer and has no backend
+ * handle, so releasing it through the reader is a no-op.
+ *
+ * @return true if there was a pending tick
+ */
+static bool readPendingTick(SimStruct *S, aerosim_message_t *message)
+{
+    pending_ticks_t *pending = (pending_ticks_t *)ssGetPWorkValue(S, EPW_PENDING_TICKS);
+
+    if (pending->count == 0)
+    {
+        return false;
+    }
+
+    int slot = pending->first;
+    const pending_tick_t *tick = &pending->ticks[slot];
+    memset(message, 0, sizeof(*message));
+    message->topic = CLOCK_TOPIC;
+    message->payload = pending->data + (size_t)slot * P_MSG_LEN;
+    message->len = tick->len;
+    message->key = pending->data + (size_t)PENDING_TICKS * P_MSG_LEN + (size_t)slot * P_KEY_LEN;
+    message->key_len = tick->key_len;
+    message->timestamp = tick->timestamp;
+    aerosimClearEnvelope(&message->envelope);
+    message->envelope.sim_ns = tick->sim_ns;
+
+    pending->first = (pending->first + 1) % PENDING_TICKS;
+    pending->count--;
+    return true;
+}
+
 /*====================*
  * S-function methods *
  *====================*/
@@ -213,7 +945,7 @@ bool isOrchestratorCommand(char* msg, const char* command) {
  */
 static void mdlInitializeSizes(SimStruct *S)
 {
-    int_T numOutports = 5;
+    clock_ports_t ports;
     DTypeId f64_id;
 
     // printSimMode(S, "mdlInitializeSizes");
@@ -222,10 +954,7 @@ static void mdlInitializeSizes(SimStruct *S)
     if (ssGetNumSFcnParams(S) != ssGetSFcnParamsCount(S))
         return;
 
-    if (P_OUTPUT_TIMESTAMP != 0)
-    {
-        numOutports += 1;
-    }
+    getOutputPorts(S, &ports);
     ssSetSFcnParamNotTunable(S, EP_BROKERS);
     ssSetSFcnParamNotTunable(S, EP_START_CMD_TIMEOUT);
     ssSetSFcnParamNotTunable(S, EP_CLOCK_MSG_TIMEOUT);
@@ -243,7 +972,7 @@ static void mdlInitializeSizes(SimStruct *S)
     if (!ssSetNumInputPorts(S, 0))
         return;
 
-    if (!ssSetNumOutputPorts(S, numOutports))
+    if (!ssSetNumOutputPorts(S, ports.count))
         return;
     // The function call output
     ssSetOutputPortWidth(S, 0, 1);
@@ -261,9 +990,8 @@ static void mdlInitializeSizes(SimStruct *S)
     ssSetOutputPortWidth(S, 4, 1);
     ssSetOutputPortDataType(S, 4, SS_UINT32);
 
-    if (P_OUTPUT_TIMESTAMP != 0)
+    if (P_OUTPUT_TIMESTAMP != 0 || ports.step >= 0)
     {
-        // The timestamp
         f64_id =
             ssRegisterDataTypeFxpBinaryPoint(S,
                                              1,  // int isSigned,
@@ -277,18 +1005,48 @@ static void mdlInitializeSizes(SimStruct *S)
             ssSetErrorStatus(S, "Couldn't register f64 datatype");
             return;
         }
-        ssSetOutputPortWidth(S, 5, 1);
-        ssSetOutputPortDataType(S, 5, f64_id);
+    }
+    if (ports.timestamp >= 0)
+    {
+        // The timestamp
+        ssSetOutputPortWidth(S, ports.timestamp, 1);
+        ssSetOutputPortDataType(S, ports.timestamp, f64_id);
+    }
+    if (ports.sim_time >= 0)
+    {
+        // The decoded sim time in seconds and step index
+        ssSetOutputPortWidth(S, ports.sim_time, 1);
+        ssSetOutputPortDataType(S, ports.sim_time, SS_DOUBLE);
+        ssSetOutputPortWidth(S, ports.step, 1);
+        ssSetOutputPortDataType(S, ports.step, f64_id);
+    }
+    if (ports.occupancy >= 0)
+    {
+        // The lookahead window occupancy
+        ssSetOutputPortWidth(S, ports.occupancy, 1);
+        ssSetOutputPortDataType(S, ports.occupancy, SS_UINT32);
+    }
+    if (ports.timing >= 0)
+    {
+        // The last step's wait, poll, compute, output and total durations in seconds
+        ssSetOutputPortWidth(S, ports.timing, PHASE_Num);
+        ssSetOutputPortDataType(S, ports.timing, SS_DOUBLE);
+    }
+    if (ports.stats >= 0)
+    {
+        // The consumer client statistics
+        ssSetOutputPortWidth(S, ports.stats, AEROSIM_STATS_OUTPUT_WIDTH);
+        ssSetOutputPortDataType(S, ports.stats, SS_DOUBLE);
     }
     ssSetNumSampleTimes(S, 1);
-    ssSetNumRWork(S, 0);
-    ssSetNumIWork(S, 0);
+    ssSetNumRWork(S, ERW_NumRWorks);
+    ssSetNumIWork(S, EIW_NumIWorks);
     ssSetNumPWork(S, EPW_NumPWorks);
     ssSetNumModes(S, 0);
     ssSetNumNonsampledZCs(S, 0);
 
-    /* Specify the sim state compliance to be same as a built-in block */
-    ssSetSimStateCompliance(S, USE_DEFAULT_SIM_STATE);
+    /* The SimState holds the read position and the synchronization state, see mdlGetSimState */
+    ssSetSimStateCompliance(S, USE_CUSTOM_SIM_STATE);
 
     ssSetOptions(S,
                  SS_OPTION_CALL_TERMINATE_ON_EXIT);
@@ -332,9 +1090,29 @@ static void mdlStart(SimStruct *S)
         // Only initialize Kafka when we're actually running in Simulink
         // printSimMode(S, "mdlStart");
 
-        // Initialize Kafka consumer for orchestrator.commands and clock
-        initKafkaConsumer(S, "aerosim.clock", "aerosim.simulink", EPW_CLOCK_CONSUMER);
-        initKafkaConsumer(S, "aerosim.orchestrator.commands", "aerosim.simulink", EPW_ORCHESTRATOR_CONSUMER);
+        aerosimTraceStart();
+        ssSetPWorkValue(S, EPW_TRACE_NAME, (void *)aerosimTraceName(ssGetPath(S)));
+
+        // Initialize one reader (Kafka consumer queue or shared-memory rings) for both orchestrator.commands and clock
+        const char *topics[2] = { ORCHESTRATOR_TOPIC, CLOCK_TOPIC };
+        initKafkaConsumer(S, topics, 2, "aerosim.simulink", EPW_READER);
+
+        // Initialize the run id, an empty one is assigned by the orchestrator start command
+        char* run_id = (char*)calloc(RUN_ID_LEN, sizeof(char));
+        ssSetPWorkValue(S, EPW_RUN_ID, run_id);
+        if (!aerosimGetOptionMX(P_CONF, RUN_ID_OPTION, run_id, RUN_ID_LEN) && getenv(RUN_ID_ENV) != NULL)
+        {
+            snprintf(run_id, RUN_ID_LEN, "%s", getenv(RUN_ID_ENV));
+        }
+
+        // Clock ticks don't name their run, so only a namespace keeps the ticks of other runs out
+        aerosim_reader_t* reader = (aerosim_reader_t*)ssGetPWorkValue(S, EPW_READER);
+        if (run_id[0] != '\0' && reader != NULL && !aerosimIsReplayReader(reader) && !aerosimIsNamespacedReader(reader))
+        {
+            ssSetErrorStatus(S, "A run id (aerosim.run.id or AEROSIM_RUN_ID) requires a namespace (aerosim.namespace or "
+                                "AEROSIM_NAMESPACE), clock ticks aren't filtered by run id");
+            return;
+        }
 
         // Initialize sim_start_status
         int* sim_start_status = (int*)malloc(sizeof(int));
@@ -349,6 +1127,72 @@ static void mdlStart(SimStruct *S)
         ssSetPWorkValue(S, EPW_ORCHESTRATOR_MSG, orchestrator_msg);
         ssSetPWorkValue(S, EPW_ORCHESTRATOR_KEY, orchestrator_key);
 
+        // Initialize the clock tick wait policy: block (default), spin or adaptive spin-then-block
+        char wait_mode[16] = "block";
+        aerosimGetOptionMX(P_CONF, "aerosim.wait.policy", wait_mode, sizeof(wait_mode));
+        aerosim_wait_policy_t* wait_policy = (aerosim_wait_policy_t*)malloc(sizeof(aerosim_wait_policy_t));
+        ssSetPWorkValue(S, EPW_WAIT_POLICY, wait_policy);
+        if (aerosimInitWaitPolicy(wait_policy, wait_mode,
+                                  aerosimGetOptionNumberMX(P_CONF, "aerosim.wait.spin.us", DEFAULT_WAIT_SPIN_US),
+                                  aerosimGetOptionNumberMX(P_CONF, "aerosim.wait.spin.max.us", DEFAULT_WAIT_SPIN_MAX_US)))
+        {
+            ssSetErrorStatus(S, "Invalid aerosim.wait.* option, expected aerosim.wait.policy = block, spin or adaptive "
+                                "and non-negative aerosim.wait.spin.us / aerosim.wait.spin.max.us");
+            return;
+        }
+
+        // Initialize the step counter and the optional step-complete acknowledgement producer
+        uint64_t* step_count = (uint64_t*)malloc(sizeof(uint64_t));
+        *step_count = 0;
+        ssSetPWorkValue(S, EPW_STEP_COUNT, step_count);
+
+        // Initialize the received tick counter and the lookahead window
+        uint64_t* tick_count = (uint64_t*)malloc(sizeof(uint64_t));
+        *tick_count = 0;
+        ssSetPWorkValue(S, EPW_TICK_COUNT, tick_count);
+
+        int_T lookahead = P_LOOKAHEAD_TICKS;
+        if (lookahead < 0)
+        {
+            ssSetErrorStatus(S, "aerosim.lookahead.ticks must not be negative");
+            return;
+        }
+        ssSetIWorkValue(S, EIW_LOOKAHEAD_TICKS, lookahead);
+
+        // Initialize pacing in lock-step, the orchestrator may switch to free-run mode
+        clock_pacing_t* pacing = (clock_pacing_t*)calloc(1, sizeof(clock_pacing_t));
+        ssSetPWorkValue(S, EPW_PACING, pacing);
+
+        // Store the optional output port indices and initialize clock tick decoding
+        clock_ports_t ports;
+        getOutputPorts(S, &ports);
+        ssSetIWorkValue(S, EIW_OCCUPANCY_PORT, ports.occupancy);
+        ssSetIWorkValue(S, EIW_SIM_TIME_PORT, ports.sim_time);
+        ssSetIWorkValue(S, EIW_STEP_PORT, ports.step);
+        ssSetIWorkValue(S, EIW_TIMING_PORT, ports.timing);
+        ssSetIWorkValue(S, EIW_STATS_PORT, ports.stats);
+        clock_tick_state_t* tick_state = (clock_tick_state_t*)calloc(1, sizeof(clock_tick_state_t));
+        ssSetPWorkValue(S, EPW_CLOCK_TICK, tick_state);
+        pending_ticks_t* pending_ticks = (pending_ticks_t*)calloc(1, sizeof(pending_ticks_t));
+        pending_ticks->start_timestamp = -1;
+        ssSetPWorkValue(S, EPW_PENDING_TICKS, pending_ticks);
+
+        // Initialize the per-phase timing histograms
+        clock_timing_t* timing = (clock_timing_t*)calloc(1, sizeof(clock_timing_t));
+        ssSetPWorkValue(S, EPW_TIMING, timing);
+
+        char ack_topic[256];
+        if (aerosimGetOptionMX(P_CONF, "aerosim.ack.topic", ack_topic, sizeof(ack_topic)) && ack_topic[0] != '\0')
+        {
+            initAckProducer(S, ack_topic);
+        }
+
+        char barrier_topic[256];
+        if (aerosimGetOptionMX(P_CONF, BARRIER_TOPIC_OPTION, barrier_topic, sizeof(barrier_topic)) && barrier_topic[0] != '\0')
+        {
+            initBarrier(S, barrier_topic);
+        }
+
         mexPrintf("Waiting for orchestrator start command (%.1lf sec timeout)...\n", P_START_CMD_TIMEOUT);
     }
 }
@@ -367,6 +1211,13 @@ static void mdlOutputs(SimStruct *S, int_T tid)
         return;
     }
 
+    const char *trace_name = (const char *)ssGetPWorkValue(S, EPW_TRACE_NAME);
+    AEROSIM_TRACE_BEGIN(trace_name, "block");
+
+    // Messages are recorded and replayed by block step
+    aerosim_reader_t *reader = (aerosim_reader_t *)ssGetPWorkValue(S, EPW_READER);
+    aerosimBeginReaderStep(reader);
+
     // Retrieve sim_start_status from p-work-vector
     // 0 = Waiting for orchestrator start command;  1 = Orchestrator start command received;  -1 = Time-out
     int* sim_start_status = (int*)ssGetPWorkValue(S, EPW_SIM_START_STATUS);
@@ -375,33 +1226,49 @@ static void mdlOutputs(SimStruct *S, int_T tid)
     if(*sim_start_status == 0) {
         // Initialize timeout variables for orchestrator start command
         const double TIMEOUT_SEC = (P_START_CMD_TIMEOUT == -1) ? DBL_MAX : P_START_CMD_TIMEOUT;
-        double elapsed_sec = 0.0;
-        clock_t start = clock();
-        clock_t end = start;
+        const int64_t deadline_ns = (P_START_CMD_TIMEOUT == -1) ? INT64_MAX
+                                    : aerosimMonotonicNs() + (int64_t)(TIMEOUT_SEC * 1e9);
 
-        // Retrieve orchestrator.command Kafka consumer handle and message/key data buffers
-        rd_kafka_t *rk = (rd_kafka_t *)ssGetPWorkValue(S, EPW_ORCHESTRATOR_CONSUMER);
+        // Retrieve the orchestrator message/key data buffers
         int8_T* orchestrator_msg = (int8_T*)ssGetPWorkValue(S, EPW_ORCHESTRATOR_MSG);
         int8_T* orchestrator_key = (int8_T*)ssGetPWorkValue(S, EPW_ORCHESTRATOR_KEY);
         uint32_T orchestrator_msgLen = 0;
         uint32_T orchestrator_keyLen = 0;
+        int discarded_ticks = 0;
 
-        while (elapsed_sec < TIMEOUT_SEC) {
-            // Returns ret = 0 if no message, ret = 1 if msg was received.
-            int ret = mwConsumeKafkaMessage(rk, orchestrator_msg, &orchestrator_msgLen, P_MSG_LEN,
-                                            orchestrator_key, &orchestrator_keyLen, P_KEY_LEN, NULL);
-
-            if (ret == 0) {
+        // Sleep until an orchestrator command message arrives or the wall clock timeout expires
+        while (aerosimWaitReaders(&reader, 1, deadline_ns, NULL) >= 0) {
+            aerosim_message_t message;
+            if (!aerosimReadMessage(reader, &message)) {
                 // Keep waiting for the orchestrator command message
-                Sleep(0.01);
-                end = clock();
-                elapsed_sec = ((double)(end - start)) / CLOCKS_PER_SEC;
                 continue;
             }
 
+            if (!isMessageTopic(&message, ORCHESTRATOR_TOPIC)) {
+                // Keep the clock ticks until the start command tells which ones belong to this run
+                if (!isOtherMessageType(&message, CLOCK_TYPE_NAME)) {
+                    discarded_ticks += keepPendingTick(S, &message);
+                }
+                aerosimReleaseMessage(reader, &message);
+                continue;
+            }
+            if (isOtherMessageType(&message, ORCHESTRATOR_TYPE_NAME)) {
+                aerosimReleaseMessage(reader, &message);
+                continue;
+            }
+
+            aerosimCopyMessage(&message, orchestrator_msg, &orchestrator_msgLen, P_MSG_LEN,
+                               orchestrator_key, &orchestrator_keyLen, P_KEY_LEN, NULL);
+            int64_t command_timestamp = message.timestamp;
+            aerosimReleaseMessage(reader, &message);
+
             // Orchestrator command message received, break if `start` command is received
-            if(isOrchestratorCommand(orchestrator_msg, "start")) {
+            // (pacing commands received before the start command apply once the simulation is started)
+            orchestrator_command_t cmd;
+            if(parseOrchestratorCommand((char*)orchestrator_msg, &cmd) && isRunCommand(S, &cmd)
+               && !applyPacingCommand(S, &cmd) && strcmp(cmd.command, "start") == 0) {
                 mexPrintf("Orchestrator start command received... Sending initial sync message\n");
+                discarded_ticks += dropPendingTicksBefore(S, command_timestamp);
                 *sim_start_status = 1;
                 mexPrintf("Starting simulation ...\n");
                 break;
@@ -412,6 +1279,10 @@ static void mdlOutputs(SimStruct *S, int_T tid)
             memset(orchestrator_key, 0, sizeof(int8_T) * P_KEY_LEN);
         }
 
+        if (discarded_ticks > 0) {
+            mexPrintf("Discarded %d aerosim.clock messages older than the orchestrator start command\n", discarded_ticks);
+        }
+
         // Orchestrator start command timed-out, stop simulation
         if(*sim_start_status != 1) {
             mexPrintf("Orchestrator start command was not received after %.1lf seconds... stopping simulation\n", TIMEOUT_SEC);
@@ -424,8 +1295,8 @@ static void mdlOutputs(SimStruct *S, int_T tid)
     else if(*sim_start_status == 1) {
         // 1. Block in a polling loop to wait for the target aerosim.clock message tick group
         int ret = 0;
-        rd_kafka_t *rk = (rd_kafka_t *)ssGetPWorkValue(S, EPW_CLOCK_CONSUMER);
-
+        int64_t phase_ns[PHASE_Num] = { 0 };
+        const int64_t step_start_ns = aerosimMonotonicNs();
         int8_T *msg = (int8_T *)ssGetOutputPortSignal(S, 1);
         uint32_T *msgLen = (uint32_T *)ssGetOutputPortSignal(S, 2);
         int8_T *key = (int8_T *)ssGetOutputPortSignal(S, 3);
@@ -438,14 +1309,11 @@ static void mdlOutputs(SimStruct *S, int_T tid)
         }
 
         const double TIMEOUT_SEC = (P_CLOCK_MSG_TIMEOUT == -1) ? DBL_MAX : P_CLOCK_MSG_TIMEOUT;
-        double elapsed_sec = 0.0;
-        clock_t start = clock();
-        clock_t end = start;
+        const int64_t deadline_ns = (P_CLOCK_MSG_TIMEOUT == -1) ? INT64_MAX
+                                    : aerosimMonotonicNs() + (int64_t)(TIMEOUT_SEC * 1e9);
 
         // Retrieve and setup Orchestrator variables
-        int orchestrator_ret = 0;
         bool is_orchestrator_stop_cmd = false;
-        rd_kafka_t *orchestrator_rk = (rd_kafka_t *)ssGetPWorkValue(S, EPW_ORCHESTRATOR_CONSUMER);
         int8_T* orchestrator_msg = (int8_T*)ssGetPWorkValue(S, EPW_ORCHESTRATOR_MSG);
         int8_T* orchestrator_key = (int8_T*)ssGetPWorkValue(S, EPW_ORCHESTRATOR_KEY);
         memset(orchestrator_msg, 0, sizeof(int8_T) * P_MSG_LEN);
@@ -453,48 +1321,179 @@ static void mdlOutputs(SimStruct *S, int_T tid)
         uint32_T orchestrator_msgLen = 0;
         uint32_T orchestrator_keyLen = 0;
 
-
-        while (elapsed_sec < TIMEOUT_SEC)
+        // The step may run once it's within the window past the last synced step
+        clock_pacing_t* pacing = (clock_pacing_t*)ssGetPWorkValue(S, EPW_PACING);
+        uint64_t* step_count = (uint64_t*)ssGetPWorkValue(S, EPW_STEP_COUNT);
+        uint64_t* tick_count = (uint64_t*)ssGetPWorkValue(S, EPW_TICK_COUNT);
+        const uint64_t target_step = *step_count + 1;
+
+        // Consume the ticks of all steps up to this one (all queued ticks in free-run mode). Sleep only
+        // while the window is used up, until a clock tick or an orchestrator command arrives or the
+        // wall clock timeout expires
+        aerosim_wait_policy_t *wait_policy = (aerosim_wait_policy_t *)ssGetPWorkValue(S, EPW_WAIT_POLICY);
+        while (pacing->free_run || *tick_count < target_step)
         {
-            // Check for orchestrator stop command
-            orchestrator_ret = mwConsumeKafkaMessage(orchestrator_rk, orchestrator_msg, &orchestrator_msgLen, P_MSG_LEN,
-                                                    orchestrator_key, &orchestrator_keyLen, P_KEY_LEN, NULL);
+            aerosim_message_t message;
+            if (!readPendingTick(S, &message) && !aerosimReadMessage(reader, &message))
+            {
+                const uint64_t synced_step = getSyncedStep(S);
+                if (target_step <= synced_step || target_step - synced_step <= getStepWindow(S))
+                {
+                    // Already synced, or run ahead of the clock within the window
+                    break;
+                }
+                int64_t wait_start_ns = aerosimMonotonicNs();
+                int ready = aerosimWaitReaders(&reader, 1, deadline_ns, wait_policy);
+                phase_ns[PHASE_WAIT] += aerosimMonotonicNs() - wait_start_ns;
+                if (ready < 0)
+                {
+                    break;
+                }
+                // Keep waiting for the simclock message that allows the next tick.
+                continue;
+            }
+
+            // Messages of other types on the clock and orchestrator topics are dropped unparsed
+            if (isOtherMessageType(&message, isMessageTopic(&message, ORCHESTRATOR_TOPIC) ? ORCHESTRATOR_TYPE_NAME
+                                                                                           : CLOCK_TYPE_NAME))
+            {
+                aerosimReleaseMessage(reader, &message);
+                continue;
+            }
+
+            if (isMessageTopic(&message, ORCHESTRATOR_TOPIC))
+            {
+                aerosimCopyMessage(&message, orchestrator_msg, &orchestrator_msgLen, P_MSG_LEN,
+                                   orchestrator_key, &orchestrator_keyLen, P_KEY_LEN, NULL);
+                aerosimReleaseMessage(reader, &message);
 
-            if(orchestrator_ret != 0) {
                 // Orchestrator command message received, break if `stop` command is received
-                if(isOrchestratorCommand(orchestrator_msg, "stop")) {
+                orchestrator_command_t cmd;
+                bool is_run_cmd = parseOrchestratorCommand((char*)orchestrator_msg, &cmd) && isRunCommand(S, &cmd);
+                if(is_run_cmd && strcmp(cmd.command, "stop") == 0) {
                     mexPrintf("Orchestrator stop command received... stopping simulation\n");
                     is_orchestrator_stop_cmd = true;
                     break;
                 }
+                if(is_run_cmd) {
+                    applyPacingCommand(S, &cmd);
+                }
 
                 // Orchestrator command is not a stop command, clear data buffer and re-try
                 memset(orchestrator_msg, 0, sizeof(int8_T) * P_MSG_LEN);
                 memset(orchestrator_key, 0, sizeof(int8_T) * P_KEY_LEN);
+                continue;
             }
 
-            // Returns ret = 0 if no message, ret = 1 if msg was received.
-            // TODO Modify mwConsumeKafkaMessage() to take the poll timeout as a parameter.
-            ret = mwConsumeKafkaMessage(rk, msg, msgLen, P_MSG_LEN,
-                                        key, keyLen, P_KEY_LEN, timestamp);
-
-            if (ret == 0)
+            // Clock ticks of an earlier run may still be queued behind the start command
+            if (isStaleClockTick(S, &message))
             {
-                // Keep waiting for the simclock message that allows the next tick.
-                end = clock();
-                elapsed_sec = ((double)(end - start)) / CLOCKS_PER_SEC;
+                aerosimReleaseMessage(reader, &message);
                 continue;
             }
 
+            // aerosim.clock message received, decode it if enabled and drop duplicate or out-of-order ticks
+            int_T sim_time_port = ssGetIWorkValue(S, EIW_SIM_TIME_PORT);
+            if (sim_time_port >= 0)
+            {
+                clock_tick_t tick;
+                if (!decodeClockTick(&message, &tick))
+                {
+                    mexPrintf("Couldn't decode aerosim.clock message timestamp_sim\n");
+                }
+                else if (!acceptClockTick((clock_tick_state_t*)ssGetPWorkValue(S, EPW_CLOCK_TICK), &tick))
+                {
+                    aerosimReleaseMessage(reader, &message);
+                    continue;
+                }
+                else
+                {
+                    *(real_T *)ssGetOutputPortSignal(S, sim_time_port) = (real_T)tick.sec + (real_T)tick.nanosec * 1e-9;
+                    *(int64_T *)ssGetOutputPortSignal(S, ssGetIWorkValue(S, EIW_STEP_PORT)) =
+                        (tick.step >= 0) ? (int64_T)tick.step : (int64_T)(*tick_count + 1);
+                }
+            }
+
+            // The outputs hold the latest tick
+            aerosimCopyMessage(&message, msg, msgLen, P_MSG_LEN, key, keyLen, P_KEY_LEN, timestamp);
+            aerosimReleaseMessage(reader, &message);
+            (*tick_count)++;
+        }
+
+        const uint64_t synced_step = getSyncedStep(S);
+        if (!is_orchestrator_stop_cmd && (target_step <= synced_step || target_step - synced_step <= getStepWindow(S)))
+        {
+            ret = 1;
+
+            // Report how many steps run ahead of the last synced step
+            int_T occupancy_port = ssGetIWorkValue(S, EIW_OCCUPANCY_PORT);
+            if (occupancy_port >= 0)
+            {
+                *(uint32_T *)ssGetOutputPortSignal(S, occupancy_port) =
+                    (uint32_T)(target_step > synced_step ? target_step - synced_step : 0);
+            }
+
+            // Pace free-running steps to the requested ratio of real time (replay runs unpaced)
+            int64_t compute_start_ns = aerosimMonotonicNs();
+            if (pacing->free_run && pacing->ratio > 0 && !aerosimIsReplayReader(reader))
+            {
+                aerosimSleepUntilNs(pacing->base_wall_ns +
+                                    (int64_t)((ssGetT(S) - pacing->base_sim_time) / pacing->ratio * 1e9));
+                int64_t paced_ns = aerosimMonotonicNs();
+                phase_ns[PHASE_WAIT] += paced_ns - compute_start_ns;
+                compute_start_ns = paced_ns;
+            }
+
+            // Release the step once every barrier participant has reported it
+            if (!waitStepBarrier(S, target_step))
+            {
+                ssSetStopRequested(S, 1);
+                AEROSIM_TRACE_END(trace_name, "block");
+                return;
+            }
+            int64_t released_ns = aerosimMonotonicNs();
+            phase_ns[PHASE_WAIT] += released_ns - compute_start_ns;
+            compute_start_ns = released_ns;
+            phase_ns[PHASE_POLL] = compute_start_ns - step_start_ns - phase_ns[PHASE_WAIT];
+
             // Call the subsystem attached
             if (!ssCallSystemWithTid(S, 0, tid))
             {
                 /* Error occurred which will be reported by Simulink */
+                AEROSIM_TRACE_END(trace_name, "block");
                 return;
             }
+            int64_t compute_end_ns = aerosimMonotonicNs();
+            phase_ns[PHASE_COMPUTE] = compute_end_ns - compute_start_ns;
+
+            // Acknowledge the completed step
+            *step_count = target_step;
+            produceStepAck(S, *step_count, phase_ns[PHASE_COMPUTE]);
+            int64_t step_end_ns = aerosimMonotonicNs();
+            phase_ns[PHASE_OUTPUT] = step_end_ns - compute_end_ns;
+            phase_ns[PHASE_STEP] = step_end_ns - step_start_ns;
+
+            // Record the step's phase durations
+            clock_timing_t* timing = (clock_timing_t*)ssGetPWorkValue(S, EPW_TIMING);
+            int_T timing_port = ssGetIWorkValue(S, EIW_TIMING_PORT);
+            for (int i = 0; i < PHASE_Num; i++)
+            {
+                aerosimHistogramRecord(&timing->histograms[i], phase_ns[i]);
+                if (timing_port >= 0)
+                {
+                    ((real_T *)ssGetOutputPortSignal(S, timing_port))[i] = phase_ns[i] * 1e-9;
+                }
+            }
+        }
 
-            // aerosim.clock message received, exit while loop
-            break;
+        // Report the consumer client statistics, e.g. to alert on clock lag before the tick timeout
+        int_T stats_port = ssGetIWorkValue(S, EIW_STATS_PORT);
+        if (stats_port >= 0)
+        {
+            aerosim_kafka_stats_t stats = { 0 };
+            stats.consumer_lag = -1;
+            aerosimGetReaderStats(reader, &stats);
+            aerosimWriteKafkaStatsOutput(&stats, (real_T *)ssGetOutputPortSignal(S, stats_port));
         }
 
         if(is_orchestrator_stop_cmd) {
@@ -506,7 +1505,200 @@ static void mdlOutputs(SimStruct *S, int_T tid)
             ssSetStopRequested(S, 1);
         }
     }
+
+    AEROSIM_TRACE_END(trace_name, "block");
+}
+
+/* Copy of an output port's signal for the SimState */
+static mxArray *getOutputPortMX(SimStruct *S, int_T port, mxClassID classId, size_t elementSize)
+{
+    int_T width = ssGetOutputPortWidth(S, port);
+    mxArray *array = mxCreateNumericMatrix(1, width, classId, mxREAL);
+    memcpy(mxGetData(array), ssGetOutputPortSignal(S, port), width * elementSize);
+    return array;
+}
+
+/* Restore an output port's signal, unless the saved one has another size (changed block parameters) */
+static void setOutputPortMX(SimStruct *S, const mxArray *array, int_T port, size_t elementSize)
+{
+    if (port >= 0 && array != NULL && mxGetNumberOfElements(array) == (size_t)ssGetOutputPortWidth(S, port))
+    {
+        memcpy(ssGetOutputPortSignal(S, port), mxGetData(array), mxGetNumberOfElements(array) * elementSize);
+    }
+}
+
+static mxArray *createUint64MX(uint64_t value)
+{
+    mxArray *array = mxCreateNumericMatrix(1, 1, mxUINT64_CLASS, mxREAL);
+    *(uint64_t *)mxGetData(array) = value;
+    return array;
+}
+
+static void getUint64MX(const mxArray *array, uint64_t *value)
+{
+    if (array != NULL && mxGetClassID(array) == mxUINT64_CLASS && mxGetNumberOfElements(array) == 1)
+    {
+        *value = *(const uint64_t *)mxGetData(array);
+    }
+}
+
+#define MDL_SIM_STATE /* Change to #undef to remove function */
+#if defined(MDL_SIM_STATE)
+static const char *sim_state_fields[] = { "position", "sim_start_status", "run_id", "step_count", "tick_count",
+                                          "free_run", "ratio", "barrier_steps", "base_step", "last_tick",
+                                          "message", "message_length", "key", "key_length", "timestamp",
+                                          "sim_time", "step" };
+
+/* Function: mdlGetSimState ===================================================
+ * Abstract:
+ *    Save the reader position together with the synchronization state: the
+ *    start command status, run id, step and tick counts, pacing and the last
+ *    clock tick with its outputs. A simulation restored from the SimState
+ *    resumes at the saved tick instead of waiting for a new start command.
+ *    The position is left empty if the backend can't restore it.
+ */
+static mxArray *mdlGetSimState(SimStruct *S)
+{
+    aerosim_reader_t *reader = (aerosim_reader_t *)ssGetPWorkValue(S, EPW_READER);
+    aerosim_reader_position_t position;
+    mxArray *state = mxCreateStructMatrix(1, 1, sizeof(sim_state_fields) / sizeof(sim_state_fields[0]),
+                                          sim_state_fields);
+
+    if (reader == NULL)
+    {
+        // Not running in normal simulation mode, there is no state to save
+        return state;
+    }
+    if (aerosimGetReaderPosition(reader, &position))
+    {
+        mxSetField(state, 0, "position", aerosimReaderPositionToMX(&position));
+    }
+    mxSetField(state, 0, "sim_start_status",
+               mxCreateDoubleScalar(*(int*)ssGetPWorkValue(S, EPW_SIM_START_STATUS)));
+    mxSetField(state, 0, "run_id", mxCreateString((const char*)ssGetPWorkValue(S, EPW_RUN_ID)));
+    mxSetField(state, 0, "step_count", createUint64MX(*(uint64_t*)ssGetPWorkValue(S, EPW_STEP_COUNT)));
+    mxSetField(state, 0, "tick_count", createUint64MX(*(uint64_t*)ssGetPWorkValue(S, EPW_TICK_COUNT)));
+
+    // The free-run wall clock base is re-anchored on restore
+    clock_pacing_t* pacing = (clock_pacing_t*)ssGetPWorkValue(S, EPW_PACING);
+    mxSetField(state, 0, "free_run", mxCreateDoubleScalar(pacing->free_run));
+    mxSetField(state, 0, "ratio", mxCreateDoubleScalar(pacing->ratio));
+    mxSetField(state, 0, "barrier_steps", createUint64MX(pacing->barrier_steps));
+    mxSetField(state, 0, "base_step", createUint64MX(pacing->base_step));
+
+    // The last accepted tick as [sec nanosec step], empty before the first one
+    clock_tick_state_t* tick_state = (clock_tick_state_t*)ssGetPWorkValue(S, EPW_CLOCK_TICK);
+    if (tick_state->valid)
+    {
+        mxArray *last_tick = mxCreateNumericMatrix(1, 3, mxINT64_CLASS, mxREAL);
+        int64_t *values = (int64_t *)mxGetData(last_tick);
+        values[0] = tick_state->last.sec;
+        values[1] = tick_state->last.nanosec;
+        values[2] = tick_state->last.step;
+        mxSetField(state, 0, "last_tick", last_tick);
+    }
+
+    // The outputs holding the last tick
+    mxSetField(state, 0, "message", getOutputPortMX(S, 1, mxINT8_CLASS, sizeof(int8_T)));
+    mxSetField(state, 0, "message_length", getOutputPortMX(S, 2, mxUINT32_CLASS, sizeof(uint32_T)));
+    mxSetField(state, 0, "key", getOutputPortMX(S, 3, mxINT8_CLASS, sizeof(int8_T)));
+    mxSetField(state, 0, "key_length", getOutputPortMX(S, 4, mxUINT32_CLASS, sizeof(uint32_T)));
+    if (P_OUTPUT_TIMESTAMP)
+    {
+        mxSetField(state, 0, "timestamp", getOutputPortMX(S, 5, mxINT64_CLASS, sizeof(int64_T)));
+    }
+    if (ssGetIWorkValue(S, EIW_SIM_TIME_PORT) >= 0)
+    {
+        mxSetField(state, 0, "sim_time", getOutputPortMX(S, ssGetIWorkValue(S, EIW_SIM_TIME_PORT),
+                                                         mxDOUBLE_CLASS, sizeof(real_T)));
+        mxSetField(state, 0, "step", getOutputPortMX(S, ssGetIWorkValue(S, EIW_STEP_PORT),
+                                                     mxINT64_CLASS, sizeof(int64_T)));
+    }
+    return state;
+}
+
+/* Function: mdlSetSimState ===================================================
+ * Abstract:
+ *    Seek the reader to the saved position and restore the synchronization
+ *    state and outputs.
+ */
+static void mdlSetSimState(SimStruct *S, const mxArray *state)
+{
+    aerosim_reader_t *reader = (aerosim_reader_t *)ssGetPWorkValue(S, EPW_READER);
+    aerosim_reader_position_t position;
+    const mxArray *field;
+
+    if (reader == NULL)
+    {
+        return;
+    }
+    if (aerosimReaderPositionFromMX(mxGetField(state, 0, "position"), &position))
+    {
+        if (aerosimSeekReader(reader, &position))
+        {
+            ssSetErrorStatus(S, "Couldn't restore the aerosim.clock position from the SimState");
+            return;
+        }
+    }
+    else
+    {
+        mexPrintf("The SimState has no aerosim.clock position, reading from the latest tick\n");
+    }
+
+    if ((field = mxGetField(state, 0, "sim_start_status")) != NULL)
+    {
+        *(int*)ssGetPWorkValue(S, EPW_SIM_START_STATUS) = (int)mxGetScalar(field);
+    }
+    if ((field = mxGetField(state, 0, "run_id")) != NULL && mxIsChar(field))
+    {
+        mxGetString(field, (char*)ssGetPWorkValue(S, EPW_RUN_ID), RUN_ID_LEN);
+    }
+    getUint64MX(mxGetField(state, 0, "step_count"), (uint64_t*)ssGetPWorkValue(S, EPW_STEP_COUNT));
+    getUint64MX(mxGetField(state, 0, "tick_count"), (uint64_t*)ssGetPWorkValue(S, EPW_TICK_COUNT));
+
+    clock_pacing_t* pacing = (clock_pacing_t*)ssGetPWorkValue(S, EPW_PACING);
+    if ((field = mxGetField(state, 0, "free_run")) != NULL)
+    {
+        pacing->free_run = mxGetScalar(field) != 0;
+    }
+    if ((field = mxGetField(state, 0, "ratio")) != NULL)
+    {
+        pacing->ratio = mxGetScalar(field);
+    }
+    getUint64MX(mxGetField(state, 0, "barrier_steps"), &pacing->barrier_steps);
+    getUint64MX(mxGetField(state, 0, "base_step"), &pacing->base_step);
+    pacing->base_sim_time = ssGetT(S);
+    pacing->base_wall_ns = aerosimMonotonicNs();
+
+    clock_tick_state_t* tick_state = (clock_tick_state_t*)ssGetPWorkValue(S, EPW_CLOCK_TICK);
+    field = mxGetField(state, 0, "last_tick");
+    tick_state->valid = field != NULL && mxGetClassID(field) == mxINT64_CLASS && mxGetNumberOfElements(field) == 3;
+    if (tick_state->valid)
+    {
+        const int64_t *values = (const int64_t *)mxGetData(field);
+        tick_state->last.sec = values[0];
+        tick_state->last.nanosec = values[1];
+        tick_state->last.step = values[2];
+    }
+
+    setOutputPortMX(S, mxGetField(state, 0, "message"), 1, sizeof(int8_T));
+    setOutputPortMX(S, mxGetField(state, 0, "message_length"), 2, sizeof(uint32_T));
+    setOutputPortMX(S, mxGetField(state, 0, "key"), 3, sizeof(int8_T));
+    setOutputPortMX(S, mxGetField(state, 0, "key_length"), 4, sizeof(uint32_T));
+    if (P_OUTPUT_TIMESTAMP)
+    {
+        setOutputPortMX(S, mxGetField(state, 0, "timestamp"), 5, sizeof(int64_T));
+    }
+    setOutputPortMX(S, mxGetField(state, 0, "sim_time"), ssGetIWorkValue(S, EIW_SIM_TIME_PORT), sizeof(real_T));
+    setOutputPortMX(S, mxGetField(state, 0, "step"), ssGetIWorkValue(S, EIW_STEP_PORT), sizeof(int64_T));
+
+    if (*(int*)ssGetPWorkValue(S, EPW_SIM_START_STATUS) == 1)
+    {
+        mexPrintf("Resuming at step %llu from the SimState\n",
+                  (unsigned long long)*(uint64_t*)ssGetPWorkValue(S, EPW_STEP_COUNT));
+    }
 }
+#endif /* MDL_SIM_STATE */
 
 /* Function: mdlTerminate =====================================================
  * Abstract:
@@ -528,11 +1720,8 @@ static void mdlTerminate(SimStruct *S)
         }
         mexPrintf("sl_aerosim_clock_sync@mdlTerminate(): Freeing up used resources\n");
 
-        rd_kafka_t *rk = (rd_kafka_t *)ssGetPWorkValue(S, EPW_CLOCK_CONSUMER);
-        mwTerminateKafkaConsumer(rk);
-
-        rd_kafka_t *orchestrator_rk = (rd_kafka_t *)ssGetPWorkValue(S, EPW_ORCHESTRATOR_CONSUMER);
-        mwTerminateKafkaConsumer(orchestrator_rk);
+        aerosim_reader_t *reader = (aerosim_reader_t *)ssGetPWorkValue(S, EPW_READER);
+        aerosimCloseReader(reader);
 
         int* sim_start_status = (int*) ssGetPWorkValue(S, EPW_SIM_START_STATUS);
         free(sim_start_status);
@@ -543,11 +1732,100 @@ static void mdlTerminate(SimStruct *S)
         int8_T* orchestrator_key = (int8_T*)ssGetPWorkValue(S, EPW_ORCHESTRATOR_KEY);
         free(orchestrator_key);
 
-        ssSetPWorkValue(S, EPW_CLOCK_CONSUMER, NULL);
-        ssSetPWorkValue(S, EPW_ORCHESTRATOR_CONSUMER, NULL);
+        aerosim_wait_policy_t* wait_policy = (aerosim_wait_policy_t*)ssGetPWorkValue(S, EPW_WAIT_POLICY);
+        if (wait_policy != NULL && wait_policy->waits > 0)
+        {
+            uint64_t spin_wakeups = (wait_policy->spin_wakeups > 0) ? wait_policy->spin_wakeups : 1;
+            mexPrintf("aerosim.clock wait policy %s: %llu ticks, %llu spin / %llu blocked wake-ups, "
+                      "spin wake-up latency mean %.2f us, max %.2f us, final spin budget %.1f us\n",
+                      aerosimWaitModeName(wait_policy->mode),
+                      (unsigned long long)wait_policy->waits,
+                      (unsigned long long)wait_policy->spin_wakeups,
+                      (unsigned long long)wait_policy->block_wakeups,
+                      wait_policy->wake_latency_sum_ns / 1e3 / (double)spin_wakeups,
+                      wait_policy->wake_latency_max_ns / 1e3,
+                      wait_policy->spin_budget_ns / 1e3);
+        }
+        free(wait_policy);
+
+        uint64_t* step_count = (uint64_t*)ssGetPWorkValue(S, EPW_STEP_COUNT);
+        free(step_count);
+
+        uint64_t* tick_count = (uint64_t*)ssGetPWorkValue(S, EPW_TICK_COUNT);
+        free(tick_count);
+
+        clock_pacing_t* pacing = (clock_pacing_t*)ssGetPWorkValue(S, EPW_PACING);
+        free(pacing);
+
+        clock_timing_t* timing = (clock_timing_t*)ssGetPWorkValue(S, EPW_TIMING);
+        if (timing != NULL && timing->histograms[PHASE_STEP].count > 0)
+        {
+            const aerosim_histogram_t *h = &timing->histograms[PHASE_STEP];
+            mexPrintf("Lock-step timing: %llu steps, p50 %.1f us, p99 %.1f us, max %.1f us\n",
+                      (unsigned long long)h->count, aerosimHistogramPercentile(h, 50.0) / 1e3,
+                      aerosimHistogramPercentile(h, 99.0) / 1e3, h->max / 1e3);
+
+            char timing_file[1024];
+            if (aerosimGetOptionMX(P_CONF, "aerosim.timing.file", timing_file, sizeof(timing_file)) && timing_file[0] != '\0')
+            {
+                dumpClockTiming(timing, timing_file);
+            }
+        }
+        free(timing);
+
+        clock_tick_state_t* tick_state = (clock_tick_state_t*)ssGetPWorkValue(S, EPW_CLOCK_TICK);
+        if (tick_state != NULL && tick_state->rejected > 0)
+        {
+            mexPrintf("Ignored %llu duplicate or out-of-order aerosim.clock ticks\n", (unsigned long long)tick_state->rejected);
+        }
+        free(tick_state);
+
+        pending_ticks_t* pending_ticks = (pending_ticks_t*)ssGetPWorkValue(S, EPW_PENDING_TICKS);
+        if (pending_ticks != NULL)
+        {
+            if (pending_ticks->stale > 0)
+            {
+                mexPrintf("Discarded %llu aerosim.clock messages older than the orchestrator start command\n",
+                          (unsigned long long)pending_ticks->stale);
+            }
+            free(pending_ticks->data);
+        }
+        free(pending_ticks);
+
+        aerosim_writer_t* ack_writer = (aerosim_writer_t*)ssGetPWorkValue(S, EPW_ACK_WRITER);
+        aerosimCloseWriter(ack_writer);
+
+        aerosim_barrier_t* barrier = (aerosim_barrier_t*)ssGetPWorkValue(S, EPW_BARRIER);
+        if (barrier != NULL)
+        {
+            mexPrintf("Barrier stragglers:\n");
+            for (int i = 1; i < aerosimGetBarrierMemberCount(barrier); i++)
+            {
+                const aerosim_barrier_member_t *member = aerosimGetBarrierMember(barrier, i);
+                mexPrintf("  %s: last %llu times, waited for %.1f ms in total, max %.1f ms\n", member->participant,
+                          (unsigned long long)member->straggler_count, member->straggler_ns_sum / 1e6,
+                          member->straggler_ns_max / 1e6);
+            }
+        }
+        aerosimCloseBarrier(barrier);
+
+        ssSetPWorkValue(S, EPW_READER, NULL);
         ssSetPWorkValue(S, EPW_SIM_START_STATUS, NULL);
         ssSetPWorkValue(S, EPW_ORCHESTRATOR_MSG, NULL);
         ssSetPWorkValue(S, EPW_ORCHESTRATOR_KEY, NULL);
+        ssSetPWorkValue(S, EPW_WAIT_POLICY, NULL);
+        ssSetPWorkValue(S, EPW_STEP_COUNT, NULL);
+        ssSetPWorkValue(S, EPW_ACK_WRITER, NULL);
+        ssSetPWorkValue(S, EPW_BARRIER, NULL);
+        ssSetPWorkValue(S, EPW_TICK_COUNT, NULL);
+        ssSetPWorkValue(S, EPW_PACING, NULL);
+        ssSetPWorkValue(S, EPW_CLOCK_TICK, NULL);
+        ssSetPWorkValue(S, EPW_PENDING_TICKS, NULL);
+        ssSetPWorkValue(S, EPW_TIMING, NULL);
+        free(ssGetPWorkValue(S, EPW_RUN_ID));
+        ssSetPWorkValue(S, EPW_RUN_ID, NULL);
+        ssSetPWorkValue(S, EPW_TRACE_NAME, NULL);
+        aerosimTraceStop();
     }
 }
 
@@ -0,0 +1,468 @@
+/*
+ * sl_aerosim_fleet_consumer
+ *
+ * Vectorized consumer and JSON decoder for a fleet of vehicles, based on
+ * sl_aerosim_kafka_consumer.c
+ */
+
+/**
+ * Consumes the messages of N vehicles from one topic with one reader and
+ * decodes them into N-by-columns field matrices, telling the vehicles apart
+ * by message key (see aerosim_fleet.h). Each step drains the topic once and
+ * decodes only the last message of each vehicle; vehicles without a message
+ * keep their previous values.
+ */
+
+#define S_FUNCTION_NAME sl_aerosim_fleet_consumer
+#define S_FUNCTION_LEVEL 2
+
+#include "simstruc.h"
+#include "fixedpoint.h"
+
+#include "rdkafka.h"
+
+#include "mw_kafka_utils.h"
+#include "mx_kafka_utils.h"
+#include "aerosim_kafka_utils.h"
+#include "aerosim_transport.h"
+#include "aerosim_fleet.h"
+#include "aerosim_trace.h"
+
+enum
+{
+    EP_BROKERS = 0,
+    EP_TOPIC,
+    EP_GROUP,
+    EP_KEYS,
+    EP_FIELDS,
+    EP_FIELD_PORTS,
+    EP_MSG_LEN,
+    EP_CONF,
+    EP_TOPIC_CONF,
+    EP_COMBINED_CONF_STR,
+    EP_TS,
+    EP_NumParams
+};
+
+#define P_BROKER (ssGetSFcnParam(S, EP_BROKERS))
+#define P_TOPIC (ssGetSFcnParam(S, EP_TOPIC))
+#define P_GROUP (ssGetSFcnParam(S, EP_GROUP))
+#define P_KEYS (ssGetSFcnParam(S, EP_KEYS))
+#define P_FIELDS (ssGetSFcnParam(S, EP_FIELDS))
+#define P_FIELD_PORTS (ssGetSFcnParam(S, EP_FIELD_PORTS))
+#define P_MSG_LEN ((int_T)mxGetScalar((ssGetSFcnParam(S, EP_MSG_LEN))))
+#define P_CONF (ssGetSFcnParam(S, EP_CONF))
+#define P_TOPIC_CONF (ssGetSFcnParam(S, EP_TOPIC_CONF))
+#define P_COMBINED_CONF_STR (ssGetSFcnParam(S, EP_COMBINED_CONF_STR))
+#define P_TS (ssGetSFcnParam(S, EP_TS))
+
+/* Number of vehicles, one per key */
+#define P_NUM_VEHICLES ((int_T)mxGetNumberOfElements(P_KEYS))
+
+/* Output 0 is the function call, the field matrices follow, then the per-vehicle message counts */
+#define FIELD_PORT(port) ((port) + 1)
+
+enum
+{
+    EPW_READER = 0,
+    EPW_FLEET,
+    EPW_MESSAGES,     /* last message of each vehicle in this step, P_MSG_LEN bytes each */
+    EPW_MESSAGE_LENS, /* their lengths */
+    EPW_PORTS,        /* field matrix of each fleet port */
+    EPW_TRACE_NAME,
+    EPW_NumPWorks
+};
+
+enum
+{
+    EIW_UNKNOWN_KEYS = 0, /* messages of vehicles outside the fleet */
+    EIW_NumIWorks
+};
+
+static char errstr[512]; /* error reporting buffer */
+
+static int getParamString(SimStruct *S, char **strPtr, const mxArray *prm, int epwIdx, char *errorHelp)
+{
+    int N = (int)mxGetNumberOfElements(prm);
+    char *tmp = (char *)malloc(N + 1);
+    if (tmp == NULL)
+    {
+        sprintf(errstr, "Couldn't allocate string for '%s'\n", errorHelp);
+        ssSetErrorStatus(S, errstr);
+        return 1;
+    }
+    if (mxGetString(prm, tmp, N + 1))
+    {
+        sprintf(errstr, "Couldn't retrieve '%s' string\n", errorHelp);
+        ssSetErrorStatus(S, errstr);
+        free(tmp);
+        return 2;
+    }
+    if (epwIdx >= 0)
+    {
+        ssSetPWorkValue(S, epwIdx, tmp);
+    }
+    *strPtr = tmp;
+
+    return 0;
+}
+
+/* Fleet of the key and field parameters, NULL after reporting an error */
+static aerosim_fleet_t *createFleet(SimStruct *S)
+{
+    int numVehicles = P_NUM_VEHICLES;
+    int numFields = (int)mxGetNumberOfElements(P_FIELDS);
+    const char **keys = NULL, **fields = NULL;
+    int *ports = NULL;
+    aerosim_fleet_t *fleet = NULL;
+    int k;
+
+    if (!mxIsCell(P_KEYS) || !mxIsCell(P_FIELDS) || !mxIsDouble(P_FIELD_PORTS)
+        || (int)mxGetNumberOfElements(P_FIELD_PORTS) != numFields)
+    {
+        ssSetErrorStatus(S, "Expected cell arrays of vehicle keys and fields, and one field port per field");
+        return NULL;
+    }
+    keys = (const char **)calloc(numVehicles, sizeof(char *));
+    fields = (const char **)calloc(numFields, sizeof(char *));
+    ports = (int *)calloc(numFields, sizeof(int));
+    if (keys != NULL && fields != NULL && ports != NULL)
+    {
+        for (k = 0; k < numVehicles; k++)
+            keys[k] = mxArrayToString(mxGetCell(P_KEYS, k));
+        for (k = 0; k < numFields; k++)
+        {
+            fields[k] = mxArrayToString(mxGetCell(P_FIELDS, k));
+            ports[k] = (int)mxGetPr(P_FIELD_PORTS)[k] - 1;
+        }
+        fleet = aerosimCreateFleet(numVehicles, keys, numFields, fields, ports);
+    }
+    if (fleet == NULL)
+    {
+        ssSetErrorStatus(S, "Invalid fleet vehicle keys or fields, see the MATLAB console");
+    }
+
+    for (k = 0; keys != NULL && k < numVehicles; k++)
+        mxFree((void *)keys[k]);
+    for (k = 0; fields != NULL && k < numFields; k++)
+        mxFree((void *)fields[k]);
+    free(keys);
+    free(fields);
+    free(ports);
+    return fleet;
+}
+
+static void initFleetConsumer(SimStruct *S)
+{
+    aerosim_reader_t *reader = NULL;
+    char *brokers = NULL, *topic = NULL, *group = NULL;
+    int nConf, nTopicConf;
+
+    mwLogInit("simulink");
+
+    if (getParamString(S, &brokers, P_BROKER, -1, "brokers"))
+        goto exit_init_fleet;
+    if (getParamString(S, &topic, P_TOPIC, -1, "topic"))
+        goto exit_init_fleet;
+    if (getParamString(S, &group, P_GROUP, -1, "group"))
+        goto exit_init_fleet;
+    mexPrintf("Initializing Fleet Consumer - (brokers: %s, topic: %s, group: %s, vehicles: %d)\n",
+              brokers, topic, group, P_NUM_VEHICLES);
+
+    nConf = mxGetNumberOfElements(P_CONF);
+    nTopicConf = mxGetNumberOfElements(P_TOPIC_CONF);
+    const char **confArray = getConfArrayFromMX(nConf, P_CONF, nTopicConf, P_TOPIC_CONF);
+    if (confArray == NULL)
+    {
+        ssSetErrorStatus(S, "Couldn't retrieve confArray from parameters");
+        goto exit_init_fleet;
+    }
+
+    int res = aerosimOpenReader(&reader, brokers, group, (const char **)&topic, 1, nConf, nTopicConf, confArray,
+                                RD_KAFKA_OFFSET_BEGINNING);
+    freeConfArray((char **)confArray, nConf + nTopicConf);
+    if (res)
+    {
+        ssSetErrorStatus(S, "Problems initializing Kafka Consumer\n");
+        goto exit_init_fleet;
+    }
+    ssSetPWorkValue(S, EPW_READER, reader);
+
+exit_init_fleet:
+    free(brokers);
+    free(topic);
+    free(group);
+}
+
+/*====================*
+ * S-function methods *
+ *====================*/
+
+/* Function: mdlInitializeSizes ===============================================
+ * Abstract:
+ *    The sizes information is used by Simulink to determine the S-function
+ *    block's characteristics (number of inputs, outputs, states, etc.).
+ */
+static void mdlInitializeSizes(SimStruct *S)
+{
+    aerosim_fleet_t *fleet;
+    int_T port, numPorts;
+
+    ssSetNumSFcnParams(S, EP_NumParams); /* Number of expected parameters */
+    if (ssGetNumSFcnParams(S) != ssGetSFcnParamsCount(S))
+        return;
+
+    ssSetSFcnParamNotTunable(S, EP_BROKERS);
+    ssSetSFcnParamNotTunable(S, EP_TOPIC);
+    ssSetSFcnParamNotTunable(S, EP_GROUP);
+    ssSetSFcnParamNotTunable(S, EP_KEYS);
+    ssSetSFcnParamNotTunable(S, EP_FIELDS);
+    ssSetSFcnParamNotTunable(S, EP_FIELD_PORTS);
+    ssSetSFcnParamNotTunable(S, EP_MSG_LEN);
+    ssSetSFcnParamNotTunable(S, EP_CONF);
+    ssSetSFcnParamNotTunable(S, EP_TOPIC_CONF);
+    ssSetSFcnParamNotTunable(S, EP_COMBINED_CONF_STR);
+    ssSetSFcnParamNotTunable(S, EP_TS);
+
+    ssSetNumContStates(S, 0);
+    ssSetNumDiscStates(S, 0);
+
+    // The port sizes follow from the fleet layout
+    fleet = createFleet(S);
+    if (fleet == NULL)
+        return;
+    numPorts = aerosimGetFleetPortCount(fleet);
+
+    if (!ssSetNumInputPorts(S, 0))
+        goto exit_sizes;
+    if (!ssSetNumOutputPorts(S, FIELD_PORT(numPorts) + 1))
+        goto exit_sizes;
+    // The function call output
+    ssSetOutputPortWidth(S, 0, 1);
+    ssSetOutputPortDataType(S, 0, SS_FCN_CALL);
+    // One N-by-columns matrix per fleet port
+    for (port = 0; port < numPorts; port++)
+    {
+        ssSetOutputPortMatrixDimensions(S, FIELD_PORT(port), P_NUM_VEHICLES, aerosimGetFleetPortColumns(fleet, port));
+        ssSetOutputPortDataType(S, FIELD_PORT(port), SS_DOUBLE);
+    }
+    // The number of messages of each vehicle in this step, 0 if it kept its values
+    ssSetOutputPortMatrixDimensions(S, FIELD_PORT(numPorts), P_NUM_VEHICLES, 1);
+    ssSetOutputPortDataType(S, FIELD_PORT(numPorts), SS_DOUBLE);
+
+    ssSetNumSampleTimes(S, 1);
+    ssSetNumRWork(S, 0);
+    ssSetNumIWork(S, EIW_NumIWorks);
+    ssSetNumPWork(S, EPW_NumPWorks);
+    ssSetNumModes(S, 0);
+    ssSetNumNonsampledZCs(S, 0);
+
+    /* Specify the sim state compliance to be same as a built-in block */
+    ssSetSimStateCompliance(S, USE_DEFAULT_SIM_STATE);
+
+    ssSetOptions(S,
+                 SS_OPTION_CALL_TERMINATE_ON_EXIT);
+
+exit_sizes:
+    aerosimDestroyFleet(fleet);
+}
+
+/* Function: mdlInitializeSampleTimes =========================================
+ * Abstract:
+ *    This function is used to specify the sample time(s) for your
+ *    S-function. You must register the same number of sample times as
+ *    specified in ssSetNumSampleTimes.
+ */
+static void mdlInitializeSampleTimes(SimStruct *S)
+{
+    real_T *pr, ts, offset = 0.0;
+    pr = mxGetPr(P_TS);
+    ts = pr[0];
+    if (mxGetNumberOfElements(P_TS) > 1)
+    {
+        offset = pr[1];
+    }
+    ssSetSampleTime(S, 0, ts);
+    ssSetOffsetTime(S, 0, offset);
+
+    ssSetCallSystemOutput(S, 0); /* call on first element */
+    ssSetModelReferenceSampleTimeDefaultInheritance(S);
+}
+
+#define MDL_START /* Change to #undef to remove function */
+#if defined(MDL_START)
+/* Function: mdlStart =======================================================
+ * Abstract:
+ *    This function is called once at start of model execution. If you
+ *    have states that should be initialized once, this is the place
+ *    to do it.
+ */
+static void mdlStart(SimStruct *S)
+{
+    if (ssGetSimMode(S) == SS_SIMMODE_NORMAL)
+    {
+        // Only initialize Kafka when we're actually running in Simulink
+        aerosim_fleet_t *fleet;
+        real_T **ports;
+        int_T port, numPorts;
+
+        aerosimTraceStart();
+        ssSetPWorkValue(S, EPW_TRACE_NAME, (void *)aerosimTraceName(ssGetPath(S)));
+        ssSetIWorkValue(S, EIW_UNKNOWN_KEYS, 0);
+
+        fleet = createFleet(S);
+        if (fleet == NULL)
+            return;
+        ssSetPWorkValue(S, EPW_FLEET, fleet);
+
+        // Resolve the output matrices once, the decoder writes them directly
+        numPorts = aerosimGetFleetPortCount(fleet);
+        ports = (real_T **)calloc(numPorts, sizeof(real_T *));
+        ssSetPWorkValue(S, EPW_PORTS, ports);
+        ssSetPWorkValue(S, EPW_MESSAGES, malloc((size_t)P_NUM_VEHICLES * P_MSG_LEN));
+        ssSetPWorkValue(S, EPW_MESSAGE_LENS, calloc(P_NUM_VEHICLES, sizeof(size_t)));
+        if (ports == NULL || ssGetPWorkValue(S, EPW_MESSAGES) == NULL || ssGetPWorkValue(S, EPW_MESSAGE_LENS) == NULL)
+        {
+            ssSetErrorStatus(S, "Couldn't allocate the fleet message buffers");
+            return;
+        }
+        for (port = 0; port < numPorts; port++)
+        {
+            ports[port] = (real_T *)ssGetOutputPortSignal(S, FIELD_PORT(port));
+        }
+
+        initFleetConsumer(S);
+    }
+}
+#endif /*  MDL_START */
+
+/* Function: mdlOutputs =======================================================
+ * Abstract:
+ *    In this function, you compute the outputs of your S-function
+ *    block.
+ */
+static void mdlOutputs(SimStruct *S, int_T tid)
+{
+    if (!ssIsMajorTimeStep(S))
+    {
+        // Only trigger consuming messages on major time steps
+        return;
+    }
+
+    aerosim_reader_t *reader = (aerosim_reader_t *)ssGetPWorkValue(S, EPW_READER);
+    aerosim_fleet_t *fleet = (aerosim_fleet_t *)ssGetPWorkValue(S, EPW_FLEET);
+    char *messages = (char *)ssGetPWorkValue(S, EPW_MESSAGES);
+    size_t *messageLens = (size_t *)ssGetPWorkValue(S, EPW_MESSAGE_LENS);
+    real_T **ports = (real_T **)ssGetPWorkValue(S, EPW_PORTS);
+    const char *trace_name = (const char *)ssGetPWorkValue(S, EPW_TRACE_NAME);
+    int_T numVehicles = P_NUM_VEHICLES;
+    int_T msgLen = P_MSG_LEN;
+    real_T *counts = (real_T *)ssGetOutputPortSignal(S, FIELD_PORT(aerosimGetFleetPortCount(fleet)));
+    int_T updated = 0;
+    aerosim_message_t message;
+    int_T v;
+
+    AEROSIM_TRACE_BEGIN(trace_name, "block");
+    for (v = 0; v < numVehicles; v++)
+    {
+        counts[v] = 0.0;
+    }
+
+    // One pass over everything available, keeping the last message of each vehicle
+    aerosimBeginReaderStep(reader);
+    while (aerosimReadMessage(reader, &message))
+    {
+        v = aerosimFindFleetVehicle(fleet, message.key, message.key_len);
+        if (v < 0)
+        {
+            if (ssGetIWorkValue(S, EIW_UNKNOWN_KEYS) == 0)
+            {
+                mexPrintf("Fleet consumer %s: ignoring messages of key '%.*s' and other keys outside the fleet\n",
+                          ssGetPath(S), (int)message.key_len, (const char *)message.key);
+            }
+            ssSetIWorkValue(S, EIW_UNKNOWN_KEYS, ssGetIWorkValue(S, EIW_UNKNOWN_KEYS) + 1);
+        }
+        else if (message.len > (size_t)msgLen)
+        {
+            sprintf(errstr, "Fleet message of %d bytes for vehicle '%s' exceeds the maximum message length (%d)",
+                    (int)message.len, aerosimGetFleetKey(fleet, v), (int)msgLen);
+            ssSetErrorStatus(S, errstr);
+            aerosimReleaseMessage(reader, &message);
+            AEROSIM_TRACE_END(trace_name, "block");
+            return;
+        }
+        else
+        {
+            memcpy(messages + (size_t)v * msgLen, message.payload, message.len);
+            messageLens[v] = message.len;
+            counts[v] += 1.0;
+        }
+        aerosimReleaseMessage(reader, &message);
+    }
+
+    // Batched decode, one message per updated vehicle
+    for (v = 0; v < numVehicles; v++)
+    {
+        if (counts[v] > 0.0)
+        {
+            aerosimDecodeFleetMessage(fleet, v, messages + (size_t)v * msgLen, messageLens[v], ports);
+            updated++;
+        }
+    }
+    AEROSIM_TRACE_END(trace_name, "block");
+
+    if (updated > 0)
+    {
+        // Call the subsystem attached
+        if (!ssCallSystemWithTid(S, 0, tid))
+        {
+            /* Error occurred which will be reported by Simulink */
+            return;
+        }
+    }
+}
+
+/* Function: mdlTerminate =====================================================
+ * Abstract:
+ *    In this function, you should perform any actions that are necessary
+ *    at the termination of a simulation.  For example, if memory was
+ *    allocated in mdlStart, this is the place to free it.
+ */
+static void mdlTerminate(SimStruct *S)
+{
+    if (ssGetSimMode(S) == SS_SIMMODE_NORMAL)
+    {
+        // We only need to terminate properly in normal simulation mode
+        void **pwp = ssGetPWork(S);
+        if (pwp == NULL)
+        {
+            // This was just a model update, no need to free resources.
+            return;
+        }
+        mexPrintf("sl_aerosim_fleet_consumer@mdlTerminate(): Freeing up used resources\n");
+
+        aerosimCloseReader((aerosim_reader_t *)ssGetPWorkValue(S, EPW_READER));
+        aerosimDestroyFleet((aerosim_fleet_t *)ssGetPWorkValue(S, EPW_FLEET));
+        free(ssGetPWorkValue(S, EPW_MESSAGES));
+        free(ssGetPWorkValue(S, EPW_MESSAGE_LENS));
+        free(ssGetPWorkValue(S, EPW_PORTS));
+
+        ssSetPWorkValue(S, EPW_READER, NULL);
+        ssSetPWorkValue(S, EPW_FLEET, NULL);
+        ssSetPWorkValue(S, EPW_MESSAGES, NULL);
+        ssSetPWorkValue(S, EPW_MESSAGE_LENS, NULL);
+        ssSetPWorkValue(S, EPW_PORTS, NULL);
+        ssSetPWorkValue(S, EPW_TRACE_NAME, NULL);
+        aerosimTraceStop();
+    }
+}
+
+/*=============================*
+ * Required S-function trailer *
+ *=============================*/
+
+#ifdef MATLAB_MEX_FILE /* Is this file being compiled as a MEX-file? */
+#include "simulink.c"  /* MEX-file interface mechanism */
+#else
+#include "cg_sfun.h" /* Code generation registration function */
+#endif
@@ -0,0 +1,438 @@
+/*
+ * sl_aerosim_fleet_producer
+ *
+ * Vectorized JSON encoder and producer for a fleet of vehicles, based on
+ * sl_aerosim_kafka_producer.c
+ */
+
+/**
+ * Encodes the rows of N-by-columns field matrices as one AeroSim message
+ * per vehicle and produces them to one topic with one writer, keyed by the
+ * vehicle key (see aerosim_fleet.h). The messages carry the block's type
+ * name and the simulation and platform timestamps in their metadata.
+ */
+
+#define S_FUNCTION_NAME sl_aerosim_fleet_producer
+#define S_FUNCTION_LEVEL 2
+
+#include "simstruc.h"
+#include "fixedpoint.h"
+
+#include "rdkafka.h"
+
+#include <math.h>
+
+#include "mw_kafka_utils.h"
+#include "mx_kafka_utils.h"
+#include "aerosim_kafka_utils.h"
+#include "aerosim_transport.h"
+#include "aerosim_fleet.h"
+#include "aerosim_trace.h"
+
+enum
+{
+    EP_BROKERS = 0,
+    EP_TOPIC,
+    EP_KEYS,
+    EP_FIELDS,
+    EP_FIELD_PORTS,
+    EP_TYPE_NAME,
+    EP_MSG_LEN,
+    EP_CONF,
+    EP_TOPIC_CONF,
+    EP_COMBINED_CONF_STR,
+    EP_TS,
+    EP_NumParams
+};
+
+#define P_BROKER (ssGetSFcnParam(S, EP_BROKERS))
+#define P_TOPIC (ssGetSFcnParam(S, EP_TOPIC))
+#define P_KEYS (ssGetSFcnParam(S, EP_KEYS))
+#define P_FIELDS (ssGetSFcnParam(S, EP_FIELDS))
+#define P_FIELD_PORTS (ssGetSFcnParam(S, EP_FIELD_PORTS))
+#define P_TYPE_NAME (ssGetSFcnParam(S, EP_TYPE_NAME))
+#define P_MSG_LEN ((int_T)mxGetScalar((ssGetSFcnParam(S, EP_MSG_LEN))))
+#define P_CONF (ssGetSFcnParam(S, EP_CONF))
+#define P_TOPIC_CONF (ssGetSFcnParam(S, EP_TOPIC_CONF))
+#define P_COMBINED_CONF_STR (ssGetSFcnParam(S, EP_COMBINED_CONF_STR))
+#define P_TS (ssGetSFcnParam(S, EP_TS))
+
+/* Number of vehicles, one per key */
+#define P_NUM_VEHICLES ((int_T)mxGetNumberOfElements(P_KEYS))
+
+/* Send the message metadata as Kafka headers, so readers needn't parse the payload to route it (client config) */
+#define P_SEND_ENVELOPE (aerosimGetOptionNumberMX(P_CONF, "aerosim.headers.envelope", 0) != 0)
+
+enum
+{
+    EPW_WRITER = 0,
+    EPW_FLEET,
+    EPW_TOPIC,
+    EPW_TYPE_NAME,
+    EPW_BUFFER,       /* encoded message, P_MSG_LEN bytes */
+    EPW_PORTS,        /* field matrix of each fleet port */
+    EPW_TRACE_NAME,
+    EPW_NumPWorks
+};
+
+enum
+{
+    EIW_SEND_ENVELOPE = 0,
+    EIW_NumIWorks
+};
+
+static char errstr[512]; /* error reporting buffer */
+
+static int getParamString(SimStruct *S, char **strPtr, const mxArray *prm, int epwIdx, char *errorHelp)
+{
+    int N = (int)mxGetNumberOfElements(prm);
+    char *tmp = (char *)malloc(N + 1);
+    if (tmp == NULL)
+    {
+        sprintf(errstr, "Couldn't allocate string for '%s'\n", errorHelp);
+        ssSetErrorStatus(S, errstr);
+        return 1;
+    }
+    if (mxGetString(prm, tmp, N + 1))
+    {
+        sprintf(errstr, "Couldn't retrieve '%s' string\n", errorHelp);
+        ssSetErrorStatus(S, errstr);
+        free(tmp);
+        return 2;
+    }
+    if (epwIdx >= 0)
+    {
+        ssSetPWorkValue(S, epwIdx, tmp);
+    }
+    *strPtr = tmp;
+
+    return 0;
+}
+
+/* Fleet of the key and field parameters, NULL after reporting an error */
+static aerosim_fleet_t *createFleet(SimStruct *S)
+{
+    int numVehicles = P_NUM_VEHICLES;
+    int numFields = (int)mxGetNumberOfElements(P_FIELDS);
+    const char **keys = NULL, **fields = NULL;
+    int *ports = NULL;
+    aerosim_fleet_t *fleet = NULL;
+    int k;
+
+    if (!mxIsCell(P_KEYS) || !mxIsCell(P_FIELDS) || !mxIsDouble(P_FIELD_PORTS)
+        || (int)mxGetNumberOfElements(P_FIELD_PORTS) != numFields)
+    {
+        ssSetErrorStatus(S, "Expected cell arrays of vehicle keys and fields, and one field port per field");
+        return NULL;
+    }
+    keys = (const char **)calloc(numVehicles, sizeof(char *));
+    fields = (const char **)calloc(numFields, sizeof(char *));
+    ports = (int *)calloc(numFields, sizeof(int));
+    if (keys != NULL && fields != NULL && ports != NULL)
+    {
+        for (k = 0; k < numVehicles; k++)
+            keys[k] = mxArrayToString(mxGetCell(P_KEYS, k));
+        for (k = 0; k < numFields; k++)
+        {
+            fields[k] = mxArrayToString(mxGetCell(P_FIELDS, k));
+            ports[k] = (int)mxGetPr(P_FIELD_PORTS)[k] - 1;
+        }
+        fleet = aerosimCreateFleet(numVehicles, keys, numFields, fields, ports);
+    }
+    if (fleet == NULL)
+    {
+        ssSetErrorStatus(S, "Invalid fleet vehicle keys or fields, see the MATLAB console");
+    }
+
+    for (k = 0; keys != NULL && k < numVehicles; k++)
+        mxFree((void *)keys[k]);
+    for (k = 0; fields != NULL && k < numFields; k++)
+        mxFree((void *)fields[k]);
+    free(keys);
+    free(fields);
+    free(ports);
+    return fleet;
+}
+
+static void initFleetProducer(SimStruct *S)
+{
+    aerosim_writer_t *writer = NULL;
+    char *brokers = NULL, *topic = NULL, *typeName = NULL;
+    int nConf, nTopicConf;
+
+    mwLogInit("simulink");
+
+    if (getParamString(S, &brokers, P_BROKER, -1, "brokers"))
+        return;
+    if (getParamString(S, &topic, P_TOPIC, EPW_TOPIC, "topic"))
+        goto exit_init_fleet;
+    if (getParamString(S, &typeName, P_TYPE_NAME, EPW_TYPE_NAME, "type name"))
+        goto exit_init_fleet;
+    mexPrintf("Initializing Fleet Producer - (brokers: %s, topic: %s, vehicles: %d)\n", brokers, topic, P_NUM_VEHICLES);
+
+    nConf = mxGetNumberOfElements(P_CONF);
+    nTopicConf = mxGetNumberOfElements(P_TOPIC_CONF);
+    const char **confArray = getConfArrayFromMX(nConf, P_CONF, nTopicConf, P_TOPIC_CONF);
+    if (confArray == NULL)
+    {
+        ssSetErrorStatus(S, "Couldn't retrieve confArray from parameters");
+        goto exit_init_fleet;
+    }
+
+    // Shares the producer instance with the producer blocks of the same brokers and client config
+    int res = aerosimOpenWriter(&writer, brokers, topic, nConf, nTopicConf, confArray);
+    freeConfArray((char **)confArray, nConf + nTopicConf);
+    if (res)
+    {
+        ssSetErrorStatus(S, "Couldn't initialize Kafka Producer");
+        goto exit_init_fleet;
+    }
+    ssSetPWorkValue(S, EPW_WRITER, writer);
+
+exit_init_fleet:
+    free(brokers);
+}
+
+/*====================*
+ * S-function methods *
+ *====================*/
+
+/* Function: mdlInitializeSizes ===============================================
+ * Abstract:
+ *    The sizes information is used by Simulink to determine the S-function
+ *    block's characteristics (number of inputs, outputs, states, etc.).
+ */
+static void mdlInitializeSizes(SimStruct *S)
+{
+    aerosim_fleet_t *fleet;
+    int_T port, numPorts;
+
+    ssSetNumSFcnParams(S, EP_NumParams); /* Number of expected parameters */
+    if (ssGetNumSFcnParams(S) != ssGetSFcnParamsCount(S))
+        return;
+
+    ssSetSFcnParamNotTunable(S, EP_BROKERS);
+    ssSetSFcnParamNotTunable(S, EP_TOPIC);
+    ssSetSFcnParamNotTunable(S, EP_KEYS);
+    ssSetSFcnParamNotTunable(S, EP_FIELDS);
+    ssSetSFcnParamNotTunable(S, EP_FIELD_PORTS);
+    ssSetSFcnParamNotTunable(S, EP_TYPE_NAME);
+    ssSetSFcnParamNotTunable(S, EP_MSG_LEN);
+    ssSetSFcnParamNotTunable(S, EP_CONF);
+    ssSetSFcnParamNotTunable(S, EP_TOPIC_CONF);
+    ssSetSFcnParamNotTunable(S, EP_COMBINED_CONF_STR);
+    ssSetSFcnParamNotTunable(S, EP_TS);
+
+    ssSetNumContStates(S, 0);
+    ssSetNumDiscStates(S, 0);
+
+    // The port sizes follow from the fleet layout
+    fleet = createFleet(S);
+    if (fleet == NULL)
+        return;
+    numPorts = aerosimGetFleetPortCount(fleet);
+
+    if (!ssSetNumInputPorts(S, numPorts))
+        goto exit_sizes;
+    // One N-by-columns matrix per fleet port
+    for (port = 0; port < numPorts; port++)
+    {
+        ssSetInputPortMatrixDimensions(S, port, P_NUM_VEHICLES, aerosimGetFleetPortColumns(fleet, port));
+        ssSetInputPortDataType(S, port, SS_DOUBLE);
+        ssSetInputPortRequiredContiguous(S, port, true); /*direct input signal access*/
+        ssSetInputPortDirectFeedThrough(S, port, 1);
+    }
+    if (!ssSetNumOutputPorts(S, 0))
+        goto exit_sizes;
+
+    ssSetNumSampleTimes(S, 1);
+    ssSetNumRWork(S, 0);
+    ssSetNumIWork(S, EIW_NumIWorks);
+    ssSetNumPWork(S, EPW_NumPWorks);
+    ssSetNumModes(S, 0);
+    ssSetNumNonsampledZCs(S, 0);
+
+    /* Specify the sim state compliance to be same as a built-in block */
+    ssSetSimStateCompliance(S, USE_DEFAULT_SIM_STATE);
+
+    ssSetOptions(S,
+                 SS_OPTION_CALL_TERMINATE_ON_EXIT);
+
+exit_sizes:
+    aerosimDestroyFleet(fleet);
+}
+
+/* Function: mdlInitializeSampleTimes =========================================
+ * Abstract:
+ *    This function is used to specify the sample time(s) for your
+ *    S-function. You must register the same number of sample times as
+ *    specified in ssSetNumSampleTimes.
+ */
+static void mdlInitializeSampleTimes(SimStruct *S)
+{
+    real_T *pr, ts, offset = 0.0;
+    pr = mxGetPr(P_TS);
+    ts = pr[0];
+    if (mxGetNumberOfElements(P_TS) > 1)
+    {
+        offset = pr[1];
+    }
+    ssSetSampleTime(S, 0, ts);
+    ssSetOffsetTime(S, 0, offset);
+    ssSetModelReferenceSampleTimeDefaultInheritance(S);
+}
+
+#define MDL_START /* Change to #undef to remove function */
+#if defined(MDL_START)
+/* Function: mdlStart =======================================================
+ * Abstract:
+ *    This function is called once at start of model execution. If you
+ *    have states that should be initialized once, this is the place
+ *    to do it.
+ */
+static void mdlStart(SimStruct *S)
+{
+    if (ssGetSimMode(S) == SS_SIMMODE_NORMAL)
+    {
+        // Only initialize Kafka when we're actually running in Simulink
+        aerosim_fleet_t *fleet;
+        const real_T **ports;
+        int_T port, numPorts;
+
+        aerosimTraceStart();
+        ssSetPWorkValue(S, EPW_TRACE_NAME, (void *)aerosimTraceName(ssGetPath(S)));
+
+        fleet = createFleet(S);
+        if (fleet == NULL)
+            return;
+        ssSetPWorkValue(S, EPW_FLEET, fleet);
+
+        // Resolve the input matrices once, the encoder reads them directly
+        numPorts = aerosimGetFleetPortCount(fleet);
+        ports = (const real_T **)calloc(numPorts, sizeof(real_T *));
+        ssSetPWorkValue(S, EPW_PORTS, (void *)ports);
+        ssSetPWorkValue(S, EPW_BUFFER, malloc(P_MSG_LEN));
+        if (ports == NULL || ssGetPWorkValue(S, EPW_BUFFER) == NULL)
+        {
+            ssSetErrorStatus(S, "Couldn't allocate the fleet message buffer");
+            return;
+        }
+        for (port = 0; port < numPorts; port++)
+        {
+            ports[port] = (const real_T *)ssGetInputPortSignal(S, port);
+        }
+
+        initFleetProducer(S);
+
+        // Store the envelope option, so it isn't looked up every step
+        ssSetIWorkValue(S, EIW_SEND_ENVELOPE, P_SEND_ENVELOPE);
+    }
+}
+#endif /*  MDL_START */
+
+/* Function: mdlOutputs =======================================================
+ * Abstract:
+ *    In this function, you compute the outputs of your S-function
+ *    block.
+ */
+static void mdlOutputs(SimStruct *S, int_T tid)
+{
+    if (!ssIsMajorTimeStep(S))
+    {
+        // Only trigger producing messages on major time steps
+        return;
+    }
+
+    aerosim_writer_t *writer = (aerosim_writer_t *)ssGetPWorkValue(S, EPW_WRITER);
+    aerosim_fleet_t *fleet = (aerosim_fleet_t *)ssGetPWorkValue(S, EPW_FLEET);
+    const char *topic = (const char *)ssGetPWorkValue(S, EPW_TOPIC);
+    const char *typeName = (const char *)ssGetPWorkValue(S, EPW_TYPE_NAME);
+    char *buf = (char *)ssGetPWorkValue(S, EPW_BUFFER);
+    const real_T *const *ports = (const real_T *const *)ssGetPWorkValue(S, EPW_PORTS);
+    const char *trace_name = (const char *)ssGetPWorkValue(S, EPW_TRACE_NAME);
+    int64_t platformNs = aerosimWallClockMs() * 1000000;
+    int_T numVehicles = P_NUM_VEHICLES;
+    int_T v;
+
+    // All vehicles share the envelope, its sim time is rounded like the message's
+    aerosim_envelope_t envelope;
+    const aerosim_envelope_t *headers = NULL;
+    if (ssGetIWorkValue(S, EIW_SEND_ENVELOPE))
+    {
+        double simSec = floor(ssGetT(S));
+        envelope.type_name = typeName;
+        envelope.type_name_len = strlen(typeName);
+        envelope.topic = topic;
+        envelope.topic_len = strlen(topic);
+        envelope.sim_ns = (int64_t)simSec * 1000000000 + (int64_t)llround((ssGetT(S) - simSec) * 1e9);
+        envelope.platform_ns = platformNs;
+        headers = &envelope;
+    }
+
+    AEROSIM_TRACE_BEGIN(trace_name, "block");
+    for (v = 0; v < numVehicles; v++)
+    {
+        const char *key = aerosimGetFleetKey(fleet, v);
+        int len = aerosimEncodeFleetMessage(fleet, v, ports, topic, typeName, ssGetT(S), platformNs, buf, P_MSG_LEN);
+
+        if (len < 0)
+        {
+            sprintf(errstr, "The message of vehicle '%s' exceeds the maximum message length (%d)", key, (int)P_MSG_LEN);
+            ssSetErrorStatus(S, errstr);
+            break;
+        }
+        if (aerosimWriteMessageEnvelope(writer, key, (int)strlen(key), buf, len, -1, headers))
+        {
+            ssSetErrorStatus(S, "Failed producing message\n");
+            break;
+        }
+    }
+    AEROSIM_TRACE_END(trace_name, "block");
+}
+
+/* Function: mdlTerminate =====================================================
+ * Abstract:
+ *    In this function, you should perform any actions that are necessary
+ *    at the termination of a simulation.  For example, if memory was
+ *    allocated in mdlStart, this is the place to free it.
+ */
+static void mdlTerminate(SimStruct *S)
+{
+    if (ssGetSimMode(S) == SS_SIMMODE_NORMAL)
+    {
+        // We only need to terminate properly in normal simulation mode
+        void **pwp = ssGetPWork(S);
+        if (pwp == NULL)
+        {
+            // This was just a model update, no need to free resources.
+            return;
+        }
+        mexPrintf("sl_aerosim_fleet_producer@mdlTerminate(): Freeing up used resources\n");
+
+        aerosimCloseWriter((aerosim_writer_t *)ssGetPWorkValue(S, EPW_WRITER));
+        aerosimDestroyFleet((aerosim_fleet_t *)ssGetPWorkValue(S, EPW_FLEET));
+        free(ssGetPWorkValue(S, EPW_TOPIC));
+        free(ssGetPWorkValue(S, EPW_TYPE_NAME));
+        free(ssGetPWorkValue(S, EPW_BUFFER));
+        free(ssGetPWorkValue(S, EPW_PORTS));
+
+        ssSetPWorkValue(S, EPW_WRITER, NULL);
+        ssSetPWorkValue(S, EPW_FLEET, NULL);
+        ssSetPWorkValue(S, EPW_TOPIC, NULL);
+        ssSetPWorkValue(S, EPW_TYPE_NAME, NULL);
+        ssSetPWorkValue(S, EPW_BUFFER, NULL);
+        ssSetPWorkValue(S, EPW_PORTS, NULL);
+        ssSetPWorkValue(S, EPW_TRACE_NAME, NULL);
+        aerosimTraceStop();
+    }
+}
+
+/*=============================*
+ * Required S-function trailer *
+ *=============================*/
+
+#ifdef MATLAB_MEX_FILE /* Is this file being compiled as a MEX-file? */
+#include "simulink.c"  /* MEX-file interface mechanism */
+#else
+#include "cg_sfun.h" /* Code generation registration function */
+#endif
@@ -27,6 +27,8 @@
 #include "mw_kafka_utils.h"
 #include "mx_kafka_utils.h"
 #include "aerosim_kafka_utils.h"
+#include "aerosim_transport.h"
+#include "aerosim_trace.h"
 
 enum
 {
@@ -54,12 +56,77 @@ enum
 #define P_COMBINED_CONF_STR (ssGetSFcnParam(S, EP_COMBINED_CONF_STR))
 #define P_TS (ssGetSFcnParam(S, EP_TS))
 
+/* Output the client statistics (client config), after the optional timestamp */
+#define P_OUTPUT_STATS (aerosimGetOptionNumberMX(P_CONF, AEROSIM_STATS_OUTPUT_OPTION, 0) != 0)
+#define STATS_PORT (5 + (P_OUTPUT_TIMESTAMP != 0))
+
+/* Output the consumer lag in messages and the age of the last message in seconds (client config), after the statistics */
+#define P_OUTPUT_LAG (aerosimGetOptionNumberMX(P_CONF, "aerosim.lag.output", 0) != 0)
+#define LAG_PORT (STATS_PORT + (P_OUTPUT_STATS ? 1 : 0))
+
+/*
+    Routing tables (client config): comma-separated message keys
+    (aerosim.key.routes) or type names (aerosim.type.routes), each with its
+    own output slot in table order; a trailing '*' matches a prefix and the
+    first matching entry wins. The message, length, key, key length and
+    timestamp outputs get one column per slot, holding the latest message
+    routed to it in the step. Type names are taken from the type_name
+    message header, or scanned from the payload metadata of messages
+    without one. Unrouted messages are dropped without copying them. Only
+    one of the tables may be given.
+*/
+#define KEY_ROUTES_OPTION "aerosim.key.routes"
+#define TYPE_ROUTES_OPTION "aerosim.type.routes"
+#define MAX_ROUTES_LEN 4096
+
+typedef struct
+{
+    const char *name;
+    size_t len;
+    int prefix;
+} route_t;
+
+typedef struct
+{
+    int count;
+    int by_type; /* routes type names instead of keys */
+    route_t *routes;
+    char *table; /* option value, split in place at the commas */
+} routes_t;
+
+/* Catch-up policy once the lag exceeds aerosim.catchup.max.lag messages (client config) */
+#define DEFAULT_CATCHUP_MAX_LAG 100
+
+typedef enum
+{
+    CATCHUP_DRAIN = 0, /* consume the whole backlog, output the last message */
+    CATCHUP_LATEST,    /* skip the backlog to the latest message */
+    CATCHUP_ERROR      /* stop the simulation with an error */
+} catchup_policy_t;
+
 enum
 {
-    EPW_KAFKA_CONSUMER = 0,
+    EPW_READER = 0,
+    EPW_TRACE_NAME,
+    EPW_ROUTES, /* NULL without a routing table */
     EPW_NumPWorks
 };
 
+enum
+{
+    EIW_CATCHUP_POLICY = 0,
+    EIW_CATCHUP_MAX_LAG,
+    EIW_STATS_PORT, /* -1 if disabled */
+    EIW_LAG_PORT,   /* -1 if disabled */
+    EIW_NumIWorks
+};
+
+enum
+{
+    ERW_LAST_TIMESTAMP_MS = 0, /* timestamp of the last consumed message, 0 before the first one */
+    ERW_NumRWorks
+};
+
 static int wait_eof = 0; /* number of partitions awaiting EOF */
 
 static char errstr[512]; /* librdkafka API error reporting buffer */
@@ -89,9 +156,119 @@ static int getParamString(SimStruct *S, char **strPtr, const mxArray *prm, int e
     return 0;
 }
 
+static void freeRoutes(routes_t *routes)
+{
+    if (routes != NULL)
+    {
+        free(routes->routes);
+        free(routes->table);
+        free(routes);
+    }
+}
+
+/* Routing table of the client config, NULL without one or after reporting an error */
+static routes_t *createRoutes(SimStruct *S)
+{
+    char keys[MAX_ROUTES_LEN], types[MAX_ROUTES_LEN];
+    int by_key = aerosimGetOptionMX(P_CONF, KEY_ROUTES_OPTION, keys, sizeof(keys));
+    int by_type = aerosimGetOptionMX(P_CONF, TYPE_ROUTES_OPTION, types, sizeof(types));
+    routes_t *routes;
+    char *entry, *next;
+    int k;
+
+    if (!by_key && !by_type)
+        return NULL;
+    if (by_key && by_type)
+    {
+        ssSetErrorStatus(S, "The aerosim.key.routes and aerosim.type.routes options can't be combined");
+        return NULL;
+    }
+
+    routes = (routes_t *)calloc(1, sizeof(routes_t));
+    if (routes == NULL || (routes->table = strdup(by_type ? types : keys)) == NULL)
+    {
+        free(routes);
+        ssSetErrorStatus(S, "Couldn't allocate the routing table");
+        return NULL;
+    }
+    routes->by_type = by_type;
+    routes->count = 1;
+    for (entry = routes->table; *entry != '\0'; entry++)
+    {
+        if (*entry == ',')
+            routes->count++;
+    }
+    routes->routes = (route_t *)calloc(routes->count, sizeof(route_t));
+    if (routes->routes == NULL)
+    {
+        freeRoutes(routes);
+        ssSetErrorStatus(S, "Couldn't allocate the routing table");
+        return NULL;
+    }
+
+    for (k = 0, entry = routes->table; k < routes->count; k++, entry = next)
+    {
+        next = strchr(entry, ',');
+        if (next != NULL)
+            *next++ = '\0';
+        routes->routes[k].name = entry;
+        routes->routes[k].len = strlen(entry);
+        if (routes->routes[k].len > 0 && entry[routes->routes[k].len - 1] == '*')
+        {
+            routes->routes[k].prefix = 1;
+            routes->routes[k].len--;
+        }
+        else if (routes->routes[k].len == 0)
+        {
+            freeRoutes(routes);
+            sprintf(errstr, "Empty entry in the %s option", by_type ? TYPE_ROUTES_OPTION : KEY_ROUTES_OPTION);
+            ssSetErrorStatus(S, errstr);
+            return NULL;
+        }
+    }
+    return routes;
+}
+
+/* Output slot of the message, -1 to drop it */
+static int routeMessage(const routes_t *routes, const aerosim_message_t *message)
+{
+    const void *name = message->key;
+    size_t len = message->key_len;
+    int k;
+
+    if (routes->by_type)
+    {
+        aerosim_envelope_t envelope = message->envelope;
+        if (envelope.type_name == NULL)
+            aerosimScanEnvelope((const char *)message->payload, message->len, &envelope);
+        if (envelope.type_name == NULL)
+            return -1;
+        name = envelope.type_name;
+        len = envelope.type_name_len;
+    }
+
+    for (k = 0; k < routes->count; k++)
+    {
+        const route_t *route = &routes->routes[k];
+        if ((route->prefix ? len >= route->len : len == route->len) && memcmp(name, route->name, route->len) == 0)
+            return k;
+    }
+    return -1;
+}
+
+/* Number of output slots, one per route or one without a routing table */
+static int getNumSlots(SimStruct *S)
+{
+    routes_t *routes = createRoutes(S);
+    int count = (routes != NULL) ? routes->count : 1;
+
+    freeRoutes(routes);
+    return count;
+}
+
 void initKafkaConsumer(SimStruct *S)
 {
-    rd_kafka_t *rk = NULL;        /* Consumer instance handle */
+    aerosim_reader_t *reader = NULL; /* Kafka consumer slot or shared-memory reader */
     rd_kafka_topic_t *rkt = NULL; /* Topic object */
     rd_kafka_conf_t *conf = NULL; /* Temporary configuration object */
     rd_kafka_topic_conf_t *topic_conf = NULL;
@@ -136,13 +313,14 @@ void initKafkaConsumer(SimStruct *S)
         return;
     }
 
-    int res = aerosimInitializeKafkaConsumer(&rk, brokers, group, topic, nConf, nTopicConf, confArray, start_offset);
+    int res = aerosimOpenReader(&reader, brokers, group, (const char **)&topic, 1, nConf, nTopicConf, confArray, start_offset);
+    freeConfArray((char **)confArray, nConf + nTopicConf);
     if (res)
     {
         ssSetErrorStatus(S, "Problems initializing Kafka Consumer\n");
         goto exit_init_kafka;
     }
-    ssSetPWorkValue(S, EPW_KAFKA_CONSUMER, rk);
+    ssSetPWorkValue(S, EPW_READER, reader);
 
 exit_init_kafka:
     if (brokers != NULL)
@@ -175,6 +353,7 @@ exit_init_kafka:
 static void mdlInitializeSizes(SimStruct *S)
 {
     int_T numOutports = 5;
+    int_T numSlots;
     DTypeId f64_id;
 
     // printSimMode(S, "mdlInitializeSizes");
@@ -187,6 +366,15 @@ static void mdlInitializeSizes(SimStruct *S)
     {
         numOutports += 1;
     }
+    numSlots = getNumSlots(S);
+    if (P_OUTPUT_STATS)
+    {
+        numOutports += 1;
+    }
+    if (P_OUTPUT_LAG)
+    {
+        numOutports += 1;
+    }
     ssSetSFcnParamNotTunable(S, EP_BROKERS);
     ssSetSFcnParamNotTunable(S, EP_TOPIC);
     ssSetSFcnParamNotTunable(S, EP_GROUP);
@@ -213,17 +401,23 @@ static void mdlInitializeSizes(SimStruct *S)
     // The function call output
     ssSetOutputPortWidth(S, 0, 1);
     ssSetOutputPortDataType(S, 0, SS_FCN_CALL);
-    // The real message
-    ssSetOutputPortWidth(S, 1, P_MSG_LEN);
+    // The real message, one column per route (a vector without routing, as before)
+    if (numSlots > 1)
+        ssSetOutputPortMatrixDimensions(S, 1, P_MSG_LEN, numSlots);
+    else
+        ssSetOutputPortWidth(S, 1, P_MSG_LEN);
     ssSetOutputPortDataType(S, 1, SS_INT8);
     // The message length
-    ssSetOutputPortWidth(S, 2, 1);
+    ssSetOutputPortWidth(S, 2, numSlots);
     ssSetOutputPortDataType(S, 2, SS_UINT32);
     // The key
-    ssSetOutputPortWidth(S, 3, P_KEY_LEN);
+    if (numSlots > 1)
+        ssSetOutputPortMatrixDimensions(S, 3, P_KEY_LEN, numSlots);
+    else
+        ssSetOutputPortWidth(S, 3, P_KEY_LEN);
     ssSetOutputPortDataType(S, 3, SS_INT8);
     // The key length
-    ssSetOutputPortWidth(S, 4, 1);
+    ssSetOutputPortWidth(S, 4, numSlots);
     ssSetOutputPortDataType(S, 4, SS_UINT32);
 
     if (P_OUTPUT_TIMESTAMP != 0)
@@ -242,18 +436,30 @@ static void mdlInitializeSizes(SimStruct *S)
             ssSetErrorStatus(S, "Couldn't register f64 datatype");
             return;
         }
-        ssSetOutputPortWidth(S, 5, 1);
+        ssSetOutputPortWidth(S, 5, numSlots);
         ssSetOutputPortDataType(S, 5, f64_id);
     }
+    if (P_OUTPUT_STATS)
+    {
+        // The client statistics
+        ssSetOutputPortWidth(S, STATS_PORT, AEROSIM_STATS_OUTPUT_WIDTH);
+        ssSetOutputPortDataType(S, STATS_PORT, SS_DOUBLE);
+    }
+    if (P_OUTPUT_LAG)
+    {
+        // The consumer lag and the last message's age
+        ssSetOutputPortWidth(S, LAG_PORT, 2);
+        ssSetOutputPortDataType(S, LAG_PORT, SS_DOUBLE);
+    }
     ssSetNumSampleTimes(S, 1);
-    ssSetNumRWork(S, 0);
-    ssSetNumIWork(S, 0);
+    ssSetNumRWork(S, ERW_NumRWorks);
+    ssSetNumIWork(S, EIW_NumIWorks);
     ssSetNumPWork(S, EPW_NumPWorks);
     ssSetNumModes(S, 0);
     ssSetNumNonsampledZCs(S, 0);
 
-    /* Specify the sim state compliance to be same as a built-in block */
-    ssSetSimStateCompliance(S, USE_DEFAULT_SIM_STATE);
+    /* The SimState holds the read position and the last messages, see mdlGetSimState */
+    ssSetSimStateCompliance(S, USE_CUSTOM_SIM_STATE);
 
     ssSetOptions(S,
                  SS_OPTION_CALL_TERMINATE_ON_EXIT);
@@ -297,7 +503,33 @@ static void mdlStart(SimStruct *S)
         // Only initialize Kafka when we're actually running in Simulink
         // printSimMode(S, "mdlStart");
 
+        aerosimTraceStart();
+        ssSetPWorkValue(S, EPW_TRACE_NAME, (void *)aerosimTraceName(ssGetPath(S)));
+
         initKafkaConsumer(S);
+        ssSetPWorkValue(S, EPW_ROUTES, createRoutes(S));
+
+        // Initialize the catch-up policy: drain (default), latest or error
+        char policy[16] = "drain";
+        aerosimGetOptionMX(P_CONF, "aerosim.catchup.policy", policy, sizeof(policy));
+        if (strcmp(policy, "drain") == 0)
+            ssSetIWorkValue(S, EIW_CATCHUP_POLICY, CATCHUP_DRAIN);
+        else if (strcmp(policy, "latest") == 0)
+            ssSetIWorkValue(S, EIW_CATCHUP_POLICY, CATCHUP_LATEST);
+        else if (strcmp(policy, "error") == 0)
+            ssSetIWorkValue(S, EIW_CATCHUP_POLICY, CATCHUP_ERROR);
+        else
+        {
+            ssSetErrorStatus(S, "Invalid aerosim.catchup.policy option, expected drain, latest or error");
+            return;
+        }
+        ssSetIWorkValue(S, EIW_CATCHUP_MAX_LAG,
+                        (int_T)aerosimGetOptionNumberMX(P_CONF, "aerosim.catchup.max.lag", DEFAULT_CATCHUP_MAX_LAG));
+        ssSetRWorkValue(S, ERW_LAST_TIMESTAMP_MS, 0.0);
+
+        // Store the optional output port indices, so the options aren't looked up every step
+        ssSetIWorkValue(S, EIW_STATS_PORT, P_OUTPUT_STATS ? STATS_PORT : -1);
+        ssSetIWorkValue(S, EIW_LAG_PORT, P_OUTPUT_LAG ? LAG_PORT : -1);
     }
 }
 #endif /*  MDL_START */
@@ -315,7 +547,13 @@ static void mdlOutputs(SimStruct *S, int_T tid)
         return;
     }
 
-    rd_kafka_t *rk = (rd_kafka_t *)ssGetPWorkValue(S, EPW_KAFKA_CONSUMER);
+    aerosim_reader_t *reader = (aerosim_reader_t *)ssGetPWorkValue(S, EPW_READER);
+    const routes_t *routes = (const routes_t *)ssGetPWorkValue(S, EPW_ROUTES);
+    const char *trace_name = (const char *)ssGetPWorkValue(S, EPW_TRACE_NAME);
+    int_T numSlots = (routes != NULL) ? routes->count : 1;
+    int_T received = 0;
+    int_T slot;
+    AEROSIM_TRACE_BEGIN(trace_name, "block");
 
     // Retrieve output signal ports
     int8_T *msg = (int8_T *)ssGetOutputPortSignal(S, 1);
@@ -328,30 +566,87 @@ static void mdlOutputs(SimStruct *S, int_T tid)
         timestamp = (int64_T *)ssGetOutputPortSignal(S, 5);
     }
 
-    // Set default length to 0 in case of error from mwConsumeKafkaMessage()
-    msgLen[0] = (uint32_T)0;
+    // Set default lengths to 0 in case no message is received
+    for (slot = 0; slot < numSlots; slot++)
+    {
+        msgLen[slot] = (uint32_T)0;
+        keyLen[slot] = (uint32_T)0;
+    }
+
+    // Messages are recorded and replayed by block step
+    aerosimBeginReaderStep(reader);
 
-    // Temp variable for storing last received valid kafka message
-    int8_T* temp_msg = (int8_T*)malloc(sizeof(int8_T)*P_MSG_LEN);
-    uint32_T temp_msgLen = 0;
-    int8_T* temp_key = (int8_T*)malloc(sizeof(int8_T)*P_KEY_LEN);
-    uint32_T temp_keyLen = 0;
+    // Apply the catch-up policy to the backlog that is not consumed yet
+    int64_t lag = aerosimGetReaderLag(reader);
+    if (lag > ssGetIWorkValue(S, EIW_CATCHUP_MAX_LAG))
+    {
+        // Skipping would lose the latest messages of the other routes, so routing drains instead
+        if (ssGetIWorkValue(S, EIW_CATCHUP_POLICY) == CATCHUP_LATEST && routes == NULL)
+        {
+            aerosimSkipReaderToLatest(reader);
+        }
+        else if (ssGetIWorkValue(S, EIW_CATCHUP_POLICY) == CATCHUP_ERROR)
+        {
+            sprintf(errstr, "Consumer lag of %lld messages exceeds aerosim.catchup.max.lag (%d)",
+                    (long long)lag, (int)ssGetIWorkValue(S, EIW_CATCHUP_MAX_LAG));
+            ssSetErrorStatus(S, errstr);
+            AEROSIM_TRACE_END(trace_name, "block");
+            return;
+        }
+    }
 
-    // Keep reading from the message queue until nothing to read
-    while(mwConsumeKafkaMessage(rk, temp_msg, &temp_msgLen, P_MSG_LEN, temp_key, &temp_keyLen, P_KEY_LEN, timestamp)) {
-        msgLen[0] = (uint32_T)temp_msgLen;
+    if (routes == NULL)
+    {
+        // Keep reading from the message queue until nothing to read, only the last message is copied
+        aerosim_message_t last;
+        if (aerosimReadLatestMessage(reader, &last))
+        {
+            // Set output signal ports to the last message received
+            aerosimCopyMessage(&last, msg, msgLen, P_MSG_LEN, key, keyLen, P_KEY_LEN, timestamp);
+            ssSetRWorkValue(S, ERW_LAST_TIMESTAMP_MS, (real_T)last.timestamp);
+            aerosimReleaseMessage(reader, &last);
+        }
+        received = msgLen[0] > 0;
+    }
+    else
+    {
+        // Route each message by key or type name; unrouted messages are dropped before copying anything
+        aerosim_message_t message;
+        while (aerosimReadMessage(reader, &message))
+        {
+            slot = routeMessage(routes, &message);
+            if (slot >= 0)
+            {
+                aerosimCopyMessage(&message, msg + (size_t)slot * P_MSG_LEN, &msgLen[slot], P_MSG_LEN,
+                                   key + (size_t)slot * P_KEY_LEN, &keyLen[slot], P_KEY_LEN,
+                                   (timestamp != NULL) ? &timestamp[slot] : NULL);
+                ssSetRWorkValue(S, ERW_LAST_TIMESTAMP_MS, (real_T)message.timestamp);
+                received |= msgLen[slot] > 0;
+            }
+            aerosimReleaseMessage(reader, &message);
+        }
     }
 
-    // Set output signal ports to the last message received
-    memcpy(msg, temp_msg, sizeof(int8_T) * msgLen[0]);
-    keyLen[0] = (uint32_T)temp_keyLen;
-    memcpy(key, temp_key, sizeof(int8_T) * keyLen[0]);
+    int_T lag_port = ssGetIWorkValue(S, EIW_LAG_PORT);
+    if (lag_port >= 0)
+    {
+        real_T *lagOut = (real_T *)ssGetOutputPortSignal(S, lag_port);
+        real_T last_timestamp_ms = ssGetRWorkValue(S, ERW_LAST_TIMESTAMP_MS);
+        lagOut[0] = (real_T)aerosimGetReaderLag(reader);
+        lagOut[1] = (last_timestamp_ms > 0) ? (aerosimWallClockMs() - last_timestamp_ms) * 1e-3 : 0.0;
+    }
 
-    // Message received, free memory
-    free(temp_msg);
-    free(temp_key);
+    int_T stats_port = ssGetIWorkValue(S, EIW_STATS_PORT);
+    if (stats_port >= 0)
+    {
+        aerosim_kafka_stats_t stats = { 0 };
+        stats.consumer_lag = -1;
+        aerosimGetReaderStats(reader, &stats);
+        aerosimWriteKafkaStatsOutput(&stats, (real_T *)ssGetOutputPortSignal(S, stats_port));
+    }
+    AEROSIM_TRACE_END(trace_name, "block");
 
-    if (msgLen[0] > 0)
+    if (received)
     {
         // Call the subsystem attached
         if (!ssCallSystemWithTid(S, 0, tid))
@@ -362,6 +657,96 @@ static void mdlOutputs(SimStruct *S, int_T tid)
     }
 }
 
+/* Copy of an output port's signal for the SimState */
+static mxArray *getOutputPortMX(SimStruct *S, int_T port, mxClassID classId, size_t elementSize)
+{
+    int_T width = ssGetOutputPortWidth(S, port);
+    mxArray *array = mxCreateNumericMatrix(1, width, classId, mxREAL);
+    memcpy(mxGetData(array), ssGetOutputPortSignal(S, port), width * elementSize);
+    return array;
+}
+
+/* Restore an output port's signal, unless the saved one has another size (changed block parameters) */
+static void setOutputPortMX(SimStruct *S, const mxArray *array, int_T port, size_t elementSize)
+{
+    int_T width = ssGetOutputPortWidth(S, port);
+    if (array != NULL && mxGetNumberOfElements(array) == (size_t)width)
+    {
+        memcpy(ssGetOutputPortSignal(S, port), mxGetData(array), width * elementSize);
+    }
+}
+
+#define MDL_SIM_STATE /* Change to #undef to remove function */
+#if defined(MDL_SIM_STATE)
+static const char *sim_state_fields[] = { "position", "last_timestamp_ms", "message", "message_length",
+                                          "key", "key_length", "timestamp" };
+
+/* Function: mdlGetSimState ===================================================
+ * Abstract:
+ *    Save the reader position and the last messages output, so a simulation
+ *    restored from the SimState continues reading where this one is instead
+ *    of from the latest message. The position is left empty if the backend
+ *    can't restore it.
+ */
+static mxArray *mdlGetSimState(SimStruct *S)
+{
+    aerosim_reader_t *reader = (aerosim_reader_t *)ssGetPWorkValue(S, EPW_READER);
+    aerosim_reader_position_t position;
+    mxArray *state = mxCreateStructMatrix(1, 1, 7, sim_state_fields);
+
+    if (reader != NULL && aerosimGetReaderPosition(reader, &position))
+    {
+        mxSetField(state, 0, "position", aerosimReaderPositionToMX(&position));
+    }
+    mxSetField(state, 0, "last_timestamp_ms", mxCreateDoubleScalar(ssGetRWorkValue(S, ERW_LAST_TIMESTAMP_MS)));
+    mxSetField(state, 0, "message", getOutputPortMX(S, 1, mxINT8_CLASS, sizeof(int8_T)));
+    mxSetField(state, 0, "message_length", getOutputPortMX(S, 2, mxUINT32_CLASS, sizeof(uint32_T)));
+    mxSetField(state, 0, "key", getOutputPortMX(S, 3, mxINT8_CLASS, sizeof(int8_T)));
+    mxSetField(state, 0, "key_length", getOutputPortMX(S, 4, mxUINT32_CLASS, sizeof(uint32_T)));
+    if (P_OUTPUT_TIMESTAMP)
+    {
+        mxSetField(state, 0, "timestamp", getOutputPortMX(S, 5, mxINT64_CLASS, sizeof(int64_T)));
+    }
+    return state;
+}
+
+/* Function: mdlSetSimState ===================================================
+ * Abstract:
+ *    Seek the reader to the saved position and restore the last messages.
+ */
+static void mdlSetSimState(SimStruct *S, const mxArray *state)
+{
+    aerosim_reader_t *reader = (aerosim_reader_t *)ssGetPWorkValue(S, EPW_READER);
+    aerosim_reader_position_t position;
+    const mxArray *field;
+
+    if (reader != NULL && aerosimReaderPositionFromMX(mxGetField(state, 0, "position"), &position))
+    {
+        if (aerosimSeekReader(reader, &position))
+        {
+            ssSetErrorStatus(S, "Couldn't restore the consumer position from the SimState");
+            return;
+        }
+    }
+    else if (reader != NULL)
+    {
+        mexPrintf("The SimState has no consumer position, reading from the start offset\n");
+    }
+    if ((field = mxGetField(state, 0, "last_timestamp_ms")) != NULL)
+    {
+        ssSetRWorkValue(S, ERW_LAST_TIMESTAMP_MS, mxGetScalar(field));
+    }
+    setOutputPortMX(S, mxGetField(state, 0, "message"), 1, sizeof(int8_T));
+    setOutputPortMX(S, mxGetField(state, 0, "message_length"), 2, sizeof(uint32_T));
+    setOutputPortMX(S, mxGetField(state, 0, "key"), 3, sizeof(int8_T));
+    setOutputPortMX(S, mxGetField(state, 0, "key_length"), 4, sizeof(uint32_T));
+    if (P_OUTPUT_TIMESTAMP)
+    {
+        setOutputPortMX(S, mxGetField(state, 0, "timestamp"), 5, sizeof(int64_T));
+    }
+}
+#endif /* MDL_SIM_STATE */
+
 /* Function: mdlTerminate =====================================================
  * Abstract:
  *    In this function, you should perform any actions that are necessary
@@ -382,11 +767,15 @@ static void mdlTerminate(SimStruct *S)
         }
         mexPrintf("sl_kafka_consumer@mdlTerminate(): Freeing up used resources\n");
 
-        rd_kafka_t *rk = (rd_kafka_t *)ssGetPWorkValue(S, EPW_KAFKA_CONSUMER);
+        aerosim_reader_t *reader = (aerosim_reader_t *)ssGetPWorkValue(S, EPW_READER);
 
-        mwTerminateKafkaConsumer(rk);
+        aerosimCloseReader(reader);
+        freeRoutes((routes_t *)ssGetPWorkValue(S, EPW_ROUTES));
 
-        ssSetPWorkValue(S, EPW_KAFKA_CONSUMER, NULL);
+        ssSetPWorkValue(S, EPW_READER, NULL);
+        ssSetPWorkValue(S, EPW_ROUTES, NULL);
+        ssSetPWorkValue(S, EPW_TRACE_NAME, NULL);
+        aerosimTraceStop();
     }
 }
 
@@ -20,6 +20,9 @@
 
 #include "mw_kafka_utils.h"
 #include "mx_kafka_utils.h"
+#include "aerosim_kafka_utils.h"
+#include "aerosim_transport.h"
+#include "aerosim_trace.h"
 
 enum
 {
@@ -49,16 +52,29 @@ enum
 #define P_COMBINED_CONF_STR (ssGetSFcnParam(S, EP_COMBINED_CONF_STR))
 #define P_TS (ssGetSFcnParam(S, EP_TS))
 
+/* Output the client statistics (client config) */
+#define P_OUTPUT_STATS (aerosimGetOptionNumberMX(P_CONF, AEROSIM_STATS_OUTPUT_OPTION, 0) != 0)
+
+/* Send the message metadata as Kafka headers, so readers needn't parse the payload to route it (client config) */
+#define P_SEND_ENVELOPE (aerosimGetOptionNumberMX(P_CONF, "aerosim.headers.envelope", 0) != 0)
+
 enum
 {
-    EPW_KAFKA_PRODUCER = 0,
-    EPW_KAFKA_TOPIC,
+    EPW_WRITER = 0,
     EPW_BROKERS,
     EPW_TOPIC,
     EPW_KEY,
+    EPW_TRACE_NAME,
     EPW_NumPWorks
 };
 
+enum
+{
+    EIW_STATS_PORT = 0, /* -1 if disabled */
+    EIW_SEND_ENVELOPE,
+    EIW_NumIWorks
+};
+
 static char errstr[512]; /* librdkafka API error reporting buffer */
 
 static int getParamString(SimStruct *S, char **strPtr, const mxArray *prm, int epwIdx, char *errorHelp)
@@ -88,8 +104,7 @@ static int getParamString(SimStruct *S, char **strPtr, const mxArray *prm, int e
 
 void initKafkaProducer(SimStruct *S)
 {
-    rd_kafka_t *rk = NULL;        /* Producer instance handle */
-    rd_kafka_topic_t *rkt = NULL; /* Topic object */
+    aerosim_writer_t *writer = NULL; /* Kafka topic on a shared producer or shared-memory writer */
 
     char *brokers = NULL; /* Argument: broker list */
     char *topic = NULL;   /* Argument: topic to produce to */
@@ -120,7 +135,8 @@ void initKafkaProducer(SimStruct *S)
         return;
     }
 
-    ret = mwInitializeKafkaProducer(&rk, &rkt, brokers, topic, nConf, nTopicConf, confArray);
+    // Producer blocks with the same brokers and client config share one producer instance
+    ret = aerosimOpenWriter(&writer, brokers, topic, nConf, nTopicConf, confArray);
 
     if (confArray != NULL)
     {
@@ -131,8 +147,7 @@ void initKafkaProducer(SimStruct *S)
     {
         ssSetErrorStatus(S, "Couldn't initialize Kafka Producer");
     }
-    ssSetPWorkValue(S, EPW_KAFKA_PRODUCER, rk);
-    ssSetPWorkValue(S, EPW_KAFKA_TOPIC, rkt);
+    ssSetPWorkValue(S, EPW_WRITER, writer);
 }
 
 /*====================*
@@ -195,12 +210,18 @@ static void mdlInitializeSizes(SimStruct *S)
         ssSetInputPortDirectFeedThrough(S, curPort, 1);
     }
 
-    if (!ssSetNumOutputPorts(S, 0))
+    if (!ssSetNumOutputPorts(S, P_OUTPUT_STATS ? 1 : 0))
         return;
+    if (P_OUTPUT_STATS)
+    {
+        // The client statistics
+        ssSetOutputPortWidth(S, 0, AEROSIM_STATS_OUTPUT_WIDTH);
+        ssSetOutputPortDataType(S, 0, SS_DOUBLE);
+    }
 
     ssSetNumSampleTimes(S, 1);
     ssSetNumRWork(S, 0);
-    ssSetNumIWork(S, 0);
+    ssSetNumIWork(S, EIW_NumIWorks);
     ssSetNumPWork(S, EPW_NumPWorks);
     ssSetNumModes(S, 0);
     ssSetNumNonsampledZCs(S, 0);
@@ -244,7 +265,14 @@ static void mdlStart(SimStruct *S)
     if (ssGetSimMode(S) == SS_SIMMODE_NORMAL)
     {
         // Only initialize Kafka when we're actually running in Simulink
+        aerosimTraceStart();
+        ssSetPWorkValue(S, EPW_TRACE_NAME, (void *)aerosimTraceName(ssGetPath(S)));
+
         initKafkaProducer(S);
+
+        // Store the optional output port index and the envelope option, so the options aren't looked up every step
+        ssSetIWorkValue(S, EIW_STATS_PORT, P_OUTPUT_STATS ? 0 : -1);
+        ssSetIWorkValue(S, EIW_SEND_ENVELOPE, P_SEND_ENVELOPE);
     }
 }
 #endif /*  MDL_START */
@@ -264,16 +292,18 @@ static void mdlOutputs(SimStruct *S, int_T tid)
 
     // mexPrintf("kafka_producer:mdlOutputs start\n");
     const int8_T *u = (const int8_T *)ssGetInputPortSignal(S, 0);
-    rd_kafka_t *rk = ssGetPWorkValue(S, EPW_KAFKA_PRODUCER);     /* Producer instance handle */
-    rd_kafka_topic_t *rkt = ssGetPWorkValue(S, EPW_KAFKA_TOPIC); /* Topic object */
-    char *buf = (char *)u;                                       /* Message value temporary buffer */
-    char *brokers;                                               /* Argument: broker list */
-    char *topic;                                                 /* Argument: topic to produce to */
+    aerosim_writer_t *writer = ssGetPWorkValue(S, EPW_WRITER); /* Message transport */
+    char *buf = (char *)u;                                      /* Message value temporary buffer */
+    char *brokers;                                              /* Argument: broker list */
+    char *topic;                                                /* Argument: topic to produce to */
     char *key;
     int keylen;
     int N = strlen(buf);
     int ret;
 
+    const char *trace_name = (const char *)ssGetPWorkValue(S, EPW_TRACE_NAME);
+    AEROSIM_TRACE_BEGIN(trace_name, "block");
+
     int inIdx = 0;
     if (P_USE_EXT_KEY)
     {
@@ -287,16 +317,38 @@ static void mdlOutputs(SimStruct *S, int_T tid)
     }
     keylen = strlen(key);
 
+    // The envelope is scanned from the message metadata, the topic defaults to the block's
+    aerosim_envelope_t envelope;
+    const aerosim_envelope_t *headers = NULL;
+    if (ssGetIWorkValue(S, EIW_SEND_ENVELOPE) && aerosimScanEnvelope(buf, N, &envelope))
+    {
+        if (envelope.topic == NULL)
+        {
+            envelope.topic = (const char *)ssGetPWorkValue(S, EPW_TOPIC);
+            envelope.topic_len = strlen(envelope.topic);
+        }
+        headers = &envelope;
+    }
+
     if (P_USE_EXT_TIMESTAMP)
     {
         inIdx++;
         int64_T *timestamp = (int64_T *)ssGetInputPortSignal(S, inIdx);
-        ret = mwProduceKafkaMessageWithTimestamp(rk, rkt, key, keylen, buf, N, timestamp[0]);
+        ret = aerosimWriteMessageEnvelope(writer, key, keylen, buf, N, timestamp[0], headers);
     }
     else
     {
-        ret = mwProduceKafkaMessage(rk, rkt, key, keylen, buf, N);
+        ret = aerosimWriteMessageEnvelope(writer, key, keylen, buf, N, -1, headers);
+    }
+    int_T stats_port = ssGetIWorkValue(S, EIW_STATS_PORT);
+    if (stats_port >= 0)
+    {
+        aerosim_kafka_stats_t stats = { 0 };
+        stats.consumer_lag = -1;
+        aerosimGetWriterStats(writer, &stats);
+        aerosimWriteKafkaStatsOutput(&stats, (real_T *)ssGetOutputPortSignal(S, stats_port));
     }
+    AEROSIM_TRACE_END(trace_name, "block");
     if (ret)
     {
         ssSetErrorStatus(S, "Failed producing message\n");
@@ -323,13 +375,11 @@ static void mdlTerminate(SimStruct *S)
         }
         mexPrintf("sl_kafka_producer@mdlTerminate(): Freeing up used resources\n");
 
-        rd_kafka_topic_t *rkt = (rd_kafka_topic_t *)ssGetPWorkValue(S, EPW_KAFKA_TOPIC);
-        rd_kafka_t *rk = (rd_kafka_t *)ssGetPWorkValue(S, EPW_KAFKA_PRODUCER);
+        aerosim_writer_t *writer = (aerosim_writer_t *)ssGetPWorkValue(S, EPW_WRITER);
 
-        mwTerminateKafkaProducer(rk, rkt);
+        aerosimCloseWriter(writer);
 
-        ssSetPWorkValue(S, EPW_KAFKA_TOPIC, NULL);
-        ssSetPWorkValue(S, EPW_KAFKA_PRODUCER, NULL);
+        ssSetPWorkValue(S, EPW_WRITER, NULL);
 
         char *brokers = (char *)ssGetPWorkValue(S, EPW_BROKERS);
         if (brokers != NULL)
@@ -355,6 +405,8 @@ static void mdlTerminate(SimStruct *S)
             free(key);
             ssSetPWorkValue(S, EPW_KEY, NULL);
         }
+        ssSetPWorkValue(S, EPW_TRACE_NAME, NULL);
+        aerosimTraceStop();
         mwLogTerminate();
     }
 }